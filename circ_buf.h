@@ -195,6 +195,23 @@ static inline size_t circ_peek_offset(circ_buf_t *buf, char *data, size_t data_s
     return data_size;
 }
 
+// Point to data_size bytes at offset in place, split in two where they wrap around. Returns the bytes available.
+static inline size_t circ_peek_ptr2_offset(circ_buf_t *buf, size_t offset, size_t data_size, const char **data1, size_t *size1, const char **data2,
+                                           size_t *size2)
+{
+    *data1 = *data2 = buf->buf;
+    *size1 = *size2 = 0;
+    if (offset >= buf->used)
+        return 0;
+    data_size = MIN(data_size, buf->used - offset);
+    size_t pos = (buf->pos + offset) % buf->size;
+
+    *data1 = buf->buf + pos;
+    *size1 = MIN(data_size, buf->size - pos);
+    *size2 = data_size - *size1;
+    return data_size;
+}
+
 static inline size_t circ_pull(circ_buf_t *buf, char *data, size_t data_size)
 {
     data_size = MIN(data_size, buf->used);
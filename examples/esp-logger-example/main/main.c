@@ -21,8 +21,10 @@
 #include "cmd_wifi.h"
 #include "cmd_nvs.h"
 
+#include "log_bench.h"
 #include "log_buffer.h"
 #include "log_capture.h"
+#include "log_level.h"
 #include "log_print.h"
 #include "log_syslog_client.h"
 #include "log_stream_client.h"
@@ -88,6 +90,8 @@ void app_main(void)
     // These are less critical initiazions that adds console commands.
     ESP_ERROR_CHECK(log_buffer_init());
     ESP_ERROR_CHECK(log_test_init());
+    ESP_ERROR_CHECK(log_level_init());
+    ESP_ERROR_CHECK(log_bench_init());
 
 
 #if CONFIG_CONSOLE_STORE_HISTORY
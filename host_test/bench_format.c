@@ -0,0 +1,77 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log_capture.h"
+#include "log_format.h"
+
+#include "printf_format.h"
+
+/*
+ * log_format_entry against the snprintf formats the console used before it, on the same
+ * entries: bench_format [-n lines]. Prints the time per line of each, plain and with color.
+ */
+
+#define ENTRIES 64
+
+static struct log_entry_store_s entries[ENTRIES];
+static volatile size_t sink; // Keeps the formatting from being optimized away.
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static double run(size_t (*format)(const log_entry_t *, bool, char *, size_t), bool color, int lines)
+{
+    char line[LOG_FORMAT_MAX_LINE_SIZE];
+    uint64_t start = now_ns();
+    for (int i = 0; i < lines; i++)
+        sink += format(&entries[i % ENTRIES].entry, color, line, sizeof(line));
+    return (double)(now_ns() - start) / lines;
+}
+
+static size_t format_entry(const log_entry_t *e, bool color, char *buf, size_t buf_size)
+{
+    return log_format_entry(e, color, buf, buf_size);
+}
+
+int main(int argc, char **argv)
+{
+    static const char *tasks[] = {"main", "wifi", "tiT", "sys_evt", "ipc0"};
+    static const char *tags[] = {"app", "wifi", "esp_netif_handlers", "logstream_client", "nvs"};
+    int lines = 1000000;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        if (opt != 'n') {
+            fprintf(stderr, "usage: %s [-n lines]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+        lines = atoi(optarg);
+    }
+
+    for (int i = 0; i < ENTRIES; i++) {
+        log_entry_t *e = &entries[i].entry;
+        log_entry_set_task(e, tasks[i % 5], strlen(tasks[i % 5]));
+        log_entry_set_tag(e, tags[i % 3 + i % 2], strlen(tags[i % 3 + i % 2]));
+        e->data_len = snprintf(log_entry_data_buf(e), LOG_ENTRY_DATA_SIZE, "connected to ap, channel %d, rssi -%d dBm", i % 13 + 1, 40 + i);
+        e->level = ESP_LOG_ERROR + i % 5;
+        e->core = i % 2;
+        e->timestamp = 1000 + i * 12345;
+    }
+
+    // Warm up the intern table and the caches.
+    run(format_entry, false, ENTRIES);
+    run(format_entry, true, ENTRIES);
+
+    for (int color = 0; color < 2; color++) {
+        double printf_ns = run(printf_format_entry, color, lines);
+        double format_ns = run(format_entry, color, lines);
+        printf("%-5s snprintf %6.1f ns/line, log_format %6.1f ns/line, %.2fx\n", color ? "color" : "plain", printf_ns, format_ns, printf_ns / format_ns);
+    }
+    return EXIT_SUCCESS;
+}
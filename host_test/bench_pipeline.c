@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_console.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "log_bench.h"
+#include "log_buffer.h"
+#include "log_capture.h"
+#include "log_print.h"
+#include "log_stream_client.h"
+#include "log_syslog_client.h"
+
+/*
+ * The logbench console command on the host, with every sink sending somewhere real: logstream
+ * and syslog to sockets drained by this process. Arguments are passed on to logbench, run it
+ * with --help on the target for what they are. Sinks default to buffer,logstream,syslog, as
+ * print would mix the lines with the results.
+ */
+
+struct drain_s {
+    int sock;
+    volatile uint32_t datagrams;
+    volatile uint64_t bytes;
+};
+
+static struct drain_s logstream_drain, syslog_drain;
+
+static void drain_task(void *arg)
+{
+    struct drain_s *drain = arg;
+    static __thread char buf[2048];
+    while (1) {
+        int len = recv(drain->sock, buf, sizeof(buf), 0);
+        if (len > 0) {
+            drain->datagrams++;
+            drain->bytes += len;
+        }
+    }
+}
+
+static int drain_start(struct drain_s *drain, const char *name)
+{
+    drain->sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    socklen_t len = sizeof(addr);
+    // Deep enough to not drop datagrams while the drain task is not scheduled.
+    int size = 4 * 1024 * 1024;
+    setsockopt(drain->sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    if (bind(drain->sock, (struct sockaddr *)&addr, sizeof(addr)) < 0 || getsockname(drain->sock, (struct sockaddr *)&addr, &len) < 0) {
+        perror(name);
+        exit(EXIT_FAILURE);
+    }
+    xTaskCreate(drain_task, name, 4096, drain, 5, NULL);
+    return ntohs(addr.sin_port);
+}
+
+int main(int argc, char **argv)
+{
+    ESP_ERROR_CHECK(log_capture_early_init());
+    ESP_ERROR_CHECK(log_buffer_early_init());
+    ESP_ERROR_CHECK(log_print_early_init());
+    ESP_ERROR_CHECK(log_buffer_init());
+    ESP_ERROR_CHECK(log_bench_init());
+
+    logstream_client_config_t logstream_config = LOGSTREAM_CLIENT_DEFAULTS;
+    logstream_config.host = "127.0.0.1";
+    logstream_config.port = drain_start(&logstream_drain, "logstream_drain");
+    ESP_ERROR_CHECK(logstream_client_init(&logstream_config));
+
+    log_syslog_client_config_t syslog_config = SYSLOG_CLIENT_DEFAULTS;
+    syslog_config.host = "127.0.0.1";
+    syslog_config.port = drain_start(&syslog_drain, "syslog_drain");
+    ESP_ERROR_CHECK(log_syslog_client_init(&syslog_config));
+
+    char cmdline[512] = "logbench";
+    bool sinks = false;
+    for (int i = 1; i < argc; i++) {
+        sinks |= strncmp(argv[i], "--sinks", 7) == 0;
+        snprintf(cmdline + strlen(cmdline), sizeof(cmdline) - strlen(cmdline), " %s", argv[i]);
+    }
+    if (!sinks)
+        snprintf(cmdline + strlen(cmdline), sizeof(cmdline) - strlen(cmdline), " --sinks buffer,logstream,syslog");
+
+    int ret = 1;
+    esp_err_t err = esp_console_run(cmdline, &ret);
+    if (err != ESP_OK) {
+        printf("Could not run '%s': %s\n", cmdline, esp_err_to_name(err));
+        return 1;
+    }
+
+    // Let the clients send what they have queued.
+    vTaskDelay(pdMS_TO_TICKS(500));
+    printf("logstream: %" PRIu32 " datagrams, %" PRIu64 " bytes\n", logstream_drain.datagrams, logstream_drain.bytes);
+    printf("syslog: %" PRIu32 " datagrams, %" PRIu64 " bytes\n", syslog_drain.datagrams, syslog_drain.bytes);
+    return ret;
+}
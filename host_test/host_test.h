@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "log_capture.h"
+
+/*
+ * Just enough of a test framework: failed checks are counted and printed, and the exit status
+ * of the test is the number of them.
+ */
+
+static int host_test_failures;
+
+#define CHECK(cond)                                                          \
+    do {                                                                     \
+        if (!(cond)) {                                                       \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            host_test_failures++;                                            \
+        }                                                                    \
+    } while (0)
+
+#define CHECK_STR(a, b)                                                                                   \
+    do {                                                                                                  \
+        const char *a_ = (a), *b_ = (b);                                                                  \
+        if (strcmp(a_, b_) != 0) {                                                                        \
+            fprintf(stderr, "%s:%d: CHECK failed: %s == %s, \"%s\" != \"%s\"\n", __FILE__, __LINE__, #a, #b, a_, b_); \
+            host_test_failures++;                                                                         \
+        }                                                                                                 \
+    } while (0)
+
+#define WAIT_UNTIL(cond, timeout_ms)                                             \
+    ({                                                                           \
+        TickType_t start_ = xTaskGetTickCount();                                 \
+        while (!(cond) && xTaskGetTickCount() - start_ < pdMS_TO_TICKS(timeout_ms)) \
+            vTaskDelay(pdMS_TO_TICKS(5));                                        \
+        (cond);                                                                  \
+    })
+
+static inline int host_test_result(const char *name)
+{
+    printf("%s: %s\n", name, host_test_failures ? "FAILED" : "OK");
+    return host_test_failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/*
+ * A log handler keeping copies of the entries with one tag, local or received from another
+ * device, for the tests to look at.
+ */
+#define COLLECT_MAX 4096
+
+static struct {
+    const char *tag;
+    bool remote;
+    SemaphoreHandle_t lock;
+    StaticSemaphore_t lock_buffer;
+    volatile size_t count;
+    struct log_entry_store_s entries[COLLECT_MAX];
+} collect;
+
+static inline bool entry_is(const char *str, size_t len, const char *expect)
+{
+    return len == strlen(expect) && memcmp(str, expect, len) == 0;
+}
+
+static void collect_handler(log_entry_t *e)
+{
+    if (!collect.tag || !entry_is(e->tag, log_entry_tag_len(e), collect.tag) || (e->hops > 0) != collect.remote)
+        return;
+    xSemaphoreTake(collect.lock, portMAX_DELAY);
+    if (collect.count < COLLECT_MAX) {
+        log_entry_copy(&collect.entries[collect.count].entry, e);
+        collect.count++;
+    }
+    xSemaphoreGive(collect.lock);
+}
+
+static inline void collect_init(void)
+{
+    collect.lock = xSemaphoreCreateMutexStatic(&collect.lock_buffer);
+    log_capture_register_handler(collect_handler);
+}
+
+// Start over, keeping entries with this tag.
+static inline void collect_start(const char *tag, bool remote)
+{
+    xSemaphoreTake(collect.lock, portMAX_DELAY);
+    collect.tag = tag;
+    collect.remote = remote;
+    collect.count = 0;
+    xSemaphoreGive(collect.lock);
+}
+
+static inline log_entry_t *collected(size_t i)
+{
+    return &collect.entries[i].entry;
+}
@@ -0,0 +1,210 @@
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "argtable3/argtable3.h"
+
+static void *arg_alloc(size_t size, enum arg_type_e type, const char *shortopts, const char *longopts, const char *datatype, const char *glossary,
+                       int mincount)
+{
+    struct arg_hdr *hdr = calloc(1, size);
+    if (!hdr)
+        abort();
+    *hdr = (struct arg_hdr){
+        .type = type,
+        .shortopts = shortopts,
+        .longopts = longopts,
+        .datatype = datatype,
+        .glossary = glossary,
+        .mincount = mincount,
+        .maxcount = 1,
+    };
+    return hdr;
+}
+
+static struct arg_lit *arg_litn(const char *shortopts, const char *longopts, const char *glossary, int mincount)
+{
+    return arg_alloc(sizeof(struct arg_lit), ARG_LIT, shortopts, longopts, NULL, glossary, mincount);
+}
+
+static struct arg_int *arg_intn(const char *shortopts, const char *longopts, const char *datatype, const char *glossary, int mincount)
+{
+    struct arg_int *arg = arg_alloc(sizeof(struct arg_int) + sizeof(int), ARG_INT, shortopts, longopts, datatype, glossary, mincount);
+    arg->ival = (int *)(arg + 1);
+    return arg;
+}
+
+static struct arg_str *arg_strn(const char *shortopts, const char *longopts, const char *datatype, const char *glossary, int mincount)
+{
+    struct arg_str *arg = arg_alloc(sizeof(struct arg_str) + sizeof(char *), ARG_STR, shortopts, longopts, datatype, glossary, mincount);
+    arg->sval = (const char **)(arg + 1);
+    arg->sval[0] = "";
+    return arg;
+}
+
+struct arg_lit *arg_lit0(const char *shortopts, const char *longopts, const char *glossary)
+{
+    return arg_litn(shortopts, longopts, glossary, 0);
+}
+
+struct arg_lit *arg_lit1(const char *shortopts, const char *longopts, const char *glossary)
+{
+    return arg_litn(shortopts, longopts, glossary, 1);
+}
+
+struct arg_int *arg_int0(const char *shortopts, const char *longopts, const char *datatype, const char *glossary)
+{
+    return arg_intn(shortopts, longopts, datatype, glossary, 0);
+}
+
+struct arg_int *arg_int1(const char *shortopts, const char *longopts, const char *datatype, const char *glossary)
+{
+    return arg_intn(shortopts, longopts, datatype, glossary, 1);
+}
+
+struct arg_str *arg_str0(const char *shortopts, const char *longopts, const char *datatype, const char *glossary)
+{
+    return arg_strn(shortopts, longopts, datatype, glossary, 0);
+}
+
+struct arg_str *arg_str1(const char *shortopts, const char *longopts, const char *datatype, const char *glossary)
+{
+    return arg_strn(shortopts, longopts, datatype, glossary, 1);
+}
+
+struct arg_end *arg_end(int maxerrors)
+{
+    return arg_alloc(sizeof(struct arg_end), ARG_END, NULL, NULL, NULL, NULL, 0);
+}
+
+static int arg_error(struct arg_end *end, const char *fmt, const char *what)
+{
+    if (!end->count++)
+        snprintf(end->error, sizeof(end->error), fmt, what);
+    return 1;
+}
+
+// Store a value, or count a literal. Returns the number of errors.
+static int arg_store(struct arg_hdr *hdr, const char *value, struct arg_end *end)
+{
+    if (hdr->type == ARG_LIT) {
+        ((struct arg_lit *)hdr)->count++;
+        return 0;
+    }
+    if (hdr->type == ARG_INT) {
+        struct arg_int *arg = (struct arg_int *)hdr;
+        char *endp;
+        long ival = strtol(value, &endp, 0);
+        if (!*value || *endp)
+            return arg_error(end, "invalid argument \"%s\", expected an integer", value);
+        if (arg->count < hdr->maxcount)
+            arg->ival[arg->count] = (int)ival;
+        arg->count++;
+    } else {
+        struct arg_str *arg = (struct arg_str *)hdr;
+        if (arg->count < hdr->maxcount)
+            arg->sval[arg->count] = value;
+        arg->count++;
+    }
+    return 0;
+}
+
+static struct arg_hdr *arg_find(struct arg_hdr **table, const char *name, size_t len, bool is_long)
+{
+    for (size_t i = 0; table[i]->type != ARG_END; i++) {
+        const char *opts = is_long ? table[i]->longopts : table[i]->shortopts;
+        if (!opts)
+            continue;
+        if (is_long ? strlen(opts) == len && strncmp(opts, name, len) == 0 : strchr(opts, *name) != NULL)
+            return table[i];
+    }
+    return NULL;
+}
+
+static struct arg_end *arg_table_end(struct arg_hdr **table)
+{
+    size_t i = 0;
+    while (table[i]->type != ARG_END)
+        i++;
+    return (struct arg_end *)table[i];
+}
+
+static int *arg_count(struct arg_hdr *hdr)
+{
+    switch (hdr->type) {
+    case ARG_LIT:
+        return &((struct arg_lit *)hdr)->count;
+    case ARG_INT:
+        return &((struct arg_int *)hdr)->count;
+    case ARG_STR:
+        return &((struct arg_str *)hdr)->count;
+    default:
+        return &((struct arg_end *)hdr)->count;
+    }
+}
+
+int arg_parse(int argc, char **argv, void **argtable)
+{
+    struct arg_hdr **table = (struct arg_hdr **)argtable;
+    struct arg_end *end = arg_table_end(table);
+
+    for (size_t i = 0; table[i]->type != ARG_END; i++)
+        *arg_count(table[i]) = 0;
+    end->count = 0;
+    end->error[0] = '\0';
+
+    for (int i = 1; i < argc; i++) {
+        const char *word = argv[i];
+        bool is_long = strncmp(word, "--", 2) == 0 && word[2];
+        bool is_short = !is_long && word[0] == '-' && isalpha((unsigned char)word[1]);
+        if (!is_long && !is_short) {
+            // The first positional argument with room left.
+            struct arg_hdr *hdr = NULL;
+            for (size_t j = 0; table[j]->type != ARG_END && !hdr; j++) {
+                if (!table[j]->shortopts && !table[j]->longopts && *arg_count(table[j]) < table[j]->maxcount)
+                    hdr = table[j];
+            }
+            if (!hdr)
+                arg_error(end, "unexpected argument \"%s\"", word);
+            else
+                arg_store(hdr, word, end);
+            continue;
+        }
+
+        const char *name = word + (is_long ? 2 : 1);
+        const char *value = NULL;
+        size_t len = is_long ? strcspn(name, "=") : 1;
+        if (name[len])
+            value = is_long ? name + len + 1 : name + len;
+        struct arg_hdr *hdr = arg_find(table, name, len, is_long);
+        if (!hdr) {
+            arg_error(end, "invalid option \"%s\"", word);
+            continue;
+        }
+        if (hdr->type != ARG_LIT && !value) {
+            if (i + 1 == argc) {
+                arg_error(end, "option \"%s\" needs a value", word);
+                continue;
+            }
+            value = argv[++i];
+        }
+        arg_store(hdr, value, end);
+    }
+
+    for (size_t i = 0; table[i]->type != ARG_END; i++) {
+        int count = *arg_count(table[i]);
+        const char *what = table[i]->longopts ? table[i]->longopts : table[i]->datatype ? table[i]->datatype : "argument";
+        if (count < table[i]->mincount)
+            arg_error(end, "missing %s", what);
+        else if (count > table[i]->maxcount)
+            arg_error(end, "too many %s", what);
+    }
+    return end->count;
+}
+
+void arg_print_errors(FILE *fp, struct arg_end *end, const char *progname)
+{
+    if (end->count)
+        fprintf(fp, "%s: %s\n", progname, end->error);
+}
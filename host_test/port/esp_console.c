@@ -0,0 +1,73 @@
+#include <stdbool.h>
+#include <string.h>
+
+#include "esp_console.h"
+
+#define MAX_COMMANDS 32
+#define MAX_ARGS 32
+#define MAX_LINE 512
+
+static esp_console_cmd_t commands[MAX_COMMANDS];
+static size_t n_commands;
+
+esp_err_t esp_console_cmd_register(const esp_console_cmd_t *cmd)
+{
+    if (!cmd || !cmd->command || !cmd->func)
+        return ESP_ERR_INVALID_ARG;
+    for (size_t i = 0; i < n_commands; i++) {
+        if (strcmp(commands[i].command, cmd->command) == 0) {
+            commands[i] = *cmd;
+            return ESP_OK;
+        }
+    }
+    if (n_commands == MAX_COMMANDS)
+        return ESP_ERR_NO_MEM;
+    commands[n_commands++] = *cmd;
+    return ESP_OK;
+}
+
+esp_err_t esp_console_run(const char *cmdline, int *cmd_ret)
+{
+    char line[MAX_LINE];
+    char *argv[MAX_ARGS + 1];
+    int argc = 0;
+
+    if (strlen(cmdline) >= sizeof(line))
+        return ESP_ERR_INVALID_SIZE;
+    strcpy(line, cmdline);
+
+    // Split in place, a double quoted word may hold spaces.
+    char *in = line;
+    while (argc < MAX_ARGS) {
+        while (*in == ' ' || *in == '\t')
+            in++;
+        if (!*in)
+            break;
+        char *out = in;
+        argv[argc++] = out;
+        bool quoted = false;
+        while (*in && (quoted || (*in != ' ' && *in != '\t'))) {
+            if (*in == '"')
+                quoted = !quoted;
+            else
+                *out++ = *in;
+            in++;
+        }
+        if (*in)
+            in++;
+        *out = '\0';
+    }
+    argv[argc] = NULL;
+    if (!argc)
+        return ESP_ERR_INVALID_ARG;
+
+    for (size_t i = 0; i < n_commands; i++) {
+        if (strcmp(commands[i].command, argv[0]) == 0) {
+            int ret = commands[i].func(argc, argv);
+            if (cmd_ret)
+                *cmd_ret = ret;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
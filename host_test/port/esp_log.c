@@ -0,0 +1,79 @@
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_log.h"
+
+#include "host_port.h"
+
+#define LEVEL_TAGS 32
+
+struct level_tag_s {
+    char tag[32];
+    esp_log_level_t level;
+};
+
+static vprintf_like_t log_vprintf = vprintf;
+static struct level_tag_s level_tags[LEVEL_TAGS];
+static size_t n_level_tags;
+static esp_log_level_t default_level = CONFIG_LOG_DEFAULT_LEVEL;
+static pthread_mutex_t level_lock = PTHREAD_MUTEX_INITIALIZER;
+
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t func)
+{
+    return __atomic_exchange_n(&log_vprintf, func, __ATOMIC_SEQ_CST);
+}
+
+void esp_log_level_set(const char *tag, esp_log_level_t level)
+{
+    pthread_mutex_lock(&level_lock);
+    if (strcmp(tag, "*") == 0) {
+        default_level = level;
+        n_level_tags = 0;
+    } else {
+        size_t i = 0;
+        while (i < n_level_tags && strcmp(level_tags[i].tag, tag) != 0)
+            i++;
+        if (i < LEVEL_TAGS) {
+            snprintf(level_tags[i].tag, sizeof(level_tags[i].tag), "%s", tag);
+            level_tags[i].level = level;
+            if (i == n_level_tags)
+                n_level_tags++;
+        }
+    }
+    pthread_mutex_unlock(&level_lock);
+}
+
+esp_log_level_t esp_log_level_get(const char *tag)
+{
+    esp_log_level_t level = default_level;
+    pthread_mutex_lock(&level_lock);
+    for (size_t i = 0; i < n_level_tags; i++) {
+        if (strcmp(level_tags[i].tag, tag) == 0) {
+            level = level_tags[i].level;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&level_lock);
+    return level;
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return (uint32_t)(host_time_us() / 1000);
+}
+
+void esp_log_writev(esp_log_level_t level, const char *tag, const char *format, va_list args)
+{
+    if (level > esp_log_level_get(tag))
+        return;
+    __atomic_load_n(&log_vprintf, __ATOMIC_SEQ_CST)(format, args);
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    esp_log_writev(level, tag, format, args);
+    va_end(args);
+}
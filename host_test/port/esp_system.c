@@ -0,0 +1,106 @@
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "esp_cpu.h"
+#include "esp_err.h"
+#include "esp_random.h"
+#include "esp_rom_crc.h"
+#include "esp_rom_sys.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+
+#include "host_port.h"
+
+static int64_t monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int64_t boot_ns;
+
+__attribute__((constructor)) static void host_boot(void)
+{
+    boot_ns = monotonic_ns();
+    srandom((unsigned)boot_ns);
+}
+
+int64_t host_time_us(void)
+{
+    return (monotonic_ns() - boot_ns) / 1000;
+}
+
+int64_t esp_timer_get_time(void)
+{
+    return host_time_us();
+}
+
+uint32_t esp_cpu_get_cycle_count(void)
+{
+    return (uint32_t)monotonic_ns();
+}
+
+uint32_t esp_rom_get_cpu_ticks_per_us(void)
+{
+    return 1000;
+}
+
+uint32_t esp_random(void)
+{
+    return ((uint32_t)random() << 16) ^ (uint32_t)random();
+}
+
+int esp_rom_printf(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    int len = vprintf(fmt, args);
+    va_end(args);
+    return len;
+}
+
+uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t *buf, uint32_t len)
+{
+    crc = ~crc;
+    while (len--) {
+        crc ^= *buf++;
+        for (int bit = 0; bit < 8; bit++)
+            crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+void esp_restart(void)
+{
+    fflush(stdout);
+    exit(EXIT_SUCCESS);
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    switch (code) {
+    case ESP_OK:
+        return "ESP_OK";
+    case ESP_FAIL:
+        return "ESP_FAIL";
+    case ESP_ERR_NO_MEM:
+        return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG:
+        return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE:
+        return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE:
+        return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND:
+        return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_NOT_SUPPORTED:
+        return "ESP_ERR_NOT_SUPPORTED";
+    case ESP_ERR_TIMEOUT:
+        return "ESP_ERR_TIMEOUT";
+    default:
+        return "UNKNOWN ERROR";
+    }
+}
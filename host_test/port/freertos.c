@@ -0,0 +1,427 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "host_port.h"
+
+/*
+ * Host stacks hold a lot more than the target ones, glibc's printf alone takes a few kB, so
+ * every task gets this much on top of what it asked for. The high water mark is still counted
+ * against the size asked for, so it is comparable to the target, if pessimistic.
+ */
+#define STACK_EXTRA (64 * 1024)
+#define STACK_FILL 0xa5
+
+struct host_task_s {
+    pthread_t thread;
+    char name[configMAX_TASK_NAME_LEN];
+    UBaseType_t priority;
+    BaseType_t core;
+    TaskFunction_t func;
+    void *arg;
+    uint8_t *stack;
+    size_t stack_size;
+    uint32_t requested_stack;
+    void *tls[configNUM_THREAD_LOCAL_STORAGE_POINTERS];
+    pthread_mutex_t notify_lock;
+    pthread_cond_t notify_cond;
+    uint32_t notify_count;
+    bool done;
+    struct host_task_s *next;
+};
+
+struct host_semaphore_s {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int count;
+    bool recursive;
+    bool owned;
+    pthread_t owner;
+    int depth;
+};
+
+_Static_assert(sizeof(struct host_semaphore_s) <= sizeof(StaticSemaphore_t), "StaticSemaphore_t too small");
+
+static __thread struct host_task_s *current;
+static struct host_task_s *tasks;
+static pthread_mutex_t tasks_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t critical_lock = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP;
+static unsigned next_core;
+
+static void cond_init(pthread_cond_t *cond)
+{
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attr);
+    pthread_condattr_destroy(&attr);
+}
+
+// Wait on a condition for some ticks, false on timeout.
+static bool cond_wait_ticks(pthread_cond_t *cond, pthread_mutex_t *lock, TickType_t ticks)
+{
+    if (ticks == portMAX_DELAY)
+        return pthread_cond_wait(cond, lock) == 0;
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    uint64_t ns = (uint64_t)ticks * portTICK_PERIOD_MS * 1000000;
+    deadline.tv_sec += ns / 1000000000;
+    deadline.tv_nsec += ns % 1000000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+    return pthread_cond_timedwait(cond, lock, &deadline) != ETIMEDOUT;
+}
+
+static struct host_task_s *task_alloc(const char *name, UBaseType_t priority, BaseType_t core)
+{
+    struct host_task_s *task = calloc(1, sizeof(*task));
+    if (!task)
+        return NULL;
+    snprintf(task->name, sizeof(task->name), "%s", name);
+    task->priority = priority;
+    task->core = core;
+    pthread_mutex_init(&task->notify_lock, NULL);
+    cond_init(&task->notify_cond);
+    return task;
+}
+
+// Threads that were not started by xTaskCreate, like the one running main(), become tasks when they first ask.
+static struct host_task_s *task_self(void)
+{
+    if (!current) {
+        current = task_alloc("main", 1, 0);
+        if (!current)
+            abort();
+        current->thread = pthread_self();
+    }
+    return current;
+}
+
+static struct host_task_s *task_or_self(TaskHandle_t task)
+{
+    return task ? task : task_self();
+}
+
+// Join and free the tasks that have returned. Called with tasks_lock held.
+static void task_reap(void)
+{
+    for (struct host_task_s **pos = &tasks; *pos;) {
+        struct host_task_s *task = *pos;
+        if (!task->done) {
+            pos = &task->next;
+            continue;
+        }
+        *pos = task->next;
+        pthread_join(task->thread, NULL);
+        pthread_mutex_destroy(&task->notify_lock);
+        pthread_cond_destroy(&task->notify_cond);
+        free(task->stack);
+        free(task);
+    }
+}
+
+static void *task_main(void *arg)
+{
+    current = arg;
+    current->func(current->arg);
+    // A FreeRTOS task must not return, but tidy up anyway.
+    vTaskDelete(NULL);
+    return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t func, const char *name, uint32_t stack, void *arg, UBaseType_t priority, TaskHandle_t *handle,
+                                   BaseType_t core)
+{
+    pthread_mutex_lock(&tasks_lock);
+    task_reap();
+    if (core == tskNO_AFFINITY)
+        core = next_core++ % portNUM_PROCESSORS;
+    pthread_mutex_unlock(&tasks_lock);
+
+    struct host_task_s *task = task_alloc(name, priority, core);
+    if (!task)
+        return pdFAIL;
+    task->func = func;
+    task->arg = arg;
+    task->requested_stack = stack;
+    task->stack_size = (stack + STACK_EXTRA + 4095) & ~(size_t)4095;
+    task->stack = aligned_alloc(4096, task->stack_size);
+    if (!task->stack) {
+        free(task);
+        return pdFAIL;
+    }
+    memset(task->stack, STACK_FILL, task->stack_size);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, task->stack, task->stack_size);
+
+    pthread_mutex_lock(&tasks_lock);
+    task->next = tasks;
+    tasks = task;
+    if (handle)
+        *handle = task;
+    int err = pthread_create(&task->thread, &attr, task_main, task);
+    if (err) {
+        tasks = task->next;
+        free(task->stack);
+        free(task);
+    }
+    pthread_mutex_unlock(&tasks_lock);
+    pthread_attr_destroy(&attr);
+    return err ? pdFAIL : pdPASS;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t func, const char *name, uint32_t stack, void *arg, UBaseType_t priority, TaskHandle_t *handle)
+{
+    return xTaskCreatePinnedToCore(func, name, stack, arg, priority, handle, tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t task)
+{
+    // Only a task deleting itself is supported, which is all the component does.
+    if (task && task != current) {
+        fprintf(stderr, "vTaskDelete: deleting another task is not supported on the host\n");
+        abort();
+    }
+    struct host_task_s *self = task_self();
+    if (!self->stack)
+        pthread_exit(NULL);
+    pthread_mutex_lock(&tasks_lock);
+    self->done = true;
+    pthread_mutex_unlock(&tasks_lock);
+    pthread_exit(NULL);
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    uint64_t ns = (uint64_t)ticks * portTICK_PERIOD_MS * 1000000;
+    struct timespec ts = {.tv_sec = ns / 1000000000, .tv_nsec = ns % 1000000000};
+    while (nanosleep(&ts, &ts) && errno == EINTR)
+        ;
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(host_time_us() / 1000 / portTICK_PERIOD_MS);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return task_self();
+}
+
+char *pcTaskGetName(TaskHandle_t task)
+{
+    return task_or_self(task)->name;
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task)
+{
+    return task_or_self(task)->priority;
+}
+
+// Reads the stack below the stack pointer, where the sanitizer has nothing to say.
+__attribute__((no_sanitize_address)) UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    struct host_task_s *self = task_or_self(task);
+    if (!self->stack)
+        return 0;
+    size_t untouched = 0;
+    while (untouched < self->stack_size && self->stack[untouched] == STACK_FILL)
+        untouched++;
+    size_t used = self->stack_size - untouched;
+    return used < self->requested_stack ? self->requested_stack - used : 0;
+}
+
+void *pvTaskGetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index)
+{
+    if (index < 0 || index >= configNUM_THREAD_LOCAL_STORAGE_POINTERS)
+        return NULL;
+    return task_or_self(task)->tls[index];
+}
+
+void vTaskSetThreadLocalStoragePointer(TaskHandle_t task, BaseType_t index, void *value)
+{
+    if (index >= 0 && index < configNUM_THREAD_LOCAL_STORAGE_POINTERS)
+        task_or_self(task)->tls[index] = value;
+}
+
+void xTaskNotifyGive(TaskHandle_t task)
+{
+    pthread_mutex_lock(&task->notify_lock);
+    task->notify_count++;
+    pthread_cond_signal(&task->notify_cond);
+    pthread_mutex_unlock(&task->notify_lock);
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t *woken)
+{
+    xTaskNotifyGive(task);
+    if (woken)
+        *woken = pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear, TickType_t ticks)
+{
+    struct host_task_s *self = task_self();
+    pthread_mutex_lock(&self->notify_lock);
+    while (!self->notify_count && ticks && cond_wait_ticks(&self->notify_cond, &self->notify_lock, ticks))
+        ;
+    uint32_t count = self->notify_count;
+    if (count)
+        self->notify_count = clear ? 0 : count - 1;
+    pthread_mutex_unlock(&self->notify_lock);
+    return count;
+}
+
+void vPortEnterCritical(portMUX_TYPE *mux)
+{
+    pthread_mutex_lock(&critical_lock);
+}
+
+void vPortExitCritical(portMUX_TYPE *mux)
+{
+    pthread_mutex_unlock(&critical_lock);
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    return task_self()->core;
+}
+
+BaseType_t xPortInIsrContext(void)
+{
+    return pdFALSE;
+}
+
+void *pvPortMalloc(size_t size)
+{
+    return malloc(size);
+}
+
+void vPortFree(void *ptr)
+{
+    free(ptr);
+}
+
+static SemaphoreHandle_t semaphore_init(StaticSemaphore_t *buffer, int count, bool recursive)
+{
+    struct host_semaphore_s *sem = (struct host_semaphore_s *)buffer;
+    memset(sem, 0, sizeof(*sem));
+    pthread_mutex_init(&sem->lock, NULL);
+    cond_init(&sem->cond);
+    sem->count = count;
+    sem->recursive = recursive;
+    return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buffer)
+{
+    return semaphore_init(buffer, 0, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer)
+{
+    return semaphore_init(buffer, 1, false);
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutexStatic(StaticSemaphore_t *buffer)
+{
+    return semaphore_init(buffer, 1, true);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    StaticSemaphore_t *buffer = malloc(sizeof(*buffer));
+    return buffer ? xSemaphoreCreateBinaryStatic(buffer) : NULL;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    StaticSemaphore_t *buffer = malloc(sizeof(*buffer));
+    return buffer ? xSemaphoreCreateMutexStatic(buffer) : NULL;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    pthread_mutex_lock(&sem->lock);
+    while (!sem->count && ticks && cond_wait_ticks(&sem->cond, &sem->lock, ticks))
+        ;
+    bool taken = sem->count > 0;
+    if (taken)
+        sem->count--;
+    pthread_mutex_unlock(&sem->lock);
+    return taken ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem)
+{
+    pthread_mutex_lock(&sem->lock);
+    bool given = sem->count == 0;
+    if (given) {
+        sem->count = 1;
+        pthread_cond_signal(&sem->cond);
+    }
+    pthread_mutex_unlock(&sem->lock);
+    return given ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t sem, BaseType_t *woken)
+{
+    if (woken)
+        *woken = pdFALSE;
+    return xSemaphoreGive(sem);
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t sem, TickType_t ticks)
+{
+    pthread_mutex_lock(&sem->lock);
+    bool taken = sem->owned && pthread_equal(sem->owner, pthread_self());
+    if (!taken) {
+        while (!sem->count && ticks && cond_wait_ticks(&sem->cond, &sem->lock, ticks))
+            ;
+        taken = sem->count > 0;
+        if (taken) {
+            sem->count--;
+            sem->owned = true;
+            sem->owner = pthread_self();
+        }
+    }
+    if (taken)
+        sem->depth++;
+    pthread_mutex_unlock(&sem->lock);
+    return taken ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t sem)
+{
+    pthread_mutex_lock(&sem->lock);
+    bool owner = sem->owned && pthread_equal(sem->owner, pthread_self());
+    if (owner && --sem->depth == 0) {
+        sem->owned = false;
+        sem->count = 1;
+        pthread_cond_signal(&sem->cond);
+    }
+    pthread_mutex_unlock(&sem->lock);
+    return owner ? pdTRUE : pdFALSE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sem)
+{
+    pthread_mutex_destroy(&sem->lock);
+    pthread_cond_destroy(&sem->cond);
+}
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// Microseconds of the monotonic clock since the process started, the host's idea of uptime.
+int64_t host_time_us(void);
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <stdio.h>
+
+/*
+ * Enough of argtable3 for the console commands of the component: optional and required
+ * literals, integers and strings, by short or long option or by position.
+ */
+
+enum arg_type_e {
+    ARG_LIT,
+    ARG_INT,
+    ARG_STR,
+    ARG_END,
+};
+
+struct arg_hdr {
+    enum arg_type_e type;
+    const char *shortopts;
+    const char *longopts;
+    const char *datatype;
+    const char *glossary;
+    int mincount;
+    int maxcount;
+};
+
+struct arg_lit {
+    struct arg_hdr hdr;
+    int count;
+};
+
+struct arg_int {
+    struct arg_hdr hdr;
+    int count;
+    int *ival;
+};
+
+struct arg_str {
+    struct arg_hdr hdr;
+    int count;
+    const char **sval;
+};
+
+struct arg_end {
+    struct arg_hdr hdr;
+    int count;
+    char error[128];
+};
+
+struct arg_lit *arg_lit0(const char *shortopts, const char *longopts, const char *glossary);
+struct arg_lit *arg_lit1(const char *shortopts, const char *longopts, const char *glossary);
+struct arg_int *arg_int0(const char *shortopts, const char *longopts, const char *datatype, const char *glossary);
+struct arg_int *arg_int1(const char *shortopts, const char *longopts, const char *datatype, const char *glossary);
+struct arg_str *arg_str0(const char *shortopts, const char *longopts, const char *datatype, const char *glossary);
+struct arg_str *arg_str1(const char *shortopts, const char *longopts, const char *datatype, const char *glossary);
+struct arg_end *arg_end(int maxerrors);
+int arg_parse(int argc, char **argv, void **argtable);
+void arg_print_errors(FILE *fp, struct arg_end *end, const char *progname);
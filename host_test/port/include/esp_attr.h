@@ -0,0 +1,7 @@
+#pragma once
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define EXT_RAM_BSS_ATTR
+#define RTC_NOINIT_ATTR
+#define __NOINIT_ATTR
@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+// On the host a cycle is a nanosecond of the monotonic clock, see esp_rom_get_cpu_ticks_per_us().
+uint32_t esp_cpu_get_cycle_count(void);
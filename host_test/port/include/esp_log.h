@@ -0,0 +1,61 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+typedef int (*vprintf_like_t)(const char *, va_list);
+
+vprintf_like_t esp_log_set_vprintf(vprintf_like_t func);
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+esp_log_level_t esp_log_level_get(const char *tag);
+uint32_t esp_log_timestamp(void);
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) __attribute__((format(printf, 3, 4)));
+void esp_log_writev(esp_log_level_t level, const char *tag, const char *format, va_list args);
+
+/*
+ * The header ESP-IDF puts in front of every line, which is what vprintf_handler parses. PRIu32 is
+ * "lu" on the target, so the timestamp is passed as an unsigned long here too.
+ */
+#define LOG_FORMAT(letter, format) #letter " (%lu) %s: " format "\n"
+
+#ifndef LOG_LOCAL_LEVEL
+#define LOG_LOCAL_LEVEL CONFIG_LOG_MAXIMUM_LEVEL
+#endif
+
+#define ESP_LOG_LEVEL(level, tag, format, ...)                                                                                  \
+    do {                                                                                                                        \
+        if ((level) == ESP_LOG_ERROR)                                                                                           \
+            esp_log_write(ESP_LOG_ERROR, tag, LOG_FORMAT(E, format), (unsigned long)esp_log_timestamp(), tag, ##__VA_ARGS__);   \
+        else if ((level) == ESP_LOG_WARN)                                                                                       \
+            esp_log_write(ESP_LOG_WARN, tag, LOG_FORMAT(W, format), (unsigned long)esp_log_timestamp(), tag, ##__VA_ARGS__);    \
+        else if ((level) == ESP_LOG_DEBUG)                                                                                      \
+            esp_log_write(ESP_LOG_DEBUG, tag, LOG_FORMAT(D, format), (unsigned long)esp_log_timestamp(), tag, ##__VA_ARGS__);   \
+        else if ((level) == ESP_LOG_VERBOSE)                                                                                    \
+            esp_log_write(ESP_LOG_VERBOSE, tag, LOG_FORMAT(V, format), (unsigned long)esp_log_timestamp(), tag, ##__VA_ARGS__); \
+        else                                                                                                                    \
+            esp_log_write(ESP_LOG_INFO, tag, LOG_FORMAT(I, format), (unsigned long)esp_log_timestamp(), tag, ##__VA_ARGS__);    \
+    } while (0)
+
+#define ESP_LOG_LEVEL_LOCAL(level, tag, format, ...)          \
+    do {                                                      \
+        if (LOG_LOCAL_LEVEL >= (level))                       \
+            ESP_LOG_LEVEL(level, tag, format, ##__VA_ARGS__); \
+    } while (0)
+
+#define ESP_LOGE(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+#define ESP_LOGD(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_DEBUG, tag, format, ##__VA_ARGS__)
+#define ESP_LOGV(tag, format, ...) ESP_LOG_LEVEL_LOCAL(ESP_LOG_VERBOSE, tag, format, ##__VA_ARGS__)
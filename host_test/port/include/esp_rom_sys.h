@@ -0,0 +1,6 @@
+#pragma once
+
+#include <stdint.h>
+
+int esp_rom_printf(const char *fmt, ...);
+uint32_t esp_rom_get_cpu_ticks_per_us(void);
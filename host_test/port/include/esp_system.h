@@ -0,0 +1,6 @@
+#pragma once
+
+#include "esp_attr.h"
+#include "esp_err.h"
+
+void esp_restart(void);
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdint.h>
+
+#include "sdkconfig.h"
+
+// Microseconds since start.
+int64_t esp_timer_get_time(void);
@@ -0,0 +1,54 @@
+#pragma once
+
+/*
+ * The subset of FreeRTOS the component uses, on top of pthreads. Tasks are threads, a tick is a
+ * millisecond, and critical sections are one process wide recursive mutex.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOSConfig.h"
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY ((TickType_t)0xffffffffu)
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)((uint64_t)(ms) * configTICK_RATE_HZ / 1000))
+#define portNUM_PROCESSORS 2
+#define tskNO_AFFINITY 0x7fffffff
+
+typedef struct {
+    int unused;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED {0}
+
+void vPortEnterCritical(portMUX_TYPE *mux);
+void vPortExitCritical(portMUX_TYPE *mux);
+BaseType_t xPortGetCoreID(void);
+BaseType_t xPortInIsrContext(void);
+void *pvPortMalloc(size_t size);
+void vPortFree(void *ptr);
+
+#define portENTER_CRITICAL(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL(mux) vPortExitCritical(mux)
+#define portENTER_CRITICAL_ISR(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL_ISR(mux) vPortExitCritical(mux)
+#define portENTER_CRITICAL_SAFE(mux) vPortEnterCritical(mux)
+#define portEXIT_CRITICAL_SAFE(mux) vPortExitCritical(mux)
+#define portYIELD_FROM_ISR(...) ((void)0)
+// There are no interrupts to mask, the critical section keeps other tasks out instead.
+#define portSET_INTERRUPT_MASK_FROM_ISR() (vPortEnterCritical(NULL), 0)
+#define portCLEAR_INTERRUPT_MASK_FROM_ISR(state) ((void)(state), vPortExitCritical(NULL))
+
+// Large enough for the pthread objects behind a semaphore.
+typedef struct {
+    void *storage[24];
+} StaticSemaphore_t;
@@ -0,0 +1,7 @@
+#pragma once
+
+#include "sdkconfig.h"
+
+#define configMAX_TASK_NAME_LEN 16
+#define configNUM_THREAD_LOCAL_STORAGE_POINTERS 4
+#define configTICK_RATE_HZ CONFIG_FREERTOS_HZ
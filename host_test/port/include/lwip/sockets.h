@@ -0,0 +1,25 @@
+#pragma once
+
+// lwIP follows the BSD socket API, on the host the C library provides it.
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+/*
+ * Sockets of the component go through the port, so tests can lose datagrams and pin the local
+ * port of a device, see port/sockets.c.
+ */
+int host_socket(int domain, int type, int protocol);
+ssize_t host_sendto(int sock, const void *buf, size_t len, int flags, const struct sockaddr *addr, socklen_t addr_len);
+#define socket host_socket
+#define sendto host_sendto
+
+// Drop every nth datagram sent from now on, until count of them are gone. Returns how many were dropped so far.
+unsigned host_sockets_drop(unsigned every, unsigned count);
+// Bind new UDP sockets to this local port, like a rebooted device that gets the same one. 0 to not bind.
+void host_sockets_bind_udp(uint16_t port);
@@ -0,0 +1,80 @@
+#pragma once
+
+// The Kconfig defaults of the component, for the host build. Override with -D on the command line.
+
+#define CONFIG_IDF_TARGET_LINUX 1
+#define CONFIG_FREERTOS_HZ 1000
+
+#ifndef CONFIG_LOG_MAXIMUM_LEVEL
+#define CONFIG_LOG_MAXIMUM_LEVEL 5
+#endif
+#ifndef CONFIG_LOG_DEFAULT_LEVEL
+#define CONFIG_LOG_DEFAULT_LEVEL 3
+#endif
+
+#ifndef CONFIG_LOGGER_LOG_BUFFER_SIZE
+#define CONFIG_LOGGER_LOG_BUFFER_SIZE 16384
+#endif
+#ifndef CONFIG_LOGGER_LOG_MAX_LOG_LINE_SIZE
+#define CONFIG_LOGGER_LOG_MAX_LOG_LINE_SIZE 128
+#endif
+#ifndef CONFIG_LOGGER_LOG_MAX_TAG_SIZE
+#define CONFIG_LOGGER_LOG_MAX_TAG_SIZE 24
+#endif
+#ifndef CONFIG_LOGGER_PANIC_DUMP
+#define CONFIG_LOGGER_PANIC_DUMP 1
+#endif
+#ifndef CONFIG_LOGGER_LOG_BUFFER_RECORDS
+#define CONFIG_LOGGER_LOG_BUFFER_RECORDS 256
+#endif
+#ifndef CONFIG_LOGGER_ISR_RING_SIZE
+#define CONFIG_LOGGER_ISR_RING_SIZE 32
+#endif
+#ifndef CONFIG_LOGGER_ISR_FLUSH_MS
+#define CONFIG_LOGGER_ISR_FLUSH_MS 20
+#endif
+#ifndef CONFIG_LOGGER_PANIC_DUMP_ENTRIES
+#define CONFIG_LOGGER_PANIC_DUMP_ENTRIES 20
+#endif
+#ifndef CONFIG_LOGGER_PANIC_SAVE_SIZE
+#define CONFIG_LOGGER_PANIC_SAVE_SIZE 1024
+#endif
+#ifndef CONFIG_LOGGER_INTERN_TABLE_SIZE
+#define CONFIG_LOGGER_INTERN_TABLE_SIZE 128
+#endif
+#ifndef CONFIG_LOGGER_SAMPLE_RULES
+#define CONFIG_LOGGER_SAMPLE_RULES 8
+#endif
+#ifndef CONFIG_LOGGER_METRICS_TAGS
+#define CONFIG_LOGGER_METRICS_TAGS 32
+#endif
+#ifndef CONFIG_LOGGER_METRICS_REPORT_S
+#define CONFIG_LOGGER_METRICS_REPORT_S 60
+#endif
+#ifndef CONFIG_LOGGER_LEVEL_RULES
+#define CONFIG_LOGGER_LEVEL_RULES 16
+#endif
+#ifndef CONFIG_LOGGER_LEVEL_DEFAULTS
+#define CONFIG_LOGGER_LEVEL_DEFAULTS ""
+#endif
+#ifndef CONFIG_LOGGER_LOGSTREAM_QUEUE_SIZE
+#define CONFIG_LOGGER_LOGSTREAM_QUEUE_SIZE 4096
+#endif
+#ifndef CONFIG_LOGGER_LOGSTREAM_FLUSH_MS
+#define CONFIG_LOGGER_LOGSTREAM_FLUSH_MS 100
+#endif
+#ifndef CONFIG_LOGGER_LOGSTREAM_REPLAY_INTERVAL_MS
+#define CONFIG_LOGGER_LOGSTREAM_REPLAY_INTERVAL_MS 50
+#endif
+#ifndef CONFIG_LOGGER_SYSLOG_QUEUE_SIZE
+#define CONFIG_LOGGER_SYSLOG_QUEUE_SIZE 2048
+#endif
+#ifndef CONFIG_LOGGER_LOGSTREAM_SERVER_MAX_SOURCES
+#define CONFIG_LOGGER_LOGSTREAM_SERVER_MAX_SOURCES 32
+#endif
+#ifndef CONFIG_LOGGER_LOGSTREAM_SERVER_MERGE_MS
+#define CONFIG_LOGGER_LOGSTREAM_SERVER_MERGE_MS 250
+#endif
+#ifndef CONFIG_LOGGER_LOGSTREAM_SERVER_MERGE_ENTRIES
+#define CONFIG_LOGGER_LOGSTREAM_SERVER_MERGE_ENTRIES 32
+#endif
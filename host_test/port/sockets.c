@@ -0,0 +1,66 @@
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "lwip/sockets.h"
+
+#undef socket
+#undef sendto
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned drop_every;
+static unsigned drop_left;
+static unsigned dropped;
+static unsigned sent;
+static uint16_t bind_port;
+
+unsigned host_sockets_drop(unsigned every, unsigned count)
+{
+    pthread_mutex_lock(&lock);
+    drop_every = every;
+    drop_left = every ? count : 0;
+    sent = 0;
+    unsigned ret = dropped;
+    pthread_mutex_unlock(&lock);
+    return ret;
+}
+
+void host_sockets_bind_udp(uint16_t port)
+{
+    pthread_mutex_lock(&lock);
+    bind_port = port;
+    pthread_mutex_unlock(&lock);
+}
+
+int host_socket(int domain, int type, int protocol)
+{
+    int sock = socket(domain, type, protocol);
+    pthread_mutex_lock(&lock);
+    uint16_t port = bind_port;
+    pthread_mutex_unlock(&lock);
+    if (sock < 0 || domain != AF_INET || type != SOCK_DGRAM || !port)
+        return sock;
+
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+    return sock;
+}
+
+// A dropped datagram looks sent, as it would with a loss on the way.
+ssize_t host_sendto(int sock, const void *buf, size_t len, int flags, const struct sockaddr *addr, socklen_t addr_len)
+{
+    pthread_mutex_lock(&lock);
+    bool drop = drop_left > 0 && ++sent % drop_every == 0;
+    if (drop) {
+        drop_left--;
+        dropped++;
+    }
+    pthread_mutex_unlock(&lock);
+    if (drop)
+        return len;
+    return sendto(sock, buf, len, flags, addr, addr_len);
+}
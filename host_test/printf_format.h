@@ -0,0 +1,45 @@
+#pragma once
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stdio.h>
+
+#include "log_capture.h"
+#include "log_common.h"
+
+/*
+ * The fprintf based lines the console printed before log_format, for checking the formatter
+ * against and measuring it by.
+ */
+
+#define PRINTF_FORMAT "%c %u (%-6" PRIu64 ") %15s%20s: %.*s\n"
+#define PRINTF_FORMAT_COLOR "%s%c %u (%-6" PRIu64 ") %15s%24s: %.*s " ANSI_RESET_COLOR "\n"
+
+static inline size_t printf_format_entry(const log_entry_t *e, bool color, char *buf, size_t buf_size)
+{
+    char task[LOG_ENTRY_TASK_SIZE], tag[LOG_ENTRY_TAG_SIZE];
+    snprintf(task, sizeof(task), "%.*s", (int)log_entry_task_len(e), e->task);
+    snprintf(tag, sizeof(tag), "%.*s", (int)log_entry_tag_len(e), e->tag);
+
+    if (!color) {
+        uint64_t timestamp = e->timestamp > 10000000 ? e->timestamp / 1000 : e->timestamp;
+        char letter = e->level < 6 ? toupper((unsigned char)log_level_names[e->level][0]) : 'X';
+        return snprintf(buf, buf_size, PRINTF_FORMAT, letter, e->core, timestamp, task, tag, (int)e->data_len, e->data);
+    }
+
+    // Levels without a color of their own were printed as info.
+    uint64_t timestamp = e->timestamp > 100000000 ? e->timestamp / 1000 : e->timestamp;
+    const char *ansi = ANSI_COLOR(ANSI_COLOR_GREEN);
+    char letter = 'I';
+    if (e->level == ESP_LOG_ERROR) {
+        ansi = ANSI_COLOR(ANSI_COLOR_RED);
+        letter = 'E';
+    } else if (e->level == ESP_LOG_WARN) {
+        ansi = ANSI_COLOR(ANSI_COLOR_BROWN);
+        letter = 'W';
+    } else if (e->level == ESP_LOG_DEBUG || e->level == ESP_LOG_VERBOSE) {
+        ansi = "";
+        letter = e->level == ESP_LOG_DEBUG ? 'D' : 'V';
+    }
+    return snprintf(buf, buf_size, PRINTF_FORMAT_COLOR, ansi, letter, e->core, timestamp, task, tag, (int)e->data_len, e->data);
+}
@@ -0,0 +1,680 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "esp_console.h"
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "log_buffer.h"
+#include "log_capture.h"
+#include "log_format.h"
+#include "log_intern.h"
+#include "log_isr.h"
+#include "log_kv.h"
+#include "log_level.h"
+#include "log_metrics.h"
+#include "log_print.h"
+#include "log_sample.h"
+#include "log_test.h"
+
+#include "host_test.h"
+#include "printf_format.h"
+
+#define TASKS 4
+#define TASK_LINES 200
+
+static const char *TAG = "cap";
+
+static void test_line(void)
+{
+    collect_start(TAG, false);
+    uint32_t before = log_buffer_last_index();
+    ESP_LOGW(TAG, "hello %d %s", 42, "world");
+
+    CHECK(collect.count == 1);
+    log_entry_t *e = collected(0);
+    CHECK(e->level == ESP_LOG_WARN);
+    CHECK(e->hops == 0 && log_entry_source_len(e) == 0);
+    CHECK(entry_is(e->tag, log_entry_tag_len(e), TAG));
+    CHECK(entry_is(e->task, log_entry_task_len(e), "main"));
+    CHECK(entry_is(e->data, e->data_len, "hello 42 world"));
+
+    // The same entry is in the log buffer.
+    struct log_entry_store_s store;
+    uint32_t index = before;
+    CHECK(log_peek_entry(&store.entry, &index));
+    CHECK(index == e->index);
+    CHECK(entry_is(store.entry.data, store.entry.data_len, "hello 42 world"));
+}
+
+static void test_parts(void)
+{
+    collect_start(TAG, false);
+    esp_log_write(ESP_LOG_INFO, TAG, "I (%lu) %s: first part, ", (unsigned long)esp_log_timestamp(), TAG);
+    CHECK(collect.count == 0);
+    esp_log_write(ESP_LOG_INFO, TAG, "second %s, ", "part");
+    esp_log_write(ESP_LOG_INFO, TAG, "last part\n");
+
+    CHECK(collect.count == 1);
+    CHECK(entry_is(collected(0)->data, collected(0)->data_len, "first part, second part, last part"));
+}
+
+static void test_truncate(void)
+{
+    char line[LOG_ENTRY_DATA_SIZE * 2];
+    memset(line, 'x', sizeof(line) - 1);
+    line[sizeof(line) - 1] = '\0';
+
+    collect_start(TAG, false);
+    ESP_LOGI(TAG, "%s", line);
+
+    CHECK(collect.count == 1);
+    log_entry_t *e = collected(0);
+    CHECK(e->data_len == LOG_ENTRY_DATA_SIZE);
+    CHECK(memcmp(e->data + e->data_len - 2, "||", 2) == 0);
+}
+
+static void test_unprintable(void)
+{
+    collect_start(TAG, false);
+    ESP_LOGI(TAG, "a\tb\x01" "c\x7f");
+
+    CHECK(collect.count == 1);
+    CHECK(entry_is(collected(0)->data, collected(0)->data_len, "a.b.c."));
+}
+
+static void test_levels(void)
+{
+    collect_start("quiet", false);
+    CHECK(log_level_set("quiet", ESP_LOG_WARN) == ESP_OK);
+    ESP_LOGI("quiet", "dropped");
+    ESP_LOGW("quiet", "kept");
+    CHECK(collect.count == 1);
+
+    // Set from the console, and back to the default.
+    int ret = -1;
+    CHECK(esp_console_run("loglevel quiet error", &ret) == ESP_OK && ret == 0);
+    ESP_LOGW("quiet", "dropped");
+    CHECK(collect.count == 1);
+    CHECK(esp_console_run("loglevel quiet reset", &ret) == ESP_OK && ret == 0);
+    ESP_LOGI("quiet", "kept");
+    CHECK(collect.count == 2);
+
+    collect_start("loud", false);
+    ESP_LOGD("loud", "dropped");
+    CHECK(log_level_set("loud", ESP_LOG_DEBUG) == ESP_OK);
+    ESP_LOGD("loud", "kept");
+    CHECK(collect.count == 1);
+    CHECK(collect.count == 1 && collected(0)->level == ESP_LOG_DEBUG);
+
+    // A tag longer than a rule has room for still finds its rule, and setting it again does not add another.
+    char tag[CONFIG_LOGGER_LOG_MAX_TAG_SIZE + 8];
+    memset(tag, 'x', sizeof(tag) - 1);
+    tag[sizeof(tag) - 1] = '\0';
+    for (int i = 0; i <= CONFIG_LOGGER_LEVEL_RULES; i++)
+        CHECK(log_level_set(tag, ESP_LOG_WARN) == ESP_OK);
+    CHECK(log_level_enabled(tag, ESP_LOG_WARN) && !log_level_enabled(tag, ESP_LOG_INFO));
+
+    // A buffer that now holds another tag is not taken for the cached one.
+    strcpy(tag, "other");
+    CHECK(log_level_enabled(tag, ESP_LOG_INFO));
+    memset(tag, 'x', sizeof(tag) - 1);
+    CHECK(!log_level_enabled(tag, ESP_LOG_INFO));
+    log_level_reset(tag);
+    CHECK(log_level_enabled(tag, ESP_LOG_INFO));
+}
+
+static void test_sample(void)
+{
+    int ret = -1;
+    collect_start("hot", false);
+    CHECK(esp_console_run("logsample hot every 3", &ret) == ESP_OK && ret == 0);
+    for (int i = 0; i < 10; i++)
+        ESP_LOGI("hot", "line %d", i);
+    CHECK(collect.count == 4);
+    CHECK(collect.count == 4 && entry_is(collected(3)->data, collected(3)->data_len, "line 9"));
+    CHECK(collect.count == 4 && collected(0)->sampled == 0 && collected(1)->sampled == 2);
+    CHECK(esp_console_run("logsample", &ret) == ESP_OK && ret == 0);
+
+    // The count is kept in the log buffer.
+    struct log_entry_store_s store;
+    uint32_t index = collected(collect.count - 1)->index - 1;
+    CHECK(log_peek_entry(&store.entry, &index) && store.entry.sampled == 2);
+
+    collect_start("hot", false);
+    CHECK(log_sample_set("hot", LOG_SAMPLE_INTERVAL, 60000, 0) == ESP_OK);
+    for (int i = 0; i < 10; i++)
+        ESP_LOGI("hot", "line %d", i);
+    CHECK(collect.count == 1);
+
+    collect_start("hot", false);
+    CHECK(log_sample_set("hot", LOG_SAMPLE_RESERVOIR, 2, 60000) == ESP_OK);
+    for (int i = 0; i < 10; i++)
+        ESP_LOGI("hot", "line %d", i);
+    CHECK(collect.count == 2);
+
+    collect_start("hot", false);
+    CHECK(esp_console_run("logsample hot off", &ret) == ESP_OK && ret == 0);
+    for (int i = 0; i < 10; i++)
+        ESP_LOGI("hot", "line %d", i);
+    CHECK(collect.count == 10);
+
+    // A tag longer than a rule has room for still finds its rule, and setting it again does not add another.
+    char tag[CONFIG_LOGGER_LOG_MAX_TAG_SIZE + 8];
+    uint16_t dropped;
+    memset(tag, 'x', sizeof(tag) - 1);
+    tag[sizeof(tag) - 1] = '\0';
+    for (int i = 0; i <= CONFIG_LOGGER_SAMPLE_RULES; i++)
+        CHECK(log_sample_set(tag, LOG_SAMPLE_EVERY, 2, 0) == ESP_OK);
+    CHECK(log_sample_keep(tag, &dropped) && !log_sample_keep(tag, &dropped));
+    CHECK(log_sample_keep(tag, &dropped) && dropped == 1);
+    log_sample_reset(tag);
+    CHECK(log_sample_keep(tag, &dropped) && log_sample_keep(tag, &dropped));
+}
+
+static void test_metrics(void)
+{
+    static struct log_metrics_s metrics[CONFIG_LOGGER_METRICS_TAGS + 1];
+
+    // Sampled away lines are counted, those below the level are not.
+    CHECK(log_sample_set("counted", LOG_SAMPLE_EVERY, 10, 0) == ESP_OK);
+    for (int i = 0; i < 20; i++)
+        ESP_LOGE("counted", "line %d", i);
+    ESP_LOGW("counted", "warning");
+    ESP_LOGV("counted", "below the level");
+    log_sample_reset("counted");
+
+    size_t n = log_metrics_get(metrics, sizeof(metrics) / sizeof(metrics[0]));
+    size_t i = 0;
+    while (i < n && strcmp(metrics[i].tag, "counted") != 0)
+        i++;
+    CHECK(i < n);
+    if (i < n) {
+        CHECK(metrics[i].total[0] == 20 && metrics[i].total[1] == 1 && metrics[i].total[4] == 0);
+        CHECK(metrics[i].window[0] == 20 && metrics[i].window[1] == 1);
+    }
+
+    int ret = -1;
+    CHECK(esp_console_run("logmetrics", &ret) == ESP_OK && ret == 0);
+}
+
+static void test_grep(void)
+{
+    struct log_grep_s grep;
+    CHECK(log_grep_compile(&grep, "world", false));
+    CHECK(log_grep_match(&grep, "hello wor", 9, "ld", 2));
+    CHECK(log_grep_match(&grep, "", 0, "hello world", 11));
+    CHECK(!log_grep_match(&grep, "hello wor", 9, "d", 1));
+    CHECK(log_grep_compile(&grep, "WORLD", true));
+    CHECK(log_grep_match(&grep, "hello wO", 8, "rLd!", 4));
+    CHECK(log_grep_compile(&grep, "^hello", false));
+    CHECK(log_grep_match(&grep, "hel", 3, "lo world", 8) && !log_grep_match(&grep, " hello", 6, "", 0));
+    CHECK(log_grep_compile(&grep, "world$", false));
+    CHECK(log_grep_match(&grep, "hello wo", 8, "rld", 3) && !log_grep_match(&grep, "world!", 6, "", 0));
+    CHECK(log_grep_compile(&grep, "^exact$", false));
+    CHECK(log_grep_match(&grep, "exa", 3, "ct", 2) && !log_grep_match(&grep, "exact ", 6, "", 0));
+    CHECK(!log_grep_compile(&grep, "^$", false));
+
+    // Enough lines to wrap around the buffer, some of them straddle its end.
+    for (int i = 0; i < 2000; i++) {
+        if (i % 100 == 7)
+            ESP_LOGI("grep", "a Needle in line %d", i);
+        else
+            ESP_LOGI("grep", "hay %d", i);
+    }
+    log_kv(ESP_LOG_INFO, "grep", "needle", LOG_I32(1));
+
+    struct log_entry_store_s store;
+    uint32_t index = 0;
+    int found = 0;
+    CHECK(log_grep_compile(&grep, "needle", true));
+    while (log_grep_entry(&store.entry, &index, &grep))
+        found++;
+    CHECK(found > 1);
+    index = 0;
+    CHECK(log_grep_compile(&grep, "needle=1", false));
+    CHECK(log_grep_entry(&store.entry, &index, &grep) && (store.entry.flags & LOG_ENTRY_FLAG_KV));
+
+    int ret = -1;
+    CHECK(esp_console_run("dmesg --grep Needle -i", &ret) == ESP_OK && ret == 0);
+}
+
+static void test_since(void)
+{
+    // Enough lines to wrap around the buffer, so old checkpoints are dropped.
+    for (int i = 0; i < 1500; i++)
+        ESP_LOGI("since", "before %d", i);
+    vTaskDelay(pdMS_TO_TICKS(5));
+    uint64_t since = log_capture_timestamp_ms();
+    uint32_t first = log_buffer_last_index() + 1;
+    for (int i = 0; i < 50; i++)
+        ESP_LOGI("since", "after %d", i);
+
+    struct log_entry_store_s store;
+    uint32_t index = 0;
+    CHECK(log_peek_since(since, &store.entry, &index));
+    CHECK(index == first && store.entry.timestamp >= since);
+    CHECK(entry_is(store.entry.data, store.entry.data_len, "after 0"));
+    // Peeking goes on from there.
+    CHECK(log_peek_entry(&store.entry, &index) && entry_is(store.entry.data, store.entry.data_len, "after 1"));
+
+    // The same entry as a scan from the oldest one.
+    index = 0;
+    while (log_peek_entry(&store.entry, &index) && store.entry.timestamp < since) {
+    }
+    CHECK(index == first);
+
+    index = 0;
+    CHECK(!log_peek_since(since + 60000, &store.entry, &index));
+    CHECK(index == log_buffer_last_index());
+
+    int ret = -1;
+    CHECK(esp_console_run("dmesg --last 60", &ret) == ESP_OK && ret == 0);
+    CHECK(esp_console_run("dmesg --grep after --last 1", &ret) == ESP_OK && ret == 0);
+}
+
+static void test_console(void)
+{
+    int ret = -1;
+    collect_start("console", false);
+    CHECK(esp_console_run("log console 1 \"from the console\"", &ret) == ESP_OK && ret == 0);
+    CHECK(collect.count == 1);
+    CHECK(collect.count == 1 && collected(0)->level == ESP_LOG_ERROR);
+    CHECK(collect.count == 1 && entry_is(collected(0)->data, collected(0)->data_len, "from the console"));
+
+    CHECK(esp_console_run("logstack", &ret) == ESP_OK && ret == 0);
+}
+
+static void test_kv(void)
+{
+    static const char *expect = "rssi=-67 temp=21.5 ok=true ssid=\"my net\" up=4294967296\n";
+    char line[LOG_FORMAT_MAX_LINE_SIZE];
+
+    collect_start("kv", false);
+    uint32_t before = log_buffer_last_index();
+    log_kv(ESP_LOG_INFO, "kv", "rssi", LOG_I32(-67), "temp", LOG_F32(21.5), "ok", LOG_BOOL(true), "ssid", LOG_STR("my net"), "up",
+           LOG_U64(1ULL << 32));
+
+    CHECK(collect.count == 1);
+    log_entry_t *e = collected(0);
+    CHECK(e->level == ESP_LOG_INFO && (e->flags & LOG_ENTRY_FLAG_KV));
+    size_t len = log_format_entry(e, false, line, sizeof(line));
+    CHECK(len > strlen(expect) && memcmp(line + len - strlen(expect), expect, strlen(expect)) == 0);
+
+    // Kept as fields in the log buffer.
+    struct log_entry_store_s store;
+    uint32_t index = before;
+    CHECK(log_peek_entry(&store.entry, &index));
+    CHECK((store.entry.flags & LOG_ENTRY_FLAG_KV) && store.entry.data_len == e->data_len);
+
+    CHECK(log_level_set("kv", ESP_LOG_WARN) == ESP_OK);
+    log_kv(ESP_LOG_INFO, "kv", "dropped", LOG_I32(1));
+    CHECK(collect.count == 1);
+    log_level_reset("kv");
+
+    // Numbers are rendered without printf.
+    struct {
+        struct log_kv_value_s value;
+        const char *text;
+    } values[] = {
+        {LOG_I64(INT64_MIN), "v=-9223372036854775808"},
+        {LOG_F64(-0.0000004), "v=-0.0"},
+        {LOG_F64(1.0000005), "v=1.000001"},
+        {LOG_F64(1e20), "v=1.0e+20"},
+        {LOG_F64(0.0 / 0.0), "v=nan"},
+        {LOG_STR(""), "v=\"\""},
+        {LOG_STR("a=\"b\""), "v=\"a=\\\"b\\\"\""},
+    };
+    for (size_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+        char data[64];
+        size_t data_len = log_kv_encode(data, 0, sizeof(data), "v", &values[i].value);
+        len = log_kv_format(data, data_len, line, sizeof(line));
+        CHECK_STR((line[len] = '\0', line), values[i].text);
+    }
+}
+
+static void test_panic_dump(void)
+{
+    for (int i = 0; i < 30; i++)
+        ESP_LOGE("panic", "line %d", i);
+
+    CHECK(log_buffer_panic_dump(10) == 10);
+    CHECK(log_buffer_panic_dump(1000) == CONFIG_LOGGER_PANIC_DUMP_ENTRIES);
+    CHECK(log_buffer_panic_save() > 0);
+}
+
+#define SAVED_MAX 8
+
+static bool entry_equal(const log_entry_t *a, const log_entry_t *b)
+{
+    return a->level == b->level && a->core == b->core && a->timestamp == b->timestamp && a->hops == b->hops && a->flags == b->flags &&
+           a->sampled == b->sampled && log_entry_task_len(a) == log_entry_task_len(b) && memcmp(a->task, b->task, log_entry_task_len(a)) == 0 &&
+           log_entry_tag_len(a) == log_entry_tag_len(b) && memcmp(a->tag, b->tag, log_entry_tag_len(a)) == 0 &&
+           log_entry_source_len(a) == log_entry_source_len(b) && memcmp(a->source, b->source, log_entry_source_len(a)) == 0 &&
+           a->data_len == b->data_len && memcmp(a->data, b->data, a->data_len) == 0;
+}
+
+// Entries kept by a panic come back after the buffer is lost, unless the saved copy is damaged.
+static void test_panic_restore(void)
+{
+    static struct log_entry_store_s saved[SAVED_MAX], store;
+    uint32_t index;
+
+    while (log_pull_entry(&store.entry)) {
+    }
+    ESP_LOGE("panic", "the last error");
+    ESP_LOGW("panic_tag", "a warning from %s", "somewhere");
+    log_kv(ESP_LOG_INFO, "panic", "heap", LOG_U32(1234));
+    log_sample_set("panic_hot", LOG_SAMPLE_EVERY, 2, 0);
+    for (int i = 0; i < 3; i++)
+        ESP_LOGI("panic_hot", "line %d", i);
+    log_sample_set("panic_hot", LOG_SAMPLE_OFF, 0, 0);
+    // Received from another device.
+    log_entry_t received = {.level = ESP_LOG_DEBUG, .core = 1, .timestamp = 1700000000123ULL, .hops = 2};
+    log_entry_view(&received, "remote", 6, "relay", 5, "from afar", 9);
+    log_entry_view_source(&received, "10.0.0.42", 9);
+    log_capture_send_log(&received);
+
+    index = 0;
+    size_t n = 0;
+    bool sampled = false;
+    while (n < SAVED_MAX && log_peek_entry(&saved[n].entry, &index))
+        sampled |= saved[n++].entry.sampled > 0;
+    CHECK(n >= 5 && sampled && !log_peek_entry(&store.entry, &index));
+    CHECK(log_buffer_panic_save() == n);
+
+    // Lost with the reboot.
+    while (log_pull_entry(&store.entry)) {
+    }
+    uint32_t last_index = log_buffer_last_index();
+    CHECK(log_buffer_panic_restore() == n);
+    index = last_index;
+    for (size_t i = 0; i < n; i++) {
+        CHECK(log_peek_entry(&store.entry, &index) && index > saved[i].entry.index);
+        CHECK(entry_equal(&store.entry, &saved[i].entry));
+    }
+    CHECK(index == log_buffer_last_index());
+
+    // Only once.
+    CHECK(log_buffer_panic_restore() == 0);
+
+    // A flipped bit fails the checksum, nothing is put back.
+    size_t len;
+    CHECK(log_buffer_panic_save() == n);
+    char *data = log_buffer_panic_save_data(&len);
+    CHECK(data && len > 0);
+    if (data && len > 0)
+        data[len / 2] ^= 0x10;
+    last_index = log_buffer_last_index();
+    CHECK(log_buffer_panic_restore() == 0);
+    CHECK(log_buffer_last_index() == last_index);
+}
+
+// Received entries keep their source with the line, however many devices there are.
+static void test_sources(void)
+{
+    struct log_entry_store_s store;
+    char source[16];
+    uint32_t index;
+
+    for (int i = 0; i < CONFIG_LOGGER_INTERN_TABLE_SIZE + 10; i++) {
+        log_entry_t received = {.level = ESP_LOG_INFO, .hops = 1};
+        snprintf(source, sizeof(source), "10.0.%d.%d", i / 256, i % 256);
+        log_entry_view(&received, "remote", 6, "src", 3, "from afar", 9);
+        log_entry_view_source(&received, source, strlen(source));
+        log_capture_send_log(&received);
+    }
+    index = log_buffer_last_index() - 1;
+    CHECK(log_peek_entry(&store.entry, &index));
+    CHECK(entry_is(store.entry.source, log_entry_source_len(&store.entry), source));
+    CHECK(entry_is(store.entry.tag, log_entry_tag_len(&store.entry), "src"));
+    CHECK(store.entry.hops == 1);
+
+    // The intern table still has room for local names.
+    CHECK(log_intern("src_local", 9) != LOG_INTERN_NONE);
+}
+
+static void test_records(void)
+{
+    struct log_entry_store_s store;
+    uint32_t index;
+    int count = 0;
+
+    // Short lines run out of records before bytes.
+    for (int i = 0; i < CONFIG_LOGGER_LOG_BUFFER_RECORDS + 50; i++)
+        ESP_LOGI("rec", "%d", i);
+    index = 0;
+    while (log_peek_entry(&store.entry, &index))
+        count++;
+    CHECK(count == CONFIG_LOGGER_LOG_BUFFER_RECORDS);
+    char tag[16];
+    snprintf(tag, sizeof(tag), "%d", CONFIG_LOGGER_LOG_BUFFER_RECORDS + 49);
+    CHECK(entry_is(store.entry.data, store.entry.data_len, tag));
+
+    // Once the intern table is full, names are kept with the line.
+    for (int i = 0; i < CONFIG_LOGGER_INTERN_TABLE_SIZE + 10; i++) {
+        snprintf(tag, sizeof(tag), "rec%d", i);
+        ESP_LOGI(tag, "line %d", i);
+    }
+    index = log_buffer_last_index() - 1;
+    CHECK(log_peek_entry(&store.entry, &index));
+    CHECK(entry_is(store.entry.tag, log_entry_tag_len(&store.entry), tag));
+    CHECK(entry_is(store.entry.task, log_entry_task_len(&store.entry), "main"));
+    CHECK(log_pull_entry(&store.entry) && store.entry.index < index);
+
+    int ret = -1;
+    CHECK(esp_console_run("dmesg -s", &ret) == ESP_OK && ret == 0);
+}
+
+static void test_isr(void)
+{
+    collect_start("irq", false);
+    uint64_t before = log_capture_timestamp_ms();
+    LOG_ISR(ESP_LOG_INFO, "irq", "rx %u bytes, status %x", 12, 0xab);
+    log_isr_text(ESP_LOG_WARN, "irq", "raw text", 8);
+    LOG_ISR(ESP_LOG_DEBUG, "irq", "below the level");
+    CHECK(collect.count == 0);
+
+    CHECK(log_isr_flush() == 3);
+    CHECK(collect.count == 2);
+    log_entry_t *e = collected(0);
+    CHECK(e->level == ESP_LOG_INFO && entry_is(e->data, e->data_len, "rx 12 bytes, status ab"));
+    CHECK(entry_is(e->task, log_entry_task_len(e), "isr") && entry_is(e->tag, log_entry_tag_len(e), "irq"));
+    CHECK(e->timestamp >= before && e->timestamp <= log_capture_timestamp_ms());
+    CHECK(collect.count == 2 && collected(1)->level == ESP_LOG_WARN && entry_is(collected(1)->data, collected(1)->data_len, "raw text"));
+    CHECK(collect.count == 2 && collected(1)->timestamp >= e->timestamp);
+
+    // A full ring drops entries, until it is flushed.
+    collect_start("irq", false);
+    uint32_t dropped = log_isr_dropped();
+    for (int i = 0; i < CONFIG_LOGGER_ISR_RING_SIZE + 8; i++)
+        LOG_ISR(ESP_LOG_INFO, "irq", "%d", i);
+    CHECK(log_isr_dropped() - dropped == 8);
+    CHECK(log_isr_flush() == CONFIG_LOGGER_ISR_RING_SIZE);
+    CHECK(collect.count == CONFIG_LOGGER_ISR_RING_SIZE);
+
+    // Then the task does it.
+    collect_start("irq", false);
+    ESP_ERROR_CHECK(log_isr_init());
+    LOG_ISR(ESP_LOG_ERROR, "irq", "from the task");
+    WAIT_UNTIL(collect.count == 1, 1000);
+    CHECK(collect.count == 1 && entry_is(collected(0)->data, collected(0)->data_len, "from the task"));
+}
+
+static struct {
+    TaskHandle_t caller;
+    int id[TASKS];
+} tasks;
+
+static void log_task(void *arg)
+{
+    int id = *(int *)arg;
+    for (int i = 0; i < TASK_LINES; i++)
+        ESP_LOGI("mt", "%d %d", id, i);
+    xTaskNotifyGive(tasks.caller);
+    vTaskDelete(NULL);
+}
+
+// The formatter writes the same bytes the fprintf based console did, for any name length.
+static void test_format(void)
+{
+    static const char *names[] = {"", "a", "main", "wifi", "fifteen_chars__", "a_tag_at_the_max_length_"};
+    static const uint64_t timestamps[] = {0, 7, 123456, 9999999, 10000001, 99999999, 1700000000123ULL};
+    struct log_entry_store_s store;
+    log_entry_t *e = &store.entry;
+    char line[LOG_FORMAT_MAX_LINE_SIZE + 1], expect[LOG_FORMAT_MAX_LINE_SIZE + 1];
+    int n = 0;
+
+    for (size_t task = 0; task < ARRAY_SIZE(names); task++) {
+        for (size_t tag = 0; tag < ARRAY_SIZE(names); tag++) {
+            for (size_t t = 0; t < ARRAY_SIZE(timestamps); t++, n++) {
+                memset(&store, 0, sizeof(store));
+                log_entry_set_task(e, names[task], strlen(names[task]));
+                log_entry_set_tag(e, names[tag], strlen(names[tag]));
+                // Some without data, and some with levels that have no letter.
+                size_t data_len = snprintf(log_entry_data_buf(e), LOG_ENTRY_DATA_SIZE, "line %d", n);
+                e->data_len = n % 9 ? data_len : 0;
+                e->level = n % 8;
+                e->core = n % 2;
+                e->timestamp = timestamps[t];
+                for (int color = 0; color < 2; color++) {
+                    size_t len = log_format_entry(e, color, line, sizeof(line));
+                    size_t expect_len = printf_format_entry(e, color, expect, sizeof(expect));
+                    if (len != expect_len || memcmp(line, expect, len) != 0) {
+                        line[len] = '\0';
+                        CHECK_STR(line, expect);
+                        return;
+                    }
+                }
+            }
+        }
+    }
+}
+
+static struct {
+    int calls;
+    bool shared;
+    bool same;
+    bool nested_shared;
+    bool copy_shared;
+} text;
+
+// Asks for the shared text twice, and once more for a line logged while holding it.
+static void text_handler(log_entry_t *e)
+{
+    if (entry_is(e->tag, log_entry_tag_len(e), "txt_inner")) {
+        size_t len;
+        text.nested_shared = log_capture_text(e, true, &len) != NULL;
+        return;
+    }
+    if (!entry_is(e->tag, log_entry_tag_len(e), "txt"))
+        return;
+
+    text.calls++;
+    size_t len, again_len;
+    const char *line = log_capture_text(e, false, &len);
+    const char *again = log_capture_text(e, false, &again_len);
+    text.shared = line != NULL;
+    if (line) {
+        char expect[LOG_FORMAT_MAX_LINE_SIZE];
+        size_t expect_len = log_format_entry(e, false, expect, sizeof(expect));
+        text.same = again == line && again_len == len && len == expect_len && memcmp(line, expect, len) == 0;
+    }
+
+    ESP_LOGI("txt_inner", "logged while the text is held");
+
+    // A copy is not being dispatched.
+    struct log_entry_store_s copy;
+    log_entry_copy(&copy.entry, e);
+    text.copy_shared = log_capture_text(&copy.entry, false, &len) != NULL;
+}
+
+static void test_text(void)
+{
+    CHECK(log_capture_register_handler(text_handler) == ESP_OK);
+    ESP_LOGI("txt", "shared %d", 1);
+    CHECK(text.calls == 1);
+#if CONFIG_LOGGER_SMALL_FOOTPRINT
+    CHECK(!text.shared);
+#else
+    // Rendered once, and a nested dispatch has a text of its own rather than overwrite it.
+    CHECK(text.shared && text.same);
+    CHECK(text.nested_shared && !text.copy_shared);
+#endif
+
+    // Each dispatch renders its own entry.
+    ESP_LOGI("txt", "shared %d", 2);
+    CHECK(text.calls == 2);
+#if !CONFIG_LOGGER_SMALL_FOOTPRINT
+    CHECK(text.shared && text.same);
+#endif
+}
+
+static void test_tasks(void)
+{
+    collect_start("mt", false);
+    tasks.caller = xTaskGetCurrentTaskHandle();
+    for (int i = 0; i < TASKS; i++) {
+        tasks.id[i] = i;
+        CHECK(xTaskCreate(log_task, "mt", 4096, &tasks.id[i], 5, NULL) == pdPASS);
+    }
+    for (int done = 0; done < TASKS;)
+        done += ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+    CHECK(collect.count == TASKS * TASK_LINES);
+
+    // Lines of each task arrive in order, with increasing buffer indexes.
+    int next[TASKS] = {0};
+    uint32_t last_index[TASKS] = {0};
+    for (size_t i = 0; i < collect.count; i++) {
+        log_entry_t *e = collected(i);
+        char line[32];
+        int id, n;
+        snprintf(line, sizeof(line), "%.*s", (int)e->data_len, e->data);
+        CHECK(sscanf(line, "%d %d", &id, &n) == 2 && id >= 0 && id < TASKS);
+        if (id < 0 || id >= TASKS)
+            continue;
+        CHECK(n == next[id]);
+        CHECK(e->index > last_index[id]);
+        CHECK(entry_is(e->task, log_entry_task_len(e), "mt"));
+        next[id] = n + 1;
+        last_index[id] = e->index;
+    }
+}
+
+int main(void)
+{
+    ESP_ERROR_CHECK(log_capture_early_init());
+    ESP_ERROR_CHECK(log_buffer_early_init());
+    ESP_ERROR_CHECK(log_print_early_init());
+    ESP_ERROR_CHECK(log_buffer_init());
+    ESP_ERROR_CHECK(log_test_init());
+    ESP_ERROR_CHECK(log_level_init());
+    ESP_ERROR_CHECK(log_sample_init());
+    ESP_ERROR_CHECK(log_metrics_init());
+    collect_init();
+
+    test_line();
+    test_parts();
+    test_truncate();
+    test_unprintable();
+    test_levels();
+    test_sample();
+    test_metrics();
+    test_console();
+    test_kv();
+    test_grep();
+    test_since();
+    test_panic_dump();
+    test_panic_restore();
+    test_sources();
+    test_records();
+    test_isr();
+    test_format();
+    test_text();
+    test_tasks();
+
+    return host_test_result("capture");
+}
@@ -0,0 +1,211 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "log_common.h"
+#include "log_stream_codec.h"
+
+#include "host_test.h"
+
+/*
+ * The logstream sequence tracking and control messages on their own, without sockets.
+ */
+
+#define SESSION 0x1234
+
+static bool missing_is(const struct logstream_seq_s *seq, const struct logstream_range_s *expect, size_t n_expect)
+{
+    struct logstream_range_s ranges[LOGSTREAM_NACK_MAX_RANGES];
+    size_t n_ranges = logstream_seq_missing(seq, ranges, ARRAY_SIZE(ranges));
+    if (n_ranges != n_expect)
+        return false;
+    for (size_t i = 0; i < n_ranges; i++) {
+        if (ranges[i].first != expect[i].first || ranges[i].len != expect[i].len)
+            return false;
+    }
+    return true;
+}
+
+static void test_receive(void)
+{
+    struct logstream_seq_s seq = {};
+
+    // The first number starts the tracking, wherever it is.
+    CHECK(logstream_seq_receive(&seq, SESSION, 100));
+    CHECK(seq.started && seq.next == 101 && seq.highest == 100);
+    CHECK(logstream_seq_receive(&seq, SESSION, 101));
+    CHECK(seq.next == 102);
+
+    // Duplicates and what is already behind are refused.
+    CHECK(!logstream_seq_receive(&seq, SESSION, 101));
+    CHECK(!logstream_seq_receive(&seq, SESSION, 50));
+
+    // Out of order, with gaps that fill in later.
+    CHECK(logstream_seq_receive(&seq, SESSION, 104));
+    CHECK(logstream_seq_receive(&seq, SESSION, 107));
+    CHECK(!logstream_seq_receive(&seq, SESSION, 104));
+    CHECK(seq.next == 102 && seq.highest == 107);
+    CHECK(missing_is(&seq, (struct logstream_range_s[]){{102, 2}, {105, 2}}, 2));
+    CHECK(logstream_seq_receive(&seq, SESSION, 103));
+    CHECK(logstream_seq_receive(&seq, SESSION, 102));
+    CHECK(seq.next == 105);
+    CHECK(missing_is(&seq, (struct logstream_range_s[]){{105, 2}}, 1));
+    CHECK(logstream_seq_receive(&seq, SESSION, 105));
+    CHECK(logstream_seq_receive(&seq, SESSION, 106));
+    CHECK(seq.next == 108 && seq.lost == 0);
+    CHECK(missing_is(&seq, NULL, 0));
+
+    // A new session starts over, behind the old numbers or not.
+    CHECK(logstream_seq_receive(&seq, SESSION + 1, 3));
+    CHECK(seq.session == SESSION + 1 && seq.next == 4 && seq.highest == 3);
+    CHECK(logstream_seq_receive(&seq, SESSION + 1, 4));
+}
+
+static void test_window(void)
+{
+    struct logstream_seq_s seq = {};
+    CHECK(logstream_seq_receive(&seq, SESSION, 1));
+    CHECK(logstream_seq_receive(&seq, SESSION, 3));
+
+    // Numbers too far ahead push the oldest out of the window, what was missing there is lost.
+    uint32_t far = 2 + LOGSTREAM_SEQ_WINDOW + 10;
+    CHECK(logstream_seq_receive(&seq, SESSION, far));
+    CHECK(seq.next == far - LOGSTREAM_SEQ_WINDOW + 1);
+    CHECK(seq.lost == far - LOGSTREAM_SEQ_WINDOW + 1 - 2 - 1);
+    CHECK(!logstream_seq_receive(&seq, SESSION, 2));
+
+    // Bits of numbers that left the window do not turn up again as received.
+    struct logstream_range_s ranges[LOGSTREAM_NACK_MAX_RANGES];
+    size_t n_ranges = logstream_seq_missing(&seq, ranges, ARRAY_SIZE(ranges));
+    CHECK(n_ranges == 1 && ranges[0].first == seq.next && ranges[0].first + ranges[0].len == far);
+
+    // A jump of half the number space is counted at once, only what was received in the window is not lost.
+    uint32_t lost = seq.lost, pending = far - seq.next;
+    uint32_t jump = far + 0x80000000u;
+    CHECK(logstream_seq_receive(&seq, SESSION, jump));
+    CHECK(seq.next == jump - LOGSTREAM_SEQ_WINDOW + 1 && seq.highest == jump);
+    CHECK(seq.lost == lost + pending + (jump - LOGSTREAM_SEQ_WINDOW + 1 - far - 1));
+    CHECK(missing_is(&seq, (struct logstream_range_s[]){{seq.next, LOGSTREAM_SEQ_WINDOW - 1}}, 1));
+    CHECK(logstream_seq_receive(&seq, SESSION, jump - 1));
+}
+
+static void test_missing_max(void)
+{
+    struct logstream_seq_s seq = {};
+    for (uint32_t number = 0; number < 2 * LOGSTREAM_NACK_MAX_RANGES + 10; number += 2)
+        CHECK(logstream_seq_receive(&seq, SESSION, number));
+
+    // Only the oldest gaps fit.
+    struct logstream_range_s ranges[4];
+    CHECK(logstream_seq_missing(&seq, ranges, ARRAY_SIZE(ranges)) == 4);
+    CHECK(ranges[0].first == 1 && ranges[3].first == 7 && ranges[3].len == 1);
+
+    struct logstream_seq_s none = {};
+    CHECK(logstream_seq_missing(&none, ranges, ARRAY_SIZE(ranges)) == 0);
+}
+
+static void test_skip_gap(void)
+{
+    struct logstream_seq_s seq = {};
+    CHECK(logstream_seq_receive(&seq, SESSION, 1));
+    CHECK(logstream_seq_receive(&seq, SESSION, 4));
+    CHECK(logstream_seq_receive(&seq, SESSION, 5));
+    CHECK(logstream_seq_receive(&seq, SESSION, 8));
+
+    // Only the oldest gap is given up on, and what follows it moves along.
+    logstream_seq_skip_gap(&seq);
+    CHECK(seq.lost == 2 && seq.next == 6);
+    CHECK(missing_is(&seq, (struct logstream_range_s[]){{6, 2}}, 1));
+    CHECK(!logstream_seq_receive(&seq, SESSION, 2));
+
+    logstream_seq_skip_gap(&seq);
+    CHECK(seq.lost == 4 && seq.next == 9);
+
+    // Nothing to give up on.
+    logstream_seq_skip_gap(&seq);
+    CHECK(seq.lost == 4 && seq.next == 9);
+}
+
+static void test_skip(void)
+{
+    struct logstream_seq_s seq = {};
+    CHECK(logstream_seq_receive(&seq, SESSION, 1));
+
+    // Left out right after what was received, including numbers not seen yet.
+    logstream_seq_skip(&seq, SESSION, 2, 3);
+    CHECK(seq.next == 5 && seq.lost == 0);
+    CHECK(logstream_seq_receive(&seq, SESSION, 5));
+    CHECK(!logstream_seq_receive(&seq, SESSION, 3));
+
+    // Another session, or a range that is behind already, changes nothing.
+    logstream_seq_skip(&seq, SESSION + 1, 6, 10);
+    logstream_seq_skip(&seq, SESSION, 2, 2);
+    CHECK(seq.next == 6);
+
+    // Behind a gap, only the range itself is marked, the gap is still asked for.
+    CHECK(logstream_seq_receive(&seq, SESSION, 20));
+    logstream_seq_skip(&seq, SESSION, 10, 4);
+    CHECK(missing_is(&seq, (struct logstream_range_s[]){{6, 4}, {14, 6}}, 2));
+    CHECK(seq.lost == 0);
+
+    // A range of half the number space behind a gap fills the window at once, the gap is lost.
+    logstream_seq_skip(&seq, SESSION, 30, 0x80000000u);
+    CHECK(seq.next == 30 + 0x80000000u && seq.highest == seq.next - 1);
+    CHECK(seq.lost == 4 + 6 + 9);
+    CHECK(missing_is(&seq, NULL, 0));
+    CHECK(logstream_seq_receive(&seq, SESSION, seq.next));
+}
+
+static void test_decode_skip(void)
+{
+    char buf[64];
+    struct logstream_encoder_s enc;
+    struct logstream_decoder_s dec;
+    struct logstream_record_s record = {.seq = 10, .task = "main", .task_len = 4, .tag = "tag", .tag_len = 3, .data = "x", .data_len = 1};
+
+    // Numbers left out before the record decode as they were sent.
+    record.skipped = 10;
+    logstream_encoder_init(&enc, buf, sizeof(buf), LOGSTREAM_FLAG_SEQ, SESSION);
+    CHECK(logstream_encode(&enc, &record));
+    CHECK(logstream_decoder_init(&dec, buf, enc.len) == LOGSTREAM_VERSION_2);
+    CHECK(logstream_decode(&dec, &record) == 1 && record.seq == 10 && record.skipped == 10);
+
+    // More than there are numbers before it is refused.
+    record.skipped = 11;
+    logstream_encoder_init(&enc, buf, sizeof(buf), LOGSTREAM_FLAG_SEQ, SESSION);
+    CHECK(logstream_encode(&enc, &record));
+    CHECK(logstream_decoder_init(&dec, buf, enc.len) == LOGSTREAM_VERSION_2);
+    CHECK(logstream_decode(&dec, &record) == -1);
+}
+
+static void test_control(void)
+{
+    const struct logstream_range_s ranges[] = {{5, 1}, {300, 20}, {0xfffffff0, 15}};
+    struct logstream_range_s decoded[LOGSTREAM_NACK_MAX_RANGES];
+    char buf[LOGSTREAM_NACK_MAX_SIZE];
+    uint32_t session, number;
+
+    size_t len = logstream_encode_nack(buf, sizeof(buf), SESSION, ranges, ARRAY_SIZE(ranges));
+    CHECK(len > 0 && len <= sizeof(buf));
+    CHECK(logstream_decode_nack(buf, len, &session, decoded, ARRAY_SIZE(decoded)) == ARRAY_SIZE(ranges));
+    CHECK(session == SESSION && memcmp(decoded, ranges, sizeof(ranges)) == 0);
+    CHECK(!logstream_decode_ack(buf, len, &session, &number));
+    // Truncated.
+    CHECK(logstream_decode_nack(buf, len - 1, &session, decoded, ARRAY_SIZE(decoded)) == 0);
+
+    len = logstream_encode_ack(buf, sizeof(buf), SESSION, 123456);
+    CHECK(len > 0 && len <= LOGSTREAM_ACK_SIZE);
+    CHECK(logstream_decode_ack(buf, len, &session, &number) && session == SESSION && number == 123456);
+    CHECK(logstream_decode_nack(buf, len, &session, decoded, ARRAY_SIZE(decoded)) == 0);
+}
+
+int main(void)
+{
+    test_receive();
+    test_window();
+    test_missing_max();
+    test_skip_gap();
+    test_skip();
+    test_decode_skip();
+    test_control();
+    return host_test_result("codec");
+}
@@ -0,0 +1,123 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "esp_console.h"
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "log_buffer.h"
+#include "log_capture.h"
+#include "log_kv.h"
+#include "log_metrics.h"
+#include "log_print.h"
+#include "log_sample.h"
+#include "log_stream_client.h"
+#include "log_stream_server.h"
+
+#include "host_test.h"
+
+/*
+ * The logstream client sending to the logstream server of the same process over loopback UDP.
+ * What the server receives is captured again, tagged with the address it came from.
+ */
+
+#define LINES 1000
+#define BATCH 50
+
+static const char *TAG = "e2e";
+
+int main(void)
+{
+    ESP_ERROR_CHECK(log_capture_early_init());
+    ESP_ERROR_CHECK(log_buffer_early_init());
+    ESP_ERROR_CHECK(log_print_early_init());
+    ESP_ERROR_CHECK(log_buffer_init());
+    collect_init();
+    // A thousand lines on stdout only slow the test down.
+    log_capture_enable_handler("print", false);
+
+    // Not a fixed port, so tests can run in parallel.
+    int port = 20000 + getpid() % 20000;
+    logstream_server_config_t server_config = LOGSTREAM_SERVER_DEFAULTS;
+    server_config.port = port;
+    ESP_ERROR_CHECK(logstream_server_init(&server_config));
+
+    logstream_client_config_t client_config = LOGSTREAM_CLIENT_DEFAULTS;
+    client_config.host = "127.0.0.1";
+    client_config.port = port;
+    client_config.flush_ms = 10;
+    client_config.overflow = LOGSTREAM_OVERFLOW_BUFFER;
+    ESP_ERROR_CHECK(logstream_client_init(&client_config));
+
+    collect_start(TAG, true);
+    for (int i = 0; i < LINES; i++) {
+        ESP_LOG_LEVEL(i % 3 == 0 ? ESP_LOG_WARN : ESP_LOG_INFO, TAG, "line %d of %d", i, LINES);
+        // Give the client a chance to keep up, the log buffer only holds so many lines.
+        if (i % BATCH == BATCH - 1)
+            vTaskDelay(pdMS_TO_TICKS(20));
+    }
+
+    CHECK(WAIT_UNTIL(collect.count == LINES, 10000));
+
+    // Everything arrives once, in order, as it was logged.
+    uint64_t last_timestamp = 0;
+    for (size_t i = 0; i < collect.count; i++) {
+        log_entry_t *e = collected(i);
+        char line[32];
+        snprintf(line, sizeof(line), "line %d of %d", (int)i, LINES);
+        CHECK(entry_is(e->data, e->data_len, line));
+        CHECK(e->level == (i % 3 == 0 ? ESP_LOG_WARN : ESP_LOG_INFO));
+        CHECK(entry_is(e->task, log_entry_task_len(e), "main"));
+        CHECK(e->hops == 1);
+        CHECK(entry_is(e->source, log_entry_source_len(e), "127.0.0.1"));
+        CHECK(e->timestamp >= last_timestamp);
+        last_timestamp = e->timestamp;
+        if (host_test_failures > 10)
+            break;
+    }
+    printf("Received %u of %d lines\n", (unsigned)collect.count, LINES);
+
+    // Key-value fields arrive as they were logged.
+    collect_start("e2e_kv", true);
+    log_kv(ESP_LOG_INFO, "e2e_kv", "rssi", LOG_I32(-67), "ssid", LOG_STR("home"));
+    CHECK(WAIT_UNTIL(collect.count == 1, 10000));
+    if (collect.count == 1) {
+        log_entry_t *e = collected(0);
+        char text[64];
+        CHECK(e->flags & LOG_ENTRY_FLAG_KV);
+        CHECK(entry_is(text, log_kv_format(e->data, e->data_len, text, sizeof(text)), "rssi=-67 ssid=home"));
+    }
+
+    // So do the lines dropped by sampling before a line.
+    collect_start("e2e_hot", true);
+    CHECK(log_sample_set("e2e_hot", LOG_SAMPLE_EVERY, 4, 0) == ESP_OK);
+    for (int i = 0; i < 5; i++)
+        ESP_LOGI("e2e_hot", "line %d", i);
+    CHECK(WAIT_UNTIL(collect.count == 2, 10000));
+    CHECK(collect.count == 2 && collected(0)->sampled == 0 && collected(1)->sampled == 3);
+
+    // Counts arrive as key-value fields, that were counted before sampling.
+    collect_start("logmetrics", true);
+    log_metrics_report();
+    CHECK(WAIT_UNTIL(collect.count > 0, 10000));
+    bool found = false;
+    for (size_t i = 0; i < collect.count; i++) {
+        char text[LOG_ENTRY_DATA_SIZE];
+        size_t len = log_kv_format(collected(i)->data, collected(i)->data_len, text, sizeof(text) - 1);
+        text[len] = '\0';
+        found |= strstr(text, "e2e_hot.I=5") != NULL;
+    }
+    CHECK(found);
+
+    // Nothing was dropped.
+    struct logstream_client_stats_s stats;
+    logstream_client_stats(&stats);
+    CHECK(stats.dropped == 0);
+    int ret = -1;
+    CHECK(esp_console_run("logstream", &ret) == ESP_OK && ret == 0);
+
+    return host_test_result("logstream");
+}
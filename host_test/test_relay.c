@@ -0,0 +1,158 @@
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "log_buffer.h"
+#include "log_capture.h"
+#include "log_print.h"
+#include "log_stream_client.h"
+#include "log_stream_server.h"
+
+#include "host_test.h"
+
+/*
+ * A relay chain of three processes over loopback UDP: a leaf logging to a gateway, that relays
+ * what it receives to the collector of the test along with its own lines. Each one is told
+ * to start when the next one up is listening, over a pipe.
+ */
+
+#define LINES 500
+#define BATCH 50
+
+static void init(void)
+{
+    ESP_ERROR_CHECK(log_capture_early_init());
+    ESP_ERROR_CHECK(log_buffer_early_init());
+    ESP_ERROR_CHECK(log_print_early_init());
+    ESP_ERROR_CHECK(log_buffer_init());
+    log_capture_enable_handler("print", false);
+}
+
+static void wait_for(int fd)
+{
+    char c;
+    if (read(fd, &c, 1) != 1)
+        exit(EXIT_FAILURE);
+}
+
+static void start_client(int port, bool relay)
+{
+    logstream_client_config_t client_config = LOGSTREAM_CLIENT_DEFAULTS;
+    client_config.host = "127.0.0.1";
+    client_config.port = port;
+    client_config.flush_ms = 10;
+    client_config.overflow = LOGSTREAM_OVERFLOW_BUFFER;
+    client_config.relay = relay;
+    ESP_ERROR_CHECK(logstream_client_init(&client_config));
+}
+
+static int port, start_gateway[2], gateway_ready[2], report[2];
+
+// Serve on the next port and relay to the collector, then tell the counters when asked to.
+static void run_gateway(void)
+{
+    wait_for(start_gateway[0]);
+    init();
+    logstream_server_config_t server_config = LOGSTREAM_SERVER_DEFAULTS;
+    server_config.port = port + 1;
+    ESP_ERROR_CHECK(logstream_server_init(&server_config));
+    start_client(port, true);
+    write(gateway_ready[1], "", 1);
+
+    wait_for(report[0]);
+    struct logstream_relay_stats_s stats;
+    logstream_client_relay_stats(&stats);
+    ESP_LOGI("gateway", "relayed %" PRIu32 " dropped %" PRIu32 " looped %" PRIu32, stats.relayed, stats.dropped, stats.looped);
+    for (;;)
+        vTaskDelay(portMAX_DELAY);
+}
+
+static void run_leaf(void)
+{
+    wait_for(gateway_ready[0]);
+    init();
+    start_client(port + 1, false);
+    for (int i = 0; i < LINES; i++) {
+        ESP_LOGI("leaf", "line %d of %d", i, LINES);
+        if (i % BATCH == BATCH - 1)
+            vTaskDelay(pdMS_TO_TICKS(20));
+    }
+    for (;;)
+        vTaskDelay(portMAX_DELAY);
+}
+
+static pid_t spawn(void (*run)(void))
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Do not outlive the test, whatever happens to it.
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        run();
+        exit(EXIT_SUCCESS);
+    }
+    return pid;
+}
+
+int main(void)
+{
+    // Not fixed ports, so tests can run in parallel.
+    port = 20000 + (getpid() % 10000) * 2;
+    if (pipe(start_gateway) || pipe(gateway_ready) || pipe(report))
+        return EXIT_FAILURE;
+    // Before any task is started here, only the calling thread survives a fork.
+    pid_t gateway_pid = spawn(run_gateway);
+    pid_t leaf_pid = spawn(run_leaf);
+
+    init();
+    collect_init();
+    logstream_server_config_t server_config = LOGSTREAM_SERVER_DEFAULTS;
+    server_config.port = port;
+    ESP_ERROR_CHECK(logstream_server_init(&server_config));
+
+    collect_start("leaf", true);
+    write(start_gateway[1], "", 1);
+
+    // The lines of the leaf arrive once and in order, two hops away with the name the gateway gave them.
+    CHECK(WAIT_UNTIL(collect.count == LINES, 10000));
+    for (size_t i = 0; i < collect.count; i++) {
+        log_entry_t *e = collected(i);
+        char line[32];
+        snprintf(line, sizeof(line), "line %d of %d", (int)i, LINES);
+        CHECK(entry_is(e->data, e->data_len, line));
+        CHECK(entry_is(e->task, log_entry_task_len(e), "main"));
+        CHECK(e->hops == 2);
+        CHECK(entry_is(e->source, log_entry_source_len(e), "127.0.0.1"));
+        if (host_test_failures > 10)
+            break;
+    }
+    printf("Received %u of %d relayed lines\n", (unsigned)collect.count, LINES);
+
+    // The lines of the gateway itself are one hop away. It relayed the lines the leaf logged
+    // about itself too, and dropped none.
+    collect_start("gateway", true);
+    write(report[1], "", 1);
+    CHECK(WAIT_UNTIL(collect.count == 1, 10000));
+    if (collect.count == 1) {
+        log_entry_t *e = collected(0);
+        char text[64];
+        unsigned relayed = 0, dropped = 1, looped = 1;
+        snprintf(text, sizeof(text), "%.*s", (int)e->data_len, e->data);
+        CHECK(e->hops == 1);
+        CHECK(sscanf(text, "relayed %u dropped %u looped %u", &relayed, &dropped, &looped) == 3);
+        CHECK(relayed >= LINES && dropped == 0 && looped == 0);
+    }
+
+    kill(leaf_pid, SIGKILL);
+    kill(gateway_pid, SIGKILL);
+    waitpid(leaf_pid, NULL, 0);
+    waitpid(gateway_pid, NULL, 0);
+    return host_test_result("relay");
+}
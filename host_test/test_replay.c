@@ -0,0 +1,156 @@
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "lwip/sockets.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "log_buffer.h"
+#include "log_capture.h"
+#include "log_print.h"
+#include "log_stream_client.h"
+#include "log_stream_server.h"
+
+#include "host_test.h"
+
+/*
+ * A device that boots twice, in a process of its own each time, logging to the server of the test.
+ * Lines logged before the client starts arrive by replay, and lines in datagrams lost on the way
+ * by retransmit. The device keeps its local port over the reboot, so the server sees the same
+ * source start a new session. Every line arrives exactly once.
+ *
+ * Both boots are forked before this process starts any task, as only the calling thread survives
+ * a fork, and wait to be told to start over a pipe.
+ */
+
+#define BOOTS 2
+#define EARLY_LINES 20
+#define LINES 400
+#define BATCH 20
+#define DROP_EVERY 4
+#define DROP_COUNT 3
+
+static const char *TAG = "dev";
+
+static int port;
+
+static void run_device(int boot, int start_fd, int report_fd)
+{
+    char c;
+    if (read(start_fd, &c, 1) != 1)
+        return;
+
+    // A new session id, as after a real reboot.
+    srandom(getpid());
+    host_sockets_bind_udp(port + 1);
+
+    ESP_ERROR_CHECK(log_capture_early_init());
+    ESP_ERROR_CHECK(log_buffer_early_init());
+    ESP_ERROR_CHECK(log_print_early_init());
+    ESP_ERROR_CHECK(log_buffer_init());
+    log_capture_enable_handler("print", false);
+
+    // Before the network is up.
+    for (int i = 0; i < EARLY_LINES; i++)
+        ESP_LOGI(TAG, "boot %d early %d", boot, i);
+
+    logstream_client_config_t client_config = LOGSTREAM_CLIENT_DEFAULTS;
+    client_config.host = "127.0.0.1";
+    client_config.port = port;
+    client_config.flush_ms = 10;
+    client_config.overflow = LOGSTREAM_OVERFLOW_BUFFER;
+    ESP_ERROR_CHECK(logstream_client_init(&client_config));
+    vTaskDelay(pdMS_TO_TICKS(500));
+
+    // Lose a few live datagrams, but not the last ones, the server only notices gaps before what it has.
+    host_sockets_drop(DROP_EVERY, DROP_COUNT);
+    for (int i = 0; i < LINES; i++) {
+        ESP_LOGI(TAG, "boot %d line %d", boot, i);
+        if (i % BATCH == BATCH - 1)
+            vTaskDelay(pdMS_TO_TICKS(20));
+    }
+    unsigned dropped = host_sockets_drop(0, 0);
+    write(report_fd, &dropped, sizeof(dropped));
+    for (;;)
+        vTaskDelay(portMAX_DELAY);
+}
+
+static pid_t fork_device(int boot, int start_fd, int report_fd)
+{
+    pid_t pid = fork();
+    if (pid == 0) {
+        prctl(PR_SET_PDEATHSIG, SIGKILL);
+        run_device(boot, start_fd, report_fd);
+        exit(EXIT_SUCCESS);
+    }
+    return pid;
+}
+
+int main(void)
+{
+    static bool early[BOOTS][EARLY_LINES], live[BOOTS][LINES];
+    int start[BOOTS][2], report[2];
+    pid_t pids[BOOTS];
+
+    port = 20000 + (getpid() % 10000) * 2;
+    if (pipe(report))
+        return EXIT_FAILURE;
+    for (int boot = 0; boot < BOOTS; boot++) {
+        if (pipe(start[boot]))
+            return EXIT_FAILURE;
+        pids[boot] = fork_device(boot, start[boot][0], report[1]);
+    }
+
+    ESP_ERROR_CHECK(log_capture_early_init());
+    ESP_ERROR_CHECK(log_buffer_early_init());
+    ESP_ERROR_CHECK(log_print_early_init());
+    ESP_ERROR_CHECK(log_buffer_init());
+    collect_init();
+    log_capture_enable_handler("print", false);
+    logstream_server_config_t server_config = LOGSTREAM_SERVER_DEFAULTS;
+    server_config.port = port;
+    ESP_ERROR_CHECK(logstream_server_init(&server_config));
+    collect_start(TAG, true);
+
+    for (int boot = 0; boot < BOOTS; boot++) {
+        write(start[boot][1], "", 1);
+
+        size_t expect = (boot + 1) * (EARLY_LINES + LINES);
+        CHECK(WAIT_UNTIL(collect.count == expect, 10000));
+        unsigned dropped = 0;
+        CHECK(read(report[0], &dropped, sizeof(dropped)) == sizeof(dropped));
+        CHECK(dropped == DROP_COUNT);
+        printf("Boot %d: received %u of %u lines, %u datagrams dropped\n", boot, (unsigned)collect.count, (unsigned)expect, dropped);
+
+        kill(pids[boot], SIGKILL);
+        waitpid(pids[boot], NULL, 0);
+    }
+
+    // Let late duplicates turn up, if there are any.
+    vTaskDelay(pdMS_TO_TICKS(500));
+    CHECK(collect.count == BOOTS * (EARLY_LINES + LINES));
+    for (size_t i = 0; i < collect.count; i++) {
+        log_entry_t *e = collected(i);
+        char line[48];
+        int boot, n;
+        snprintf(line, sizeof(line), "%.*s", (int)e->data_len, e->data);
+        if (sscanf(line, "boot %d early %d", &boot, &n) == 2 && boot >= 0 && boot < BOOTS && n >= 0 && n < EARLY_LINES) {
+            CHECK(!early[boot][n]);
+            early[boot][n] = true;
+        } else if (sscanf(line, "boot %d line %d", &boot, &n) == 2 && boot >= 0 && boot < BOOTS && n >= 0 && n < LINES) {
+            CHECK(!live[boot][n]);
+            live[boot][n] = true;
+        } else {
+            CHECK_STR(line, "a line that was logged");
+        }
+        if (host_test_failures > 10)
+            break;
+    }
+    return host_test_result("replay");
+}
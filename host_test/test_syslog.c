@@ -0,0 +1,158 @@
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "esp_log.h"
+#include "lwip/sockets.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "log_buffer.h"
+#include "log_capture.h"
+#include "log_print.h"
+#include "log_syslog_client.h"
+
+#include "host_test.h"
+
+/*
+ * The syslog client sending to a socket of the test over loopback, by UDP or TCP as given on the
+ * command line, checking the messages are RFC 5424 and framed by octet counting on TCP.
+ */
+
+#define LINES 20
+#define TIMEOUT_MS 5000
+
+static const char *TAG = "sys";
+
+static const esp_log_level_t levels[] = {ESP_LOG_ERROR, ESP_LOG_WARN, ESP_LOG_INFO};
+static const int severities[] = {3, 4, 6};
+
+static char messages[LINES][256];
+static int n_messages;
+
+// Keep a message if it is one of ours, the client logs about itself too.
+static void add_message(const char *msg, size_t len)
+{
+    char copy[256];
+    snprintf(copy, sizeof(copy), "%.*s", (int)len, msg);
+    if (strstr(copy, " devhost sys main - - ") && n_messages < LINES)
+        strcpy(messages[n_messages++], copy);
+}
+
+static int bind_socket(int type, int port)
+{
+    int sock = socket(AF_INET, type, 0);
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        perror("bind");
+        exit(EXIT_FAILURE);
+    }
+    struct timeval timeout = {.tv_sec = TIMEOUT_MS / 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return sock;
+}
+
+static void receive_udp(int sock)
+{
+    char buf[512];
+    while (n_messages < LINES) {
+        int len = recv(sock, buf, sizeof(buf), 0);
+        if (len <= 0)
+            break;
+        add_message(buf, len);
+    }
+}
+
+// Frames are "LEN MSG", with no delimiter between them.
+static void receive_tcp(int sock)
+{
+    static char buf[16384];
+    size_t used = 0;
+
+    fd_set fds;
+    FD_ZERO(&fds);
+    FD_SET(sock, &fds);
+    struct timeval timeout = {.tv_sec = TIMEOUT_MS / 1000};
+    CHECK(select(sock + 1, &fds, NULL, NULL, &timeout) == 1);
+    int conn = accept(sock, NULL, NULL);
+    CHECK(conn >= 0);
+    if (conn < 0)
+        return;
+    setsockopt(conn, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+    while (n_messages < LINES && used < sizeof(buf)) {
+        int len = recv(conn, buf + used, sizeof(buf) - used, 0);
+        if (len <= 0)
+            break;
+        used += len;
+
+        size_t pos = 0;
+        while (pos < used) {
+            char *space = memchr(buf + pos, ' ', used - pos);
+            if (!space)
+                break;
+            size_t frame = strtoul(buf + pos, NULL, 10);
+            size_t start = space - buf + 1;
+            CHECK(frame > 0);
+            if (!frame || start + frame > used)
+                break;
+            add_message(buf + start, frame);
+            pos = start + frame;
+        }
+        memmove(buf, buf + pos, used - pos);
+        used -= pos;
+    }
+    close(conn);
+}
+
+int main(int argc, char **argv)
+{
+    bool tcp = argc > 1 && strcmp(argv[1], "tcp") == 0;
+
+    ESP_ERROR_CHECK(log_capture_early_init());
+    ESP_ERROR_CHECK(log_buffer_early_init());
+    ESP_ERROR_CHECK(log_print_early_init());
+    ESP_ERROR_CHECK(log_buffer_init());
+
+    int port = 20000 + getpid() % 20000;
+    int sock = bind_socket(tcp ? SOCK_STREAM : SOCK_DGRAM, port);
+    if (tcp)
+        listen(sock, 1);
+
+    log_syslog_client_config_t config = SYSLOG_CLIENT_DEFAULTS;
+    config.host = "127.0.0.1";
+    config.port = port;
+    config.transport = tcp ? LOG_SYSLOG_TRANSPORT_TCP : LOG_SYSLOG_TRANSPORT_UDP;
+    config.hostname = "devhost";
+    config.flush_ms = 10;
+    ESP_ERROR_CHECK(log_syslog_client_init(&config));
+
+    for (int i = 0; i < LINES; i++)
+        ESP_LOG_LEVEL(levels[i % 3], TAG, "message %d", i);
+
+    if (tcp)
+        receive_tcp(sock);
+    else
+        receive_udp(sock);
+    close(sock);
+
+    CHECK(n_messages == LINES);
+    for (int i = 0; i < n_messages; i++) {
+        // <PRI>1 2024-05-01T12:00:00.123Z devhost sys main - - message 0
+        int pri = -1, consumed = 0;
+        CHECK(sscanf(messages[i], "<%d>1 %*4d-%*2d-%*2dT%*2d:%*2d:%*2d.%*3dZ %n", &pri, &consumed) == 1);
+        CHECK(pri == LOG_SYSLOG_FACILITY_USER * 8 + severities[i % 3]);
+
+        char expect[64];
+        snprintf(expect, sizeof(expect), "devhost sys main - - message %d", i);
+        CHECK_STR(messages[i] + consumed, expect);
+        if (host_test_failures > 10)
+            break;
+    }
+
+    return host_test_result(tcp ? "syslog tcp" : "syslog udp");
+}
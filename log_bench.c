@@ -0,0 +1,253 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "argtable3/argtable3.h"
+#include "esp_console.h"
+#include "esp_cpu.h"
+#include "esp_log.h"
+#include "esp_rom_sys.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "log_bench.h"
+#include "log_buffer.h"
+#include "log_capture.h"
+#include "log_common.h"
+
+#define LOG_BENCH_MAX_TASKS 16
+#define LOG_BENCH_MAX_HANDLERS 10
+
+/*
+ * Latencies are counted in a histogram with 4 buckets per power of two, so percentiles are
+ * within 25% without keeping every sample.
+ */
+#define LOG_BENCH_SUB_BITS 2
+#define LOG_BENCH_BUCKETS (32 << LOG_BENCH_SUB_BITS)
+
+#define CYCLES_TO_NS(cycles, mhz) ((uint64_t)(cycles) * 1000 / (mhz))
+
+static const char *bench_tags[] = {"bench0", "bench1", "bench2", "bench3", "bench4", "bench5", "bench6", "bench7"};
+
+struct log_bench_task_s {
+    uint32_t max_cycles;
+    UBaseType_t stack_free;
+    uint32_t histogram[LOG_BENCH_BUCKETS];
+};
+
+static struct {
+    TaskHandle_t caller;
+    uint32_t lines;
+    size_t size;
+    size_t n_tags;
+    char levels[8];
+    size_t n_levels;
+    char payload[LOG_ENTRY_DATA_SIZE];
+} bench;
+
+static size_t log_bench_bucket(uint32_t cycles)
+{
+    if (cycles < (1 << LOG_BENCH_SUB_BITS))
+        return cycles;
+    int msb = 31 - __builtin_clz(cycles);
+    return (msb << LOG_BENCH_SUB_BITS) | ((cycles >> (msb - LOG_BENCH_SUB_BITS)) & ((1 << LOG_BENCH_SUB_BITS) - 1));
+}
+
+// Lowest number of cycles counted in a bucket.
+static uint32_t log_bench_bucket_cycles(size_t bucket)
+{
+    int msb = bucket >> LOG_BENCH_SUB_BITS;
+    if (msb < LOG_BENCH_SUB_BITS)
+        return bucket;
+    return (uint32_t)((1 << LOG_BENCH_SUB_BITS) | (bucket & ((1 << LOG_BENCH_SUB_BITS) - 1))) << (msb - LOG_BENCH_SUB_BITS);
+}
+
+static esp_log_level_t log_bench_level(char c)
+{
+    switch (c) {
+    case 'E':
+        return ESP_LOG_ERROR;
+    case 'W':
+        return ESP_LOG_WARN;
+    case 'D':
+        return ESP_LOG_DEBUG;
+    case 'V':
+        return ESP_LOG_VERBOSE;
+    default:
+        return ESP_LOG_INFO;
+    }
+}
+
+static void log_bench_task(void *arg)
+{
+    struct log_bench_task_s *result = arg;
+
+    // Start together with the other tasks.
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    for (uint32_t i = 0; i < bench.lines; i++) {
+        esp_log_level_t level = log_bench_level(bench.levels[i % bench.n_levels]);
+        const char *tag = bench_tags[i % bench.n_tags];
+
+        uint32_t start = esp_cpu_get_cycle_count();
+        ESP_LOG_LEVEL(level, tag, "%" PRIu32 " %.*s", i, (int)bench.size, bench.payload);
+        uint32_t cycles = esp_cpu_get_cycle_count() - start;
+
+        result->histogram[log_bench_bucket(cycles)]++;
+        result->max_cycles = MAX(result->max_cycles, cycles);
+    }
+    result->stack_free = uxTaskGetStackHighWaterMark(NULL);
+    xTaskNotifyGive(bench.caller);
+    vTaskDelete(NULL);
+}
+
+static uint32_t log_bench_percentile(const uint32_t *histogram, uint32_t total, uint32_t per_mille)
+{
+    uint64_t rank = ((uint64_t)total * per_mille + 999) / 1000;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < LOG_BENCH_BUCKETS; i++) {
+        seen += histogram[i];
+        if (seen >= rank && histogram[i])
+            return log_bench_bucket_cycles(i);
+    }
+    return 0;
+}
+
+static struct {
+    struct arg_int *tasks;
+    struct arg_int *lines;
+    struct arg_int *size;
+    struct arg_int *tags;
+    struct arg_str *levels;
+    struct arg_str *sinks;
+    struct arg_int *stack;
+    struct arg_end *end;
+} logbench_args;
+
+/*
+ * Turn on only the sinks in a comma separated list, and return the ones that were enabled before.
+ */
+static size_t log_bench_select_sinks(const char *sinks, struct log_handler_stats_s *before)
+{
+    size_t n = log_capture_handler_stats(before, LOG_BENCH_MAX_HANDLERS);
+    for (size_t i = 0; i < n; i++) {
+        if (!before[i].name)
+            continue;
+        const char *pos = strstr(sinks, before[i].name);
+        size_t len = strlen(before[i].name);
+        bool selected = pos && (pos == sinks || pos[-1] == ',') && (pos[len] == '\0' || pos[len] == ',');
+        log_capture_enable_handler(before[i].name, selected);
+    }
+    return n;
+}
+
+static int cmd_logbench(int argc, char **argv)
+{
+    static struct log_bench_task_s results[LOG_BENCH_MAX_TASKS];
+    static uint32_t histogram[LOG_BENCH_BUCKETS];
+    struct log_handler_stats_s before[LOG_BENCH_MAX_HANDLERS];
+    struct log_handler_stats_s stats[LOG_BENCH_MAX_HANDLERS];
+    TaskHandle_t tasks[LOG_BENCH_MAX_TASKS];
+
+    int nerrors = arg_parse(argc, argv, (void **)&logbench_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, logbench_args.end, argv[0]);
+        return 1;
+    }
+
+    size_t n_tasks = logbench_args.tasks->count ? MIN(MAX(logbench_args.tasks->ival[0], 1), LOG_BENCH_MAX_TASKS) : portNUM_PROCESSORS;
+    int stack = logbench_args.stack->count ? logbench_args.stack->ival[0] : 4096;
+    bench.caller = xTaskGetCurrentTaskHandle();
+    bench.lines = logbench_args.lines->count ? MAX(logbench_args.lines->ival[0], 1) : 1000;
+    bench.size = logbench_args.size->count ? MIN(MAX(logbench_args.size->ival[0], 0), sizeof(bench.payload)) : 64;
+    bench.n_tags = logbench_args.tags->count ? MIN(MAX(logbench_args.tags->ival[0], 1), ARRAY_SIZE(bench_tags)) : 4;
+    snprintf(bench.levels, sizeof(bench.levels), "%s", logbench_args.levels->count ? logbench_args.levels->sval[0] : "I");
+    bench.n_levels = MAX(strlen(bench.levels), 1);
+    memset(bench.payload, 'x', sizeof(bench.payload));
+
+    size_t n_handlers = 0;
+    if (logbench_args.sinks->count)
+        n_handlers = log_bench_select_sinks(logbench_args.sinks->sval[0], before);
+
+    memset(results, 0, sizeof(results));
+    size_t started = 0;
+    for (; started < n_tasks; started++) {
+        // Spread over the cores.
+        if (xTaskCreatePinnedToCore(log_bench_task, "logbench", stack, &results[started], uxTaskPriorityGet(NULL), &tasks[started],
+                                    started % portNUM_PROCESSORS) != pdPASS) {
+            printf("Could not create task %u\n", (unsigned)started);
+            break;
+        }
+    }
+
+    uint32_t evictions = log_buffer_evictions();
+    log_capture_timing(true);
+    int64_t start = esp_timer_get_time();
+    for (size_t i = 0; i < started; i++)
+        xTaskNotifyGive(tasks[i]);
+    for (size_t done = 0; done < started;)
+        done += ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    int64_t elapsed = esp_timer_get_time() - start;
+    log_capture_timing(false);
+    evictions = log_buffer_evictions() - evictions;
+
+    size_t n_stats = log_capture_handler_stats(stats, ARRAY_SIZE(stats));
+    for (size_t i = 0; i < n_handlers; i++) {
+        if (before[i].name)
+            log_capture_enable_handler(before[i].name, before[i].enabled);
+    }
+    if (!started)
+        return 1;
+
+    memset(histogram, 0, sizeof(histogram));
+    uint32_t max_cycles = 0;
+    UBaseType_t stack_free = UINT32_MAX;
+    for (size_t i = 0; i < started; i++) {
+        for (size_t j = 0; j < LOG_BENCH_BUCKETS; j++)
+            histogram[j] += results[i].histogram[j];
+        max_cycles = MAX(max_cycles, results[i].max_cycles);
+        stack_free = MIN(stack_free, results[i].stack_free);
+    }
+
+    uint32_t total = started * bench.lines;
+    uint32_t mhz = esp_rom_get_cpu_ticks_per_us();
+    printf("%" PRIu32 " lines of %u bytes from %u tasks in %" PRId64 " ms, %" PRIu64 " lines/s\n", total, (unsigned)bench.size, (unsigned)started,
+           elapsed / 1000, elapsed ? (uint64_t)total * 1000000 / elapsed : 0);
+    printf("Latency ns: p50 %" PRIu64 " p90 %" PRIu64 " p99 %" PRIu64 " p99.9 %" PRIu64 " max %" PRIu64 "\n",
+           CYCLES_TO_NS(log_bench_percentile(histogram, total, 500), mhz), CYCLES_TO_NS(log_bench_percentile(histogram, total, 900), mhz),
+           CYCLES_TO_NS(log_bench_percentile(histogram, total, 990), mhz), CYCLES_TO_NS(log_bench_percentile(histogram, total, 999), mhz),
+           CYCLES_TO_NS(max_cycles, mhz));
+    printf("%-12s %8s %8s\n", "Handler", "Calls", "Avg ns");
+    for (size_t i = 0; i < n_stats; i++) {
+        if (!stats[i].calls)
+            continue;
+        printf("%-12s %8" PRIu32 " %8" PRIu64 "\n", stats[i].name ? stats[i].name : "-", stats[i].calls, CYCLES_TO_NS(stats[i].cycles / stats[i].calls, mhz));
+    }
+    printf("Buffer evictions: %" PRIu32 "\n", evictions);
+    printf("Stack used: %u of %d bytes\n", (unsigned)(stack - stack_free), stack);
+    return 0;
+}
+
+esp_err_t log_bench_init(void)
+{
+    logbench_args.tasks = arg_int0("t", "tasks", "<n>", "Logging tasks, spread over the cores, one per core by default");
+    logbench_args.lines = arg_int0("n", "lines", "<n>", "Lines logged by each task, 1000 by default");
+    logbench_args.size = arg_int0("s", "size", "<bytes>", "Size of each line, 64 by default");
+    logbench_args.tags = arg_int0(NULL, "tags", "<n>", "Number of tags to take turns on, 4 by default");
+    logbench_args.levels = arg_str0("l", "levels", "<EWIDV>", "Levels to take turns on, I by default");
+    logbench_args.sinks = arg_str0(NULL, "sinks", "<list>", "Comma separated sinks to run with, like buffer,logstream. All enabled by default");
+    logbench_args.stack = arg_int0(NULL, "stack", "<bytes>", "Stack of each logging task, 4096 by default");
+    logbench_args.end = arg_end(7);
+
+    const esp_console_cmd_t logbench_cmd = {
+        .command = "logbench",
+        .help = "Measure logging throughput and latency",
+        .hint = NULL,
+        .func = &cmd_logbench,
+        .argtable = &logbench_args,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&logbench_cmd));
+
+    return ESP_OK;
+}
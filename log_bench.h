@@ -0,0 +1,6 @@
+#pragma once
+
+#include "esp_err.h"
+
+// Registers the logbench console command, measuring logging throughput and latency on target.
+esp_err_t log_bench_init(void);
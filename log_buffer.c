@@ -3,11 +3,15 @@
 #include <ctype.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <sys/queue.h>
 
 #include "esp_console.h"
 #include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "esp_rom_sys.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 
 #include "argtable3/argtable3.h"
 #include "freertos/FreeRTOS.h"
@@ -18,65 +22,266 @@
 #include "circ_buf.h"
 #include "log_common.h"
 #include "log_buffer.h"
+#include "log_format.h"
+#include "log_intern.h"
+#include "log_kv_codec.h"
 #include "log_print.h"
 
+/*
+ * Entries are kept as a fixed size record in internal RAM, with the line and any names that are
+ * not interned in a byte ring in PSRAM. Scans, purges and stats only touch the records, the
+ * payload is read when an entry is copied out or searched.
+ */
+#define LOG_BUFFER_RECORDS CONFIG_LOGGER_LOG_BUFFER_RECORDS
+
+struct log_record_s {
+    uint64_t timestamp;
+    uint32_t index;
+    uint32_t offset;   // Position of the payload, bytes pushed to the payload ring before it since start.
+    uint16_t data_len; // Of the line, after the names.
+    uint16_t task;     // Interned, LOG_INTERN_NONE when the names are in the payload.
+    uint16_t tag;
+    uint16_t sampled;
+    uint8_t names_len; // Payload bytes of names in front of the line, 0 when they are interned.
+    uint8_t core;
+    uint8_t level;
+    uint8_t hops;
+    uint8_t flags;
+};
+
+static struct log_record_s records[LOG_BUFFER_RECORDS];
+static size_t record_first;
+static size_t record_count;
 static EXT_RAM_BSS_ATTR char log_data[CONFIG_LOGGER_LOG_BUFFER_SIZE];
 static circ_buf_t log_buf;
+static uint32_t pulled_bytes; // Payload bytes pulled or purged since start, the position of the oldest payload.
 static uint32_t last_index = 0;
-static struct {
-    uint32_t offset;
-    uint32_t entry;
-} peek_cache = {};
+static uint32_t evictions; // Entries purged to make room for new ones.
 
 static SemaphoreHandle_t xSemaphore = NULL;
 static StaticSemaphore_t xSemaphoreBuffer;
 
-struct log_header_s {
+/*
+ * Time index, a checkpoint every TIME_INDEX_STRIDE entries with the newest timestamp before it.
+ * Received and restored entries can be older than the ones before them, the newest timestamp so
+ * far never goes back, so the checkpoints can be binary searched.
+ */
+#define TIME_INDEX_STRIDE 16
+#define TIME_INDEX_SIZE (LOG_BUFFER_RECORDS / TIME_INDEX_STRIDE + 1)
+
+struct time_checkpoint_s {
     uint32_t index;
-    uint8_t core;
-    uint8_t level;
-    uint16_t data_len;
-    uint64_t timestamp;
-    char task[configMAX_TASK_NAME_LEN];
-    char tag[CONFIG_LOGGER_LOG_MAX_TAG_SIZE];
-} __attribute__((packed));
+    uint64_t newest_before;
+};
+
+static struct time_checkpoint_s time_index[TIME_INDEX_SIZE];
+static size_t time_first;
+static size_t time_count;
+static uint64_t newest_timestamp;
+
+static struct time_checkpoint_s *time_checkpoint(size_t i)
+{
+    return &time_index[(time_first + i) % TIME_INDEX_SIZE];
+}
+
+static struct log_record_s *log_record(size_t i)
+{
+    return &records[(record_first + i) % LOG_BUFFER_RECORDS];
+}
+
+// Position of the record for the entry after index, record_count if there is none.
+static size_t log_record_after(uint32_t index)
+{
+    if (!record_count)
+        return 0;
+    uint32_t oldest = log_record(0)->index;
+    if (index < oldest)
+        return 0;
+    return MIN((size_t)(index - oldest) + 1, record_count);
+}
+
+static size_t log_record_payload_offset(const struct log_record_s *record)
+{
+    return record->offset - pulled_bytes;
+}
+
+// Called with the lock held, drops the oldest entry.
+static void log_buffer_drop_oldest(void)
+{
+    const struct log_record_s *record = log_record(0);
+    size_t len = record->names_len + record->data_len;
+    uint32_t index = record->index;
+    // The record goes first, so a lock free reader never sees it without its payload.
+    record_first = (record_first + 1) % LOG_BUFFER_RECORDS;
+    __atomic_store_n(&record_count, record_count - 1, __ATOMIC_RELEASE);
+    circ_pull_ptr_pulled(&log_buf, len);
+    pulled_bytes += len;
+    while (time_count && time_checkpoint(0)->index <= index) {
+        time_first = (time_first + 1) % TIME_INDEX_SIZE;
+        time_count--;
+    }
+}
 
 static void purge_entry()
 {
-    struct log_header_s header = {};
-    if (!circ_peek(&log_buf, (char *)&header, sizeof(struct log_header_s)))
+    if (!record_count)
+        return;
+    log_buffer_drop_oldest();
+    evictions++;
+}
+
+// Task, tag and source of an entry, pointing into an entry, the intern table or the payload.
+struct log_names_s {
+    const char *task;
+    const char *tag;
+    const char *source;
+    size_t task_len;
+    size_t tag_len;
+    size_t source_len;
+};
+
+#define LOG_RECORD_NAMES_SIZE (3 + LOG_ENTRY_TASK_SIZE + LOG_ENTRY_TAG_SIZE + LOG_ENTRY_SOURCE_SIZE)
+
+static void log_buffer_push_name(const char *name, size_t len)
+{
+    uint8_t len8 = len;
+    circ_push(&log_buf, (const char *)&len8, 1);
+    if (len)
+        circ_push(&log_buf, name, len);
+}
+
+/*
+ * Called with the lock held, makes room for the entry by purging the oldest ones. The names are
+ * interned, and kept in the payload if the intern table is full. Received entries keep theirs in
+ * the payload, the names of other devices come and go and would fill the intern table.
+ */
+static void log_buffer_push_locked(struct log_record_s *record, const struct log_names_s *names, const char *data)
+{
+    record->task = record->tag = LOG_INTERN_NONE;
+    record->names_len = 0;
+    if (!names->source_len) {
+        record->task = log_intern(names->task, names->task_len);
+        record->tag = log_intern(names->tag, names->tag_len);
+    }
+    if (names->source_len || (record->task == LOG_INTERN_NONE && names->task_len) || (record->tag == LOG_INTERN_NONE && names->tag_len)) {
+        record->task = record->tag = LOG_INTERN_NONE;
+        record->names_len = 3 + names->task_len + names->tag_len + names->source_len;
+    }
+
+    size_t len = record->names_len + record->data_len;
+    while (record_count && (record_count == LOG_BUFFER_RECORDS || circ_get_free_bytes(&log_buf) < len))
+        purge_entry();
+
+    if (record->index % TIME_INDEX_STRIDE == 0) {
+        *time_checkpoint(time_count++) = (struct time_checkpoint_s){
+            .index = record->index,
+            .newest_before = newest_timestamp,
+        };
+    }
+    newest_timestamp = MAX(newest_timestamp, record->timestamp);
+
+    record->offset = pulled_bytes + circ_used(&log_buf);
+    if (record->names_len) {
+        log_buffer_push_name(names->task, names->task_len);
+        log_buffer_push_name(names->tag, names->tag_len);
+        log_buffer_push_name(names->source, names->source_len);
+    }
+    if (circ_push(&log_buf, data, record->data_len) != record->data_len)
+        abort();
+    // The payload goes first, see log_buffer_drop_oldest.
+    *log_record(record_count) = *record;
+    __atomic_store_n(&record_count, record_count + 1, __ATOMIC_RELEASE);
+}
+
+static size_t log_buffer_read_name(const char *buf, size_t len, size_t pos, size_t max, const char **name, size_t *name_len)
+{
+    *name = buf + pos + 1;
+    *name_len = pos < len ? MIN((size_t)(uint8_t)buf[pos], MIN(len - pos - 1, max)) : 0;
+    return pos + 1 + *name_len;
+}
+
+/*
+ * The names of a record, from the intern table or read from the payload at offset into scratch,
+ * LOG_RECORD_NAMES_SIZE bytes. Lengths are checked, the panic dump reads records that may be torn.
+ */
+static void log_buffer_record_names(circ_buf_t *buf, size_t offset, const struct log_record_s *record, char *scratch, struct log_names_s *names)
+{
+    if (!record->names_len) {
+        names->task = log_intern_str(record->task);
+        names->task_len = log_intern_len(record->task);
+        names->tag = log_intern_str(record->tag);
+        names->tag_len = log_intern_len(record->tag);
+        names->source = "";
+        names->source_len = 0;
         return;
-    circ_pull_ptr_pulled(&log_buf, sizeof(struct log_header_s) + header.data_len);
-    memset(&peek_cache, 0, sizeof(peek_cache));
+    }
+    size_t len = circ_peek_offset(buf, scratch, MIN((size_t)record->names_len, (size_t)LOG_RECORD_NAMES_SIZE), offset);
+    size_t pos = log_buffer_read_name(scratch, len, 0, LOG_ENTRY_TASK_SIZE, &names->task, &names->task_len);
+    pos = log_buffer_read_name(scratch, len, pos, LOG_ENTRY_TAG_SIZE, &names->tag, &names->tag_len);
+    log_buffer_read_name(scratch, len, pos, LOG_ENTRY_SOURCE_SIZE, &names->source, &names->source_len);
+}
+
+// Copy a record and its payload into the entry, with the lock held.
+static void log_buffer_entry_from_record(struct log_entry_s *entry, const struct log_record_s *record)
+{
+    char scratch[LOG_RECORD_NAMES_SIZE];
+    struct log_names_s names;
+    size_t offset = log_record_payload_offset(record);
+    entry->index = record->index;
+    entry->core = record->core;
+    entry->level = record->level;
+    entry->hops = record->hops;
+    entry->flags = record->flags;
+    entry->sampled = record->sampled;
+    entry->timestamp = record->timestamp;
+    log_buffer_record_names(&log_buf, offset, record, scratch, &names);
+    log_entry_set_task(entry, names.task, names.task_len);
+    log_entry_set_tag(entry, names.tag, names.tag_len);
+    log_entry_set_source(entry, names.source, names.source_len);
+    entry->data_len = circ_peek_offset(&log_buf, log_entry_data_buf(entry), record->data_len, offset + record->names_len);
 }
 
 static void log_buffer_push_entry(struct log_entry_s *e)
 {
-    struct log_header_s header = {
-        .index = last_index++,
+    struct log_names_s names = {
+        .task = e->task,
+        .tag = e->tag,
+        .source = e->source,
+        .task_len = MIN(log_entry_task_len(e), (size_t)LOG_ENTRY_TASK_SIZE),
+        .tag_len = MIN(log_entry_tag_len(e), (size_t)LOG_ENTRY_TAG_SIZE),
+        .source_len = e->hops ? MIN(log_entry_source_len(e), (size_t)LOG_ENTRY_SOURCE_SIZE) : 0,
+    };
+    struct log_record_s record = {
         .core = e->core,
         .level = e->level,
         .timestamp = e->timestamp,
-        .data_len = e->data_len,
+        .data_len = MIN(e->data_len, (size_t)LOG_ENTRY_DATA_SIZE),
+        .hops = e->hops,
+        .flags = e->flags,
+        .sampled = e->sampled,
     };
-    strncpy(header.task, e->task, sizeof(header.task));
-    strncpy(header.tag, e->tag, sizeof(header.tag));
     if (xSemaphoreTake(xSemaphore, portMAX_DELAY) != pdTRUE) {
         return;
     }
 
-    // Free space in log header
-    while (circ_get_free_bytes(&log_buf) < (sizeof(struct log_header_s) + e->data_len)) {
-        purge_entry();
-    }
-
-    if (circ_push(&log_buf, (char *)&header, sizeof(struct log_header_s)) != sizeof(struct log_header_s))
-        abort();
-    if (circ_push(&log_buf, (char *)e->data, e->data_len) != e->data_len)
-        abort();
+    // Indexes are taken under the lock, so they are strictly increasing in the buffer.
+    // They start at 1, as peeking returns entries after the given index.
+    record.index = e->index = ++last_index;
+    log_buffer_push_locked(&record, &names, e->data);
     xSemaphoreGive(xSemaphore);
 }
 
+// Index of the newest entry pushed, 0 if there is none.
+uint32_t log_buffer_last_index(void)
+{
+    return last_index;
+}
+
+uint32_t log_buffer_evictions(void)
+{
+    return evictions;
+}
+
 bool log_pull_entry(struct log_entry_s *entry)
 {
 
@@ -84,85 +289,350 @@ bool log_pull_entry(struct log_entry_s *entry)
         return false;
     }
 
-    struct log_header_s header = {};
-    // Peek entry, without pulling it
-    if (!circ_pull(&log_buf, (char *)&header, sizeof(header))) {
+    if (!record_count) {
         xSemaphoreGive(xSemaphore);
         return false;
     }
 
-    if (header.data_len == 0)
-        abort();
-
-    entry->core = header.core;
-    entry->level = header.level;
-    strncpy(entry->task, header.task, sizeof(entry->task));
-    strncpy(entry->tag, header.tag, sizeof(entry->tag));
-    entry->timestamp = header.timestamp;
-    entry->data_len = header.data_len;
-
-    if (header.data_len > sizeof(entry->data))
-        abort();
-
-    if (circ_pull(&log_buf, (char *)entry->data, header.data_len) != header.data_len)
-        abort();
-    memset(&peek_cache, 0, sizeof(peek_cache));
+    log_buffer_entry_from_record(entry, log_record(0));
+    log_buffer_drop_oldest();
     xSemaphoreGive(xSemaphore);
     return true;
 }
 
 bool log_peek_entry(struct log_entry_s *entry, uint32_t *index)
 {
-    if (xSemaphoreTake(xSemaphore, portMAX_DELAY) != pdTRUE)
+    if (!xSemaphore || xSemaphoreTake(xSemaphore, portMAX_DELAY) != pdTRUE)
         return false;
 
-    size_t offset = 0;
+    size_t i = log_record_after(*index);
+    if (i == record_count) {
+        xSemaphoreGive(xSemaphore);
+        return false;
+    }
+    log_buffer_entry_from_record(entry, log_record(i));
+    *index = entry->index;
+    xSemaphoreGive(xSemaphore);
+    return true;
+}
+
+/*
+ * The index before the first entry with a timestamp at or after the given one, or the last index if
+ * there is none. Checkpoints with only older entries before them are skipped by binary search, and
+ * the records from the last of them scanned.
+ */
+uint32_t log_buffer_index_since(uint64_t timestamp)
+{
+    if (!xSemaphore || xSemaphoreTake(xSemaphore, portMAX_DELAY) != pdTRUE)
+        return 0;
+
+    size_t lo = 0, hi = time_count;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (time_checkpoint(mid)->newest_before < timestamp)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
 
-    if (peek_cache.offset > 0 && peek_cache.entry > 0 && peek_cache.entry == *index) {
-        offset = peek_cache.offset;
+    uint32_t index = last_index;
+    for (size_t i = lo ? log_record_after(time_checkpoint(lo - 1)->index - 1) : 0; i < record_count; i++) {
+        if (log_record(i)->timestamp >= timestamp) {
+            index = log_record(i)->index - 1;
+            break;
+        }
     }
+    xSemaphoreGive(xSemaphore);
+    return index;
+}
 
-    // Lets search of an entry, that is greater than timestamp.
-    while (1) {
-        struct log_header_s header = {};
-        // Peek entry, without pulling it
-        if (circ_peek_offset(&log_buf, (char *)&header, sizeof(header), offset) != sizeof(header)) {
+bool log_peek_since(uint64_t timestamp, struct log_entry_s *entry, uint32_t *index)
+{
+    *index = log_buffer_index_since(timestamp);
+    return log_peek_entry(entry, index);
+}
+
+/*
+ * Like log_peek_entry, for the next entry whose line matches. Lines are searched in place in the
+ * buffer, only entries that match are copied out.
+ */
+bool log_grep_entry(struct log_entry_s *entry, uint32_t *index, const struct log_grep_s *grep)
+{
+    // Only used under the lock.
+    static char kv[LOG_ENTRY_DATA_SIZE];
+    static char text[LOG_ENTRY_DATA_SIZE];
+
+    if (!xSemaphore || xSemaphoreTake(xSemaphore, portMAX_DELAY) != pdTRUE)
+        return false;
+
+    for (size_t i = log_record_after(*index); i < record_count; i++) {
+        const struct log_record_s *record = log_record(i);
+        size_t data_offset = log_record_payload_offset(record) + record->names_len;
+        const char *data1, *data2;
+        size_t len1, len2;
+        circ_peek_ptr2_offset(&log_buf, data_offset, record->data_len, &data1, &len1, &data2, &len2);
+        if (record->flags & LOG_ENTRY_FLAG_KV) {
+            // Fields are searched the way they are printed.
+            size_t kv_len = circ_peek_offset(&log_buf, kv, record->data_len, data_offset);
+            data1 = text;
+            len1 = log_kv_format(kv, kv_len, text, sizeof(text));
+            len2 = 0;
+        }
+        if (log_grep_match(grep, data1, len1, data2, len2)) {
+            log_buffer_entry_from_record(entry, record);
+            *index = record->index;
             xSemaphoreGive(xSemaphore);
-            return false;
+            return true;
         }
-        // Store offset in a local cache to speed up peeking.
-        peek_cache.entry = header.index;
-        peek_cache.offset = offset;
-
-        offset += sizeof(header);
-        if (header.index > *index) {
-            *index = header.index;
-            entry->core = header.core;
-            entry->level = header.level;
-            strcpy(entry->task, header.task);
-            strcpy(entry->tag, header.tag);
-            entry->timestamp = header.timestamp;
-            entry->data_len = header.data_len;
-
-            if (header.data_len < 1)
-                abort();
-            if (header.data_len > sizeof(entry->data))
-                abort();
-
-            if (circ_peek_offset(&log_buf, (char *)entry->data, header.data_len, offset) != header.data_len)
-                abort();
+    }
+    xSemaphoreGive(xSemaphore);
+    return false;
+}
+
+#if CONFIG_LOGGER_PANIC_DUMP
+
+#define PANIC_SAVE_MAGIC 0x4c4f4733 // LOG3, headers without an index.
+
+// Records of the newest entries found by the last walk, oldest first.
+static struct log_record_s panic_records[CONFIG_LOGGER_PANIC_DUMP_ENTRIES];
+static size_t panic_count;
+static circ_buf_t panic_buf;
+static uint32_t panic_pulled;
+
+// Entries as they are kept over the reboot.
+struct log_header_s {
+    uint8_t core;
+    uint8_t level;
+    uint16_t data_len;
+    uint8_t hops;
+    uint8_t flags;
+    uint16_t sampled;
+    uint64_t timestamp;
+    char task[configMAX_TASK_NAME_LEN];
+    char tag[CONFIG_LOGGER_LOG_MAX_TAG_SIZE];
+    char source[LOG_ENTRY_SOURCE_SIZE];
+} __attribute__((packed));
+
+#if CONFIG_LOGGER_PANIC_SAVE_SIZE > 0
+static __NOINIT_ATTR struct {
+    uint32_t magic;
+    uint32_t crc;
+    uint32_t len;
+    char data[CONFIG_LOGGER_PANIC_SAVE_SIZE];
+} panic_save;
+
+static bool log_buffer_header_valid(const struct log_header_s *header)
+{
+    return header->data_len > 0 && header->data_len <= LOG_ENTRY_DATA_SIZE && header->level <= ESP_LOG_VERBOSE &&
+           !(header->flags & ~(LOG_ENTRY_FLAG_KV | LOG_ENTRY_FLAG_METRICS));
+}
+#endif
+
+static bool log_buffer_record_valid(const struct log_record_s *record, const struct log_record_s *prev)
+{
+    return record->data_len <= LOG_ENTRY_DATA_SIZE && record->level <= ESP_LOG_VERBOSE && !(record->flags & ~(LOG_ENTRY_FLAG_KV | LOG_ENTRY_FLAG_METRICS)) &&
+           record->offset - panic_pulled + record->names_len + record->data_len <= circ_used(&panic_buf) &&
+           (!prev || (record->index == prev->index + 1 && record->offset == prev->offset + prev->names_len + prev->data_len));
+}
+
+/*
+ * Find the newest entries without taking the lock, the task that crashed may hold it. The records
+ * are walked from a copy of the ring state, and the walk stops at the first one that does not
+ * follow the one before or whose payload is not in the ring, like one that was being pushed or purged.
+ */
+static size_t log_buffer_panic_walk(size_t max_entries)
+{
+    panic_buf = log_buf;
+    panic_pulled = pulled_bytes;
+    size_t first = record_first;
+    size_t count = __atomic_load_n(&record_count, __ATOMIC_ACQUIRE);
+
+    panic_count = 0;
+    max_entries = MIN(max_entries, ARRAY_SIZE(panic_records));
+    for (size_t i = count - MIN(count, max_entries); i < count; i++) {
+        const struct log_record_s *record = &records[(first + i) % LOG_BUFFER_RECORDS];
+        if (!log_buffer_record_valid(record, panic_count ? &panic_records[panic_count - 1] : NULL))
             break;
+        panic_records[panic_count++] = *record;
+    }
+    return panic_count;
+}
+
+size_t log_buffer_panic_dump(size_t max_entries)
+{
+    // Static, as the stack of a crashed task may be nearly gone.
+    static char line[32 + configMAX_TASK_NAME_LEN + CONFIG_LOGGER_LOG_MAX_TAG_SIZE + LOG_ENTRY_DATA_SIZE];
+    static char scratch[LOG_RECORD_NAMES_SIZE];
+    static char kv[LOG_ENTRY_DATA_SIZE];
+
+    size_t count = log_buffer_panic_walk(max_entries);
+    esp_rom_printf("\n%u newest log entries:\n", (unsigned)count);
+    for (size_t i = 0; i < count; i++) {
+        const struct log_record_s *record = &panic_records[i];
+        size_t offset = record->offset - panic_pulled;
+        struct log_names_s n;
+        log_buffer_record_names(&panic_buf, offset, record, scratch, &n);
+        offset += record->names_len;
+
+        // E (1714564800123) task tag: data
+        char *pos = line;
+        *pos++ = "NEWIDV"[record->level];
+        *pos++ = ' ';
+        *pos++ = '(';
+        pos += log_format_u64(pos, record->timestamp);
+        *pos++ = ')';
+        *pos++ = ' ';
+        memcpy(pos, n.task, n.task_len);
+        pos += n.task_len;
+        *pos++ = ' ';
+        memcpy(pos, n.tag, n.tag_len);
+        pos += n.tag_len;
+        *pos++ = ':';
+        *pos++ = ' ';
+        if (record->flags & LOG_ENTRY_FLAG_KV) {
+            size_t kv_len = circ_peek_offset(&panic_buf, kv, record->data_len, offset);
+            pos += log_kv_format(kv, kv_len, pos, LOG_ENTRY_DATA_SIZE);
+        } else {
+            pos += circ_peek_offset(&panic_buf, pos, record->data_len, offset);
         }
-        offset += header.data_len;
-    };
+        *pos++ = '\n';
+        *pos = '\0';
+        esp_rom_printf("%s", line);
+    }
+    return count;
+}
+
+size_t log_buffer_panic_save(void)
+{
+#if CONFIG_LOGGER_PANIC_SAVE_SIZE > 0
+    static char scratch[LOG_RECORD_NAMES_SIZE];
+    static struct log_header_s header;
+
+    size_t n = log_buffer_panic_walk(ARRAY_SIZE(panic_records));
+
+    // As many of the newest entries as fit.
+    size_t first = n;
+    size_t len = 0;
+    while (first > 0 && len + sizeof(header) + panic_records[first - 1].data_len <= sizeof(panic_save.data))
+        len += sizeof(header) + panic_records[--first].data_len;
+    if (first == n)
+        return 0;
+
+    panic_save.len = 0;
+    for (size_t i = first; i < n; i++) {
+        const struct log_record_s *record = &panic_records[i];
+        size_t offset = record->offset - panic_pulled;
+        struct log_names_s names;
+        log_buffer_record_names(&panic_buf, offset, record, scratch, &names);
+
+        memset(&header, 0, sizeof(header));
+        header.core = record->core;
+        header.level = record->level;
+        header.data_len = record->data_len;
+        header.hops = record->hops;
+        header.flags = record->flags;
+        header.sampled = record->sampled;
+        header.timestamp = record->timestamp;
+        memcpy(header.task, names.task, MIN(names.task_len, sizeof(header.task)));
+        memcpy(header.tag, names.tag, MIN(names.tag_len, sizeof(header.tag)));
+        memcpy(header.source, names.source, MIN(names.source_len, sizeof(header.source)));
+        memcpy(panic_save.data + panic_save.len, &header, sizeof(header));
+        panic_save.len += sizeof(header);
+        panic_save.len += circ_peek_offset(&panic_buf, panic_save.data + panic_save.len, record->data_len, offset + record->names_len);
+    }
+    panic_save.crc = esp_rom_crc32_le(0, (const uint8_t *)panic_save.data, panic_save.len);
+    panic_save.magic = PANIC_SAVE_MAGIC;
+    return n - first;
+#else
+    return 0;
+#endif
+}
 
+/*
+ * Put the entries saved by a panic back in the buffer, with new indexes. Memory that is not
+ * cleared on reboot is random after power on, hence the magic and the checksum.
+ */
+static size_t log_buffer_panic_restore_locked(void)
+{
+    size_t n = 0;
+#if CONFIG_LOGGER_PANIC_SAVE_SIZE > 0
+    if (panic_save.magic != PANIC_SAVE_MAGIC || panic_save.len > sizeof(panic_save.data) ||
+        esp_rom_crc32_le(0, (const uint8_t *)panic_save.data, panic_save.len) != panic_save.crc) {
+        panic_save.magic = 0;
+        return 0;
+    }
+    panic_save.magic = 0;
+
+    struct log_header_s header;
+    for (size_t offset = 0; offset + sizeof(header) <= panic_save.len; offset += sizeof(header) + header.data_len) {
+        memcpy(&header, panic_save.data + offset, sizeof(header));
+        if (!log_buffer_header_valid(&header) || offset + sizeof(header) + header.data_len > panic_save.len)
+            break;
+        struct log_record_s record = {
+            .index = ++last_index,
+            .core = header.core,
+            .level = header.level,
+            .timestamp = header.timestamp,
+            .data_len = header.data_len,
+            .hops = header.hops,
+            .flags = header.flags,
+            .sampled = header.sampled,
+        };
+        struct log_names_s names = {
+            .task = header.task,
+            .tag = header.tag,
+            .source = header.source,
+            .task_len = strnlen(header.task, sizeof(header.task)),
+            .tag_len = strnlen(header.tag, sizeof(header.tag)),
+            .source_len = header.hops ? strnlen(header.source, sizeof(header.source)) : 0,
+        };
+        log_buffer_push_locked(&record, &names, panic_save.data + offset + sizeof(header));
+        n++;
+    }
+#endif
+    return n;
+}
+
+size_t log_buffer_panic_restore(void)
+{
+    if (xSemaphoreTake(xSemaphore, portMAX_DELAY) != pdTRUE)
+        return 0;
+    size_t n = log_buffer_panic_restore_locked();
     xSemaphoreGive(xSemaphore);
-    return true;
+    return n;
 }
 
+#if CONFIG_IDF_TARGET_LINUX
+char *log_buffer_panic_save_data(size_t *len)
+{
+#if CONFIG_LOGGER_PANIC_SAVE_SIZE > 0
+    *len = panic_save.len;
+    return panic_save.data;
+#else
+    *len = 0;
+    return NULL;
+#endif
+}
+#endif
+
+#if !CONFIG_IDF_TARGET_LINUX
+void __real_esp_panic_handler(void *info);
+
+// Linked in place of esp_panic_handler with --wrap, before the backtrace and the core dump.
+void __wrap_esp_panic_handler(void *info)
+{
+    log_buffer_panic_save();
+    log_buffer_panic_dump(CONFIG_LOGGER_PANIC_DUMP_ENTRIES);
+    __real_esp_panic_handler(info);
+}
+#endif
+
+#endif
+
 struct log_buffer_stat {
     size_t buffer_max_size_bytes;
     size_t buffer_size_bytes;
+    size_t buffer_max_entries;
     size_t buffer_size_entries;
 };
 
@@ -172,19 +642,9 @@ void log_buffer_stats(struct log_buffer_stat *stat)
         return;
     memset(stat, 0, sizeof(struct log_buffer_stat));
     stat->buffer_max_size_bytes = circ_total_size(&log_buf);
-
-    // Lets search of an entry, that is greater than timestamp.
-    while (1) {
-        struct log_header_s header = {};
-        // Peek entry, without pulling it
-        if (circ_peek_offset(&log_buf, (char *)&header, sizeof(header), stat->buffer_size_bytes) != sizeof(header)) {
-            xSemaphoreGive(xSemaphore);
-            return;
-        }
-        stat->buffer_size_bytes += sizeof(header) + header.data_len;
-        stat->buffer_size_entries++;
-    };
-
+    stat->buffer_size_bytes = circ_used(&log_buf);
+    stat->buffer_max_entries = LOG_BUFFER_RECORDS;
+    stat->buffer_size_entries = record_count;
     xSemaphoreGive(xSemaphore);
 }
 
@@ -193,6 +653,10 @@ static struct {
     struct arg_lit *color;
     struct arg_lit *purge;
     struct arg_lit *stats;
+    struct arg_str *grep;
+    struct arg_lit *icase;
+    struct arg_str *since; // 64 bit, wall clock ms do not fit an arg_int.
+    struct arg_int *last;
     struct arg_end *end;
 } dmesg_args;
 
@@ -204,13 +668,25 @@ static int cmd_dmesg(int argc, char **argv)
         arg_print_errors(stderr, dmesg_args.end, argv[0]);
         return 1;
     }
-    struct log_entry_s entry = {};
+    // Console commands run one at a time, keep the entry off the console task stack.
+    static struct log_entry_store_s store;
+    log_entry_t *entry = &store.entry;
 
     bool clear = dmesg_args.clear->count > 0;
     bool color = dmesg_args.color->count > 0;
 
+    // Entries up to this index are older than --since or --last.
+    uint32_t start_index = 0;
+    if (dmesg_args.since->count > 0)
+        start_index = log_buffer_index_since(strtoull(dmesg_args.since->sval[0], NULL, 10));
+    if (dmesg_args.last->count > 0) {
+        uint64_t now = log_capture_timestamp_ms();
+        uint64_t last = (uint64_t)MAX(dmesg_args.last->ival[0], 0) * 1000;
+        start_index = log_buffer_index_since(now > last ? now - last : 0);
+    }
+
     if (dmesg_args.purge->count > 0) {
-        while (log_pull_entry(&entry)) {
+        while (log_pull_entry(entry)) {
         }
         return 0;
     }
@@ -218,26 +694,49 @@ static int cmd_dmesg(int argc, char **argv)
     if (dmesg_args.stats->count > 0) {
         struct log_buffer_stat stat;
         log_buffer_stats(&stat);
-        printf("Log buffer max size: %d bytes.\n", stat.buffer_max_size_bytes);
-        printf("Log buffer current size: %d bytes.\n", stat.buffer_size_bytes);
-        printf("Log buffer current size: %d entries.\n", stat.buffer_size_entries);
+        printf("Log buffer max size: %zu bytes.\n", stat.buffer_max_size_bytes);
+        printf("Log buffer current size: %zu bytes.\n", stat.buffer_size_bytes);
+        printf("Log buffer current size: %zu of %zu entries.\n", stat.buffer_size_entries, stat.buffer_max_entries);
+        printf("Log buffer evicted: %" PRIu32 " entries.\n", log_buffer_evictions());
+        return 0;
+    }
+
+    if (dmesg_args.grep->count > 0) {
+        static struct log_grep_s grep;
+        if (!log_grep_compile(&grep, dmesg_args.grep->sval[0], dmesg_args.icase->count > 0)) {
+            printf("Pattern must be 1 to %d characters\n", LOG_GREP_MAX_PATTERN);
+            return 1;
+        }
+        uint32_t index = start_index;
+        uint32_t matches = 0;
+        int64_t start = esp_timer_get_time();
+        while (log_grep_entry(entry, &index, &grep)) {
+            if (color)
+                print_log_entry_color(entry, stdout);
+            else
+                print_log_entry(entry, stdout);
+            matches++;
+        }
+        printf("%" PRIu32 " matching entries, in %" PRId64 " us\n", matches, esp_timer_get_time() - start);
         return 0;
     }
 
     if (clear) {
-        while (log_pull_entry(&entry)) {
+        while (log_pull_entry(entry)) {
+            if (entry->index <= start_index)
+                continue;
             if (color)
-                print_log_entry_color(&entry, stdout);
+                print_log_entry_color(entry, stdout);
             else
-                print_log_entry(&entry, stdout);
+                print_log_entry(entry, stdout);
         }
     } else {
-        uint32_t index = 0;
-        while (log_peek_entry(&entry, &index)) {
+        uint32_t index = start_index;
+        while (log_peek_entry(entry, &index)) {
             if (color)
-                print_log_entry_color(&entry, stdout);
+                print_log_entry_color(entry, stdout);
             else
-                print_log_entry(&entry, stdout);
+                print_log_entry(entry, stdout);
         }
     }
     return 0;
@@ -247,8 +746,15 @@ esp_err_t log_buffer_early_init()
 {
     xSemaphore = xSemaphoreCreateBinaryStatic(&xSemaphoreBuffer);
     circ_init(&log_buf, log_data, sizeof(log_data));
-    log_capture_register_handler(&log_buffer_push_entry);
+    log_capture_register_named_handler("buffer", &log_buffer_push_entry);
+#if CONFIG_LOGGER_PANIC_DUMP
+    size_t restored = log_buffer_panic_restore_locked();
+#endif
     xSemaphoreGive(xSemaphore);
+#if CONFIG_LOGGER_PANIC_DUMP
+    if (restored)
+        ESP_LOGW("log_buffer", "Restored %u log entries from before the panic", (unsigned)restored);
+#endif
 
     return ESP_OK;
 }
@@ -259,7 +765,11 @@ esp_err_t log_buffer_init(void)
     dmesg_args.color = arg_lit0("o", "color", "Color the output");
     dmesg_args.purge = arg_lit0("p", "purge", "Purge buffer without printing");
     dmesg_args.stats = arg_lit0("s", "stats", "Print log buffer stats");
-    dmesg_args.end = arg_end(2);
+    dmesg_args.grep = arg_str0("g", "grep", "<pattern>", "Only print entries containing the pattern, ^ and $ anchor it to the start and end of the line");
+    dmesg_args.icase = arg_lit0("i", "ignore-case", "Ignore case with --grep");
+    dmesg_args.since = arg_str0(NULL, "since", "<ms>", "Only print entries logged at or after this timestamp, in ms like the entries");
+    dmesg_args.last = arg_int0("l", "last", "<seconds>", "Only print entries logged in the last seconds");
+    dmesg_args.end = arg_end(4);
 
     const esp_console_cmd_t dmesg_cmd = {
         .command = "dmesg",
@@ -6,9 +6,36 @@
 #include "freertos/FreeRTOSConfig.h"
 
 #include "log_capture.h"
+#include "log_grep.h"
 
 esp_err_t log_buffer_init(void);
 esp_err_t log_buffer_early_init(void);
 
+// Entries are read into a struct log_entry_store_s.
 bool log_pull_entry(struct log_entry_s *entry);
+uint32_t log_buffer_last_index(void);
+// Entries dropped from the buffer to make room for new ones, since start.
+uint32_t log_buffer_evictions(void);
+// Get the oldest entry with an index greater than *index, and update *index to it.
 bool log_peek_entry(struct log_entry_s *entry, uint32_t *index);
+// The same, for the oldest entry after *index whose line matches.
+bool log_grep_entry(struct log_entry_s *entry, uint32_t *index, const struct log_grep_s *grep);
+// The index to peek from for entries logged at or after a timestamp in ms, found with a time index.
+uint32_t log_buffer_index_since(uint64_t timestamp);
+// Get the first entry logged at or after a timestamp, *index is updated to peek on from it.
+bool log_peek_since(uint64_t timestamp, struct log_entry_s *entry, uint32_t *index);
+
+/*
+ * For panic handlers, these read the buffer without taking its lock, use no heap and little
+ * stack. Called from the ESP-IDF panic handler with CONFIG_LOGGER_PANIC_DUMP.
+ */
+// Print the newest entries straight to the console, returns how many.
+size_t log_buffer_panic_dump(size_t max_entries);
+// Keep the newest entries over the reboot, they are put back in the buffer at start.
+size_t log_buffer_panic_save(void);
+// Put the kept entries back in the buffer once, returns how many. Done by log_buffer_early_init.
+size_t log_buffer_panic_restore(void);
+#if CONFIG_IDF_TARGET_LINUX
+// The host keeps no memory over a reboot, tests reach the saved entries through this to damage them.
+char *log_buffer_panic_save_data(size_t *len);
+#endif
@@ -7,6 +7,7 @@
 #include <sys/time.h>
 
 #include "esp_console.h"
+#include "esp_cpu.h"
 #include "esp_log.h"
 #include "esp_system.h"
 
@@ -16,6 +17,10 @@
 
 #include "log_capture.h"
 #include "log_common.h"
+#include "log_format.h"
+#include "log_level.h"
+#include "log_metrics.h"
+#include "log_sample.h"
 
 // Override original vprint handler, and prefix log line with thread name.
 static vprintf_like_t original_handler;
@@ -23,7 +28,30 @@ static vprintf_like_t original_handler;
 #define MAX_LOG_HANDLERS 10
 #define LOCAL_STORAGE_INDEX 1
 
-static void (*handlers[MAX_LOG_HANDLERS])(struct log_entry_s *e);
+struct log_handler_s {
+    log_entry_cb_t *cb;
+    const char *name; // NULL if it can not be turned off.
+    bool enabled;
+    uint32_t calls;
+    uint64_t cycles;
+};
+
+static struct log_handler_s handlers[MAX_LOG_HANDLERS];
+
+// Time spent in the handlers is only counted while benchmarking.
+static volatile bool timing;
+static portMUX_TYPE timing_lock = portMUX_INITIALIZER_UNLOCKED;
+
+/*
+ * Text representation of the entry being dispatched, owned by the dispatch and rendered on first
+ * request, so that every text sink shares the same formatting work. One line, in the style last
+ * asked for, the text sinks of a device tend to agree on it.
+ */
+struct log_text_s {
+    uint16_t len;
+    bool color;
+    char line[LOG_FORMAT_MAX_LINE_SIZE];
+};
 
 const char *log_level_names[6] = {"none", "error", "warn", "info", "debug", "verbose"};
 
@@ -47,7 +75,7 @@ static uint8_t log_level_from_char(char c)
     }
 }
 
-static uint64_t current_timestamp_ms()
+uint64_t log_capture_timestamp_ms(void)
 {
     struct timeval te;
     gettimeofday(&te, NULL);                                        // get current time
@@ -60,6 +88,47 @@ static int vprintf_handler(const char *fmt, va_list args)
 {
     int ret = 0;
     bool tls_entry = false;
+    bool header = true;
+    uint8_t level = ESP_LOG_VERBOSE;
+    uint16_t sampled = 0;
+    unsigned long uptime = 0;
+    const char *tag = NULL;
+
+    // This format, always have one log per printf call.
+    if (fmt[0] && strncmp(fmt + 1, " (%lu) %s: ", 11) == 0) {
+        level = log_level_from_char(fmt[0]);
+        uptime = va_arg(args, long unsigned);
+        tag = va_arg(args, char *);
+        fmt += 12;
+    }
+    // Look for the header in fmt, if found take that appart.
+    else if (strncmp(fmt, "%c (%lu) %s:", 12) == 0) {
+        level = log_level_from_char(va_arg(args, int));
+        uptime = va_arg(args, long unsigned);
+        tag = va_arg(args, char *);
+        fmt += 12;
+    } else if (strncmp(fmt, "%c (%d) %s:", 11) == 0) {
+        level = log_level_from_char(va_arg(args, int));
+        uptime = va_arg(args, uint32_t);
+        tag = va_arg(args, char *);
+        fmt += 11;
+    } else {
+        header = false;
+    }
+
+    /*
+     * Drop lines below the level of their tag, or sampled away, before doing any work on them.
+     * Only whole lines, a line logged in parts is kept together. Sampled lines are still counted.
+     */
+    if (header) {
+        size_t fmt_len = strlen(fmt);
+        bool whole = fmt_len > 0 && fmt[fmt_len - 1] == '\n';
+        if (whole && !log_level_enabled(tag, level))
+            return 0;
+        log_metrics_count(tag, level);
+        if (whole && !log_sample_keep(tag, &sampled))
+            return 0;
+    }
 
     /*
      *  99% of all logs, is one log line, with an ending newline for every call to this handler.
@@ -88,36 +157,39 @@ static int vprintf_handler(const char *fmt, va_list args)
         memset(e, 0, sizeof(struct log_entry_s));
     }
 
-    // This format, always have one log per printf call.
-    if (fmt[0] && strncmp(fmt + 1, " (%lu) %s: ", 11) == 0) {
-        e->level = log_level_from_char(fmt[0]);
-        e->uptime = va_arg(args, long unsigned);
-        strncpy(e->tag, va_arg(args, char *), sizeof(e->tag));
+#if CONFIG_LOGGER_SMALL_FOOTPRINT
+    // Unless continuing a line kept in TLS, the entry only points to the tag, the task name and the line formatted here.
+    char line[LOG_ENTRY_DATA_SIZE];
+    char *data = tls_entry ? log_entry_data_buf(e) : line;
+#else
+    char *data = e->data;
+#endif
+    const char *task = pcTaskGetName(NULL);
+    if (!task)
+        task = "";
+
+    if (header) {
+        e->level = level;
+        e->uptime = uptime;
+        e->sampled = sampled;
         e->data_len = 0;
-        fmt += 12;
     }
-    // Look for the header in fmt, if found take that appart.
-    else if (strncmp(fmt, "%c (%lu) %s:", 12) == 0) {
-        e->level = log_level_from_char(va_arg(args, int));
-        e->uptime = va_arg(args, long unsigned);
-        strncpy(e->tag, va_arg(args, char *), sizeof(e->tag));
-        e->data_len = 0;
-        fmt += 12;
-    } else if (strncmp(fmt, "%c (%d) %s:", 11) == 0) {
-        e->level = log_level_from_char(va_arg(args, int));
-        e->uptime = va_arg(args, uint32_t);
-        strncpy(e->tag, va_arg(args, char *), sizeof(e->tag));
-        e->data_len = 0;
-        fmt += 11;
-    }
-
-    // Add some extra stuff
-    memset(e->task, 0, sizeof(e->task));
-    if (pcTaskGetName(NULL)) {
-        strcpy(e->task, pcTaskGetName(NULL));
+#if CONFIG_LOGGER_SMALL_FOOTPRINT
+    if (!tls_entry) {
+        e->tag = header ? tag : "";
+        e->tag_len = strnlen(e->tag, LOG_ENTRY_TAG_SIZE - 1);
+        e->task = task;
+        e->task_len = strnlen(task, LOG_ENTRY_TASK_SIZE - 1);
+        e->data = line;
+    } else
+#endif
+    {
+        if (header)
+            log_entry_set_tag(e, tag, strlen(tag));
+        log_entry_set_task(e, task, strlen(task));
     }
     e->core = xPortGetCoreID();
-    e->timestamp = current_timestamp_ms();
+    e->timestamp = log_capture_timestamp_ms();
 
     /*
      *  int vsnprintf(char str[size], size_t size, const char *format, va_list ap);
@@ -133,35 +205,35 @@ static int vprintf_handler(const char *fmt, va_list args)
      */
 
     // Append the data to the log entry.
-    size_t free_bytes = sizeof(e->data) - e->data_len;
+    size_t free_bytes = LOG_ENTRY_DATA_SIZE - e->data_len;
     if (*fmt && free_bytes > 0) {
-        ret = vsnprintf(e->data + e->data_len, free_bytes, fmt, args); // Returns bytes excluding the newline
+        ret = vsnprintf(data + e->data_len, free_bytes, fmt, args); // Returns bytes excluding the newline
         if (ret > 0 && ret <= free_bytes) {
             e->data_len = e->data_len + ret;
         } else if (ret > 0) { // Concatinated
             e->data_len += free_bytes;
 
             // Add some marker showing that the log line was cut.
-            memcpy(e->data + sizeof(e->data) - 2, "||", 2);
+            memcpy(data + LOG_ENTRY_DATA_SIZE - 2, "||", 2);
         }
     }
-    if (e->data_len > sizeof(e->data))
+    if (e->data_len > LOG_ENTRY_DATA_SIZE)
         abort();
 
     // On newline, commit to log buffer
-    if (e->data_len > 0 && (e->data[e->data_len - 1] == '\n' || e->data_len >= sizeof(e->data) - 2)) {
+    if (e->data_len > 0 && (data[e->data_len - 1] == '\n' || e->data_len >= LOG_ENTRY_DATA_SIZE - 2)) {
         // Trim ending newlines.
-        while (e->data_len > 0 && e->data[e->data_len - 1] == '\n')
+        while (e->data_len > 0 && data[e->data_len - 1] == '\n')
             e->data_len--; // Skip ending newline
 
         if (e->data_len > 0) {
-            if (e->data_len > sizeof(e->data))
+            if (e->data_len > LOG_ENTRY_DATA_SIZE)
                 abort();
 
             // Replace unprintable characters with '.'
             for (size_t i = 0; i < e->data_len; i++) {
-                if (!isprint((unsigned char)e->data[i])) {
-                    e->data[i] = '.';
+                if (!isprint((unsigned char)data[i])) {
+                    data[i] = '.';
                 }
             }
 
@@ -175,42 +247,263 @@ static int vprintf_handler(const char *fmt, va_list args)
          * heap, and save it in TLS.
          */
         if (!tls_entry) {
-            // printf("Moving log struct to heap in task: '%s' fmt: '%s'\n", e->task, fmt);
-            // We need to copy the struct from stack to heap.
-            struct log_entry_s *heap_entry = pvPortMalloc(sizeof(struct log_entry_s));
+            // We need to copy the entry and its strings from stack to heap.
+            struct log_entry_store_s *heap_entry = pvPortMalloc(sizeof(struct log_entry_store_s));
             if (!heap_entry)
                 return 0;
-            memcpy(heap_entry, e, sizeof(struct log_entry_s));
-            vTaskSetThreadLocalStoragePointer(NULL, LOCAL_STORAGE_INDEX, (void *)heap_entry);
+            log_entry_copy(&heap_entry->entry, e);
+            vTaskSetThreadLocalStoragePointer(NULL, LOCAL_STORAGE_INDEX, (void *)&heap_entry->entry);
         }
     }
     return ret;
 }
 
+static void log_capture_dispatch(log_entry_t *log_entry)
+{
+    for (size_t i = 0; i < MAX_LOG_HANDLERS; i++) {
+        struct log_handler_s *handler = &handlers[i];
+        if (!handler->cb || !handler->enabled)
+            continue;
+        if (!timing) {
+            handler->cb(log_entry);
+            continue;
+        }
+
+        uint32_t start = esp_cpu_get_cycle_count();
+        handler->cb(log_entry);
+        uint32_t cycles = esp_cpu_get_cycle_count() - start;
+        portENTER_CRITICAL(&timing_lock);
+        handler->calls++;
+        handler->cycles += cycles;
+        portEXIT_CRITICAL(&timing_lock);
+    }
+}
+
 void log_capture_send_log(log_entry_t *log_entry)
 {
-    for (size_t i = 0; i < MAX_LOG_HANDLERS; i++)
-        if (handlers[i] != NULL)
-            handlers[i](log_entry);
+#if CONFIG_LOGGER_SMALL_FOOTPRINT
+    // No shared text on the stack of the logging task, text sinks format into their own static line.
+    log_capture_dispatch(log_entry);
+#else
+    struct log_text_s text;
+    struct log_text_s *prev_text = log_entry->text;
+    text.len = 0;
+    log_entry->text = &text;
+    log_capture_dispatch(log_entry);
+    log_entry->text = prev_text;
+#endif
+}
+
+void log_capture_send_data(esp_log_level_t level, const char *tag, const char *data, size_t data_len, uint8_t flags, uint16_t sampled)
+{
+    log_entry_t e = {};
+    const char *task = pcTaskGetName(NULL);
+    if (!task)
+        task = "";
+
+    log_entry_view(&e, task, strlen(task), tag, strlen(tag), data, data_len);
+    e.level = level;
+    e.core = xPortGetCoreID();
+    e.uptime = esp_log_timestamp();
+    e.timestamp = log_capture_timestamp_ms();
+    e.flags = flags;
+    e.sampled = sampled;
+    log_capture_send_log(&e);
+}
+
+/*
+ * Get the formatted line of an entry, with ending newline. Only valid to call from a log handler,
+ * the text is rendered once no matter how many handlers ask for it in the same style, and stays
+ * valid until the next call. Returns NULL for entries not being dispatched, and in small
+ * footprint mode where there is no text, the caller then formats into a line of its own.
+ */
+const char *log_capture_text(log_entry_t *log_entry, bool color, size_t *len)
+{
+#if CONFIG_LOGGER_SMALL_FOOTPRINT
+    return NULL;
+#else
+    struct log_text_s *text = log_entry->text;
+    if (!text)
+        return NULL;
+    if (text->len == 0 || text->color != color) {
+        text->len = log_format_entry(log_entry, color, text->line, sizeof(text->line));
+        text->color = color;
+    }
+    *len = text->len;
+    return text->line;
+#endif
+}
+
+/*
+ * The entry is the first member of its store, so in small footprint mode the strings it is
+ * filled with can be copied right after it.
+ */
+void log_entry_set_task(log_entry_t *e, const char *task, size_t len)
+{
+    len = MIN(len, LOG_ENTRY_TASK_SIZE - 1);
+#if CONFIG_LOGGER_SMALL_FOOTPRINT
+    struct log_entry_store_s *store = (struct log_entry_store_s *)e;
+    memcpy(store->task, task, len);
+    e->task = store->task;
+    e->task_len = len;
+#else
+    memcpy(e->task, task, len);
+    e->task[len] = '\0';
+#endif
+}
+
+void log_entry_set_tag(log_entry_t *e, const char *tag, size_t len)
+{
+    len = MIN(len, LOG_ENTRY_TAG_SIZE - 1);
+#if CONFIG_LOGGER_SMALL_FOOTPRINT
+    struct log_entry_store_s *store = (struct log_entry_store_s *)e;
+    memcpy(store->tag, tag, len);
+    e->tag = store->tag;
+    e->tag_len = len;
+#else
+    memcpy(e->tag, tag, len);
+    e->tag[len] = '\0';
+#endif
+}
+
+void log_entry_set_source(log_entry_t *e, const char *source, size_t len)
+{
+    len = MIN(len, LOG_ENTRY_SOURCE_SIZE - 1);
+#if CONFIG_LOGGER_SMALL_FOOTPRINT
+    struct log_entry_store_s *store = (struct log_entry_store_s *)e;
+    if (len)
+        memcpy(store->source, source, len);
+    e->source = store->source;
+    e->source_len = len;
+#else
+    if (len)
+        memcpy(e->source, source, len);
+    e->source[len] = '\0';
+#endif
+}
+
+void log_entry_view_source(log_entry_t *e, const char *source, size_t len)
+{
+#if CONFIG_LOGGER_SMALL_FOOTPRINT
+    e->source = source;
+    e->source_len = MIN(len, LOG_ENTRY_SOURCE_SIZE - 1);
+#else
+    log_entry_set_source(e, source, len);
+#endif
+}
+
+// Where the line of an entry in a store is written, LOG_ENTRY_DATA_SIZE bytes.
+char *log_entry_data_buf(log_entry_t *e)
+{
+#if CONFIG_LOGGER_SMALL_FOOTPRINT
+    struct log_entry_store_s *store = (struct log_entry_store_s *)e;
+    e->data = store->data;
+    return store->data;
+#else
+    return e->data;
+#endif
+}
+
+void log_entry_copy(log_entry_t *dst, const log_entry_t *src)
+{
+#if CONFIG_LOGGER_SMALL_FOOTPRINT
+    *dst = *src;
+    log_entry_set_task(dst, src->task, src->task_len);
+    log_entry_set_tag(dst, src->tag, src->tag_len);
+    log_entry_set_source(dst, src->source, src->source_len);
+    dst->data_len = MIN(src->data_len, LOG_ENTRY_DATA_SIZE);
+    memcpy(log_entry_data_buf(dst), src->data, dst->data_len);
+#else
+    memcpy(dst, src, sizeof(*dst));
+#endif
+    // The text belongs to the dispatch of the original.
+    dst->text = NULL;
+}
+
+void log_entry_view(log_entry_t *e, const char *task, size_t task_len, const char *tag, size_t tag_len, const char *data, size_t data_len)
+{
+    data_len = MIN(data_len, LOG_ENTRY_DATA_SIZE);
+#if CONFIG_LOGGER_SMALL_FOOTPRINT
+    e->task = task;
+    e->task_len = MIN(task_len, LOG_ENTRY_TASK_SIZE - 1);
+    e->tag = tag;
+    e->tag_len = MIN(tag_len, LOG_ENTRY_TAG_SIZE - 1);
+    e->data = data;
+#else
+    log_entry_set_task(e, task, task_len);
+    log_entry_set_tag(e, tag, tag_len);
+    memcpy(e->data, data, data_len);
+#endif
+    e->data_len = data_len;
 }
 
 esp_err_t log_capture_early_init()
 {
+    log_level_early_init();
     original_handler = esp_log_set_vprintf(vprintf_handler);
     return ESP_OK;
 }
 
-esp_err_t log_capture_register_handler(log_entry_cb_t cb)
+esp_err_t log_capture_register_named_handler(const char *name, log_entry_cb_t cb)
 {
     for (size_t i = 0; i < MAX_LOG_HANDLERS; i++) {
-        if (handlers[i] == NULL) {
-            handlers[i] = cb;
+        if (handlers[i].cb == NULL) {
+            handlers[i].name = name;
+            handlers[i].enabled = true;
+            handlers[i].cb = cb;
             return ESP_OK;
         }
     }
     return ESP_FAIL;
 }
 
+esp_err_t log_capture_register_handler(log_entry_cb_t cb)
+{
+    return log_capture_register_named_handler(NULL, cb);
+}
+
+esp_err_t log_capture_enable_handler(const char *name, bool enable)
+{
+    for (size_t i = 0; i < MAX_LOG_HANDLERS; i++) {
+        if (handlers[i].name && strcmp(handlers[i].name, name) == 0) {
+            handlers[i].enabled = enable;
+            return ESP_OK;
+        }
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+void log_capture_timing(bool enable)
+{
+    portENTER_CRITICAL(&timing_lock);
+    if (enable) {
+        for (size_t i = 0; i < MAX_LOG_HANDLERS; i++) {
+            handlers[i].calls = 0;
+            handlers[i].cycles = 0;
+        }
+    }
+    timing = enable;
+    portEXIT_CRITICAL(&timing_lock);
+}
+
+size_t log_capture_handler_stats(struct log_handler_stats_s *stats, size_t max)
+{
+    size_t n = 0;
+    portENTER_CRITICAL(&timing_lock);
+    for (size_t i = 0; i < MAX_LOG_HANDLERS && n < max; i++) {
+        if (!handlers[i].cb)
+            continue;
+        stats[n++] = (struct log_handler_stats_s){
+            .name = handlers[i].name,
+            .enabled = handlers[i].enabled,
+            .calls = handlers[i].calls,
+            .cycles = handlers[i].cycles,
+        };
+    }
+    portEXIT_CRITICAL(&timing_lock);
+    return n;
+}
+
 char *log_printable_char(char c)
 {
     static char buf[5];
@@ -234,10 +527,10 @@ char *log_printable_char(char c)
         sprintf(buf, "NUL");
         break;
     default:
-        if (isprint(c)) {
+        if (isprint((unsigned char)c)) {
             sprintf(buf, "'%c'", c);
         } else {
-            sprintf(buf, "%2X ", c);
+            sprintf(buf, "%2X ", (unsigned char)c);
         }
         break;
     }
@@ -277,10 +570,14 @@ char *log_printable_char2(char c)
     return buf;
 }
 
+// Offset, 8 bytes in hex and 8 printable chars of at most 3 characters, each with a space.
+#define LOG_ARRAY_LINE_SIZE (10 + 8 * 3 + 8 * 4 + 1)
+
 int log_array(esp_log_level_t log_level, const char *tag, const char *prefix, const uint8_t *data, size_t data_size)
 {
     for (uint32_t i = 0; i < data_size; i += 8) {
-        char buffer[CONFIG_LOGGER_LOG_MAX_LOG_LINE_SIZE];
+        // Sized for the line rather than the log line size, it is on the stack while the line is captured.
+        char buffer[LOG_ARRAY_LINE_SIZE];
         size_t buffer_pos = sprintf(buffer, "%04lx: ", (long unsigned int)i);
         for (uint32_t j = i; j < data_size && j < i + 8; j++)
             buffer_pos += sprintf(&buffer[buffer_pos], "%02x ", data[j]);
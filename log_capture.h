@@ -1,28 +1,137 @@
 #pragma once
 
+#include <stdbool.h>
+#include <string.h>
+
 #include "esp_log.h"
 #include "esp_system.h"
 
 #include "freertos/FreeRTOSConfig.h"
 
+struct log_text_s;
+
+#define LOG_ENTRY_TASK_SIZE configMAX_TASK_NAME_LEN
+#define LOG_ENTRY_TAG_SIZE CONFIG_LOGGER_LOG_MAX_TAG_SIZE
+#define LOG_ENTRY_DATA_SIZE CONFIG_LOGGER_LOG_MAX_LOG_LINE_SIZE
+#define LOG_ENTRY_SOURCE_SIZE 16 // An IPv4 address and its terminator.
+
+// The data is key-value fields from log_kv(), see log_kv_codec.h, rather than text.
+#define LOG_ENTRY_FLAG_KV 0x01
+// Counts from log_metrics_report(), for the logstream client and the log buffer only.
+#define LOG_ENTRY_FLAG_METRICS 0x02
+
 struct log_entry_s {
+    uint32_t index; // Log buffer index, set when the entry is pushed to the log buffer.
     uint8_t core;
     uint8_t level;
     uint16_t uptime;
+    uint8_t hops;    // Logstream servers a received entry has passed, 0 if it was logged here.
+    uint8_t flags;   // LOG_ENTRY_FLAG_*.
+    uint16_t sampled; // Lines of the tag dropped by sampling right before this one.
     uint64_t timestamp;
-    char task[configMAX_TASK_NAME_LEN];
-    char tag[CONFIG_LOGGER_LOG_MAX_TAG_SIZE];
+#if CONFIG_LOGGER_SMALL_FOOTPRINT
+    // A view of strings owned by whoever passes the entry on, they are not NUL terminated.
+    const char *task;
+    const char *tag;
+    const char *source; // Name of the device a received entry came from.
+    uint8_t task_len;
+    uint8_t tag_len;
+    uint8_t source_len;
     size_t data_len;
-    char data[CONFIG_LOGGER_LOG_MAX_LOG_LINE_SIZE];
+    const char *data;
+#else
+    char task[LOG_ENTRY_TASK_SIZE];
+    char tag[LOG_ENTRY_TAG_SIZE];
+    char source[LOG_ENTRY_SOURCE_SIZE]; // Name of the device a received entry came from.
+    size_t data_len;
+    char data[LOG_ENTRY_DATA_SIZE];
+#endif
+    struct log_text_s *text; // Shared rendered text, only valid inside log_capture_send_log.
 };
 
 typedef struct log_entry_s log_entry_t;
 
+/*
+ * An entry that owns its strings, to keep it past a handler call or read it back from the log
+ * buffer. Entries filled by log_entry_set_*, log_entry_copy, log_pull_entry and log_peek_entry
+ * must live in one of these.
+ */
+struct log_entry_store_s {
+    log_entry_t entry;
+#if CONFIG_LOGGER_SMALL_FOOTPRINT
+    char task[LOG_ENTRY_TASK_SIZE];
+    char tag[LOG_ENTRY_TAG_SIZE];
+    char source[LOG_ENTRY_SOURCE_SIZE];
+    char data[LOG_ENTRY_DATA_SIZE];
+#endif
+};
+
+#if CONFIG_LOGGER_SMALL_FOOTPRINT
+static inline size_t log_entry_task_len(const log_entry_t *e)
+{
+    return e->task_len;
+}
+
+static inline size_t log_entry_tag_len(const log_entry_t *e)
+{
+    return e->tag_len;
+}
+
+static inline size_t log_entry_source_len(const log_entry_t *e)
+{
+    return e->source_len;
+}
+#else
+static inline size_t log_entry_task_len(const log_entry_t *e)
+{
+    return strnlen(e->task, sizeof(e->task));
+}
+
+static inline size_t log_entry_tag_len(const log_entry_t *e)
+{
+    return strnlen(e->tag, sizeof(e->tag));
+}
+
+static inline size_t log_entry_source_len(const log_entry_t *e)
+{
+    return strnlen(e->source, sizeof(e->source));
+}
+#endif
+
+void log_entry_set_task(log_entry_t *e, const char *task, size_t len);
+void log_entry_set_tag(log_entry_t *e, const char *tag, size_t len);
+void log_entry_set_source(log_entry_t *e, const char *source, size_t len);
+// Point the entry at the source name in small footprint mode, otherwise copy it.
+void log_entry_view_source(log_entry_t *e, const char *source, size_t len);
+char *log_entry_data_buf(log_entry_t *e);
+void log_entry_copy(log_entry_t *dst, const log_entry_t *src);
+// Point the entry at the strings in small footprint mode, otherwise copy them.
+void log_entry_view(log_entry_t *e, const char *task, size_t task_len, const char *tag, size_t tag_len, const char *data, size_t data_len);
+
 extern const char *log_level_names[6];
 typedef void log_entry_cb_t(log_entry_t *e);
 esp_err_t log_capture_early_init(void);
 esp_err_t log_capture_register_handler(log_entry_cb_t cb);
+// Named handlers can be turned off and on again, like the sinks of this component: buffer, print, logstream and syslog.
+esp_err_t log_capture_register_named_handler(const char *name, log_entry_cb_t cb);
+esp_err_t log_capture_enable_handler(const char *name, bool enable);
+
+struct log_handler_stats_s {
+    const char *name;
+    bool enabled;
+    uint32_t calls;
+    uint64_t cycles; // CPU cycles spent in the handler while timing.
+};
+
+// Count the time spent in each handler, for benchmarks. Enabling starts the counts over.
+void log_capture_timing(bool enable);
+size_t log_capture_handler_stats(struct log_handler_stats_s *stats, size_t max);
 void log_capture_send_log(log_entry_t * log_entry);
+// Pass on an entry of data logged by this task, bypassing the vprintf hook.
+void log_capture_send_data(esp_log_level_t level, const char *tag, const char *data, size_t data_len, uint8_t flags, uint16_t sampled);
+// The clock entries are timestamped with, in ms.
+uint64_t log_capture_timestamp_ms(void);
+const char *log_capture_text(log_entry_t *log_entry, bool color, size_t *len);
 
 int log_array(esp_log_level_t log_level, const char *tag, const char *prefix, const uint8_t *data, size_t data_size);
 int log_string(esp_log_level_t log_level, const char *tag, const char *prefix, const char *data, size_t data_size);
@@ -0,0 +1,153 @@
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "log_capture.h"
+#include "log_common.h"
+#include "log_format.h"
+#include "log_intern.h"
+#include "log_kv_codec.h"
+
+/*
+ * A printf free formatter for the text sinks. Produces the same line as the old fprintf based printer,
+ * but with precomputed level prefixes and padded task/tag fragments from the intern table.
+ */
+
+struct level_prefix_s {
+    uint8_t len;
+    char text[12];
+};
+
+#define LEVEL_PREFIX(str) {STRLEN(str), str}
+
+static const struct level_prefix_s level_prefix[] = {
+    LEVEL_PREFIX("N "),
+    LEVEL_PREFIX("E "),
+    LEVEL_PREFIX("W "),
+    LEVEL_PREFIX("I "),
+    LEVEL_PREFIX("D "),
+    LEVEL_PREFIX("V "),
+};
+
+static const struct level_prefix_s level_prefix_color[] = {
+    LEVEL_PREFIX(ANSI_COLOR(ANSI_COLOR_GREEN) "I "),
+    LEVEL_PREFIX(ANSI_COLOR(ANSI_COLOR_RED) "E "),
+    LEVEL_PREFIX(ANSI_COLOR(ANSI_COLOR_BROWN) "W "),
+    LEVEL_PREFIX(ANSI_COLOR(ANSI_COLOR_GREEN) "I "),
+    LEVEL_PREFIX("D "),
+    LEVEL_PREFIX("V "),
+};
+
+static const struct level_prefix_s level_prefix_unknown = LEVEL_PREFIX("X ");
+
+#define FORMAT_END_COLOR " " ANSI_RESET_COLOR "\n"
+
+/*
+ * Write value as decimal, returns number of digits written. Buffer needs room for 20 digits.
+ */
+size_t log_format_u64(char *buf, uint64_t value)
+{
+    char tmp[20];
+    size_t len = 0;
+
+    // Keep the 64 bit divisions out of the common case, uptime in ms fits in 32 bits for 49 days.
+    if (value <= UINT32_MAX) {
+        uint32_t v = value;
+        do {
+            tmp[len++] = '0' + v % 10;
+            v /= 10;
+        } while (v);
+    } else {
+        do {
+            tmp[len++] = '0' + value % 10;
+            value /= 10;
+        } while (value);
+    }
+
+    for (size_t i = 0; i < len; i++)
+        buf[i] = tmp[len - 1 - i];
+    return len;
+}
+
+static inline char *format_append(char *pos, const char *str, size_t len)
+{
+    memcpy(pos, str, len);
+    return pos + len;
+}
+
+// Append str right aligned in width, padding by hand.
+static char *format_pad(char *pos, const char *str, size_t len, size_t width)
+{
+    if (len < width) {
+        memset(pos, ' ', width - len);
+        pos += width - len;
+    }
+    return format_append(pos, str, len);
+}
+
+/*
+ * Append str right aligned in width, uses the interned padded copy when there is one.
+ */
+static char *format_padded(char *pos, const char *str, size_t max_len, size_t width)
+{
+    uint16_t id = log_intern(str, max_len);
+    if (id != LOG_INTERN_NONE) {
+        // The interned copy is padded to at most LOG_INTERN_WIDTH, small tag sizes need more in front.
+        size_t extra = width - MIN(width, (size_t)LOG_INTERN_WIDTH);
+        memset(pos, ' ', extra);
+        const char *padded = log_intern_padded(id, width);
+        return format_append(pos + extra, padded, strlen(padded));
+    }
+
+    // Intern table is full.
+    return format_pad(pos, str, strnlen(str, max_len), width);
+}
+
+/*
+ * Format a complete log line, including the ending newline, into buf.
+ * Returns the number of bytes written, or 0 if buf is smaller than LOG_FORMAT_MAX_LINE_SIZE.
+ */
+size_t log_format_entry(const struct log_entry_s *entry, bool color, char *buf, size_t buf_size)
+{
+    if (buf_size < LOG_FORMAT_MAX_LINE_SIZE)
+        return 0;
+
+    const struct level_prefix_s *prefix = &level_prefix_unknown;
+    if (entry->level < ARRAY_SIZE(level_prefix))
+        prefix = color ? &level_prefix_color[entry->level] : &level_prefix[entry->level];
+    else if (color)
+        prefix = &level_prefix_color[ESP_LOG_INFO];
+
+    // Timestamps are either uptime in ms, or wall clock time that is printed in seconds.
+    uint64_t timestamp = entry->timestamp;
+    if (timestamp > (color ? 100000000 : 10000000))
+        timestamp /= 1000;
+
+    char *pos = buf;
+    // Entries received from other devices start with where they came from. There can be many
+    // more sources than tags, so they are not interned.
+    if (entry->hops) {
+        pos = format_pad(pos, entry->source, log_entry_source_len(entry), LOG_FORMAT_SOURCE_WIDTH);
+        *pos++ = ' ';
+    }
+    pos = format_append(pos, prefix->text, prefix->len);
+    pos += log_format_u64(pos, entry->core);
+    pos = format_append(pos, " (", 2);
+    size_t digits = log_format_u64(pos, timestamp);
+    pos += digits;
+    while (digits++ < 6)
+        *pos++ = ' ';
+    pos = format_append(pos, ") ", 2);
+    pos = format_padded(pos, entry->task, log_entry_task_len(entry), LOG_FORMAT_TASK_WIDTH);
+    pos = format_padded(pos, entry->tag, log_entry_tag_len(entry), color ? LOG_FORMAT_TAG_WIDTH_COLOR : LOG_FORMAT_TAG_WIDTH);
+    pos = format_append(pos, ": ", 2);
+    if (entry->flags & LOG_ENTRY_FLAG_KV)
+        pos += log_kv_format(entry->data, MIN(entry->data_len, LOG_ENTRY_DATA_SIZE), pos, LOG_ENTRY_DATA_SIZE);
+    else
+        pos = format_append(pos, entry->data, MIN(entry->data_len, LOG_ENTRY_DATA_SIZE));
+    if (color)
+        pos = format_append(pos, FORMAT_END_COLOR, STRLEN(FORMAT_END_COLOR));
+    else
+        *pos++ = '\n';
+    return pos - buf;
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "log_capture.h"
+#include "log_intern.h"
+
+#define LOG_FORMAT_TASK_WIDTH 15
+#define LOG_FORMAT_TAG_WIDTH 20
+#define LOG_FORMAT_TAG_WIDTH_COLOR 24
+#define LOG_FORMAT_SOURCE_WIDTH 15
+
+// The padded source, task and tag, columns are wider than the names unless the tag size is large.
+#define LOG_FORMAT_PADDED_SIZE \
+    (MAX(LOG_FORMAT_SOURCE_WIDTH, LOG_ENTRY_SOURCE_SIZE) + MAX(LOG_FORMAT_TASK_WIDTH, LOG_INTERN_WIDTH) + MAX(LOG_FORMAT_TAG_WIDTH_COLOR, LOG_INTERN_WIDTH))
+// Color prefix, level, core, timestamp, separators and color reset, the padded names and the data.
+#define LOG_FORMAT_MAX_LINE_SIZE (49 + LOG_FORMAT_PADDED_SIZE + CONFIG_LOGGER_LOG_MAX_LOG_LINE_SIZE)
+
+size_t log_format_u64(char *buf, uint64_t value);
+size_t log_format_entry(const struct log_entry_s *entry, bool color, char *buf, size_t buf_size);
@@ -0,0 +1,83 @@
+#include <ctype.h>
+#include <string.h>
+
+#include "log_grep.h"
+
+static inline uint8_t grep_fold(const struct log_grep_s *grep, char c)
+{
+    return grep->icase ? tolower((unsigned char)c) : (uint8_t)c;
+}
+
+bool log_grep_compile(struct log_grep_s *grep, const char *pattern, bool icase)
+{
+    memset(grep, 0, sizeof(*grep));
+    grep->icase = icase;
+    if (*pattern == '^') {
+        grep->anchor_start = true;
+        pattern++;
+    }
+    size_t len = strlen(pattern);
+    if (len > 0 && pattern[len - 1] == '$') {
+        grep->anchor_end = true;
+        len--;
+    }
+    if (len == 0 || len > sizeof(grep->pattern))
+        return false;
+
+    grep->len = len;
+    for (size_t i = 0; i < len; i++)
+        grep->pattern[i] = grep_fold(grep, pattern[i]);
+
+    // How far the window can move when its last byte is c.
+    memset(grep->skip, len, sizeof(grep->skip));
+    for (size_t i = 0; i + 1 < len; i++) {
+        grep->skip[(uint8_t)grep->pattern[i]] = len - 1 - i;
+        if (icase)
+            grep->skip[toupper((unsigned char)grep->pattern[i])] = len - 1 - i;
+    }
+    return true;
+}
+
+// Compare the pattern at pos of the split line.
+static bool grep_match_at(const struct log_grep_s *grep, const char *data1, size_t len1, const char *data2, size_t pos)
+{
+    for (size_t i = 0; i < grep->len; i++, pos++) {
+        char c = pos < len1 ? data1[pos] : data2[pos - len1];
+        if (grep_fold(grep, c) != (uint8_t)grep->pattern[i])
+            return false;
+    }
+    return true;
+}
+
+static bool grep_search(const struct log_grep_s *grep, const char *data, size_t len)
+{
+    size_t m = grep->len;
+    for (size_t pos = 0; pos + m <= len;) {
+        uint8_t last = data[pos + m - 1];
+        if (grep_fold(grep, last) == (uint8_t)grep->pattern[m - 1] && grep_match_at(grep, data + pos, m, NULL, 0))
+            return true;
+        pos += grep->skip[last];
+    }
+    return false;
+}
+
+bool log_grep_match(const struct log_grep_s *grep, const char *data1, size_t len1, const char *data2, size_t len2)
+{
+    size_t len = len1 + len2;
+    size_t m = grep->len;
+    if (m > len)
+        return false;
+    if (grep->anchor_start)
+        return (!grep->anchor_end || m == len) && grep_match_at(grep, data1, len1, data2, 0);
+    if (grep->anchor_end)
+        return grep_match_at(grep, data1, len1, data2, len - m);
+
+    if (grep_search(grep, data1, len1))
+        return true;
+    // Matches across the split.
+    for (size_t pos = len1 > m - 1 ? len1 - (m - 1) : 0; pos < len1 && pos + m <= len; pos++) {
+        if (grep_match_at(grep, data1, len1, data2, pos))
+            return true;
+    }
+    return len2 && grep_search(grep, data2, len2);
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Substring search over log lines that may be split in two, like a record that wraps around the
+ * end of the log buffer, without copying them. Boyer-Moore-Horspool, optionally ignoring case.
+ * A pattern starting with ^ only matches at the start of a line, one ending with $ at the end.
+ */
+
+#define LOG_GREP_MAX_PATTERN 64
+
+struct log_grep_s {
+    char pattern[LOG_GREP_MAX_PATTERN];
+    uint8_t len;
+    bool icase;
+    bool anchor_start;
+    bool anchor_end;
+    uint8_t skip[256];
+};
+
+// False if the pattern is empty or longer than LOG_GREP_MAX_PATTERN.
+bool log_grep_compile(struct log_grep_s *grep, const char *pattern, bool icase);
+// Whether the line made of the len1 bytes at data1 followed by the len2 bytes at data2 matches.
+bool log_grep_match(const struct log_grep_s *grep, const char *data1, size_t len1, const char *data2, size_t len2);
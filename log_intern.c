@@ -0,0 +1,96 @@
+
+#include <stddef.h>
+#include <stdio.h>
+
+#include "freertos/FreeRTOS.h"
+
+#include "log_common.h"
+#include "log_intern.h"
+
+#define INTERN_TABLE_SIZE CONFIG_LOGGER_INTERN_TABLE_SIZE
+
+struct intern_slot_s {
+    uint32_t hash; // Zero marks a free slot, written last when a slot is published.
+    uint8_t len;
+    char text[LOG_INTERN_WIDTH + 1];
+};
+
+static struct intern_slot_s intern_table[INTERN_TABLE_SIZE];
+static portMUX_TYPE intern_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t intern_hash(const char *str, size_t len)
+{
+    // FNV-1a, never returns zero as that marks an empty slot.
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)str[i];
+        hash *= 16777619u;
+    }
+    return hash ? hash : 1;
+}
+
+static inline bool intern_match(const struct intern_slot_s *slot, uint32_t hash, const char *str, size_t len)
+{
+    return slot->hash == hash && slot->len == len && memcmp(slot->text + LOG_INTERN_WIDTH - len, str, len) == 0;
+}
+
+/*
+ * Look up or insert a string, returns an id that is stable for the lifetime of the program.
+ * Lookups are lock free, only inserts of new strings take the spinlock.
+ */
+uint16_t log_intern(const char *str, size_t max_len)
+{
+    if (!str)
+        return LOG_INTERN_NONE;
+
+    size_t len = strnlen(str, MIN(max_len, (size_t)LOG_INTERN_WIDTH));
+    uint32_t hash = intern_hash(str, len);
+    size_t pos = hash % INTERN_TABLE_SIZE;
+
+    for (size_t i = 0; i < INTERN_TABLE_SIZE; i++) {
+        struct intern_slot_s *slot = &intern_table[(pos + i) % INTERN_TABLE_SIZE];
+        uint32_t slot_hash = __atomic_load_n(&slot->hash, __ATOMIC_ACQUIRE);
+        if (slot_hash == 0) {
+            portENTER_CRITICAL(&intern_lock);
+            // Someone else might have taken the slot while we were not looking.
+            if (slot->hash == 0) {
+                slot->len = len;
+                memset(slot->text, ' ', LOG_INTERN_WIDTH - len);
+                memcpy(slot->text + LOG_INTERN_WIDTH - len, str, len);
+                slot->text[LOG_INTERN_WIDTH] = '\0';
+                __atomic_store_n(&slot->hash, hash, __ATOMIC_RELEASE);
+                portEXIT_CRITICAL(&intern_lock);
+                return (pos + i) % INTERN_TABLE_SIZE + 1;
+            }
+            portEXIT_CRITICAL(&intern_lock);
+        }
+        if (intern_match(slot, hash, str, len))
+            return (pos + i) % INTERN_TABLE_SIZE + 1;
+    }
+
+    // Table is full.
+    return LOG_INTERN_NONE;
+}
+
+const char *log_intern_str(uint16_t id)
+{
+    return log_intern_padded(id, 0);
+}
+
+size_t log_intern_len(uint16_t id)
+{
+    if (id == LOG_INTERN_NONE || id > INTERN_TABLE_SIZE)
+        return 0;
+    return intern_table[id - 1].len;
+}
+
+/*
+ * Return the string right aligned to at least width characters, the same as printf("%*s").
+ */
+const char *log_intern_padded(uint16_t id, size_t width)
+{
+    if (id == LOG_INTERN_NONE || id > INTERN_TABLE_SIZE)
+        return "";
+    const struct intern_slot_s *slot = &intern_table[id - 1];
+    return slot->text + LOG_INTERN_WIDTH - MAX(MIN(width, (size_t)LOG_INTERN_WIDTH), (size_t)slot->len);
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "freertos/FreeRTOSConfig.h"
+
+#include "log_common.h"
+
+/*
+ * Interned strings are stored right aligned in a fixed width field, padded with spaces in front.
+ * This makes the string table double as a cache of pre padded fragments for the formatters.
+ */
+#define LOG_INTERN_WIDTH MAX(CONFIG_LOGGER_LOG_MAX_TAG_SIZE, configMAX_TASK_NAME_LEN)
+#define LOG_INTERN_NONE 0
+
+uint16_t log_intern(const char *str, size_t max_len);
+const char *log_intern_str(uint16_t id);
+size_t log_intern_len(uint16_t id);
+const char *log_intern_padded(uint16_t id, size_t width);
@@ -0,0 +1,220 @@
+#include <stdio.h>
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "log_capture.h"
+#include "log_common.h"
+#include "log_isr.h"
+#include "log_level.h"
+#include "log_metrics.h"
+#include "log_sample.h"
+
+#define LOG_ISR_RING_SIZE CONFIG_LOGGER_ISR_RING_SIZE
+
+// Head and tail run freely and wrap, which only works out with a power of two.
+_Static_assert((LOG_ISR_RING_SIZE & (LOG_ISR_RING_SIZE - 1)) == 0, "CONFIG_LOGGER_ISR_RING_SIZE must be a power of two");
+
+static const char *TAG = "log_isr";
+
+struct log_isr_slot_s {
+    int64_t time_us;
+    const char *tag;
+    const char *fmt; // NULL for text.
+    union {
+        uint32_t args[LOG_ISR_MAX_ARGS];
+        char text[LOG_ISR_TEXT_SIZE];
+    };
+    uint8_t level;
+    uint8_t text_len;
+};
+
+/*
+ * Written by the interrupts of one core with them masked, so they do not need a lock against
+ * each other, and read by the task. The head is published after the slot is written, and the
+ * tail after the slot is copied out.
+ */
+struct log_isr_ring_s {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t dropped;
+    uint32_t dropped_reported; // Only used by the task.
+    struct log_isr_slot_s slots[LOG_ISR_RING_SIZE];
+};
+
+static DRAM_ATTR struct log_isr_ring_s rings[portNUM_PROCESSORS];
+static TaskHandle_t flush_task;
+
+// Take the next slot of the ring of this core, with interrupts masked. NULL when it is full.
+static IRAM_ATTR struct log_isr_slot_s *log_isr_slot(struct log_isr_ring_s *ring)
+{
+    if (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) >= LOG_ISR_RING_SIZE) {
+        ring->dropped++;
+        return NULL;
+    }
+    return &ring->slots[ring->head % LOG_ISR_RING_SIZE];
+}
+
+// Publish the slot, and wake the task when the ring is half full.
+static IRAM_ATTR bool log_isr_publish(struct log_isr_ring_s *ring)
+{
+    uint32_t head = ring->head + 1;
+    __atomic_store_n(&ring->head, head, __ATOMIC_RELEASE);
+    return head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == LOG_ISR_RING_SIZE / 2;
+}
+
+static IRAM_ATTR void log_isr_wake(void)
+{
+    if (!flush_task)
+        return;
+    if (xPortInIsrContext()) {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(flush_task, &woken);
+        portYIELD_FROM_ISR(woken);
+    } else {
+        xTaskNotifyGive(flush_task);
+    }
+}
+
+IRAM_ATTR void log_isr_write(esp_log_level_t level, const char *tag, const char *fmt, const uint32_t *args)
+{
+    int64_t now = esp_timer_get_time();
+    bool wake = false;
+    UBaseType_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+    struct log_isr_ring_s *ring = &rings[xPortGetCoreID()];
+    struct log_isr_slot_s *slot = log_isr_slot(ring);
+    if (slot) {
+        slot->time_us = now;
+        slot->tag = tag;
+        slot->fmt = fmt;
+        slot->level = level;
+        for (size_t i = 0; i < LOG_ISR_MAX_ARGS; i++)
+            slot->args[i] = args[i];
+        wake = log_isr_publish(ring);
+    }
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+    if (wake)
+        log_isr_wake();
+}
+
+IRAM_ATTR void log_isr_text(esp_log_level_t level, const char *tag, const char *text, size_t len)
+{
+    int64_t now = esp_timer_get_time();
+    bool wake = false;
+    UBaseType_t state = portSET_INTERRUPT_MASK_FROM_ISR();
+    struct log_isr_ring_s *ring = &rings[xPortGetCoreID()];
+    struct log_isr_slot_s *slot = log_isr_slot(ring);
+    if (slot) {
+        slot->time_us = now;
+        slot->tag = tag;
+        slot->fmt = NULL;
+        slot->level = level;
+        slot->text_len = MIN(len, sizeof(slot->text));
+        // Not memcpy, it may not be in IRAM.
+        for (size_t i = 0; i < slot->text_len; i++)
+            slot->text[i] = text[i];
+        wake = log_isr_publish(ring);
+    }
+    portCLEAR_INTERRUPT_MASK_FROM_ISR(state);
+    if (wake)
+        log_isr_wake();
+}
+
+uint32_t log_isr_dropped(void)
+{
+    uint32_t dropped = 0;
+    for (size_t i = 0; i < portNUM_PROCESSORS; i++)
+        dropped += __atomic_load_n(&rings[i].dropped, __ATOMIC_RELAXED);
+    return dropped;
+}
+
+static void log_isr_send(const struct log_isr_slot_s *slot, int core, int64_t now_us, uint64_t now_ms)
+{
+    // The same checks as esp_log_write and the capture do for other lines.
+    uint16_t sampled;
+    if (slot->level > esp_log_level_get(slot->tag) || !log_level_enabled(slot->tag, slot->level))
+        return;
+    log_metrics_count(slot->tag, slot->level);
+    if (!log_sample_keep(slot->tag, &sampled))
+        return;
+
+    char data[LOG_ENTRY_DATA_SIZE];
+    size_t len = slot->text_len;
+    if (slot->fmt) {
+        int ret = snprintf(data, sizeof(data), slot->fmt, slot->args[0], slot->args[1], slot->args[2], slot->args[3]);
+        len = ret < 0 ? 0 : MIN((size_t)ret, sizeof(data) - 1);
+    } else {
+        memcpy(data, slot->text, len);
+    }
+
+    log_entry_t e = {};
+    log_entry_view(&e, "isr", 3, slot->tag, strlen(slot->tag), data, len);
+    e.level = slot->level;
+    e.core = core;
+    e.uptime = slot->time_us / 1000;
+    // The capture clock may be set to wall time, it is stepped back by how long ago the entry was logged.
+    e.timestamp = now_ms - (uint64_t)(now_us - slot->time_us) / 1000;
+    e.sampled = sampled;
+    log_capture_send_log(&e);
+}
+
+size_t log_isr_flush(void)
+{
+    struct log_isr_slot_s slot;
+    uint32_t head[portNUM_PROCESSORS];
+    size_t n = 0;
+
+    int64_t now_us = esp_timer_get_time();
+    uint64_t now_ms = log_capture_timestamp_ms();
+    for (size_t i = 0; i < portNUM_PROCESSORS; i++)
+        head[i] = __atomic_load_n(&rings[i].head, __ATOMIC_ACQUIRE);
+
+    // Merge the rings, the oldest entry first.
+    while (1) {
+        struct log_isr_ring_s *oldest = NULL;
+        int core = 0;
+        for (size_t i = 0; i < portNUM_PROCESSORS; i++) {
+            struct log_isr_ring_s *ring = &rings[i];
+            if (ring->tail != head[i] && (!oldest || ring->slots[ring->tail % LOG_ISR_RING_SIZE].time_us < oldest->slots[oldest->tail % LOG_ISR_RING_SIZE].time_us)) {
+                oldest = ring;
+                core = i;
+            }
+        }
+        if (!oldest)
+            break;
+        slot = oldest->slots[oldest->tail % LOG_ISR_RING_SIZE];
+        __atomic_store_n(&oldest->tail, oldest->tail + 1, __ATOMIC_RELEASE);
+        log_isr_send(&slot, core, now_us, now_ms);
+        n++;
+    }
+
+    for (size_t i = 0; i < portNUM_PROCESSORS; i++) {
+        uint32_t dropped = __atomic_load_n(&rings[i].dropped, __ATOMIC_RELAXED);
+        if (dropped != rings[i].dropped_reported) {
+            ESP_LOGW(TAG, "%" PRIu32 " entries from interrupts on core %u dropped", dropped - rings[i].dropped_reported, (unsigned)i);
+            rings[i].dropped_reported = dropped;
+        }
+    }
+    return n;
+}
+
+static void log_isr_task(void *arg)
+{
+    while (1) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(CONFIG_LOGGER_ISR_FLUSH_MS));
+        log_isr_flush();
+    }
+}
+
+esp_err_t log_isr_init(void)
+{
+    if (flush_task)
+        return ESP_ERR_INVALID_STATE;
+    if (xTaskCreate(log_isr_task, "log_isr", 3072, NULL, 5, &flush_task) != pdPASS)
+        return ESP_ERR_NO_MEM;
+    return ESP_OK;
+}
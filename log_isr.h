@@ -0,0 +1,43 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+/*
+ * Logging from interrupt handlers. Entries are put in a lock free ring of the core, without
+ * formatting or taking locks, and the log_isr task passes them on to the capture later, timestamped
+ * when they were logged:
+ *
+ *   LOG_ISR(ESP_LOG_INFO, TAG, "rx %u bytes, status %x", len, status);
+ *
+ * Only the pointer to the format is kept, so it must be a string literal, and it is formatted in the
+ * task with up to LOG_ISR_MAX_ARGS integer arguments of at most 32 bits, like %d, %u and %x.
+ * log_isr_text() copies up to LOG_ISR_TEXT_SIZE bytes of text instead. Both can be called from
+ * tasks too. Entries are dropped when the ring is full, and the drops logged by the task.
+ */
+
+#define LOG_ISR_MAX_ARGS 4
+#define LOG_ISR_TEXT_SIZE 32
+
+#define LOG_ISR(level, tag, fmt, ...)                                                                                                                    \
+    do {                                                                                                                                                 \
+        if (LOG_LOCAL_LEVEL >= (level))                                                                                                                  \
+            log_isr_write(level, tag, fmt, (const uint32_t[LOG_ISR_MAX_ARGS]){__VA_ARGS__});                                                             \
+    } while (0)
+
+void log_isr_write(esp_log_level_t level, const char *tag, const char *fmt, const uint32_t *args);
+void log_isr_text(esp_log_level_t level, const char *tag, const char *text, size_t len);
+// Entries dropped since start, as the ring of their core was full.
+uint32_t log_isr_dropped(void);
+
+/*
+ * Pass the entries logged so far on to the capture, the oldest first, returns how many. Called by
+ * the log_isr task every CONFIG_LOGGER_ISR_FLUSH_MS, or when a ring is half full. Only one task
+ * may call it, without log_isr_init() an application can call it itself.
+ */
+size_t log_isr_flush(void);
+// Starts the log_isr task.
+esp_err_t log_isr_init(void);
@@ -0,0 +1,33 @@
+#include <stdarg.h>
+
+#include "log_capture.h"
+#include "log_kv.h"
+#include "log_level.h"
+#include "log_metrics.h"
+#include "log_sample.h"
+
+void log_kv_write(esp_log_level_t level, const char *tag, ...)
+{
+    // The same checks as esp_log_write and the capture do for text lines.
+    uint16_t sampled;
+    if (level > esp_log_level_get(tag) || !log_level_enabled(tag, level))
+        return;
+    log_metrics_count(tag, level);
+    if (!log_sample_keep(tag, &sampled))
+        return;
+
+    char data[LOG_ENTRY_DATA_SIZE];
+    size_t len = 0;
+    va_list args;
+    va_start(args, tag);
+    for (const char *key = va_arg(args, const char *); key; key = va_arg(args, const char *)) {
+        struct log_kv_value_s value = va_arg(args, struct log_kv_value_s);
+        size_t next = log_kv_encode(data, len, sizeof(data), key, &value);
+        if (next)
+            len = next;
+    }
+    va_end(args);
+
+    if (len)
+        log_capture_send_data(level, tag, data, len, LOG_ENTRY_FLAG_KV, sampled);
+}
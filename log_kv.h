@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_log.h"
+
+#include "log_kv_codec.h"
+
+/*
+ * Structured logging, without printf. Fields are stored in binary in the log buffer and sent as they
+ * are by the logstream client, the text sinks render them as key=value:
+ *
+ *   log_kv(ESP_LOG_INFO, TAG, "rssi", LOG_I32(rssi), "temp", LOG_F32(temp), "ssid", LOG_STR(ssid));
+ *
+ * Keys are cut at LOG_KV_MAX_KEY_LEN bytes, and fields that do not fit in a log line are left out.
+ */
+
+#define LOG_KV_VALUE(t, field, v) ((struct log_kv_value_s){.type = (t), .field = (v)})
+
+#define LOG_I32(v) LOG_KV_VALUE(LOG_KV_INT, i, (int32_t)(v))
+#define LOG_I64(v) LOG_KV_VALUE(LOG_KV_INT, i, (int64_t)(v))
+#define LOG_U32(v) LOG_KV_VALUE(LOG_KV_UINT, u, (uint32_t)(v))
+#define LOG_U64(v) LOG_KV_VALUE(LOG_KV_UINT, u, (uint64_t)(v))
+#define LOG_F32(v) LOG_KV_VALUE(LOG_KV_FLOAT, f, (float)(v))
+#define LOG_F64(v) LOG_KV_VALUE(LOG_KV_DOUBLE, f, (double)(v))
+#define LOG_BOOL(v) LOG_KV_VALUE(LOG_KV_BOOL, b, (bool)(v))
+#define LOG_STR(v) LOG_KV_VALUE(LOG_KV_STR, s, (v))
+
+#define log_kv(level, tag, ...)                                                                                                                          \
+    do {                                                                                                                                                 \
+        if (LOG_LOCAL_LEVEL >= (level))                                                                                                                  \
+            log_kv_write(level, tag, __VA_ARGS__, NULL);                                                                                                 \
+    } while (0)
+
+// Pairs of key and value made with the LOG_* macros, ending with NULL.
+void log_kv_write(esp_log_level_t level, const char *tag, ...) __attribute__((sentinel));
@@ -0,0 +1,240 @@
+#include <float.h>
+#include <string.h>
+
+#include "log_kv_codec.h"
+#include "log_stream_codec.h"
+
+// Longest text of a number, like -1.797693e+308.
+#define KV_NUMBER_SIZE 32
+
+static uint64_t kv_zigzag_encode(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static int64_t kv_zigzag_decode(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+size_t log_kv_encode(char *buf, size_t len, size_t size, const char *key, const struct log_kv_value_s *value)
+{
+    size_t key_len = strnlen(key, LOG_KV_MAX_KEY_LEN);
+    size_t str_len = value->type == LOG_KV_STR && value->s ? strlen(value->s) : 0;
+
+    // Key, and the largest value of its type.
+    if (len + 1 + key_len + 10 + str_len > size)
+        return 0;
+
+    buf[len++] = key_len << LOG_KV_KEY_SHIFT | (value->type & LOG_KV_TYPE_MASK);
+    memcpy(buf + len, key, key_len);
+    len += key_len;
+
+    switch (value->type) {
+    case LOG_KV_INT:
+        len += logstream_put_varint(buf + len, kv_zigzag_encode(value->i));
+        break;
+    case LOG_KV_UINT:
+        len += logstream_put_varint(buf + len, value->u);
+        break;
+    case LOG_KV_FLOAT: {
+        float f = value->f;
+        memcpy(buf + len, &f, sizeof(f));
+        len += sizeof(f);
+        break;
+    }
+    case LOG_KV_DOUBLE:
+        memcpy(buf + len, &value->f, sizeof(value->f));
+        len += sizeof(value->f);
+        break;
+    case LOG_KV_BOOL:
+        buf[len++] = value->b;
+        break;
+    case LOG_KV_STR:
+        len += logstream_put_varint(buf + len, str_len);
+        memcpy(buf + len, value->s, str_len);
+        len += str_len;
+        break;
+    }
+    return len;
+}
+
+static size_t kv_format_u64(char *buf, uint64_t value)
+{
+    char tmp[20];
+    size_t len = 0;
+    do {
+        tmp[len++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    for (size_t i = 0; i < len; i++)
+        buf[i] = tmp[len - 1 - i];
+    return len;
+}
+
+static size_t kv_format_i64(char *buf, int64_t value)
+{
+    if (value >= 0)
+        return kv_format_u64(buf, value);
+    buf[0] = '-';
+    return 1 + kv_format_u64(buf + 1, -(uint64_t)value);
+}
+
+/*
+ * Up to six decimals, or one digit and an exponent for the very large.
+ */
+static size_t kv_format_double(char *buf, double value)
+{
+    char *pos = buf;
+    if (value != value) {
+        memcpy(pos, "nan", 3);
+        return 3;
+    }
+    if (value < 0) {
+        *pos++ = '-';
+        value = -value;
+    }
+    if (value > DBL_MAX) {
+        memcpy(pos, "inf", 3);
+        return pos + 3 - buf;
+    }
+
+    // Beyond 64 bit integers, one digit before the point.
+    int exponent = 0;
+    if (value >= 1e18) {
+        while (value >= 10) {
+            value /= 10;
+            exponent++;
+        }
+    }
+    uint64_t integer = value;
+    uint64_t fraction = (value - integer) * 1000000 + 0.5;
+    if (fraction >= 1000000) {
+        integer++;
+        fraction -= 1000000;
+    }
+    pos += kv_format_u64(pos, integer);
+    *pos++ = '.';
+    int digits = 6;
+    while (digits > 1 && fraction % 10 == 0) {
+        fraction /= 10;
+        digits--;
+    }
+    for (int i = digits - 1; i >= 0; i--) {
+        pos[i] = '0' + fraction % 10;
+        fraction /= 10;
+    }
+    pos += digits;
+    if (exponent) {
+        memcpy(pos, "e+", 2);
+        pos += 2 + kv_format_u64(pos + 2, exponent);
+    }
+    return pos - buf;
+}
+
+// Quote strings that would not read back as one value.
+static bool kv_needs_quotes(const char *str, size_t len)
+{
+    if (!len)
+        return true;
+    for (size_t i = 0; i < len; i++) {
+        if (str[i] == ' ' || str[i] == '=' || str[i] == '"')
+            return true;
+    }
+    return false;
+}
+
+size_t log_kv_format(const char *data, size_t len, char *buf, size_t size)
+{
+    char number[KV_NUMBER_SIZE];
+    size_t out = 0;
+    size_t pos = 0;
+
+#define KV_PUT(str, n)                       \
+    do {                                     \
+        size_t n_ = (n);                     \
+        if (out + n_ > size)                 \
+            goto done;                       \
+        memcpy(buf + out, (str), n_);        \
+        out += n_;                           \
+    } while (0)
+
+    while (pos < len) {
+        uint8_t head = data[pos++];
+        size_t key_len = head >> LOG_KV_KEY_SHIFT;
+        if (key_len > len - pos)
+            break;
+        if (out)
+            KV_PUT(" ", 1);
+        KV_PUT(data + pos, key_len);
+        KV_PUT("=", 1);
+        pos += key_len;
+
+        uint64_t value;
+        size_t n = 0;
+        switch (head & LOG_KV_TYPE_MASK) {
+        case LOG_KV_INT:
+        case LOG_KV_UINT:
+            n = logstream_get_varint(data + pos, len - pos, &value);
+            if (!n)
+                goto done;
+            pos += n;
+            n = (head & LOG_KV_TYPE_MASK) == LOG_KV_INT ? kv_format_i64(number, kv_zigzag_decode(value)) : kv_format_u64(number, value);
+            KV_PUT(number, n);
+            break;
+        case LOG_KV_FLOAT: {
+            float f;
+            if (len - pos < sizeof(f))
+                goto done;
+            memcpy(&f, data + pos, sizeof(f));
+            pos += sizeof(f);
+            KV_PUT(number, kv_format_double(number, f));
+            break;
+        }
+        case LOG_KV_DOUBLE: {
+            double d;
+            if (len - pos < sizeof(d))
+                goto done;
+            memcpy(&d, data + pos, sizeof(d));
+            pos += sizeof(d);
+            KV_PUT(number, kv_format_double(number, d));
+            break;
+        }
+        case LOG_KV_BOOL:
+            if (pos == len)
+                goto done;
+            if (data[pos++])
+                KV_PUT("true", 4);
+            else
+                KV_PUT("false", 5);
+            break;
+        case LOG_KV_STR:
+            n = logstream_get_varint(data + pos, len - pos, &value);
+            if (!n || value > len - pos - n)
+                goto done;
+            pos += n;
+            bool quote = kv_needs_quotes(data + pos, value);
+            if (quote)
+                KV_PUT("\"", 1);
+            for (size_t i = 0; i < value; i++) {
+                char c = data[pos + i];
+                if (c == '"')
+                    KV_PUT("\\\"", 2);
+                else if ((unsigned char)c < ' ' || c == 0x7f)
+                    KV_PUT(".", 1);
+                else
+                    KV_PUT(&c, 1);
+            }
+            if (quote)
+                KV_PUT("\"", 1);
+            pos += value;
+            break;
+        default:
+            goto done;
+        }
+    }
+#undef KV_PUT
+
+done:
+    return out;
+}
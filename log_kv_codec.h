@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Key-value fields, the data of entries logged with log_kv(). Like the logstream codec it only
+ * depends on the C library, so host tools can render them too.
+ *
+ * Field:
+ *   u8 key length << 3 | type, the key, then the value by type:
+ *   LOG_KV_INT: varint zigzag. LOG_KV_UINT: varint.
+ *   LOG_KV_FLOAT: 4 bytes, LOG_KV_DOUBLE: 8 bytes, IEEE 754 little endian.
+ *   LOG_KV_BOOL: u8 0 or 1. LOG_KV_STR: varint length, the bytes.
+ */
+
+enum log_kv_type_e {
+    LOG_KV_INT,
+    LOG_KV_UINT,
+    LOG_KV_FLOAT,
+    LOG_KV_DOUBLE,
+    LOG_KV_BOOL,
+    LOG_KV_STR,
+};
+
+#define LOG_KV_TYPE_MASK 0x07
+#define LOG_KV_KEY_SHIFT 3
+#define LOG_KV_MAX_KEY_LEN 31
+
+struct log_kv_value_s {
+    uint8_t type;
+    union {
+        int64_t i;
+        uint64_t u;
+        double f;
+        bool b;
+        const char *s;
+    };
+};
+
+// Append a field to the len bytes in buf, returns the new length or 0 if it does not fit in size.
+size_t log_kv_encode(char *buf, size_t len, size_t size, const char *key, const struct log_kv_value_s *value);
+
+/*
+ * Render fields as text, key=value separated by spaces, without printf. Returns the bytes written,
+ * the text is cut at size and not NUL terminated.
+ */
+size_t log_kv_format(const char *data, size_t len, char *buf, size_t size);
@@ -0,0 +1,225 @@
+#include <ctype.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "argtable3/argtable3.h"
+#include "esp_console.h"
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+
+#include "log_capture.h"
+#include "log_common.h"
+#include "log_intern.h"
+#include "log_level.h"
+#include "log_tag_cache.h"
+
+static const char *TAG = "log_level";
+
+#define LEVEL_CACHE_BITS 6
+
+struct level_rule_s {
+    char tag[CONFIG_LOGGER_LOG_MAX_TAG_SIZE];
+    uint8_t level;
+};
+
+// Rules and default are protected by level_lock, so are changes to the cache. While active is false everything passes.
+static struct level_rule_s rules[CONFIG_LOGGER_LEVEL_RULES];
+static size_t n_rules;
+static uint8_t default_level = ESP_LOG_VERBOSE;
+static volatile bool active;
+static struct log_tag_slot_s cache_slots[1 << LEVEL_CACHE_BITS];
+static struct log_tag_cache_s cache = LOG_TAG_CACHE_INIT(cache_slots, LEVEL_CACHE_BITS); // Tag pointer to level.
+static portMUX_TYPE level_lock = portMUX_INITIALIZER_UNLOCKED;
+
+// Called with level_lock held.
+static uint8_t level_rule_lookup(const char *tag)
+{
+    for (size_t i = 0; i < n_rules; i++) {
+        if (strncmp(rules[i].tag, tag, sizeof(rules[i].tag) - 1) == 0)
+            return rules[i].level;
+    }
+    return default_level;
+}
+
+// Called with level_lock held.
+static void level_changed(void)
+{
+    log_tag_cache_clear(&cache);
+    active = n_rules > 0 || default_level < ESP_LOG_VERBOSE;
+}
+
+bool log_level_enabled(const char *tag, uint8_t level)
+{
+    if (!active || !tag)
+        return true;
+
+    uint8_t max_level;
+    if (log_tag_cache_get(&cache, tag, &max_level))
+        return level <= max_level;
+
+    // Look up the rules by name, and remember the answer for this pointer.
+    uint16_t name = log_intern(tag, CONFIG_LOGGER_LOG_MAX_TAG_SIZE);
+    portENTER_CRITICAL(&level_lock);
+    max_level = level_rule_lookup(tag);
+    log_tag_cache_put(&cache, tag, name, max_level);
+    portEXIT_CRITICAL(&level_lock);
+    return level <= max_level;
+}
+
+esp_err_t log_level_set(const char *tag, esp_log_level_t level)
+{
+    esp_err_t err = ESP_OK;
+
+    portENTER_CRITICAL(&level_lock);
+    if (strcmp(tag, "*") == 0) {
+        default_level = level;
+    } else {
+        size_t i = 0;
+        while (i < n_rules && strncmp(rules[i].tag, tag, sizeof(rules[i].tag) - 1) != 0)
+            i++;
+        if (i == ARRAY_SIZE(rules)) {
+            err = ESP_ERR_NO_MEM;
+        } else {
+            if (i == n_rules) {
+                strncpy(rules[i].tag, tag, sizeof(rules[i].tag) - 1);
+                n_rules++;
+            }
+            rules[i].level = level;
+        }
+    }
+    if (err == ESP_OK)
+        level_changed();
+    portEXIT_CRITICAL(&level_lock);
+
+    // ESP-IDF filters before we see anything, so it has to let the tag through.
+    if (err == ESP_OK)
+        esp_log_level_set(tag, level);
+    return err;
+}
+
+void log_level_reset(const char *tag)
+{
+    portENTER_CRITICAL(&level_lock);
+    for (size_t i = 0; i < n_rules; i++) {
+        if (strncmp(rules[i].tag, tag, sizeof(rules[i].tag) - 1) == 0) {
+            rules[i] = rules[--n_rules];
+            break;
+        }
+    }
+    level_changed();
+    uint8_t level = default_level;
+    portEXIT_CRITICAL(&level_lock);
+    esp_log_level_set(tag, level);
+}
+
+/*
+ * A level by name, first letter or number.
+ */
+static int log_level_parse(const char *str, size_t len)
+{
+    if (len == 1 && isdigit((unsigned char)str[0]))
+        return str[0] - '0' <= ESP_LOG_VERBOSE ? str[0] - '0' : -1;
+    for (size_t i = 0; i < ARRAY_SIZE(log_level_names); i++) {
+        if ((len == 1 && toupper((unsigned char)str[0]) == toupper((unsigned char)log_level_names[i][0])) ||
+            (len == strlen(log_level_names[i]) && strncasecmp(str, log_level_names[i], len) == 0))
+            return i;
+    }
+    return -1;
+}
+
+/*
+ * Apply CONFIG_LOGGER_LEVEL_DEFAULTS, comma separated tag:level pairs.
+ */
+esp_err_t log_level_early_init(void)
+{
+    const char *pos = CONFIG_LOGGER_LEVEL_DEFAULTS;
+    while (*pos) {
+        const char *end = pos + strcspn(pos, ",");
+        const char *colon = memchr(pos, ':', end - pos);
+        char tag[CONFIG_LOGGER_LOG_MAX_TAG_SIZE];
+        int level = colon ? log_level_parse(colon + 1, end - colon - 1) : -1;
+        if (level < 0 || (size_t)(colon - pos) >= sizeof(tag)) {
+            ESP_LOGE(TAG, "Bad level default '%.*s'", (int)(end - pos), pos);
+        } else {
+            memcpy(tag, pos, colon - pos);
+            tag[colon - pos] = '\0';
+            log_level_set(tag, level);
+        }
+        pos = *end ? end + 1 : end;
+    }
+    return ESP_OK;
+}
+
+static struct {
+    struct arg_str *tag;
+    struct arg_str *level;
+    struct arg_end *end;
+} loglevel_args;
+
+static int cmd_loglevel(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **)&loglevel_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, loglevel_args.end, argv[0]);
+        return 1;
+    }
+
+    if (loglevel_args.tag->count == 0) {
+        portENTER_CRITICAL(&level_lock);
+        struct level_rule_s copy[ARRAY_SIZE(rules)];
+        size_t n = n_rules;
+        uint8_t level = default_level;
+        memcpy(copy, rules, sizeof(copy));
+        portEXIT_CRITICAL(&level_lock);
+
+        printf("%-*s %s\n", CONFIG_LOGGER_LOG_MAX_TAG_SIZE, "*", log_level_names[level]);
+        for (size_t i = 0; i < n; i++)
+            printf("%-*s %s\n", CONFIG_LOGGER_LOG_MAX_TAG_SIZE, copy[i].tag, log_level_names[copy[i].level]);
+        return 0;
+    }
+
+    const char *tag = loglevel_args.tag->sval[0];
+    if (loglevel_args.level->count == 0) {
+        portENTER_CRITICAL(&level_lock);
+        uint8_t level = level_rule_lookup(tag);
+        portEXIT_CRITICAL(&level_lock);
+        printf("%s %s\n", tag, log_level_names[level]);
+        return 0;
+    }
+
+    const char *level_str = loglevel_args.level->sval[0];
+    if (strcmp(level_str, "reset") == 0) {
+        log_level_reset(tag);
+        return 0;
+    }
+    int level = log_level_parse(level_str, strlen(level_str));
+    if (level < 0) {
+        printf("Unknown level %s\n", level_str);
+        return 1;
+    }
+    if (log_level_set(tag, level) != ESP_OK) {
+        printf("No room for more rules, see CONFIG_LOGGER_LEVEL_RULES\n");
+        return 1;
+    }
+    return 0;
+}
+
+esp_err_t log_level_init(void)
+{
+    loglevel_args.tag = arg_str0(NULL, NULL, "<tag>", "Tag, or * for all tags without a rule of their own");
+    loglevel_args.level = arg_str0(NULL, NULL, "<level>", "none, error, warn, info, debug, verbose, or reset to remove the rule");
+    loglevel_args.end = arg_end(2);
+
+    const esp_console_cmd_t loglevel_cmd = {
+        .command = "loglevel",
+        .help = "Print or set log levels per tag",
+        .hint = NULL,
+        .func = &cmd_loglevel,
+        .argtable = &loglevel_args,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&loglevel_cmd));
+
+    return ESP_OK;
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+/*
+ * Per tag levels owned by the capture pipeline, checked before a line is formatted. Tags are
+ * looked up by pointer in a small cache, as they are nearly always the same string constant,
+ * and by name in the list of rules on a miss. Tags without a rule use the level of "*".
+ */
+
+esp_err_t log_level_early_init(void);
+esp_err_t log_level_init(void);
+
+// Set the most verbose level logged for a tag, or "*" for the default. Also sets the ESP-IDF level.
+esp_err_t log_level_set(const char *tag, esp_log_level_t level);
+// Remove the rule of a tag, so it gets the default level again.
+void log_level_reset(const char *tag);
+
+bool log_level_enabled(const char *tag, uint8_t level);
@@ -0,0 +1,170 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "argtable3/argtable3.h"
+#include "esp_console.h"
+#include "esp_log.h"
+
+#include "freertos/FreeRTOS.h"
+
+#include "log_capture.h"
+#include "log_common.h"
+#include "log_intern.h"
+#include "log_kv_codec.h"
+#include "log_metrics.h"
+
+#define METRICS_SLOTS (CONFIG_LOGGER_METRICS_TAGS + 1) // Slot 0 counts the tags that did not get one.
+#define METRICS_BUCKETS 4
+#define METRICS_BUCKET_MS (LOG_METRICS_WINDOW_S * 1000 / METRICS_BUCKETS)
+#define METRICS_SLOT_NONE 0xffff
+
+static const char *TAG = "logmetrics";
+
+/*
+ * Counters are only ever added to atomically. The window is a ring of buckets, the first line
+ * counted in a new period claims its bucket and clears it, a line counted in a bucket that is
+ * just being cleared may be lost.
+ */
+static uint32_t totals[METRICS_SLOTS][LOG_METRICS_LEVELS];
+static uint32_t buckets[METRICS_BUCKETS][METRICS_SLOTS][LOG_METRICS_LEVELS];
+static uint32_t bucket_period[METRICS_BUCKETS];
+static uint32_t reported[METRICS_SLOTS][LOG_METRICS_LEVELS]; // Only touched by log_metrics_report.
+
+// Interned tag to slot, and back.
+static uint16_t tag_slot[CONFIG_LOGGER_INTERN_TABLE_SIZE + 1];
+static uint16_t slot_name[METRICS_SLOTS];
+static uint16_t n_slots = 1;
+static portMUX_TYPE metrics_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static size_t metrics_slot(const char *tag)
+{
+    uint16_t name = log_intern(tag, CONFIG_LOGGER_LOG_MAX_TAG_SIZE);
+    if (name == LOG_INTERN_NONE)
+        return 0;
+
+    uint16_t slot = __atomic_load_n(&tag_slot[name], __ATOMIC_RELAXED);
+    if (slot)
+        return slot == METRICS_SLOT_NONE ? 0 : slot;
+
+    // First line of the tag.
+    portENTER_CRITICAL(&metrics_lock);
+    slot = tag_slot[name];
+    if (!slot) {
+        slot = n_slots < METRICS_SLOTS ? n_slots++ : METRICS_SLOT_NONE;
+        if (slot != METRICS_SLOT_NONE)
+            slot_name[slot] = name;
+        __atomic_store_n(&tag_slot[name], slot, __ATOMIC_RELEASE);
+    }
+    portEXIT_CRITICAL(&metrics_lock);
+    return slot == METRICS_SLOT_NONE ? 0 : slot;
+}
+
+void log_metrics_count(const char *tag, uint8_t level)
+{
+    if (!tag || level < ESP_LOG_ERROR || level > ESP_LOG_VERBOSE)
+        return;
+
+    size_t slot = metrics_slot(tag);
+    size_t l = level - ESP_LOG_ERROR;
+    uint32_t period = esp_log_timestamp() / METRICS_BUCKET_MS + 1;
+    size_t b = period % METRICS_BUCKETS;
+
+    uint32_t claimed = __atomic_load_n(&bucket_period[b], __ATOMIC_ACQUIRE);
+    if (claimed != period && __atomic_compare_exchange_n(&bucket_period[b], &claimed, period, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        for (size_t i = 0; i < METRICS_SLOTS; i++) {
+            for (size_t j = 0; j < LOG_METRICS_LEVELS; j++)
+                __atomic_store_n(&buckets[b][i][j], 0, __ATOMIC_RELAXED);
+        }
+    }
+    __atomic_fetch_add(&totals[slot][l], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&buckets[b][slot][l], 1, __ATOMIC_RELAXED);
+}
+
+size_t log_metrics_get(struct log_metrics_s *metrics, size_t max)
+{
+    uint32_t period = esp_log_timestamp() / METRICS_BUCKET_MS + 1;
+    size_t slots = MIN(__atomic_load_n(&n_slots, __ATOMIC_ACQUIRE), max);
+
+    for (size_t i = 0; i < slots; i++) {
+        metrics[i].tag = i ? log_intern_str(slot_name[i]) : "*";
+        for (size_t l = 0; l < LOG_METRICS_LEVELS; l++) {
+            metrics[i].total[l] = __atomic_load_n(&totals[i][l], __ATOMIC_RELAXED);
+            metrics[i].window[l] = 0;
+        }
+        // The buckets of the periods in the window, the current one is partly filled.
+        for (size_t b = 0; b < METRICS_BUCKETS; b++) {
+            if (period - __atomic_load_n(&bucket_period[b], __ATOMIC_ACQUIRE) >= METRICS_BUCKETS)
+                continue;
+            for (size_t l = 0; l < LOG_METRICS_LEVELS; l++)
+                metrics[i].window[l] += __atomic_load_n(&buckets[b][i][l], __ATOMIC_RELAXED);
+        }
+    }
+    return slots;
+}
+
+/*
+ * Fields like wifi.E=3, only for the tags and levels that logged since the last report, as many
+ * entries as it takes. Sent by the logstream client, not printed.
+ */
+void log_metrics_report(void)
+{
+    char data[LOG_ENTRY_DATA_SIZE];
+    char key[LOG_KV_MAX_KEY_LEN + 1];
+    size_t len = 0;
+
+    size_t slots = __atomic_load_n(&n_slots, __ATOMIC_ACQUIRE);
+    for (size_t i = 0; i < slots; i++) {
+        const char *tag = i ? log_intern_str(slot_name[i]) : "*";
+        size_t tag_len = MIN(strlen(tag), sizeof(key) - 3);
+        memcpy(key, tag, tag_len);
+        key[tag_len] = '.';
+        key[tag_len + 2] = '\0';
+        for (size_t l = 0; l < LOG_METRICS_LEVELS; l++) {
+            uint32_t total = __atomic_load_n(&totals[i][l], __ATOMIC_RELAXED);
+            if (total == reported[i][l])
+                continue;
+            struct log_kv_value_s value = {.type = LOG_KV_UINT, .u = total - reported[i][l]};
+            key[tag_len + 1] = "EWIDV"[l];
+            size_t next = log_kv_encode(data, len, sizeof(data), key, &value);
+            if (!next) {
+                log_capture_send_data(ESP_LOG_INFO, TAG, data, len, LOG_ENTRY_FLAG_KV | LOG_ENTRY_FLAG_METRICS, 0);
+                next = log_kv_encode(data, 0, sizeof(data), key, &value);
+            }
+            len = next;
+            reported[i][l] = total;
+        }
+    }
+    if (len)
+        log_capture_send_data(ESP_LOG_INFO, TAG, data, len, LOG_ENTRY_FLAG_KV | LOG_ENTRY_FLAG_METRICS, 0);
+}
+
+static int cmd_logmetrics(int argc, char **argv)
+{
+    static struct log_metrics_s metrics[METRICS_SLOTS];
+
+    size_t n = log_metrics_get(metrics, ARRAY_SIZE(metrics));
+    printf("%-*s %8s %8s %8s %8s %8s   last %d s E/W/I\n", CONFIG_LOGGER_LOG_MAX_TAG_SIZE, "tag", "error", "warn", "info", "debug", "verbose",
+           LOG_METRICS_WINDOW_S);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t *t = metrics[i].total, *w = metrics[i].window;
+        if (!t[0] && !t[1] && !t[2] && !t[3] && !t[4])
+            continue;
+        printf("%-*s %8" PRIu32 " %8" PRIu32 " %8" PRIu32 " %8" PRIu32 " %8" PRIu32 "   %" PRIu32 "/%" PRIu32 "/%" PRIu32 "\n",
+               CONFIG_LOGGER_LOG_MAX_TAG_SIZE, metrics[i].tag, t[0], t[1], t[2], t[3], t[4], w[0], w[1], w[2]);
+    }
+    return 0;
+}
+
+esp_err_t log_metrics_init(void)
+{
+    const esp_console_cmd_t logmetrics_cmd = {
+        .command = "logmetrics",
+        .help = "Print the lines logged per tag and level, in total and in the last minute",
+        .hint = NULL,
+        .func = &cmd_logmetrics,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&logmetrics_cmd));
+
+    return ESP_OK;
+}
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/*
+ * Lines logged per tag and level, counted by the capture without locks, before sampling. Kept in
+ * total and for the last LOG_METRICS_WINDOW_S seconds, for the first CONFIG_LOGGER_METRICS_TAGS tags,
+ * the rest are counted together under "*".
+ */
+
+#define LOG_METRICS_LEVELS 5 // Error to verbose.
+#define LOG_METRICS_WINDOW_S 60
+
+struct log_metrics_s {
+    const char *tag;
+    uint32_t total[LOG_METRICS_LEVELS];
+    uint32_t window[LOG_METRICS_LEVELS];
+};
+
+void log_metrics_count(const char *tag, uint8_t level);
+// Copy the counts of up to max tags, returns the number copied.
+size_t log_metrics_get(struct log_metrics_s *metrics, size_t max);
+// Log the lines counted since the last report as key-value fields, for the logstream client.
+void log_metrics_report(void);
+
+// Registers the logmetrics console command.
+esp_err_t log_metrics_init(void);
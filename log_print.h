@@ -3,7 +3,8 @@
 #include "esp_log.h"
 #include "esp_system.h"
 
-#include "freertos/FreeRTOSConfig.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
 
 #include "log_capture.h"
 
@@ -0,0 +1,254 @@
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "argtable3/argtable3.h"
+#include "esp_console.h"
+#include "esp_log.h"
+#include "esp_random.h"
+
+#include "freertos/FreeRTOS.h"
+
+#include "log_common.h"
+#include "log_intern.h"
+#include "log_sample.h"
+#include "log_tag_cache.h"
+
+#define SAMPLE_CACHE_BITS 5
+#define SAMPLE_NO_RULE 0xff
+
+struct sample_rule_s {
+    char tag[CONFIG_LOGGER_LOG_MAX_TAG_SIZE];
+    uint8_t mode;
+    uint32_t n;
+    uint32_t window_ms;
+    uint32_t last_ms;   // When the last line was kept, or the window started.
+    uint32_t in_window; // Lines seen in the current window, or since the last kept line.
+    uint32_t expected;  // Lines seen in the previous window.
+    uint32_t kept_in_window;
+    uint32_t dropped;   // Since the last kept line.
+    uint32_t total_seen;
+    uint32_t total_kept;
+};
+
+static struct sample_rule_s rules[CONFIG_LOGGER_SAMPLE_RULES];
+static size_t n_rules;
+static volatile bool active;
+static struct log_tag_slot_s cache_slots[1 << SAMPLE_CACHE_BITS];
+// Tag pointer to rule index. Its generation changes with the rules, an index of another may be that of another tag.
+static struct log_tag_cache_s cache = LOG_TAG_CACHE_INIT(cache_slots, SAMPLE_CACHE_BITS);
+static portMUX_TYPE sample_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static const char *sample_mode_names[] = {"off", "every", "interval", "reservoir"};
+
+// Called with sample_lock held. Longer tags share the rule of what fits.
+static uint8_t sample_rule_lookup(const char *tag)
+{
+    for (size_t i = 0; i < n_rules; i++) {
+        if (strncmp(rules[i].tag, tag, sizeof(rules[i].tag) - 1) == 0)
+            return i;
+    }
+    return SAMPLE_NO_RULE;
+}
+
+// The rule of the tag, and the generation of the rules it was looked up in.
+static uint8_t sample_rule_of(const char *tag, uint32_t *rule_generation)
+{
+    // Read first, a rule cached in a later generation only costs another lookup.
+    uint8_t rule;
+    *rule_generation = log_tag_cache_generation(&cache);
+    if (log_tag_cache_get(&cache, tag, &rule))
+        return rule;
+
+    uint16_t name = log_intern(tag, CONFIG_LOGGER_LOG_MAX_TAG_SIZE);
+    portENTER_CRITICAL(&sample_lock);
+    rule = sample_rule_lookup(tag);
+    *rule_generation = cache.generation;
+    log_tag_cache_put(&cache, tag, name, rule);
+    portEXIT_CRITICAL(&sample_lock);
+    return rule;
+}
+
+/*
+ * Reservoir sampling proper would hold lines back until the window is over. Instead each line is
+ * kept with a probability of n in the lines seen in the previous window, which spreads the kept
+ * lines over the window the same way as long as the rate is steady. Called with sample_lock held.
+ */
+static bool sample_reservoir(struct sample_rule_s *rule, uint32_t now)
+{
+    if (now - rule->last_ms >= rule->window_ms) {
+        rule->expected = rule->in_window;
+        rule->in_window = rule->kept_in_window = 0;
+        rule->last_ms = now;
+    }
+    rule->in_window++;
+    if (rule->kept_in_window >= rule->n)
+        return false;
+    if (rule->expected > rule->n && esp_random() % rule->expected >= rule->n)
+        return false;
+    rule->kept_in_window++;
+    return true;
+}
+
+bool log_sample_keep(const char *tag, uint16_t *dropped)
+{
+    *dropped = 0;
+    if (!active || !tag)
+        return true;
+
+    uint32_t rule_generation;
+    uint8_t i = sample_rule_of(tag, &rule_generation);
+    if (i == SAMPLE_NO_RULE)
+        return true;
+
+    uint32_t now = esp_log_timestamp();
+    bool keep = true;
+    portENTER_CRITICAL(&sample_lock);
+    // The rules changed since it was looked up, the index may be that of another tag now.
+    if (rule_generation != cache.generation)
+        i = sample_rule_lookup(tag);
+    if (i != SAMPLE_NO_RULE) {
+        struct sample_rule_s *rule = &rules[i];
+        switch (rule->mode) {
+        case LOG_SAMPLE_EVERY:
+            keep = rule->in_window++ % rule->n == 0;
+            break;
+        case LOG_SAMPLE_INTERVAL:
+            keep = !rule->total_kept || now - rule->last_ms >= rule->n;
+            if (keep)
+                rule->last_ms = now;
+            break;
+        case LOG_SAMPLE_RESERVOIR:
+            keep = sample_reservoir(rule, now);
+            break;
+        }
+        rule->total_seen++;
+        if (keep) {
+            rule->total_kept++;
+            *dropped = MIN(rule->dropped, UINT16_MAX);
+            rule->dropped = 0;
+        } else {
+            rule->dropped++;
+        }
+    }
+    portEXIT_CRITICAL(&sample_lock);
+    return keep;
+}
+
+// Called with sample_lock held.
+static void sample_changed(void)
+{
+    log_tag_cache_clear(&cache);
+    active = n_rules > 0;
+}
+
+esp_err_t log_sample_set(const char *tag, enum log_sample_mode_e mode, uint32_t n, uint32_t window_ms)
+{
+    if (mode == LOG_SAMPLE_OFF) {
+        log_sample_reset(tag);
+        return ESP_OK;
+    }
+    if (n == 0 || (mode == LOG_SAMPLE_RESERVOIR && window_ms == 0) || mode > LOG_SAMPLE_RESERVOIR)
+        return ESP_ERR_INVALID_ARG;
+
+    esp_err_t err = ESP_OK;
+    portENTER_CRITICAL(&sample_lock);
+    uint8_t i = sample_rule_lookup(tag);
+    if (i == SAMPLE_NO_RULE && n_rules == ARRAY_SIZE(rules)) {
+        err = ESP_ERR_NO_MEM;
+    } else {
+        if (i == SAMPLE_NO_RULE)
+            i = n_rules++;
+        rules[i] = (struct sample_rule_s){.mode = mode, .n = n, .window_ms = window_ms};
+        strncpy(rules[i].tag, tag, sizeof(rules[i].tag) - 1);
+        sample_changed();
+    }
+    portEXIT_CRITICAL(&sample_lock);
+    return err;
+}
+
+void log_sample_reset(const char *tag)
+{
+    portENTER_CRITICAL(&sample_lock);
+    uint8_t i = sample_rule_lookup(tag);
+    if (i != SAMPLE_NO_RULE)
+        rules[i] = rules[--n_rules];
+    sample_changed();
+    portEXIT_CRITICAL(&sample_lock);
+}
+
+static struct {
+    struct arg_str *tag;
+    struct arg_str *mode;
+    struct arg_int *n;
+    struct arg_int *window;
+    struct arg_end *end;
+} logsample_args;
+
+static int cmd_logsample(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **)&logsample_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, logsample_args.end, argv[0]);
+        return 1;
+    }
+
+    if (logsample_args.tag->count == 0) {
+        portENTER_CRITICAL(&sample_lock);
+        struct sample_rule_s copy[ARRAY_SIZE(rules)];
+        size_t n = n_rules;
+        memcpy(copy, rules, sizeof(copy));
+        portEXIT_CRITICAL(&sample_lock);
+
+        printf("%-*s %-9s %8s %8s %10s %10s\n", CONFIG_LOGGER_LOG_MAX_TAG_SIZE, "tag", "mode", "n", "window", "seen", "kept");
+        for (size_t i = 0; i < n; i++)
+            printf("%-*s %-9s %8" PRIu32 " %8" PRIu32 " %10" PRIu32 " %10" PRIu32 "\n", CONFIG_LOGGER_LOG_MAX_TAG_SIZE, copy[i].tag,
+                   sample_mode_names[copy[i].mode], copy[i].n, copy[i].window_ms, copy[i].total_seen, copy[i].total_kept);
+        return 0;
+    }
+
+    const char *tag = logsample_args.tag->sval[0];
+    const char *mode_str = logsample_args.mode->count ? logsample_args.mode->sval[0] : "off";
+    int mode = -1;
+    for (size_t i = 0; i < ARRAY_SIZE(sample_mode_names); i++) {
+        if (strcmp(mode_str, sample_mode_names[i]) == 0)
+            mode = i;
+    }
+    if (mode < 0) {
+        printf("Unknown mode %s\n", mode_str);
+        return 1;
+    }
+    uint32_t n = logsample_args.n->count ? MAX(logsample_args.n->ival[0], 0) : 0;
+    uint32_t window = 0;
+    if (mode == LOG_SAMPLE_RESERVOIR)
+        window = logsample_args.window->count ? MAX(logsample_args.window->ival[0], 0) : 1000;
+    esp_err_t err = log_sample_set(tag, mode, n, window);
+    if (err == ESP_ERR_NO_MEM) {
+        printf("No room for more rules, see CONFIG_LOGGER_SAMPLE_RULES\n");
+        return 1;
+    } else if (err != ESP_OK) {
+        printf("Give a count above 0\n");
+        return 1;
+    }
+    return 0;
+}
+
+esp_err_t log_sample_init(void)
+{
+    logsample_args.tag = arg_str0(NULL, NULL, "<tag>", "Tag to sample");
+    logsample_args.mode = arg_str0(NULL, NULL, "<mode>", "every <n> lines, interval <ms> between lines, reservoir <n> lines per window, or off");
+    logsample_args.n = arg_int0(NULL, NULL, "<n>", "Lines or ms");
+    logsample_args.window = arg_int0("w", "window", "<ms>", "Reservoir window, 1000 by default");
+    logsample_args.end = arg_end(4);
+
+    const esp_console_cmd_t logsample_cmd = {
+        .command = "logsample",
+        .help = "Print or set sampling of tags that log a lot",
+        .hint = NULL,
+        .func = &cmd_logsample,
+        .argtable = &logsample_args,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&logsample_cmd));
+
+    return ESP_OK;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp_err.h"
+
+/*
+ * Per tag sampling, for tags that log in tight loops. Applied in the capture right after the level,
+ * before a line is formatted. The next line kept carries the number of lines dropped before it, so
+ * whoever reads the logs can scale counts back up.
+ */
+
+enum log_sample_mode_e {
+    LOG_SAMPLE_OFF,
+    LOG_SAMPLE_EVERY,     // Keep 1 in n lines.
+    LOG_SAMPLE_INTERVAL,  // Keep at most one line every n ms.
+    LOG_SAMPLE_RESERVOIR, // Keep n lines at random in every window of window_ms.
+};
+
+esp_err_t log_sample_set(const char *tag, enum log_sample_mode_e mode, uint32_t n, uint32_t window_ms);
+void log_sample_reset(const char *tag);
+
+// Whether to keep a line of tag. If so, dropped is set to the lines of the tag dropped since the last kept one.
+bool log_sample_keep(const char *tag, uint16_t *dropped);
+
+// Registers the logsample console command.
+esp_err_t log_sample_init(void);
@@ -1,56 +1,802 @@
 
-
 #include <ctype.h>
+#include <inttypes.h>
 #include <lwip/netdb.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <sys/queue.h>
 
+#include "esp_console.h"
 #include "esp_log.h"
+#include "esp_random.h"
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
 
+#include "circ_buf.h"
+#include "log_buffer.h"
 #include "log_capture.h"
 #include "log_common.h"
+#include "log_metrics.h"
 #include "log_stream_client.h"
+#include "log_stream_codec.h"
 #include "log_stream_common.h"
+#include "log_stream_compress.h"
 #include "lwip/err.h"
 #include "lwip/sockets.h"
 #include "lwip/sys.h"
 
 static struct sockaddr_in dest_addr;
+static logstream_client_config_t client_config;
 
 static const char *TAG = "logstream_client";
-#define MAX_PACKET_SIZE 1400 // mtu minus some overhead
+
+/*
+ * Entries are encoded straight into a queue by the logging task, and a sender task packs
+ * them into datagrams on a persistent socket. The logging task never touches the network.
+ */
+static char queue_data[CONFIG_LOGGER_LOGSTREAM_QUEUE_SIZE];
+static circ_buf_t queue;
+static SemaphoreHandle_t xSemaphore = NULL;
+static StaticSemaphore_t xSemaphoreBuffer;
+static TaskHandle_t sender_task;
+static volatile bool flush_now;
+static struct logstream_client_stats_s client_stats;
+static struct logstream_relay_stats_s relay_stats;
+
+/*
+ * Entries are numbered with their log buffer index, so the server can detect loss and ask for
+ * the missing ones, which are then served from the log buffer. The session id tells the
+ * server when numbering restarts.
+ */
+static uint32_t session;
+static uint32_t local_seq;
+
+/*
+ * Entries that are not sent, like received ones when not relaying, leave gaps in the numbering.
+ * The record after a run of them says how long it was, so the server does not ask for them.
+ * Only a run right before the record counts, anything else is resolved by retransmits.
+ */
+struct logstream_skip_s {
+    uint32_t last;
+    uint32_t run;
+};
+
+static struct logstream_skip_s queue_skip;
+
+/*
+ * Entries that did not fit in the queue are sent from the log buffer instead, once the queue
+ * has drained. While that is going on, new entries are left in the log buffer too, to keep
+ * them in order. Both are protected by xSemaphore, and backfill_end is 0 when not active.
+ */
+static uint32_t backfill_next;
+static uint32_t backfill_end;
+
+/*
+ * The server acknowledges what it has received. When the link comes up, after boot or an
+ * outage, everything newer than that is replayed from the log buffer, a datagram at a time
+ * next to the live traffic. Only touched by the sender task, replay_end is 0 when not active.
+ */
+static uint32_t acked_index;
+static uint32_t replay_next;
+static uint32_t replay_end;
+static TickType_t last_replay;
+static bool link_up;
+
+/*
+ * Connection state, only touched by the sender task. Datagrams are encoded after room for a
+ * frame header, which is filled in when sending over TCP.
+ */
+static int sock = -1;
+static uint32_t backoff_ms;
+static TickType_t next_connect;
+static char frame[LOGSTREAM_FRAME_HEADER_SIZE + LOGSTREAM_MAX_PACKET_SIZE];
+static char rx_buf[LOGSTREAM_FRAME_HEADER_SIZE + LOGSTREAM_NACK_MAX_SIZE];
+static size_t rx_len;
+
+#if CONFIG_LOGGER_LOGSTREAM_COMPRESS
+// Datagrams are encoded here first, with room for more than a packet as they shrink when compressed.
+static char raw[LOGSTREAM_MAX_RAW_SIZE];
+static size_t raw_budget = LOGSTREAM_MAX_PACKET_SIZE;
+static struct logstream_compressor_s compressor;
+#endif
+
+#define LOGSTREAM_POLL_MS 250
+#define RETRANSMIT_MAX_ENTRIES 64
+#define CONNECT_TIMEOUT_MS 3000
+#define SEND_TIMEOUT_MS 1000
+#define BACKOFF_MIN_MS 500
+#define BACKOFF_MAX_MS 30000
+#define REPLAY_INTERVAL_MS CONFIG_LOGGER_LOGSTREAM_REPLAY_INTERVAL_MS
+
+/*
+ * Entries are queued in a compact form, the wire encoding is done by the sender as it needs the
+ * previous entries in the same datagram for timestamp deltas and string references.
+ */
+struct logstream_queued_s {
+    uint32_t seq;
+    uint64_t timestamp;
+    uint16_t data_len;
+    uint16_t skipped;
+    uint16_t sampled;
+    uint8_t core;
+    uint8_t level;
+    uint8_t source_len;
+    uint8_t hops;
+    uint8_t task_len;
+    uint8_t tag_len;
+    uint8_t flags;
+};
+
+#define QUEUED_MAX_SIZE                                                                                                                         \
+    (sizeof(struct logstream_queued_s) + LOG_ENTRY_SOURCE_SIZE + configMAX_TASK_NAME_LEN + CONFIG_LOGGER_LOG_MAX_TAG_SIZE + CONFIG_LOGGER_LOG_MAX_LOG_LINE_SIZE)
+
+static void logstream_skip_add(struct logstream_skip_s *skip, uint32_t index)
+{
+    skip->run = index == skip->last + 1 ? skip->run + 1 : 1;
+    skip->last = index;
+}
+
+static uint32_t logstream_skipped(const struct logstream_skip_s *skip, uint32_t index)
+{
+    return index == skip->last + 1 ? skip->run : 0;
+}
+
+/*
+ * Entries received by the logstream server are only sent on when relaying, and only so many
+ * times, in case relays send to each other.
+ */
+static bool logstream_sends(const log_entry_t *entry)
+{
+    return !entry->hops || (client_config.relay && entry->hops < LOGSTREAM_MAX_HOPS);
+}
+
+/*
+ * Decide if an entry gets a place in the queue. With the drop lowest policy the queue is
+ * gradually reserved for more severe levels as it fills up.
+ */
+static bool logstream_queue_admit(uint8_t level, size_t size)
+{
+    if (circ_get_free_bytes(&queue) < size)
+        return false;
+    if (client_config.overflow != LOGSTREAM_OVERFLOW_DROP_LOWEST)
+        return true;
+
+    size_t used = circ_used(&queue) + size;
+    size_t total = circ_total_size(&queue);
+    if (used > total / 2 && level > ESP_LOG_INFO)
+        return false;
+    if (used > total * 3 / 4 && level > ESP_LOG_WARN)
+        return false;
+    if (used > total * 9 / 10 && level > ESP_LOG_ERROR)
+        return false;
+    return true;
+}
 
 static void send_logstream(log_entry_t *entry)
 {
-    log_stream_entry_t tx_entry;
-    tx_entry.log_stream_version = 1;
-    tx_entry.core = entry->core;
-    tx_entry.level = entry->level;
-    strncpy(tx_entry.task, entry->task, sizeof(tx_entry.task));
-    strncpy(tx_entry.tag, entry->tag, sizeof(tx_entry.tag));
-    tx_entry.timestamp = entry->timestamp;
-    tx_entry.data_len = entry->data_len;
-    memcpy(tx_entry.data, entry->data, tx_entry.data_len);
+    bool received = entry->hops > 0;
+    struct logstream_queued_s queued = {
+        .seq = entry->index,
+        .timestamp = entry->timestamp,
+        .data_len = MIN(entry->data_len, LOG_ENTRY_DATA_SIZE),
+        .core = entry->core,
+        .level = entry->level,
+        .source_len = received ? log_entry_source_len(entry) : 0,
+        .hops = entry->hops,
+        .task_len = log_entry_task_len(entry),
+        .tag_len = log_entry_tag_len(entry),
+        .flags = entry->flags,
+        .sampled = entry->sampled,
+    };
+    size_t size = sizeof(queued) + queued.source_len + queued.task_len + queued.tag_len + queued.data_len;
+
+    if (xSemaphoreTake(xSemaphore, portMAX_DELAY) != pdTRUE)
+        return;
+
+    // Sending from the log buffer, this entry will be picked up from there.
+    if (backfill_end && entry->index) {
+        backfill_end = entry->index;
+        xSemaphoreGive(xSemaphore);
+        return;
+    }
 
-    int log_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
-    size_t packet_size = MIN(offsetof(log_stream_entry_t, data) + tx_entry.data_len, MAX_PACKET_SIZE);
+    if (!logstream_sends(entry)) {
+        if (client_config.relay)
+            relay_stats.looped++;
+        if (entry->index)
+            logstream_skip_add(&queue_skip, entry->index);
+        xSemaphoreGive(xSemaphore);
+        return;
+    }
 
-    if (log_socket > 0)
-        sendto(log_socket, &tx_entry, packet_size, 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
-    close(log_socket);
+    if (!logstream_queue_admit(entry->level, size)) {
+        if (client_config.overflow == LOGSTREAM_OVERFLOW_BUFFER && entry->index)
+            backfill_next = backfill_end = entry->index;
+        else if (received)
+            relay_stats.dropped++;
+        else
+            client_stats.dropped++;
+        xSemaphoreGive(xSemaphore);
+        return;
+    }
+    // Without a log buffer there is nothing to retransmit from, but loss can still be detected.
+    if (!queued.seq)
+        queued.seq = ++local_seq;
+    else
+        queued.skipped = MIN(logstream_skipped(&queue_skip, entry->index), UINT16_MAX);
+    if (received)
+        relay_stats.relayed++;
+    bool was_empty = circ_used(&queue) == 0;
+    circ_push(&queue, (char *)&queued, sizeof(queued));
+    if (queued.source_len)
+        circ_push(&queue, entry->source, queued.source_len);
+    circ_push(&queue, entry->task, queued.task_len);
+    circ_push(&queue, entry->tag, queued.tag_len);
+    circ_push(&queue, entry->data, queued.data_len);
+
+    // Errors go out right away, and so does a full datagram.
+    if (entry->level == ESP_LOG_ERROR || circ_used(&queue) >= LOGSTREAM_MAX_PACKET_SIZE)
+        flush_now = true;
+    xSemaphoreGive(xSemaphore);
+
+    if (was_empty || flush_now)
+        xTaskNotifyGive(sender_task);
+}
+
+/*
+ * Copy the queued entry at offset into scratch, and point record into it.
+ * Returns the size of the entry in the queue, or 0 if there are no more entries.
+ */
+static size_t logstream_peek_queued(char *scratch, struct logstream_record_s *record, size_t offset)
+{
+    struct logstream_queued_s queued;
+    size_t size = 0;
+
+    if (xSemaphoreTake(xSemaphore, portMAX_DELAY) != pdTRUE)
+        return 0;
+    if (circ_peek_offset(&queue, (char *)&queued, sizeof(queued), offset) == sizeof(queued)) {
+        size = sizeof(queued) + queued.source_len + queued.task_len + queued.tag_len + queued.data_len;
+        circ_peek_offset(&queue, scratch, size - sizeof(queued), offset + sizeof(queued));
+    }
+    xSemaphoreGive(xSemaphore);
+
+    if (!size)
+        return 0;
+
+    record->seq = queued.seq;
+    record->level = queued.level;
+    record->core = queued.core;
+    record->timestamp = queued.timestamp;
+    record->source = queued.source_len ? scratch : NULL;
+    record->source_len = queued.source_len;
+    record->hops = queued.hops;
+    record->skipped = queued.skipped;
+    record->kv = queued.flags & LOG_ENTRY_FLAG_KV;
+    record->sampled = queued.sampled;
+    record->task = scratch + queued.source_len;
+    record->task_len = queued.task_len;
+    record->tag = record->task + queued.task_len;
+    record->tag_len = queued.tag_len;
+    record->data = record->tag + queued.tag_len;
+    record->data_len = queued.data_len;
+    return size;
+}
+
+static void logstream_pull_queued(size_t size)
+{
+    if (xSemaphoreTake(xSemaphore, portMAX_DELAY) != pdTRUE)
+        return;
+    circ_pull_ptr_pulled(&queue, size);
+    xSemaphoreGive(xSemaphore);
+}
+
+static void logstream_record_from_entry(struct logstream_record_s *record, const log_entry_t *entry, uint32_t skipped)
+{
+    record->seq = entry->index;
+    record->skipped = skipped;
+    record->kv = entry->flags & LOG_ENTRY_FLAG_KV;
+    record->sampled = entry->sampled;
+    record->source = entry->hops ? entry->source : NULL;
+    record->source_len = entry->hops ? log_entry_source_len(entry) : 0;
+    record->hops = entry->hops;
+    record->level = entry->level;
+    record->core = entry->core;
+    record->timestamp = entry->timestamp;
+    record->task = entry->task;
+    record->task_len = log_entry_task_len(entry);
+    record->tag = entry->tag;
+    record->tag_len = log_entry_tag_len(entry);
+    record->data = entry->data;
+    record->data_len = entry->data_len;
+}
+
+static void logstream_packet_init(struct logstream_encoder_s *enc, uint8_t flags)
+{
+#if CONFIG_LOGGER_LOGSTREAM_COMPRESS
+    logstream_encoder_init(enc, raw, raw_budget, LOGSTREAM_FLAG_SEQ | flags, session);
+#else
+    logstream_encoder_init(enc, frame + LOGSTREAM_FRAME_HEADER_SIZE, LOGSTREAM_MAX_PACKET_SIZE, LOGSTREAM_FLAG_SEQ | flags, session);
+#endif
+}
+
+#if CONFIG_LOGGER_LOGSTREAM_COMPRESS
+/*
+ * Compress the encoded datagram into the frame. Returns false, with a smaller budget for the next
+ * attempt, if it did not fit in a packet.
+ */
+static bool logstream_compress_packet(const struct logstream_encoder_s *enc, size_t *len)
+{
+    char *out = frame + LOGSTREAM_FRAME_HEADER_SIZE;
+    size_t n = logstream_compress_datagram(&compressor, enc->buf, enc->len, out, LOGSTREAM_MAX_PACKET_SIZE);
+    if (!n) {
+        if (enc->len > LOGSTREAM_MAX_PACKET_SIZE) {
+            raw_budget = MAX(raw_budget / 2, LOGSTREAM_MAX_PACKET_SIZE);
+            return false;
+        }
+        memcpy(out, enc->buf, enc->len);
+        *len = enc->len;
+        return true;
+    }
+
+    // Encode as much as is likely to fill a packet after compression, going by the last full one.
+    if (enc->len > raw_budget / 2)
+        raw_budget = MIN(MAX(enc->len * LOGSTREAM_MAX_PACKET_SIZE / n * 7 / 8, LOGSTREAM_MAX_PACKET_SIZE), sizeof(raw));
+    *len = n;
+    return true;
+}
+#endif
+
+/*
+ * The link is up, schedule a replay of everything the server has not acknowledged, up to what
+ * is still waiting in the queue.
+ */
+static void logstream_link_up(void)
+{
+    struct logstream_queued_s queued;
+
+    link_up = true;
+    if (xSemaphoreTake(xSemaphore, portMAX_DELAY) != pdTRUE)
+        return;
+    uint32_t end = log_buffer_last_index();
+    if (circ_peek(&queue, (char *)&queued, sizeof(queued)) == sizeof(queued))
+        end = queued.seq - 1;
+    xSemaphoreGive(xSemaphore);
+
+    if (end <= acked_index)
+        return;
+    replay_next = acked_index + 1;
+    replay_end = end;
+}
+
+static void logstream_disconnect(void)
+{
+    if (sock >= 0)
+        close(sock);
+    sock = -1;
+    link_up = false;
+    backoff_ms = backoff_ms ? MIN(backoff_ms * 2, BACKOFF_MAX_MS) : BACKOFF_MIN_MS;
+    next_connect = xTaskGetTickCount() + MS_TO_TICKS(backoff_ms);
+}
+
+static void logstream_connect(void)
+{
+    if (client_config.transport == LOGSTREAM_TRANSPORT_UDP) {
+        sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+        return;
+    }
+
+    if ((int32_t)(xTaskGetTickCount() - next_connect) < 0)
+        return;
+
+    sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) {
+        logstream_disconnect();
+        return;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+    int err = connect(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+    if (err < 0 && errno == EINPROGRESS) {
+        fd_set wfds;
+        FD_ZERO(&wfds);
+        FD_SET(sock, &wfds);
+        struct timeval timeout = {.tv_sec = CONNECT_TIMEOUT_MS / MS_PER_SEC};
+        socklen_t len = sizeof(err);
+        if (select(sock + 1, NULL, &wfds, NULL, &timeout) <= 0 || getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+            err = -1;
+    }
+    if (err != 0) {
+        logstream_disconnect();
+        return;
+    }
+
+    int nodelay = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &nodelay, sizeof(nodelay));
+    backoff_ms = 0;
+    rx_len = 0;
+    logstream_link_up();
+}
+
+static bool logstream_tcp_send(const char *buf, size_t len)
+{
+    while (len > 0) {
+        int n = send(sock, buf, len, MSG_DONTWAIT);
+        if (n > 0) {
+            buf += n;
+            len -= n;
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            return false;
+
+        // Socket buffer is full, give the peer a moment to catch up.
+        fd_set wfds;
+        FD_ZERO(&wfds);
+        FD_SET(sock, &wfds);
+        struct timeval timeout = {.tv_sec = SEND_TIMEOUT_MS / MS_PER_SEC};
+        if (select(sock + 1, NULL, &wfds, NULL, &timeout) <= 0)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Returns false if the datagram could not be sent. The connection is then closed, unless it was
+ * only too large after compression.
+ */
+static bool logstream_send_packet(struct logstream_encoder_s *enc)
+{
+    // No logging here, it would only feed the queue we are draining.
+    if (sock < 0)
+        return false;
+    if (enc->records == 0)
+        return true;
+
+    size_t len = enc->len;
+#if CONFIG_LOGGER_LOGSTREAM_COMPRESS
+    if (!logstream_compress_packet(enc, &len))
+        return false;
+#endif
+
+    if (client_config.transport == LOGSTREAM_TRANSPORT_UDP) {
+        // Without a route to the server, as before wifi is up, treat it like a lost connection.
+        if (sendto(sock, frame + LOGSTREAM_FRAME_HEADER_SIZE, len, 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0) {
+            logstream_disconnect();
+            return false;
+        }
+        if (!link_up)
+            logstream_link_up();
+        return true;
+    }
+
+    frame[0] = len >> 8;
+    frame[1] = len & 0xff;
+    if (!logstream_tcp_send(frame, LOGSTREAM_FRAME_HEADER_SIZE + len)) {
+        logstream_disconnect();
+        return false;
+    }
+    return true;
+}
+
+/*
+ * Drain the queue, packing as many entries as fits in each datagram. Entries stay in the queue
+ * until their datagram has been sent.
+ */
+static void logstream_send_queued(void)
+{
+    static char scratch[QUEUED_MAX_SIZE];
+    struct logstream_encoder_s enc;
+    struct logstream_record_s record;
+    size_t pending = 0;
+
+    logstream_packet_init(&enc, 0);
+    while (1) {
+        size_t size = logstream_peek_queued(scratch, &record, pending);
+        if (size && logstream_encode(&enc, &record)) {
+            pending += size;
+            continue;
+        }
+        if (size && enc.records == 0) {
+            // Too large for any datagram.
+            logstream_pull_queued(size);
+            if (xSemaphoreTake(xSemaphore, portMAX_DELAY) == pdTRUE) {
+                client_stats.dropped++;
+                xSemaphoreGive(xSemaphore);
+            }
+            continue;
+        }
+
+        // Datagram is full or the queue is drained. If the datagram did not fit after
+        // compression, its entries go out again in a smaller one.
+        bool sent = logstream_send_packet(&enc);
+        if (!sent && sock < 0)
+            return;
+        if (sent) {
+            logstream_pull_queued(pending);
+            if (!size)
+                return;
+        }
+        pending = 0;
+        logstream_packet_init(&enc, 0);
+    }
+}
+
+/*
+ * Send one datagram worth of entries from the log buffer, that did not fit in the queue.
+ */
+static void logstream_backfill(void)
+{
+    static struct log_entry_store_s store;
+    log_entry_t *entry = &store.entry;
+    struct logstream_encoder_s enc;
+    struct logstream_record_s record;
+
+    if (xSemaphoreTake(xSemaphore, portMAX_DELAY) != pdTRUE)
+        return;
+    uint32_t index = backfill_next - 1;
+    bool active = backfill_end != 0;
+    xSemaphoreGive(xSemaphore);
+    if (!active)
+        return;
+
+    struct logstream_skip_s skip = {};
+    uint32_t sent = index;
+    bool at_end = true;
+    logstream_packet_init(&enc, 0);
+    while (log_peek_entry(entry, &index)) {
+        if (!logstream_sends(entry)) {
+            logstream_skip_add(&skip, index);
+            continue;
+        }
+        logstream_record_from_entry(&record, entry, logstream_skipped(&skip, index));
+        if (!logstream_encode(&enc, &record)) {
+            at_end = false;
+            break;
+        }
+        sent = index;
+    }
+    if (!logstream_send_packet(&enc))
+        return;
+
+    if (xSemaphoreTake(xSemaphore, portMAX_DELAY) != pdTRUE)
+        return;
+    // At the end of the buffer, the queue takes over and any entries left out are counted there.
+    if (at_end && skip.last > sent) {
+        sent = skip.last;
+        queue_skip = skip;
+    }
+    backfill_next = sent + 1;
+    if (sent >= backfill_end)
+        backfill_end = 0;
+    xSemaphoreGive(xSemaphore);
+}
+
+/*
+ * Send one datagram of history from the log buffer, rate limited to leave room for live entries.
+ */
+static void logstream_replay(void)
+{
+    static struct log_entry_store_s store;
+    log_entry_t *entry = &store.entry;
+    struct logstream_encoder_s enc;
+    struct logstream_record_s record;
+
+    if (!replay_end || xTaskGetTickCount() - last_replay < MS_TO_TICKS(REPLAY_INTERVAL_MS))
+        return;
+    last_replay = xTaskGetTickCount();
+
+    uint32_t index = replay_next - 1;
+    uint32_t sent = index;
+    bool done = true;
+    logstream_packet_init(&enc, LOGSTREAM_FLAG_REPLAY);
+    while (log_peek_entry(entry, &index) && index <= replay_end) {
+        // Replayed entries are older than the live numbering, so gaps do not matter.
+        if (!logstream_sends(entry))
+            continue;
+        logstream_record_from_entry(&record, entry, 0);
+        if (!logstream_encode(&enc, &record)) {
+            done = false;
+            break;
+        }
+        sent = index;
+    }
+    if (!logstream_send_packet(&enc))
+        return;
+
+    replay_next = sent + 1;
+    if (done)
+        replay_end = 0;
+}
+
+/*
+ * Resend the entries asked for by the server, straight from the log buffer.
+ * Entries that have already been evicted from the buffer are lost.
+ */
+static void logstream_retransmit(const struct logstream_range_s *ranges, size_t n_ranges)
+{
+    static struct log_entry_store_s store;
+    log_entry_t *entry = &store.entry;
+    struct logstream_encoder_s enc;
+    struct logstream_record_s record;
+    size_t budget = RETRANSMIT_MAX_ENTRIES;
+
+    logstream_packet_init(&enc, 0);
+    for (size_t i = 0; i < n_ranges && budget > 0; i++) {
+        // What is about to be replayed anyway is not worth sending twice.
+        uint32_t index = ranges[i].first - 1;
+        if (replay_end)
+            index = MAX(index, replay_end);
+        struct logstream_skip_s skip = {};
+        while (budget > 0 && log_peek_entry(entry, &index)) {
+            // Past the range only to tell the server about entries at its end that were left out.
+            bool past = index - ranges[i].first >= ranges[i].len;
+            if (past && !logstream_skipped(&skip, index))
+                break;
+            if (!logstream_sends(entry)) {
+                logstream_skip_add(&skip, index);
+                continue;
+            }
+            logstream_record_from_entry(&record, entry, logstream_skipped(&skip, index));
+            if (!logstream_encode(&enc, &record)) {
+                if (!logstream_send_packet(&enc))
+                    return;
+                logstream_packet_init(&enc, 0);
+                logstream_encode(&enc, &record);
+            }
+            budget--;
+            if (past)
+                break;
+        }
+    }
+    logstream_send_packet(&enc);
+}
+
+static void logstream_handle_control_packet(const char *buf, size_t len)
+{
+    struct logstream_range_s ranges[LOGSTREAM_NACK_MAX_RANGES];
+    uint32_t control_session, seq;
+
+    size_t n_ranges = logstream_decode_nack(buf, len, &control_session, ranges, ARRAY_SIZE(ranges));
+    if (n_ranges > 0 && control_session == session)
+        logstream_retransmit(ranges, n_ranges);
+
+    if (logstream_decode_ack(buf, len, &control_session, &seq) && control_session == session && seq > acked_index)
+        acked_index = seq;
+}
+
+static void logstream_handle_control(void)
+{
+    int len;
+
+    if (client_config.transport == LOGSTREAM_TRANSPORT_UDP) {
+        while (sock >= 0 && (len = recv(sock, rx_buf, sizeof(rx_buf), MSG_DONTWAIT)) > 0)
+            logstream_handle_control_packet(rx_buf, len);
+        return;
+    }
+
+    // Collect frames from the stream.
+    while (sock >= 0 && (len = recv(sock, rx_buf + rx_len, sizeof(rx_buf) - rx_len, MSG_DONTWAIT)) != 0) {
+        if (len < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK)
+                logstream_disconnect();
+            return;
+        }
+        rx_len += len;
+        while (rx_len >= LOGSTREAM_FRAME_HEADER_SIZE) {
+            size_t frame_len = ((uint8_t)rx_buf[0] << 8) | (uint8_t)rx_buf[1];
+            if (frame_len > sizeof(rx_buf) - LOGSTREAM_FRAME_HEADER_SIZE) {
+                logstream_disconnect();
+                return;
+            }
+            if (rx_len < LOGSTREAM_FRAME_HEADER_SIZE + frame_len)
+                break;
+            logstream_handle_control_packet(rx_buf + LOGSTREAM_FRAME_HEADER_SIZE, frame_len);
+            rx_len -= LOGSTREAM_FRAME_HEADER_SIZE + frame_len;
+            memmove(rx_buf, rx_buf + LOGSTREAM_FRAME_HEADER_SIZE + frame_len, rx_len);
+        }
+    }
+
+    // Connection closed by the server.
+    if (sock >= 0)
+        logstream_disconnect();
+}
+
+static void logstream_client_task(void *pvParameters)
+{
+    TickType_t last_metrics = xTaskGetTickCount();
+
+    while (1) {
+        // Sleep until something is queued, then give more entries a chance to join the batch.
+        // Wake up now and then anyway, to serve retransmit requests and send from the log buffer.
+        uint32_t poll_ms = backfill_end ? client_config.flush_ms : replay_end ? REPLAY_INTERVAL_MS : LOGSTREAM_POLL_MS;
+        if (ulTaskNotifyTake(pdTRUE, MS_TO_TICKS(poll_ms))) {
+            TickType_t start = xTaskGetTickCount();
+            while (!flush_now && xTaskGetTickCount() - start < MS_TO_TICKS(client_config.flush_ms))
+                ulTaskNotifyTake(pdTRUE, MS_TO_TICKS(client_config.flush_ms) - (xTaskGetTickCount() - start));
+            flush_now = false;
+        }
+
+        // Queued like any other entry, so sent with the next datagram.
+        if (client_config.metrics_ms > 0 && xTaskGetTickCount() - last_metrics >= MS_TO_TICKS(client_config.metrics_ms)) {
+            last_metrics = xTaskGetTickCount();
+            log_metrics_report();
+        }
+
+        // While disconnected, entries wait in the queue for as long as there is room.
+        if (sock < 0)
+            logstream_connect();
+        if (sock < 0)
+            continue;
+
+        logstream_send_queued();
+        logstream_backfill();
+        logstream_replay();
+        logstream_handle_control();
+    }
+    vTaskDelete(NULL);
+}
+
+void logstream_client_stats(struct logstream_client_stats_s *stats)
+{
+    if (!xSemaphore || xSemaphoreTake(xSemaphore, portMAX_DELAY) != pdTRUE) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    *stats = client_stats;
+    xSemaphoreGive(xSemaphore);
+}
+
+void logstream_client_relay_stats(struct logstream_relay_stats_s *stats)
+{
+    if (!xSemaphore || xSemaphoreTake(xSemaphore, portMAX_DELAY) != pdTRUE) {
+        memset(stats, 0, sizeof(*stats));
+        return;
+    }
+    *stats = relay_stats;
+    xSemaphoreGive(xSemaphore);
+}
+
+static int cmd_logstream(int argc, char **argv)
+{
+    struct logstream_client_stats_s stats;
+    struct logstream_relay_stats_s relay;
+    logstream_client_stats(&stats);
+    logstream_client_relay_stats(&relay);
+    printf("%s, dropped %" PRIu32 "\n", sock >= 0 ? "connected" : "disconnected", stats.dropped);
+    if (client_config.relay)
+        printf("relayed %" PRIu32 ", dropped %" PRIu32 ", looped %" PRIu32 "\n", relay.relayed, relay.dropped, relay.looped);
+    return 0;
 }
 
 esp_err_t logstream_client_init(const logstream_client_config_t *config)
 {
+    client_config = *config;
 
     dest_addr.sin_addr.s_addr = inet_addr(config->host);
     dest_addr.sin_family = AF_INET;
     dest_addr.sin_port = htons(config->port);
 
-    ESP_LOGD(TAG, "Sending logs to logstream server %s:%d", config->host, config->port);
+    xSemaphore = xSemaphoreCreateMutexStatic(&xSemaphoreBuffer);
+    circ_init(&queue, queue_data, sizeof(queue_data));
+    session = esp_random();
+
+    if (xTaskCreate(logstream_client_task, "logstream_client", 3072, NULL, 5, &sender_task) != pdPASS)
+        return ESP_ERR_NO_MEM;
+
+    ESP_LOGD(TAG, "Sending logs to logstream server %s:%d over %s", config->host, config->port,
+             config->transport == LOGSTREAM_TRANSPORT_TCP ? "tcp" : "udp");
+
+    log_capture_register_named_handler("logstream", &send_logstream);
 
-    log_capture_register_handler(&send_logstream);
+    const esp_console_cmd_t logstream_cmd = {
+        .command = "logstream",
+        .help = "Print logstream client counters",
+        .hint = NULL,
+        .func = &cmd_logstream,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&logstream_cmd));
 
     return ESP_OK;
 }
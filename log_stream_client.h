@@ -1,14 +1,48 @@
 #pragma once
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #include "esp_err.h"
 
+enum logstream_transport_e {
+    LOGSTREAM_TRANSPORT_UDP,
+    LOGSTREAM_TRANSPORT_TCP, // One long lived connection, with length prefixed frames.
+};
+
+// What to do with new entries when the send queue backs up.
+enum logstream_overflow_e {
+    LOGSTREAM_OVERFLOW_DROP_LOWEST, // Drop verbose levels first as the queue fills up, errors last.
+    LOGSTREAM_OVERFLOW_BUFFER,      // Stop queueing, and send from the log buffer once the queue has drained.
+};
+
 struct logstream_client_config_s {
     const char *host;
     int port;
+    int flush_ms; // Max time an entry waits in the queue for more entries to share its datagram.
+    enum logstream_transport_e transport;
+    enum logstream_overflow_e overflow;
+    bool relay; // Also send the entries received by the logstream server, tagged with the device they came from.
+    int metrics_ms; // Send the lines logged per tag and level this often, see log_metrics.h. 0 to not send them.
 };
 
-#define LOGSTREAM_CLIENT_DEFAULTS { .port = 1514 }
+// Counters of the client, the sender task does not log about itself.
+struct logstream_client_stats_s {
+    uint32_t dropped; // Entries logged here that did not fit in the queue, or in any datagram.
+};
+
+// Counters of this hop, when relaying.
+struct logstream_relay_stats_s {
+    uint32_t relayed; // Received entries queued to be sent on.
+    uint32_t dropped; // Received entries that did not fit in the queue.
+    uint32_t looped;  // Received entries not sent on, as they had passed LOGSTREAM_MAX_HOPS servers already.
+};
+
+#define LOGSTREAM_CLIENT_DEFAULTS { .port = 1514, .flush_ms = CONFIG_LOGGER_LOGSTREAM_FLUSH_MS, .metrics_ms = CONFIG_LOGGER_METRICS_REPORT_S * 1000 }
 
 typedef struct logstream_client_config_s logstream_client_config_t;
 
 esp_err_t logstream_client_init(const logstream_client_config_t * config);
+void logstream_client_stats(struct logstream_client_stats_s *stats);
+void logstream_client_relay_stats(struct logstream_relay_stats_s *stats);
+
@@ -0,0 +1,476 @@
+
+#include <stddef.h>
+#include <string.h>
+
+#include "log_stream_codec.h"
+
+size_t logstream_put_varint(char *buf, uint64_t value)
+{
+    size_t len = 0;
+    while (value >= 0x80) {
+        buf[len++] = (char)(value | 0x80);
+        value >>= 7;
+    }
+    buf[len++] = (char)value;
+    return len;
+}
+
+/*
+ * Returns the number of bytes consumed, or 0 if the varint is truncated or too long.
+ */
+size_t logstream_get_varint(const char *buf, size_t len, uint64_t *value)
+{
+    uint64_t result = 0;
+    for (size_t i = 0; i < len && i < 10; i++) {
+        result |= (uint64_t)((uint8_t)buf[i] & 0x7f) << (7 * i);
+        if (!((uint8_t)buf[i] & 0x80)) {
+            *value = result;
+            return i + 1;
+        }
+    }
+    return 0;
+}
+
+static inline uint64_t zigzag_encode(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+static inline int64_t zigzag_decode(uint64_t value)
+{
+    return (int64_t)(value >> 1) ^ -(int64_t)(value & 1);
+}
+
+void logstream_encoder_init(struct logstream_encoder_s *enc, char *buf, size_t size, uint8_t flags, uint32_t session)
+{
+    memset(enc, 0, sizeof(*enc));
+    enc->buf = buf;
+    enc->size = size;
+    enc->flags = flags;
+    enc->buf[enc->len++] = LOGSTREAM_VERSION_2;
+    enc->buf[enc->len++] = flags;
+    if (flags & LOGSTREAM_FLAG_SEQ)
+        enc->len += logstream_put_varint(enc->buf + enc->len, session);
+}
+
+static size_t encode_string(struct logstream_encoder_s *enc, size_t pos, const char *str, size_t len)
+{
+    for (size_t i = 0; i < enc->n_strings; i++) {
+        if (enc->strings[i].len == len && memcmp(enc->strings[i].str, str, len) == 0)
+            return pos + logstream_put_varint(enc->buf + pos, (i << 1) | 1);
+    }
+
+    pos += logstream_put_varint(enc->buf + pos, len << 1);
+    memcpy(enc->buf + pos, str, len);
+    if (enc->n_strings < LOGSTREAM_DICT_SIZE) {
+        enc->strings[enc->n_strings].str = enc->buf + pos;
+        enc->strings[enc->n_strings].len = len;
+        enc->n_strings++;
+    }
+    return pos + len;
+}
+
+/*
+ * Append a record, returns false and leaves the encoder untouched if it does not fit.
+ */
+bool logstream_encode(struct logstream_encoder_s *enc, const struct logstream_record_s *record)
+{
+    uint32_t ext = (record->source_len ? LOGSTREAM_EXT_SOURCE : 0) | (record->skipped ? LOGSTREAM_EXT_SKIP : 0) | (record->kv ? LOGSTREAM_EXT_KV : 0) |
+                   (record->sampled ? LOGSTREAM_EXT_SAMPLED : 0);
+
+    // Worst case, without any dictionary hits.
+    size_t ext_size = ext ? LOGSTREAM_EXT_MAX_OVERHEAD + record->source_len : 0;
+    if (enc->len + LOGSTREAM_RECORD_MAX_OVERHEAD + ext_size + record->task_len + record->tag_len + record->data_len > enc->size)
+        return false;
+
+    size_t pos = enc->len;
+    enc->buf[pos++] = (record->level & LOGSTREAM_INFO_LEVEL_MASK) | ((record->core & LOGSTREAM_INFO_CORE_MASK) << LOGSTREAM_INFO_CORE_SHIFT) |
+                      (ext ? LOGSTREAM_INFO_EXT : 0);
+    if (ext) {
+        pos += logstream_put_varint(enc->buf + pos, ext);
+        if (ext & LOGSTREAM_EXT_SOURCE) {
+            pos = encode_string(enc, pos, record->source, record->source_len);
+            pos += logstream_put_varint(enc->buf + pos, record->hops);
+        }
+        if (ext & LOGSTREAM_EXT_SKIP)
+            pos += logstream_put_varint(enc->buf + pos, record->skipped);
+        if (ext & LOGSTREAM_EXT_SAMPLED)
+            pos += logstream_put_varint(enc->buf + pos, record->sampled);
+    }
+    if (enc->flags & LOGSTREAM_FLAG_SEQ)
+        pos += logstream_put_varint(enc->buf + pos, zigzag_encode((int32_t)(record->seq - enc->last_seq)));
+    pos += logstream_put_varint(enc->buf + pos, zigzag_encode((int64_t)(record->timestamp - enc->last_timestamp)));
+    pos = encode_string(enc, pos, record->task, record->task_len);
+    pos = encode_string(enc, pos, record->tag, record->tag_len);
+    pos += logstream_put_varint(enc->buf + pos, record->data_len);
+    memcpy(enc->buf + pos, record->data, record->data_len);
+    pos += record->data_len;
+
+    enc->len = pos;
+    enc->last_seq = record->seq;
+    enc->last_timestamp = record->timestamp;
+    enc->records++;
+    return true;
+}
+
+/*
+ * Returns the version of the datagram, or -1 if it can not be decoded.
+ * Version 1 datagrams are recognized, but left to the caller to parse.
+ */
+int logstream_decoder_init(struct logstream_decoder_s *dec, const char *buf, size_t len)
+{
+    memset(dec, 0, sizeof(*dec));
+    dec->buf = buf;
+    dec->len = len;
+    if (len < 1)
+        return -1;
+    dec->version = buf[0];
+    if (dec->version == LOGSTREAM_VERSION_1)
+        return dec->version;
+    if (dec->version != LOGSTREAM_VERSION_2 || len < LOGSTREAM_V2_HEADER_SIZE)
+        return -1;
+    dec->flags = buf[1];
+    dec->pos = LOGSTREAM_V2_HEADER_SIZE;
+    if (dec->flags & (LOGSTREAM_FLAG_CONTROL | LOGSTREAM_FLAG_COMPRESSED))
+        return -1;
+    if (dec->flags & LOGSTREAM_FLAG_SEQ) {
+        uint64_t session;
+        size_t n = logstream_get_varint(buf + dec->pos, len - dec->pos, &session);
+        if (!n)
+            return -1;
+        dec->session = session;
+        dec->pos += n;
+    }
+    return dec->version;
+}
+
+static bool decode_varint(struct logstream_decoder_s *dec, uint64_t *value)
+{
+    size_t n = logstream_get_varint(dec->buf + dec->pos, dec->len - dec->pos, value);
+    dec->pos += n;
+    return n > 0;
+}
+
+static bool decode_string(struct logstream_decoder_s *dec, const char **str, size_t *len)
+{
+    uint64_t value;
+    if (!decode_varint(dec, &value))
+        return false;
+
+    if (value & 1) {
+        if ((value >> 1) >= dec->n_strings)
+            return false;
+        *str = dec->strings[value >> 1].str;
+        *len = dec->strings[value >> 1].len;
+        return true;
+    }
+
+    if ((value >> 1) > dec->len - dec->pos)
+        return false;
+    *str = dec->buf + dec->pos;
+    *len = value >> 1;
+    dec->pos += *len;
+    if (dec->n_strings < LOGSTREAM_DICT_SIZE) {
+        dec->strings[dec->n_strings].str = *str;
+        dec->strings[dec->n_strings].len = *len;
+        dec->n_strings++;
+    }
+    return true;
+}
+
+/*
+ * Decode the next record, pointing into the datagram. Returns 1 on success, 0 at the end and -1 on errors.
+ */
+int logstream_decode(struct logstream_decoder_s *dec, struct logstream_record_s *record)
+{
+    if (dec->pos >= dec->len)
+        return 0;
+
+    uint8_t info = dec->buf[dec->pos++];
+    record->level = info & LOGSTREAM_INFO_LEVEL_MASK;
+    record->core = (info >> LOGSTREAM_INFO_CORE_SHIFT) & LOGSTREAM_INFO_CORE_MASK;
+
+    uint64_t value, ext = 0;
+    record->source = NULL;
+    record->source_len = 0;
+    record->hops = 0;
+    record->skipped = 0;
+    record->kv = false;
+    record->sampled = 0;
+    if ((info & LOGSTREAM_INFO_EXT) && !decode_varint(dec, &ext))
+        return -1;
+    // A sender using extensions we do not know needs a newer receiver.
+    if (ext & ~(uint64_t)(LOGSTREAM_EXT_SOURCE | LOGSTREAM_EXT_SKIP | LOGSTREAM_EXT_KV | LOGSTREAM_EXT_SAMPLED))
+        return -1;
+    if (ext & LOGSTREAM_EXT_SOURCE) {
+        if (!decode_string(dec, &record->source, &record->source_len) || !decode_varint(dec, &value))
+            return -1;
+        record->hops = value;
+    }
+    if (ext & LOGSTREAM_EXT_SKIP) {
+        if (!decode_varint(dec, &value) || value > UINT32_MAX)
+            return -1;
+        record->skipped = value;
+    }
+    record->kv = ext & LOGSTREAM_EXT_KV;
+    if (ext & LOGSTREAM_EXT_SAMPLED) {
+        if (!decode_varint(dec, &value))
+            return -1;
+        record->sampled = value > UINT16_MAX ? UINT16_MAX : value;
+    }
+
+    record->seq = 0;
+    if (dec->flags & LOGSTREAM_FLAG_SEQ) {
+        if (!decode_varint(dec, &value))
+            return -1;
+        record->seq = dec->last_seq + (uint32_t)zigzag_decode(value);
+        dec->last_seq = record->seq;
+    }
+    // Only numbers before this record can have been left out.
+    if (record->skipped > record->seq)
+        return -1;
+
+    if (!decode_varint(dec, &value))
+        return -1;
+    record->timestamp = dec->last_timestamp + (uint64_t)zigzag_decode(value);
+    dec->last_timestamp = record->timestamp;
+
+    if (!decode_string(dec, &record->task, &record->task_len))
+        return -1;
+    if (!decode_string(dec, &record->tag, &record->tag_len))
+        return -1;
+
+    if (!decode_varint(dec, &value) || value > dec->len - dec->pos)
+        return -1;
+    record->data = dec->buf + dec->pos;
+    record->data_len = value;
+    dec->pos += value;
+    return 1;
+}
+
+size_t logstream_encode_nack(char *buf, size_t size, uint32_t session, const struct logstream_range_s *ranges, size_t n_ranges)
+{
+    size_t len = 0;
+    if (size < 3 + 5 + 5 + n_ranges * 10)
+        return 0;
+    buf[len++] = LOGSTREAM_VERSION_2;
+    buf[len++] = LOGSTREAM_FLAG_CONTROL;
+    buf[len++] = LOGSTREAM_CONTROL_NACK;
+    len += logstream_put_varint(buf + len, session);
+    len += logstream_put_varint(buf + len, n_ranges);
+    for (size_t i = 0; i < n_ranges; i++) {
+        len += logstream_put_varint(buf + len, ranges[i].first);
+        len += logstream_put_varint(buf + len, ranges[i].len);
+    }
+    return len;
+}
+
+/*
+ * Check the control header, returns the control type and sets body to the offset of the
+ * type specific part. Returns -1 if this is not a control datagram.
+ */
+int logstream_decode_control(const char *buf, size_t len, uint32_t *session, size_t *body)
+{
+    if (len < 3 || buf[0] != LOGSTREAM_VERSION_2 || !(buf[1] & LOGSTREAM_FLAG_CONTROL))
+        return -1;
+
+    uint64_t value;
+    size_t n = logstream_get_varint(buf + 3, len - 3, &value);
+    if (!n)
+        return -1;
+    *session = value;
+    *body = 3 + n;
+    return (uint8_t)buf[2];
+}
+
+/*
+ * Returns the number of ranges decoded, 0 if the datagram is not a valid nack.
+ */
+size_t logstream_decode_nack(const char *buf, size_t len, uint32_t *session, struct logstream_range_s *ranges, size_t max_ranges)
+{
+    size_t pos, n;
+    if (logstream_decode_control(buf, len, session, &pos) != LOGSTREAM_CONTROL_NACK)
+        return 0;
+
+    uint64_t value, count;
+    if (!(n = logstream_get_varint(buf + pos, len - pos, &count)))
+        return 0;
+    pos += n;
+
+    size_t n_ranges = 0;
+    for (; n_ranges < count && n_ranges < max_ranges; n_ranges++) {
+        if (!(n = logstream_get_varint(buf + pos, len - pos, &value)))
+            return 0;
+        ranges[n_ranges].first = value;
+        pos += n;
+        if (!(n = logstream_get_varint(buf + pos, len - pos, &value)))
+            return 0;
+        ranges[n_ranges].len = value;
+        pos += n;
+    }
+    return n_ranges;
+}
+
+size_t logstream_encode_ack(char *buf, size_t size, uint32_t session, uint32_t seq)
+{
+    size_t len = 0;
+    if (size < LOGSTREAM_ACK_SIZE)
+        return 0;
+    buf[len++] = LOGSTREAM_VERSION_2;
+    buf[len++] = LOGSTREAM_FLAG_CONTROL;
+    buf[len++] = LOGSTREAM_CONTROL_ACK;
+    len += logstream_put_varint(buf + len, session);
+    len += logstream_put_varint(buf + len, seq);
+    return len;
+}
+
+bool logstream_decode_ack(const char *buf, size_t len, uint32_t *session, uint32_t *seq)
+{
+    size_t pos;
+    uint64_t value;
+    if (logstream_decode_control(buf, len, session, &pos) != LOGSTREAM_CONTROL_ACK)
+        return false;
+    if (!logstream_get_varint(buf + pos, len - pos, &value))
+        return false;
+    *seq = value;
+    return true;
+}
+
+static inline bool seq_bit(const struct logstream_seq_s *seq, uint32_t number)
+{
+    return seq->received[(number % LOGSTREAM_SEQ_WINDOW) / 32] & (1u << (number % 32));
+}
+
+static inline void seq_set_bit(struct logstream_seq_s *seq, uint32_t number, bool value)
+{
+    if (value)
+        seq->received[(number % LOGSTREAM_SEQ_WINDOW) / 32] |= 1u << (number % 32);
+    else
+        seq->received[(number % LOGSTREAM_SEQ_WINDOW) / 32] &= ~(1u << (number % 32));
+}
+
+static void seq_advance(struct logstream_seq_s *seq)
+{
+    while (seq->next <= seq->highest && seq_bit(seq, seq->next)) {
+        seq_set_bit(seq, seq->next, false);
+        seq->next++;
+    }
+}
+
+/*
+ * Give up on everything missing below new_next. The window only holds what was received, so a jump
+ * past all of it is counted in one step instead of walking every number.
+ */
+static void seq_give_up(struct logstream_seq_s *seq, uint32_t new_next)
+{
+    if (new_next - seq->next >= LOGSTREAM_SEQ_WINDOW) {
+        uint32_t received = 0;
+        for (size_t i = 0; i < sizeof(seq->received) / sizeof(seq->received[0]); i++)
+            received += __builtin_popcount(seq->received[i]);
+        seq->lost += new_next - seq->next - received;
+        memset(seq->received, 0, sizeof(seq->received));
+        seq->next = new_next;
+        return;
+    }
+    while (seq->next < new_next) {
+        if (!seq_bit(seq, seq->next))
+            seq->lost++;
+        seq_set_bit(seq, seq->next, false);
+        seq->next++;
+    }
+}
+
+/*
+ * Record that number was received. Returns false for duplicates, and numbers that were already given up on.
+ */
+bool logstream_seq_receive(struct logstream_seq_s *seq, uint32_t session, uint32_t number)
+{
+    // A new session means the sender restarted its numbering.
+    if (!seq->started || seq->session != session) {
+        memset(seq->received, 0, sizeof(seq->received));
+        seq->started = true;
+        seq->session = session;
+        seq->next = number + 1;
+        seq->highest = number;
+        return true;
+    }
+
+    if (number < seq->next)
+        return false;
+
+    // Too far ahead, give up on whatever falls out of the window.
+    if (number - seq->next >= LOGSTREAM_SEQ_WINDOW)
+        seq_give_up(seq, number - LOGSTREAM_SEQ_WINDOW + 1);
+
+    if (seq_bit(seq, number))
+        return false;
+    seq_set_bit(seq, number, true);
+    if (number > seq->highest)
+        seq->highest = number;
+    seq_advance(seq);
+    return true;
+}
+
+/*
+ * List the gaps between what has been received in order and the highest number seen.
+ */
+size_t logstream_seq_missing(const struct logstream_seq_s *seq, struct logstream_range_s *ranges, size_t max_ranges)
+{
+    size_t n_ranges = 0;
+    if (!seq->started)
+        return 0;
+
+    for (uint32_t number = seq->next; number < seq->highest && n_ranges < max_ranges; number++) {
+        if (seq_bit(seq, number))
+            continue;
+        if (n_ranges > 0 && ranges[n_ranges - 1].first + ranges[n_ranges - 1].len == number) {
+            ranges[n_ranges - 1].len++;
+        } else {
+            ranges[n_ranges].first = number;
+            ranges[n_ranges].len = 1;
+            n_ranges++;
+        }
+    }
+    return n_ranges;
+}
+
+/*
+ * Stop waiting for the oldest gap, and count it as lost.
+ */
+void logstream_seq_skip_gap(struct logstream_seq_s *seq)
+{
+    if (!seq->started || seq->next >= seq->highest)
+        return;
+    while (seq->next < seq->highest && !seq_bit(seq, seq->next)) {
+        seq->lost++;
+        seq->next++;
+    }
+    seq_advance(seq);
+}
+
+/*
+ * Mark numbers the sender left out on purpose as received, so they are neither asked for nor counted as lost.
+ */
+void logstream_seq_skip(struct logstream_seq_s *seq, uint32_t session, uint32_t first, uint32_t count)
+{
+    uint32_t end = first + count;
+    if (!seq->started || seq->session != session || end <= seq->next)
+        return;
+
+    // A range that fills the window pushes out whatever is missing before it, and leaves nothing pending.
+    uint32_t start = first > seq->next ? first : seq->next;
+    if (end - start >= LOGSTREAM_SEQ_WINDOW)
+        seq_give_up(seq, start);
+
+    for (uint32_t number = start; number != end; number++) {
+        // Nothing is missing before the rest of the range, and nothing pending beyond it.
+        if (number == seq->next && seq->highest < end) {
+            memset(seq->received, 0, sizeof(seq->received));
+            seq->next = end;
+            seq->highest = end - 1;
+            return;
+        }
+        // A gap before the range ends this within a window, when it is given up on.
+        logstream_seq_receive(seq, session, number);
+    }
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Logstream version 2 wire format, shared by the stream client, the stream server and host tools.
+ * It only depends on the C library, so it builds anywhere.
+ *
+ * Datagram:
+ *   u8 version (2), u8 flags, then records until the end of the datagram.
+ *   With LOGSTREAM_FLAG_SEQ the header is followed by a varint session id, that changes on every boot.
+ * Record:
+ *   u8 info: level in bit 0-2, core in bit 3-6, bit 7 set if a varint of LOGSTREAM_EXT_* flags follows.
+ *   The fields of the extensions present, in the order of their flags.
+ *   With LOGSTREAM_FLAG_SEQ, varint zigzag sequence delta from the previous record, the first is relative to 0.
+ *   varint zigzag timestamp delta from the previous record in the datagram, the first is relative to 0.
+ *   string task, string tag.
+ *   varint data length, data.
+ * String:
+ *   varint (length << 1) followed by the bytes, or (index << 1 | 1) referencing the index:th
+ *   string sent earlier in the same datagram.
+ *
+ * Control datagrams, sent from the server back to the client, have LOGSTREAM_FLAG_CONTROL set:
+ *   u8 version (2), u8 flags, u8 type, varint session id, then a type specific body.
+ *   LOGSTREAM_CONTROL_NACK: varint count, then count ranges of varint first sequence and varint length.
+ *   LOGSTREAM_CONTROL_ACK: varint sequence, everything up to and including it has been received.
+ *
+ * Over TCP every datagram is sent as a frame, prefixed with its length as a big endian u16.
+ */
+
+#define LOGSTREAM_VERSION_1 1
+#define LOGSTREAM_VERSION_2 2
+
+#define LOGSTREAM_V2_HEADER_SIZE 2
+#define LOGSTREAM_FRAME_HEADER_SIZE 2
+#define LOGSTREAM_V2_MAX_HEADER_SIZE (LOGSTREAM_V2_HEADER_SIZE + 5)
+#define LOGSTREAM_DICT_SIZE 16
+
+#define LOGSTREAM_FLAG_SEQ 0x01
+#define LOGSTREAM_FLAG_REPLAY 0x02 // Records are history sent after a reconnect, older than the live sequence.
+#define LOGSTREAM_FLAG_COMPRESSED 0x04 // See log_stream_compress.h, decompress before decoding.
+#define LOGSTREAM_FLAG_CONTROL 0x80
+
+#define LOGSTREAM_CONTROL_NACK 1
+#define LOGSTREAM_CONTROL_ACK 2
+
+// Number of sequence numbers a receiver tracks for gaps and reordering.
+#define LOGSTREAM_SEQ_WINDOW 256
+#define LOGSTREAM_NACK_MAX_RANGES 16
+#define LOGSTREAM_NACK_MAX_SIZE (3 + 5 + 5 + LOGSTREAM_NACK_MAX_RANGES * 10)
+#define LOGSTREAM_ACK_SIZE (3 + 5 + 5)
+
+#define LOGSTREAM_INFO_LEVEL_MASK 0x07
+#define LOGSTREAM_INFO_CORE_SHIFT 3
+#define LOGSTREAM_INFO_CORE_MASK 0x0f
+#define LOGSTREAM_INFO_EXT 0x80
+
+// Relayed record: string name of the device it was logged on, varint number of servers it has passed.
+#define LOGSTREAM_EXT_SOURCE 0x01
+// Varint count of sequence numbers right before this record, that the sender left out on purpose.
+#define LOGSTREAM_EXT_SKIP 0x02
+// No fields, the data is key-value fields from log_kv(), see log_kv_codec.h.
+#define LOGSTREAM_EXT_KV 0x04
+// Varint count of lines of the same tag dropped by sampling on the device right before this record.
+#define LOGSTREAM_EXT_SAMPLED 0x08
+
+// Relays stop forwarding records that have passed this many servers, in case they form a loop.
+#define LOGSTREAM_MAX_HOPS 8
+
+// Largest possible record overhead besides strings and data, and that of the extensions besides the source.
+#define LOGSTREAM_RECORD_MAX_OVERHEAD (1 + 5 + 10 + 3 + 3 + 5)
+#define LOGSTREAM_EXT_MAX_OVERHEAD (1 + 3 + 5 + 5 + 3)
+
+struct logstream_record_s {
+    uint32_t seq; // Zero if the sender does not number its records.
+    uint8_t level;
+    uint8_t core;
+    uint64_t timestamp;
+    const char *task;
+    size_t task_len;
+    const char *tag;
+    size_t tag_len;
+    const char *data;
+    size_t data_len;
+    const char *source; // Set on relayed records only.
+    size_t source_len;
+    uint32_t hops;
+    uint32_t skipped;
+    bool kv;
+    uint16_t sampled;
+};
+
+struct logstream_string_s {
+    const char *str;
+    size_t len;
+};
+
+struct logstream_encoder_s {
+    char *buf;
+    size_t size;
+    size_t len;
+    size_t records;
+    uint8_t flags;
+    uint32_t last_seq;
+    uint64_t last_timestamp;
+    size_t n_strings;
+    struct logstream_string_s strings[LOGSTREAM_DICT_SIZE];
+};
+
+struct logstream_decoder_s {
+    const char *buf;
+    size_t len;
+    size_t pos;
+    uint8_t version;
+    uint8_t flags;
+    uint32_t session;
+    uint32_t last_seq;
+    uint64_t last_timestamp;
+    size_t n_strings;
+    struct logstream_string_s strings[LOGSTREAM_DICT_SIZE];
+};
+
+size_t logstream_put_varint(char *buf, uint64_t value);
+size_t logstream_get_varint(const char *buf, size_t len, uint64_t *value);
+
+struct logstream_range_s {
+    uint32_t first;
+    uint32_t len;
+};
+
+/*
+ * Receiver side sequence tracking, over a sliding window of LOGSTREAM_SEQ_WINDOW numbers.
+ * Everything below next has been received or given up on.
+ */
+struct logstream_seq_s {
+    bool started;
+    uint32_t session;
+    uint32_t next;
+    uint32_t highest;
+    uint32_t lost;
+    uint32_t received[LOGSTREAM_SEQ_WINDOW / 32];
+};
+
+void logstream_encoder_init(struct logstream_encoder_s *enc, char *buf, size_t size, uint8_t flags, uint32_t session);
+bool logstream_encode(struct logstream_encoder_s *enc, const struct logstream_record_s *record);
+
+int logstream_decoder_init(struct logstream_decoder_s *dec, const char *buf, size_t len);
+int logstream_decode(struct logstream_decoder_s *dec, struct logstream_record_s *record);
+
+int logstream_decode_control(const char *buf, size_t len, uint32_t *session, size_t *body);
+size_t logstream_encode_nack(char *buf, size_t size, uint32_t session, const struct logstream_range_s *ranges, size_t n_ranges);
+size_t logstream_decode_nack(const char *buf, size_t len, uint32_t *session, struct logstream_range_s *ranges, size_t max_ranges);
+size_t logstream_encode_ack(char *buf, size_t size, uint32_t session, uint32_t seq);
+bool logstream_decode_ack(const char *buf, size_t len, uint32_t *session, uint32_t *seq);
+
+bool logstream_seq_receive(struct logstream_seq_s *seq, uint32_t session, uint32_t number);
+size_t logstream_seq_missing(const struct logstream_seq_s *seq, struct logstream_range_s *ranges, size_t max_ranges);
+void logstream_seq_skip_gap(struct logstream_seq_s *seq);
+void logstream_seq_skip(struct logstream_seq_s *seq, uint32_t session, uint32_t first, uint32_t count);
@@ -1,6 +1,12 @@
-
 #pragma once
 
+#define LOGSTREAM_MAX_PACKET_SIZE 1400 // mtu minus some overhead
+
+/*
+ * Version 1 entry. A datagram carries one or more entries back to back,
+ * each one cut after data_len bytes of data. Still accepted by the server,
+ * the client sends the version 2 format from log_stream_codec.h.
+ */
 struct log_stream_entry_s {
     uint8_t log_stream_version;
     uint8_t core;
@@ -14,3 +20,5 @@ struct log_stream_entry_s {
 }  __attribute__((packed));
 
 typedef struct log_stream_entry_s log_stream_entry_t;
+
+#define LOGSTREAM_ENTRY_HEADER_SIZE offsetof(log_stream_entry_t, data)
@@ -0,0 +1,233 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "log_stream_compress.h"
+
+/*
+ * Task names, tags and words that show up in most logs. Strings are prefixed with their encoded
+ * length, like in records, so a match can start at the length.
+ */
+static const char dictionary[] = "\x08" "main" "\x08" "IDLE" "\x06" "tiT" "\x0e" "sys_evt" "\x12" "esp_timer" "\x08" "wifi"
+                                 "\x10" "phy_init" "\x12" "cpu_start" "\x12" "heap_init" "\x12" "spi_flash" "\x0a" "netif" "\x0a" "event"
+                                 "\x06" "nvs" "\x24" "esp_netif_handlers" "\x16" "mqtt_client" "\x16" "HTTP_CLIENT" "\x0a" "httpd"
+                                 "\x12" "logstream" "\x0c" "syslog" "\x14" "system_api"
+                                 "Initializing Starting started stopped Connected connected disconnected "
+                                 "Disconnected reconnect retry timeout Failed to failed error Error: "
+                                 "ESP_ERR_ ESP_OK ESP_FAIL received sending sent bytes free heap: "
+                                 "memory 0x00000000 state: status: channel rssi sta ip: , mask: , gw: "
+                                 "address port version config enabled disabled  ms (ms) done: ";
+
+#define DICT_LEN (sizeof(dictionary) - 1)
+#define MIN_MATCH 4
+#define MAX_OFFSET 0xffff
+
+// Read from the dictionary followed by the source, as one window.
+static inline uint8_t window_byte(const char *src, size_t pos)
+{
+    return pos < DICT_LEN ? (uint8_t)dictionary[pos] : (uint8_t)src[pos - DICT_LEN];
+}
+
+static inline uint32_t window_u32(const char *src, size_t pos)
+{
+    if (pos >= DICT_LEN) {
+        uint32_t value;
+        memcpy(&value, src + pos - DICT_LEN, sizeof(value));
+        return value;
+    }
+    return window_byte(src, pos) | window_byte(src, pos + 1) << 8 | window_byte(src, pos + 2) << 16 | (uint32_t)window_byte(src, pos + 3) << 24;
+}
+
+static inline uint32_t hash(uint32_t value)
+{
+    return (value * 2654435761u) >> (32 - LOGSTREAM_COMPRESS_HASH_BITS);
+}
+
+static size_t put_length(char *dst, size_t pos, size_t size, size_t len)
+{
+    for (; len >= 255; len -= 255) {
+        if (pos >= size)
+            return 0;
+        dst[pos++] = (char)255;
+    }
+    if (pos >= size)
+        return 0;
+    dst[pos++] = len;
+    return pos;
+}
+
+/*
+ * Emit one sequence, returns the new position or 0 if it does not fit.
+ */
+static size_t put_sequence(char *dst, size_t pos, size_t size, const char *literals, size_t n_literals, size_t offset, size_t match_len)
+{
+    if (pos >= size)
+        return 0;
+    size_t token = pos++;
+    dst[token] = (n_literals < 15 ? n_literals : 15) << 4;
+    if (n_literals >= 15 && !(pos = put_length(dst, pos, size, n_literals - 15)))
+        return 0;
+    if (n_literals > size - pos)
+        return 0;
+    memcpy(dst + pos, literals, n_literals);
+    pos += n_literals;
+
+    if (!match_len)
+        return pos;
+    if (size - pos < 2)
+        return 0;
+    dst[pos++] = offset & 0xff;
+    dst[pos++] = offset >> 8;
+    match_len -= MIN_MATCH;
+    dst[token] |= match_len < 15 ? match_len : 15;
+    if (match_len >= 15 && !(pos = put_length(dst, pos, size, match_len - 15)))
+        return 0;
+    return pos;
+}
+
+/*
+ * Greedy single pass compression, returns the compressed size or 0 if it does not fit in size.
+ */
+size_t logstream_compress(struct logstream_compressor_s *c, const char *src, size_t len, char *dst, size_t size)
+{
+    size_t end = DICT_LEN + len;
+    size_t pos = 0;
+    if (len > LOGSTREAM_MAX_RAW_SIZE)
+        return 0;
+
+    // Table entries are window positions + 1, 0 is empty.
+    memset(c->table, 0, sizeof(c->table));
+    for (size_t i = 0; i + MIN_MATCH <= DICT_LEN; i++)
+        c->table[hash(window_u32(src, i))] = i + 1;
+
+    size_t ip = DICT_LEN;
+    size_t anchor = ip;
+    while (ip + MIN_MATCH <= end) {
+        uint32_t value = window_u32(src, ip);
+        uint32_t h = hash(value);
+        size_t candidate = c->table[h];
+        c->table[h] = ip + 1;
+        if (!candidate || ip - (candidate - 1) > MAX_OFFSET || window_u32(src, candidate - 1) != value) {
+            ip++;
+            continue;
+        }
+
+        candidate--;
+        size_t match_len = MIN_MATCH;
+        while (ip + match_len < end && window_byte(src, candidate + match_len) == window_byte(src, ip + match_len))
+            match_len++;
+
+        pos = put_sequence(dst, pos, size, src + anchor - DICT_LEN, ip - anchor, ip - candidate, match_len);
+        if (!pos)
+            return 0;
+
+        for (size_t i = ip + 1; i < ip + match_len && i + MIN_MATCH <= end; i++)
+            c->table[hash(window_u32(src, i))] = i + 1;
+        ip += match_len;
+        anchor = ip;
+    }
+
+    return put_sequence(dst, pos, size, src + anchor - DICT_LEN, end - anchor, 0, 0);
+}
+
+static bool get_length(const char *src, size_t len, size_t *pos, size_t *value)
+{
+    uint8_t byte;
+    do {
+        if (*pos >= len)
+            return false;
+        byte = src[(*pos)++];
+        *value += byte;
+    } while (byte == 255);
+    return true;
+}
+
+/*
+ * Returns the decompressed size, or 0 if the block is malformed or does not fit in size.
+ */
+size_t logstream_decompress(const char *src, size_t len, char *dst, size_t size)
+{
+    size_t ip = 0, op = 0;
+    while (ip < len) {
+        uint8_t token = src[ip++];
+
+        size_t n_literals = token >> 4;
+        if (n_literals == 15 && !get_length(src, len, &ip, &n_literals))
+            return 0;
+        if (n_literals > len - ip || n_literals > size - op)
+            return 0;
+        memcpy(dst + op, src + ip, n_literals);
+        ip += n_literals;
+        op += n_literals;
+        if (ip == len)
+            break;
+
+        if (len - ip < 2)
+            return 0;
+        size_t offset = (uint8_t)src[ip] | (uint8_t)src[ip + 1] << 8;
+        ip += 2;
+        size_t match_len = token & 0x0f;
+        if (match_len == 15 && !get_length(src, len, &ip, &match_len))
+            return 0;
+        match_len += MIN_MATCH;
+        if (!offset || offset > op + DICT_LEN || match_len > size - op)
+            return 0;
+
+        // Byte by byte, matches may overlap what they produce.
+        for (size_t i = 0; i < match_len; i++, op++)
+            dst[op] = offset > op ? dictionary[DICT_LEN - (offset - op)] : dst[op - offset];
+    }
+    return op;
+}
+
+static size_t header_size(const char *buf, size_t len)
+{
+    if (len < LOGSTREAM_V2_HEADER_SIZE || buf[0] != LOGSTREAM_VERSION_2)
+        return 0;
+    if (!(buf[1] & LOGSTREAM_FLAG_SEQ))
+        return LOGSTREAM_V2_HEADER_SIZE;
+
+    uint64_t session;
+    size_t n = logstream_get_varint(buf + LOGSTREAM_V2_HEADER_SIZE, len - LOGSTREAM_V2_HEADER_SIZE, &session);
+    return n ? LOGSTREAM_V2_HEADER_SIZE + n : 0;
+}
+
+/*
+ * Compress an encoded datagram into out. Returns the compressed size, or 0 if it does not fit
+ * in size or would not get any smaller.
+ */
+size_t logstream_compress_datagram(struct logstream_compressor_s *c, const char *buf, size_t len, char *out, size_t size)
+{
+    size_t header = header_size(buf, len);
+    if (!header || (buf[1] & (LOGSTREAM_FLAG_CONTROL | LOGSTREAM_FLAG_COMPRESSED)) || size < header + 5)
+        return 0;
+
+    memcpy(out, buf, header);
+    out[1] |= LOGSTREAM_FLAG_COMPRESSED;
+    size_t pos = header + logstream_put_varint(out + header, len - header);
+
+    size_t n = logstream_compress(c, buf + header, len - header, out + pos, (size < len ? size : len) - pos);
+    return n ? pos + n : 0;
+}
+
+/*
+ * Restore a compressed datagram into out, as it was before compression. Returns its size,
+ * or 0 if it is malformed or does not fit in size.
+ */
+size_t logstream_decompress_datagram(const char *buf, size_t len, char *out, size_t size)
+{
+    size_t header = header_size(buf, len);
+    if (!header || !(buf[1] & LOGSTREAM_FLAG_COMPRESSED) || (buf[1] & LOGSTREAM_FLAG_CONTROL) || size < header)
+        return 0;
+
+    uint64_t raw_len;
+    size_t n = logstream_get_varint(buf + header, len - header, &raw_len);
+    if (!n || raw_len > size - header)
+        return 0;
+
+    memcpy(out, buf, header);
+    out[1] &= ~LOGSTREAM_FLAG_COMPRESSED;
+    if (logstream_decompress(buf + header + n, len - header - n, out + header, raw_len) != raw_len)
+        return 0;
+    return header + raw_len;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "log_stream_codec.h"
+
+/*
+ * Optional compression of logstream version 2 datagrams, plain C like the codec.
+ *
+ * A compressed datagram has LOGSTREAM_FLAG_COMPRESSED set. The header, up to and including the
+ * session, is left as is and followed by a varint length of the uncompressed records, then the
+ * records as one LZ77 block in the LZ4 block layout:
+ *   u8 token: literal length in the high nibble, match length - 4 in the low nibble.
+ *   A nibble of 15 is followed by bytes adding to it, until one is below 255.
+ *   Literals, then u16 little endian match offset, except in the last sequence that only has literals.
+ * Matches may reach back into a dictionary of common log text, that both sides have built in and that
+ * precedes the block. The dictionary is part of the wire format and must never change.
+ */
+
+// Largest uncompressed datagram, bounds the buffers on both sides.
+#define LOGSTREAM_MAX_RAW_SIZE 4096
+
+#define LOGSTREAM_COMPRESS_HASH_BITS 10
+
+struct logstream_compressor_s {
+    uint16_t table[1 << LOGSTREAM_COMPRESS_HASH_BITS];
+};
+
+size_t logstream_compress(struct logstream_compressor_s *c, const char *src, size_t len, char *dst, size_t size);
+size_t logstream_decompress(const char *src, size_t len, char *dst, size_t size);
+
+size_t logstream_compress_datagram(struct logstream_compressor_s *c, const char *buf, size_t len, char *out, size_t size);
+size_t logstream_decompress_datagram(const char *buf, size_t len, char *out, size_t size);
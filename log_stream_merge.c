@@ -0,0 +1,145 @@
+#include <string.h>
+
+#include "esp_timer.h"
+
+#include "log_common.h"
+#include "log_stream_merge.h"
+
+// Offsets are the smallest seen over the last one to two windows, so they follow drift and clocks being set.
+#define CLOCK_WINDOW_MS (10 * MS_PER_SEC)
+
+int64_t logstream_merge_now(void)
+{
+    return esp_timer_get_time() / US_PER_MS;
+}
+
+int64_t logstream_clock_correct(struct logstream_clock_s *clock, uint64_t timestamp, int64_t now)
+{
+    int64_t offset = now - (int64_t)timestamp;
+    if (!clock->valid || now - clock->window_start >= 2 * CLOCK_WINDOW_MS) {
+        clock->offset[0] = clock->offset[1] = offset;
+        clock->window_start = now;
+        clock->valid = true;
+    } else if (now - clock->window_start >= CLOCK_WINDOW_MS) {
+        clock->offset[1] = clock->offset[0];
+        clock->offset[0] = offset;
+        clock->window_start = now;
+    } else if (offset < clock->offset[0]) {
+        clock->offset[0] = offset;
+    }
+    return (int64_t)timestamp + MIN(clock->offset[0], clock->offset[1]);
+}
+
+#if CONFIG_LOGGER_LOGSTREAM_SERVER_MERGE_MS
+
+/*
+ * A min heap on corrected time of the queued entries, ties broken by arrival so the entries of
+ * one device stay in the order it sent them. Entries stay in their slot, only the nodes move.
+ */
+struct merge_node_s {
+    int64_t time;
+    uint32_t order;
+    uint16_t slot;
+};
+
+static struct log_entry_store_s slots[CONFIG_LOGGER_LOGSTREAM_SERVER_MERGE_ENTRIES];
+static uint16_t free_slots[CONFIG_LOGGER_LOGSTREAM_SERVER_MERGE_ENTRIES];
+static size_t n_free;
+static size_t n_slots_used;
+static struct merge_node_s heap[CONFIG_LOGGER_LOGSTREAM_SERVER_MERGE_ENTRIES];
+static size_t heap_len;
+static uint32_t order;
+static int64_t released_time = INT64_MIN;
+
+static bool merge_before(const struct merge_node_s *a, const struct merge_node_s *b)
+{
+    return a->time < b->time || (a->time == b->time && (int32_t)(a->order - b->order) < 0);
+}
+
+static void merge_sift_up(size_t i)
+{
+    struct merge_node_s node = heap[i];
+    while (i > 0 && merge_before(&node, &heap[(i - 1) / 2])) {
+        heap[i] = heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    heap[i] = node;
+}
+
+static void merge_sift_down(size_t i)
+{
+    struct merge_node_s node = heap[i];
+    while (2 * i + 1 < heap_len) {
+        size_t child = 2 * i + 1;
+        if (child + 1 < heap_len && merge_before(&heap[child + 1], &heap[child]))
+            child++;
+        if (!merge_before(&heap[child], &node))
+            break;
+        heap[i] = heap[child];
+        i = child;
+    }
+    heap[i] = node;
+}
+
+static void merge_pop(void)
+{
+    struct merge_node_s top = heap[0];
+    heap[0] = heap[--heap_len];
+    if (heap_len)
+        merge_sift_down(0);
+
+    released_time = top.time;
+    log_capture_send_log(&slots[top.slot].entry);
+    free_slots[n_free++] = top.slot;
+}
+
+bool logstream_merge_push(log_entry_t *entry, int64_t time, int64_t now)
+{
+    // Make room by letting the oldest go early, memory is bounded rather than latency.
+    if (heap_len == ARRAY_SIZE(heap))
+        merge_pop();
+
+    // Entries older than what has already been passed on can not be put in order any more.
+    if (time < released_time) {
+        log_capture_send_log(entry);
+        return false;
+    }
+
+    uint16_t slot = n_free ? free_slots[--n_free] : n_slots_used++;
+    log_entry_copy(&slots[slot].entry, entry);
+    heap[heap_len] = (struct merge_node_s){.time = time, .order = order++, .slot = slot};
+    merge_sift_up(heap_len++);
+    return true;
+}
+
+void logstream_merge_release(int64_t now, bool flush)
+{
+    while (heap_len && (flush || heap[0].time + CONFIG_LOGGER_LOGSTREAM_SERVER_MERGE_MS <= now))
+        merge_pop();
+}
+
+int64_t logstream_merge_next(int64_t now)
+{
+    if (!heap_len)
+        return -1;
+    return MAX(heap[0].time + CONFIG_LOGGER_LOGSTREAM_SERVER_MERGE_MS - now, 0);
+}
+
+#else
+
+bool logstream_merge_push(log_entry_t *entry, int64_t time, int64_t now)
+{
+    log_capture_send_log(entry);
+    return true;
+}
+
+void logstream_merge_release(int64_t now, bool flush)
+{
+}
+
+int64_t logstream_merge_next(int64_t now)
+{
+    return -1;
+}
+
+#endif
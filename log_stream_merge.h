@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "log_capture.h"
+
+/*
+ * Time ordered merge of the entries received from several devices.
+ *
+ * Every device has its own clock, so an entry is ordered by its timestamp corrected to our clock.
+ * The offset of a device is the smallest difference between arrival and timestamp seen recently,
+ * that of the entry that was the least delayed by the client and the network. Entries are held
+ * until their corrected time is CONFIG_LOGGER_LOGSTREAM_SERVER_MERGE_MS old, then passed on to
+ * log_capture_send_log oldest first.
+ */
+
+struct logstream_clock_s {
+    int64_t offset[2]; // Smallest arrival - timestamp in the current and the previous window.
+    int64_t window_start;
+    bool valid;
+};
+
+// Our clock, in ms.
+int64_t logstream_merge_now(void);
+
+// Estimate the offset of a device from an entry that arrived now, and return its corrected time.
+int64_t logstream_clock_correct(struct logstream_clock_s *clock, uint64_t timestamp, int64_t now);
+
+// Queue an entry, returns false if it came too late to be put in order and was sent right away.
+bool logstream_merge_push(log_entry_t *entry, int64_t time, int64_t now);
+
+// Send the entries that have waited long enough, all of them if flush is set.
+void logstream_merge_release(int64_t now, bool flush);
+
+// How long until logstream_merge_release has something to send, -1 if nothing is queued.
+int64_t logstream_merge_next(int64_t now);
@@ -1,11 +1,13 @@
 
 
 #include <ctype.h>
+#include <inttypes.h>
 #include <lwip/netdb.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <sys/queue.h>
 
+#include "esp_console.h"
 #include "esp_log.h"
 
 #include "freertos/FreeRTOS.h"
@@ -13,7 +15,11 @@
 
 #include "log_capture.h"
 #include "log_common.h"
+#include "log_stream_client.h"
+#include "log_stream_codec.h"
 #include "log_stream_common.h"
+#include "log_stream_compress.h"
+#include "log_stream_merge.h"
 #include "log_stream_server.h"
 #include "lwip/err.h"
 #include "lwip/sockets.h"
@@ -23,9 +29,283 @@ logstream_server_config_t server_config;
 
 static const char *TAG = "logstream_server";
 
+#define NACK_INTERVAL_MS 200
+#define NACK_MAX_ROUNDS 3
+#define RATE_INTERVAL_MS 1000
+// Datagrams handled before following up on gaps, when they keep coming.
+#define BATCH_MAX_PACKETS 32
+
+/*
+ * State kept for every client sending to us, used to find gaps in the sequence numbers,
+ * ask the client to resend them and acknowledge what has arrived. Entries are tagged with
+ * the address of the source, so the sinks can tell devices apart, and merged in
+ * order of their timestamps corrected by the clock offset of the source.
+ */
+struct logstream_source_s {
+    struct sockaddr_in addr;
+    char name[INET_ADDRSTRLEN];
+    uint32_t packets;
+    uint32_t entries;
+    uint32_t bytes;
+    uint32_t duplicates;
+    uint32_t malformed;
+    uint32_t late; // Entries that came too late to be merged in order.
+    uint32_t rate; // Entries per second.
+    uint32_t rate_entries;
+    TickType_t rate_start;
+    TickType_t last_seen;
+    TickType_t last_nack;
+    TickType_t last_ack;
+    uint32_t nack_next; // seq.next when the last nack was sent.
+    uint32_t acked;     // Last seq acknowledged.
+    uint8_t nack_rounds;
+    struct logstream_seq_s seq;
+    struct logstream_clock_s clock;
+};
+
+static struct logstream_source_s sources[CONFIG_LOGGER_LOGSTREAM_SERVER_MAX_SOURCES];
+
+static struct logstream_source_s *logstream_server_get_source(const struct sockaddr_in *addr)
+{
+    struct logstream_source_s *oldest = &sources[0];
+    for (size_t i = 0; i < ARRAY_SIZE(sources); i++) {
+        struct logstream_source_s *source = &sources[i];
+        if (source->addr.sin_addr.s_addr == addr->sin_addr.s_addr && source->addr.sin_port == addr->sin_port)
+            return source;
+        if (source->last_seen < oldest->last_seen)
+            oldest = source;
+    }
+
+    // Forget the one we heard the least from recently.
+    memset(oldest, 0, sizeof(*oldest));
+    oldest->addr = *addr;
+    inet_ntop(AF_INET, &addr->sin_addr, oldest->name, sizeof(oldest->name));
+    oldest->rate_start = xTaskGetTickCount();
+    return oldest;
+}
+
+static void logstream_server_send_nack(int sock, struct logstream_source_s *source)
+{
+    struct logstream_range_s ranges[LOGSTREAM_NACK_MAX_RANGES];
+    char buf[LOGSTREAM_NACK_MAX_SIZE];
+
+    TickType_t now = xTaskGetTickCount();
+    if (now - source->last_nack < MS_TO_TICKS(NACK_INTERVAL_MS))
+        return;
+
+    size_t n_ranges = logstream_seq_missing(&source->seq, ranges, ARRAY_SIZE(ranges));
+    if (n_ranges == 0) {
+        source->nack_rounds = 0;
+        return;
+    }
+
+    // Stop asking for the oldest gap when the client has not been able to fill it.
+    if (source->seq.next == source->nack_next && ++source->nack_rounds >= NACK_MAX_ROUNDS) {
+        logstream_seq_skip_gap(&source->seq);
+        source->nack_rounds = 0;
+        n_ranges = logstream_seq_missing(&source->seq, ranges, ARRAY_SIZE(ranges));
+        if (n_ranges == 0)
+            return;
+    } else if (source->seq.next != source->nack_next) {
+        source->nack_rounds = 0;
+    }
+
+    size_t len = logstream_encode_nack(buf, sizeof(buf), source->seq.session, ranges, n_ranges);
+    sendto(sock, buf, len, 0, (struct sockaddr *)&source->addr, sizeof(source->addr));
+    source->last_nack = now;
+    source->nack_next = source->seq.next;
+}
+
+/*
+ * Tell the client how far we have everything, so it knows where to replay from after an outage.
+ */
+static void logstream_server_send_ack(int sock, struct logstream_source_s *source)
+{
+    char buf[LOGSTREAM_ACK_SIZE];
+
+    TickType_t now = xTaskGetTickCount();
+    uint32_t acked = source->seq.next - 1;
+    if (acked == source->acked || now - source->last_ack < MS_TO_TICKS(NACK_INTERVAL_MS))
+        return;
+
+    size_t len = logstream_encode_ack(buf, sizeof(buf), source->seq.session, acked);
+    sendto(sock, buf, len, 0, (struct sockaddr *)&source->addr, sizeof(source->addr));
+    source->last_ack = now;
+    source->acked = acked;
+}
+
+static void logstream_server_send_control(int sock, struct logstream_source_s *source)
+{
+    logstream_server_send_nack(sock, source);
+    logstream_server_send_ack(sock, source);
+}
+
+static void logstream_server_update_rate(struct logstream_source_s *source, TickType_t now)
+{
+    TickType_t elapsed = now - source->rate_start;
+    if (elapsed < MS_TO_TICKS(RATE_INTERVAL_MS))
+        return;
+    source->rate = (uint64_t)(source->entries - source->rate_entries) * MS_PER_SEC / TICKS_TO_MS(elapsed);
+    source->rate_entries = source->entries;
+    source->rate_start = now;
+}
+
+/*
+ * After a batch of datagrams, or when nothing arrived for a while, ask for gaps and acknowledge
+ * what has arrived. Rate limited per source.
+ */
+static void logstream_server_follow_up(int sock)
+{
+    TickType_t now = xTaskGetTickCount();
+    for (size_t i = 0; i < ARRAY_SIZE(sources); i++) {
+        struct logstream_source_s *source = &sources[i];
+        if (!source->packets)
+            continue;
+        if (source->seq.started)
+            logstream_server_send_control(sock, source);
+        logstream_server_update_rate(source, now);
+    }
+}
+
+static void logstream_server_emit(struct logstream_source_s *source, log_entry_t *entry)
+{
+    // Relayed entries keep the name of the device they were logged on.
+    if (!entry->hops) {
+        log_entry_view_source(entry, source->name, strlen(source->name));
+        entry->hops = 1;
+    }
+    source->entries++;
+
+    int64_t now = logstream_merge_now();
+    int64_t time = logstream_clock_correct(&source->clock, entry->timestamp, now);
+    if (!logstream_merge_push(entry, time, now))
+        source->late++;
+}
+
+/*
+ * A version 1 datagram holds one or more entries back to back.
+ */
+static void logstream_server_handle_v1(struct logstream_source_s *source, const char *packet, size_t len)
+{
+    size_t offset = 0;
+    while (offset + LOGSTREAM_ENTRY_HEADER_SIZE <= len) {
+        // Packed, so the header can be read in place.
+        const log_stream_entry_t *log_stream_entry = (const log_stream_entry_t *)(packet + offset);
+
+        // Wrong version or truncated, counted rather than logged as a bad sender could flood us.
+        if (log_stream_entry->log_stream_version != 1 || log_stream_entry->data_len > sizeof(log_stream_entry->data) ||
+            offset + LOGSTREAM_ENTRY_HEADER_SIZE + log_stream_entry->data_len > len) {
+            source->malformed++;
+            return;
+        }
+
+        log_entry_t entry = {};
+        entry.core = log_stream_entry->core;
+        entry.level = log_stream_entry->level;
+        entry.uptime = log_stream_entry->uptime;
+        entry.timestamp = log_stream_entry->timestamp;
+        log_entry_view(&entry, log_stream_entry->task, strnlen(log_stream_entry->task, sizeof(log_stream_entry->task)), log_stream_entry->tag,
+                       strnlen(log_stream_entry->tag, sizeof(log_stream_entry->tag)), packet + offset + LOGSTREAM_ENTRY_HEADER_SIZE,
+                       log_stream_entry->data_len);
+        logstream_server_emit(source, &entry);
+
+        offset += LOGSTREAM_ENTRY_HEADER_SIZE + log_stream_entry->data_len;
+    }
+}
+
+static void logstream_server_handle_v2(struct logstream_decoder_s *dec, struct logstream_source_s *source)
+{
+    struct logstream_record_s record;
+    int ret;
+
+    // A new session is a restarted client, its clock may have started over.
+    if ((dec->flags & LOGSTREAM_FLAG_SEQ) && source->seq.started && source->seq.session != dec->session)
+        source->clock.valid = false;
+
+    while ((ret = logstream_decode(dec, &record)) > 0) {
+        // Entries the client left out on purpose, like those it does not relay, are not missing.
+        if (record.skipped && (dec->flags & LOGSTREAM_FLAG_SEQ))
+            logstream_seq_skip(&source->seq, dec->session, record.seq - record.skipped, record.skipped);
+
+        // History replayed after an outage is older than what we have seen live, let it through.
+        bool replayed = (dec->flags & LOGSTREAM_FLAG_REPLAY) && source->seq.started && source->seq.session == dec->session &&
+                        record.seq < source->seq.next;
+
+        // Skip duplicates, from retransmits where the original made it after all.
+        if (!replayed && (dec->flags & LOGSTREAM_FLAG_SEQ) && !logstream_seq_receive(&source->seq, dec->session, record.seq)) {
+            source->duplicates++;
+            continue;
+        }
+
+        log_entry_t entry = {};
+        entry.core = record.core;
+        entry.level = record.level;
+        entry.timestamp = record.timestamp;
+        entry.flags = record.kv ? LOG_ENTRY_FLAG_KV : 0;
+        entry.sampled = record.sampled;
+        log_entry_view(&entry, record.task, record.task_len, record.tag, record.tag_len, record.data, record.data_len);
+        if (record.source_len) {
+            log_entry_view_source(&entry, record.source, record.source_len);
+            entry.hops = MIN(record.hops + 1, UINT8_MAX);
+        }
+        logstream_server_emit(source, &entry);
+    }
+    if (ret < 0)
+        source->malformed++;
+}
+
+static void logstream_server_handle_packet(const struct sockaddr_in *addr, const char *packet, size_t len)
+{
+    static char raw[LOGSTREAM_MAX_RAW_SIZE];
+    struct logstream_decoder_s dec;
+    struct logstream_source_s *source = logstream_server_get_source(addr);
+    source->last_seen = xTaskGetTickCount();
+    source->packets++;
+    source->bytes += len;
+
+    if (len >= LOGSTREAM_V2_HEADER_SIZE && packet[0] == LOGSTREAM_VERSION_2 && (packet[1] & LOGSTREAM_FLAG_COMPRESSED)) {
+        len = logstream_decompress_datagram(packet, len, raw, sizeof(raw));
+        if (!len) {
+            source->malformed++;
+            return;
+        }
+        packet = raw;
+    }
+
+    switch (logstream_decoder_init(&dec, packet, len)) {
+    case LOGSTREAM_VERSION_1:
+        logstream_server_handle_v1(source, packet, len);
+        break;
+    case LOGSTREAM_VERSION_2:
+        logstream_server_handle_v2(&dec, source);
+        break;
+    default:
+        source->malformed++;
+        break;
+    }
+}
+
+/*
+ * Wake up in time to pass on merged entries, and regularly to ask for missing entries even if the
+ * clients went quiet.
+ */
+static void logstream_server_set_timeout(int sock, int64_t *current_ms)
+{
+    int64_t ms = logstream_merge_next(logstream_merge_now());
+    ms = ms < 0 ? NACK_INTERVAL_MS : MAX(MIN(ms, NACK_INTERVAL_MS), 1);
+    if (ms == *current_ms)
+        return;
+
+    struct timeval timeout;
+    timeout.tv_sec = 0;
+    timeout.tv_usec = ms * US_PER_MS;
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
+    *current_ms = ms;
+}
+
 static void logstream_server_task(void *pvParameters)
 {
-    log_stream_entry_t log_stream_entry;
+    static char packet[LOGSTREAM_MAX_PACKET_SIZE];
     struct sockaddr_in6 dest_addr;
 
     while (1) {
@@ -41,52 +321,38 @@ static void logstream_server_task(void *pvParameters)
             break;
         }
 
-        // Set timeout
-        struct timeval timeout;
-        timeout.tv_sec = 3600;
-        timeout.tv_usec = 0;
-        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof timeout);
-
         int err = bind(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
         if (err < 0) {
             ESP_LOGE(TAG, "Socket unable to bind: errno %d", errno);
         }
 
         struct sockaddr_storage source_addr; // Large enough for both IPv4 or IPv6
-        socklen_t socklen = sizeof(source_addr);
+        int64_t timeout_ms = 0;
 
         while (1) {
 
-            int len = recvfrom(sock, &log_stream_entry, sizeof(log_stream_entry), 0, (struct sockaddr *)&source_addr, &socklen);
-
-            // Error occurred during receiving
-            if (len < 0) {
-                if (errno != 11)
-                    ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
-                break;
+            // Wait for a datagram, then drain whatever else is already waiting.
+            logstream_server_set_timeout(sock, &timeout_ms);
+            socklen_t socklen = sizeof(source_addr);
+            int len = recvfrom(sock, packet, sizeof(packet), 0, (struct sockaddr *)&source_addr, &socklen);
+            for (size_t batch = 1; len > 0; batch++) {
+                logstream_server_handle_packet((struct sockaddr_in *)&source_addr, packet, len);
+                if (batch == BATCH_MAX_PACKETS)
+                    break;
+                socklen = sizeof(source_addr);
+                len = recvfrom(sock, packet, sizeof(packet), MSG_DONTWAIT, (struct sockaddr *)&source_addr, &socklen);
             }
-            // Data received
-            else if (len > offsetof(log_entry_t, data)) {
-                char addr_str[128];
-                inet_ntoa_r(((struct sockaddr_in *)&source_addr)->sin_addr, addr_str, sizeof(addr_str) - 1);
-
-                log_entry_t entry = {};
-                if (log_stream_entry.log_stream_version == 1) {
-                    entry.core = log_stream_entry.core;
-                    entry.level = log_stream_entry.level;
-                    strncpy(entry.task, log_stream_entry.task, sizeof(entry.task));
-                    strncpy(entry.tag, log_stream_entry.tag, sizeof(entry.tag));
-                    entry.timestamp = log_stream_entry.timestamp;
-                    entry.data_len = log_stream_entry.data_len;
-                    memcpy(entry.data, log_stream_entry.data, log_stream_entry.data_len);
-                    log_capture_send_log(&entry);
-                } else {
-                    ESP_LOGE(TAG, "Wrong version %d", log_stream_entry.log_stream_version);
-                }
 
+            // Error occurred during receiving, a timeout or a drained socket is fine.
+            if (len < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                ESP_LOGE(TAG, "recvfrom failed: errno %d", errno);
+                break;
             }
+            logstream_merge_release(logstream_merge_now(), false);
+            logstream_server_follow_up(sock);
         }
 
+        logstream_merge_release(logstream_merge_now(), true);
         if (sock != -1) {
             shutdown(sock, 0);
             close(sock);
@@ -95,9 +361,39 @@ static void logstream_server_task(void *pvParameters)
     vTaskDelete(NULL);
 }
 
+static int cmd_logsources(int argc, char **argv)
+{
+    TickType_t now = xTaskGetTickCount();
+    printf("%-15s %8s %8s %10s %6s %6s %6s %6s %6s %6s\n", "source", "packets", "entries", "bytes", "rate/s", "lost", "dups", "bad", "late",
+           "idle s");
+    for (size_t i = 0; i < ARRAY_SIZE(sources); i++) {
+        const struct logstream_source_s *source = &sources[i];
+        if (!source->packets)
+            continue;
+        printf("%-15s %8" PRIu32 " %8" PRIu32 " %10" PRIu32 " %6" PRIu32 " %6" PRIu32 " %6" PRIu32 " %6" PRIu32 " %6" PRIu32 " %6" PRIu32 "\n",
+               source->name, source->packets, source->entries, source->bytes, source->rate, source->seq.lost,
+               source->duplicates, source->malformed, source->late, (uint32_t)TICKS_TO_S(now - source->last_seen));
+    }
+
+    struct logstream_relay_stats_s relay;
+    logstream_client_relay_stats(&relay);
+    if (relay.relayed || relay.dropped || relay.looped)
+        printf("relayed %" PRIu32 ", dropped %" PRIu32 ", looped %" PRIu32 "\n", relay.relayed, relay.dropped, relay.looped);
+    return 0;
+}
+
 esp_err_t logstream_server_init(const logstream_server_config_t *config)
 {
     server_config = *config;
     xTaskCreate(logstream_server_task, "logstream_server", 4096, (void *)AF_INET, 5, NULL);
+
+    const esp_console_cmd_t logsources_cmd = {
+        .command = "logsources",
+        .help = "Print logstream server sources",
+        .hint = NULL,
+        .func = &cmd_logsources,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&logsources_cmd));
+
     return ESP_OK;
 }
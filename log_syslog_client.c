@@ -1,15 +1,21 @@
-
-
 #include <ctype.h>
 #include <lwip/netdb.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <sys/queue.h>
+#include <time.h>
 
 #include "esp_log.h"
 
-#include "log_common.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+
+#include "circ_buf.h"
 #include "log_capture.h"
+#include "log_common.h"
+#include "log_format.h"
+#include "log_kv_codec.h"
 #include "log_syslog_client.h"
 
 #include "lwip/err.h"
@@ -17,31 +23,412 @@
 #include "lwip/sys.h"
 
 static struct sockaddr_in dest_addr;
+static log_syslog_client_config_t client_config;
 
 static const char *TAG = "log_syslog_client";
 
-static void send_syslog(log_entry_t *entry) {
+/*
+ * Entries are queued in a compact form by the logging task, then formatted and sent by a sender
+ * task on a persistent socket. Logging never waits for the network, entries are dropped when
+ * the queue is full.
+ */
+static char queue_data[CONFIG_LOGGER_SYSLOG_QUEUE_SIZE];
+static circ_buf_t queue;
+static SemaphoreHandle_t xSemaphore = NULL;
+static StaticSemaphore_t xSemaphoreBuffer;
+static TaskHandle_t sender_task;
+static uint32_t dropped;
+
+#define SYSLOG_POLL_MS 250
+#define CONNECT_TIMEOUT_MS 3000
+#define SEND_TIMEOUT_MS 1000
+#define BACKOFF_MIN_MS 500
+#define BACKOFF_MAX_MS 30000
+
+// RFC 5424 field limits, and the length of its timestamp with milliseconds.
+#define SYSLOG_HOSTNAME_MAX 255
+#define SYSLOG_APP_NAME_MAX 48
+#define SYSLOG_TAG_MAX 32 // RFC 3164
+#define SYSLOG_PROCID_MAX 128
+#define SYSLOG_TIMESTAMP_SIZE 24
+
+// Timestamps before this are from a clock that has not been set, and sent as unknown.
+#define SYSLOG_MIN_TIMESTAMP_MS 1577836800000ULL // 2020-01-01
+
+#define SYSLOG_MAX_HEADER_SIZE (16 + SYSLOG_TIMESTAMP_SIZE + SYSLOG_HOSTNAME_MAX + SYSLOG_APP_NAME_MAX + configMAX_TASK_NAME_LEN)
+#define SYSLOG_MAX_MESSAGE_SIZE (SYSLOG_MAX_HEADER_SIZE + CONFIG_LOGGER_LOG_MAX_LOG_LINE_SIZE)
+
+/*
+ * Connection state, only touched by the sender task. Over TCP, messages are collected in the
+ * batch with their octet count in front, and sent together.
+ */
+static int sock = -1;
+static uint32_t backoff_ms;
+static TickType_t next_connect;
+static char message[SYSLOG_MAX_MESSAGE_SIZE];
+static char batch[MAX(1400, 8 + SYSLOG_MAX_MESSAGE_SIZE)];
+
+struct log_syslog_queued_s {
+    uint64_t timestamp;
+    uint16_t data_len;
+    uint8_t source_len; // Of the name of the device a received entry came from, queued first.
+    uint8_t level;
+    uint8_t task_len;
+    uint8_t tag_len;
+    uint8_t flags;
+};
+
+#define QUEUED_MAX_SIZE (sizeof(struct log_syslog_queued_s) + LOG_ENTRY_SOURCE_SIZE + configMAX_TASK_NAME_LEN + CONFIG_LOGGER_LOG_MAX_TAG_SIZE + CONFIG_LOGGER_LOG_MAX_LOG_LINE_SIZE)
+
+static void send_syslog(log_entry_t *entry)
+{
+    if (entry->flags & LOG_ENTRY_FLAG_METRICS)
+        return;
+    struct log_syslog_queued_s queued = {
+        .timestamp = entry->timestamp,
+        .data_len = MIN(entry->data_len, LOG_ENTRY_DATA_SIZE),
+        .source_len = entry->hops ? log_entry_source_len(entry) : 0,
+        .level = entry->level,
+        .task_len = log_entry_task_len(entry),
+        .tag_len = log_entry_tag_len(entry),
+        .flags = entry->flags,
+    };
+    size_t size = sizeof(queued) + queued.source_len + queued.task_len + queued.tag_len + queued.data_len;
+
+    if (xSemaphoreTake(xSemaphore, portMAX_DELAY) != pdTRUE)
+        return;
+    if (circ_get_free_bytes(&queue) < size) {
+        dropped++;
+        xSemaphoreGive(xSemaphore);
+        return;
+    }
+    bool was_empty = circ_used(&queue) == 0;
+    circ_push(&queue, (char *)&queued, sizeof(queued));
+    if (queued.source_len)
+        circ_push(&queue, entry->source, queued.source_len);
+    circ_push(&queue, entry->task, queued.task_len);
+    circ_push(&queue, entry->tag, queued.tag_len);
+    circ_push(&queue, entry->data, queued.data_len);
+    xSemaphoreGive(xSemaphore);
+
+    if (was_empty)
+        xTaskNotifyGive(sender_task);
+}
+
+/*
+ * Copy the queued entry at offset into scratch, returns its size in the queue or 0 if there are no more.
+ */
+static size_t log_syslog_peek_queued(struct log_syslog_queued_s *queued, char *scratch, size_t offset)
+{
+    size_t size = 0;
+
+    if (xSemaphoreTake(xSemaphore, portMAX_DELAY) != pdTRUE)
+        return 0;
+    if (circ_peek_offset(&queue, (char *)queued, sizeof(*queued), offset) == sizeof(*queued)) {
+        size = sizeof(*queued) + queued->source_len + queued->task_len + queued->tag_len + queued->data_len;
+        circ_peek_offset(&queue, scratch, size - sizeof(*queued), offset + sizeof(*queued));
+    }
+    xSemaphoreGive(xSemaphore);
+    return size;
+}
+
+static void log_syslog_pull_queued(size_t size)
+{
+    if (xSemaphoreTake(xSemaphore, portMAX_DELAY) != pdTRUE)
+        return;
+    circ_pull_ptr_pulled(&queue, size);
+    xSemaphoreGive(xSemaphore);
+}
+
+/*
+ * Syslog severities: errors are err (3), warnings warning (4), info informational (6) and the
+ * rest debug (7).
+ */
+static uint8_t log_syslog_severity(uint8_t level)
+{
+    switch (level) {
+    case ESP_LOG_ERROR:
+        return 3;
+    case ESP_LOG_WARN:
+        return 4;
+    case ESP_LOG_INFO:
+        return 6;
+    default:
+        return 7;
+    }
+}
+
+/*
+ * Header fields are printable ASCII without spaces, or a dash when empty.
+ */
+static char *log_syslog_field(char *pos, const char *str, size_t len, size_t max_len)
+{
+    len = MIN(len, max_len);
+    if (len == 0) {
+        *pos++ = '-';
+        return pos;
+    }
+    for (size_t i = 0; i < len; i++)
+        *pos++ = str[i] > ' ' && str[i] < 0x7f ? str[i] : '_';
+    return pos;
+}
+
+static char *log_syslog_digits(char *pos, unsigned value, size_t digits)
+{
+    while (digits-- > 0) {
+        pos[digits] = '0' + value % 10;
+        value /= 10;
+    }
+    return pos;
+}
+
+static char *log_syslog_timestamp(char *pos, uint64_t timestamp, bool rfc5424)
+{
+    static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+    struct tm tm;
+    time_t seconds = timestamp / MS_PER_SEC;
 
-    int log_socket = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
-    char buffer[256];
-    int msglen = snprintf(buffer, sizeof(buffer), "<%d>%.*s", entry->level, entry->data_len, entry->data);
+    if (rfc5424) {
+        if (timestamp < SYSLOG_MIN_TIMESTAMP_MS) {
+            *pos++ = '-';
+            return pos;
+        }
+        // 2024-05-01T12:00:00.123Z
+        gmtime_r(&seconds, &tm);
+        log_syslog_digits(pos, tm.tm_year + 1900, 4);
+        pos[4] = '-';
+        log_syslog_digits(pos + 5, tm.tm_mon + 1, 2);
+        pos[7] = '-';
+        log_syslog_digits(pos + 8, tm.tm_mday, 2);
+        pos[10] = 'T';
+        log_syslog_digits(pos + 11, tm.tm_hour, 2);
+        pos[13] = ':';
+        log_syslog_digits(pos + 14, tm.tm_min, 2);
+        pos[16] = ':';
+        log_syslog_digits(pos + 17, tm.tm_sec, 2);
+        pos[19] = '.';
+        log_syslog_digits(pos + 20, timestamp % MS_PER_SEC, 3);
+        pos[23] = 'Z';
+        return pos + SYSLOG_TIMESTAMP_SIZE;
+    }
 
-    if (log_socket > 0)
-        sendto(log_socket, buffer, msglen, 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+    // May  1 12:00:00, in local time.
+    localtime_r(&seconds, &tm);
+    memcpy(pos, months + 3 * tm.tm_mon, 3);
+    pos[3] = ' ';
+    log_syslog_digits(pos + 4, tm.tm_mday, 2);
+    if (pos[4] == '0')
+        pos[4] = ' ';
+    pos[6] = ' ';
+    log_syslog_digits(pos + 7, tm.tm_hour, 2);
+    pos[9] = ':';
+    log_syslog_digits(pos + 10, tm.tm_min, 2);
+    pos[12] = ':';
+    log_syslog_digits(pos + 13, tm.tm_sec, 2);
+    return pos + 15;
+}
+
+/*
+ * Format a message, the tag is the app name and the task the process id:
+ *   RFC 5424: <PRI>1 TIMESTAMP HOSTNAME TAG TASK - - MSG
+ *   RFC 3164: <PRI>TIMESTAMP HOSTNAME TAG[TASK]: MSG
+ * Entries received from other devices have the name of that device as hostname.
+ */
+static size_t log_syslog_format(char *buf, const struct log_syslog_queued_s *queued, const char *scratch)
+{
+    bool rfc5424 = client_config.format == LOG_SYSLOG_FORMAT_RFC5424;
+    const char *source = scratch;
+    const char *task = source + queued->source_len;
+    const char *tag = task + queued->task_len;
+    const char *data = tag + queued->tag_len;
+    const char *hostname = queued->source_len ? source : client_config.hostname;
+    size_t hostname_len = queued->source_len ? queued->source_len : hostname ? strlen(hostname) : 0;
+    char *pos = buf;
 
-    close(log_socket);
+    *pos++ = '<';
+    pos += log_format_u64(pos, client_config.facility * 8 + log_syslog_severity(queued->level));
+    *pos++ = '>';
+    if (rfc5424) {
+        *pos++ = '1';
+        *pos++ = ' ';
+    }
+    pos = log_syslog_timestamp(pos, queued->timestamp, rfc5424);
+    *pos++ = ' ';
+    pos = log_syslog_field(pos, hostname, hostname_len, SYSLOG_HOSTNAME_MAX);
+    *pos++ = ' ';
+    pos = log_syslog_field(pos, tag, queued->tag_len, rfc5424 ? SYSLOG_APP_NAME_MAX : SYSLOG_TAG_MAX);
+    if (rfc5424) {
+        *pos++ = ' ';
+        pos = log_syslog_field(pos, task, queued->task_len, SYSLOG_PROCID_MAX);
+        memcpy(pos, " - - ", 5);
+        pos += 5;
+    } else {
+        if (queued->task_len) {
+            *pos++ = '[';
+            pos = log_syslog_field(pos, task, queued->task_len, SYSLOG_PROCID_MAX);
+            *pos++ = ']';
+        }
+        memcpy(pos, ": ", 2);
+        pos += 2;
+    }
+    if (queued->flags & LOG_ENTRY_FLAG_KV)
+        return pos + log_kv_format(data, queued->data_len, pos, LOG_ENTRY_DATA_SIZE) - buf;
+    memcpy(pos, data, queued->data_len);
+    return pos + queued->data_len - buf;
+}
+
+static void log_syslog_disconnect(void)
+{
+    if (sock >= 0)
+        close(sock);
+    sock = -1;
+    backoff_ms = backoff_ms ? MIN(backoff_ms * 2, BACKOFF_MAX_MS) : BACKOFF_MIN_MS;
+    next_connect = xTaskGetTickCount() + MS_TO_TICKS(backoff_ms);
+}
+
+static void log_syslog_connect(void)
+{
+    if (client_config.transport == LOG_SYSLOG_TRANSPORT_UDP) {
+        sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_IP);
+        return;
+    }
+
+    if ((int32_t)(xTaskGetTickCount() - next_connect) < 0)
+        return;
+
+    sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    if (sock < 0) {
+        log_syslog_disconnect();
+        return;
+    }
+    fcntl(sock, F_SETFL, fcntl(sock, F_GETFL, 0) | O_NONBLOCK);
+
+    int err = connect(sock, (struct sockaddr *)&dest_addr, sizeof(dest_addr));
+    if (err < 0 && errno == EINPROGRESS) {
+        fd_set wfds;
+        FD_ZERO(&wfds);
+        FD_SET(sock, &wfds);
+        struct timeval timeout = {.tv_sec = CONNECT_TIMEOUT_MS / MS_PER_SEC};
+        socklen_t len = sizeof(err);
+        if (select(sock + 1, NULL, &wfds, NULL, &timeout) <= 0 || getsockopt(sock, SOL_SOCKET, SO_ERROR, &err, &len) < 0)
+            err = -1;
+    }
+    if (err != 0) {
+        log_syslog_disconnect();
+        return;
+    }
+    backoff_ms = 0;
+}
+
+static bool log_syslog_tcp_send(const char *buf, size_t len)
+{
+    while (len > 0) {
+        int n = send(sock, buf, len, MSG_DONTWAIT);
+        if (n > 0) {
+            buf += n;
+            len -= n;
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            return false;
+
+        // Socket buffer is full, give the server a moment to catch up.
+        fd_set wfds;
+        FD_ZERO(&wfds);
+        FD_SET(sock, &wfds);
+        struct timeval timeout = {.tv_sec = SEND_TIMEOUT_MS / MS_PER_SEC};
+        if (select(sock + 1, NULL, &wfds, NULL, &timeout) <= 0)
+            return false;
+    }
+    return true;
+}
+
+/*
+ * Format and send everything queued. Entries stay in the queue until they have been sent, so
+ * they survive a reconnect.
+ */
+static void log_syslog_send_queued(void)
+{
+    static char scratch[QUEUED_MAX_SIZE];
+    struct log_syslog_queued_s queued;
+    size_t pending = 0, len = 0;
+
+    while (1) {
+        size_t size = log_syslog_peek_queued(&queued, scratch, pending);
+
+        if (client_config.transport == LOG_SYSLOG_TRANSPORT_UDP) {
+            if (!size)
+                return;
+            size_t n = log_syslog_format(message, &queued, scratch);
+            // Without a route, as before wifi is up, try again later.
+            if (sendto(sock, message, n, 0, (struct sockaddr *)&dest_addr, sizeof(dest_addr)) < 0)
+                return;
+            log_syslog_pull_queued(size);
+            continue;
+        }
+
+        // Send the batch when the next message does not fit, or the queue is drained.
+        size_t n = size ? log_syslog_format(message, &queued, scratch) : 0;
+        if (len > 0 && (!size || len + n + 8 > sizeof(batch))) {
+            if (!log_syslog_tcp_send(batch, len)) {
+                log_syslog_disconnect();
+                return;
+            }
+            log_syslog_pull_queued(pending);
+            pending = len = 0;
+        }
+        if (!size)
+            return;
+
+        len += log_format_u64(batch + len, n);
+        batch[len++] = ' ';
+        memcpy(batch + len, message, n);
+        len += n;
+        pending += size;
+    }
+}
+
+static void log_syslog_task(void *pvParameters)
+{
+    while (1) {
+        // Over TCP, give more messages a chance to share the segment.
+        if (ulTaskNotifyTake(pdTRUE, MS_TO_TICKS(SYSLOG_POLL_MS)) && client_config.transport == LOG_SYSLOG_TRANSPORT_TCP)
+            vTaskDelay(MS_TO_TICKS(client_config.flush_ms));
+
+        // While disconnected, entries wait in the queue for as long as there is room.
+        if (sock < 0)
+            log_syslog_connect();
+        if (sock < 0)
+            continue;
+
+        log_syslog_send_queued();
+
+        if (dropped) {
+            ESP_LOGW(TAG, "Queue full, dropped %" PRIu32 " entries", dropped);
+            dropped = 0;
+        }
+    }
+    vTaskDelete(NULL);
 }
 
 esp_err_t log_syslog_client_init(const log_syslog_client_config_t *config)
 {
+    client_config = *config;
 
     dest_addr.sin_addr.s_addr = inet_addr(config->host);
     dest_addr.sin_family = AF_INET;
     dest_addr.sin_port = htons(config->port);
 
-    ESP_LOGD(TAG, "Sending logs to syslog %s:%d", config->host, config->port);
+    xSemaphore = xSemaphoreCreateMutexStatic(&xSemaphoreBuffer);
+    circ_init(&queue, queue_data, sizeof(queue_data));
+
+    if (xTaskCreate(log_syslog_task, "syslog_client", 3072, NULL, 5, &sender_task) != pdPASS)
+        return ESP_ERR_NO_MEM;
+
+    ESP_LOGD(TAG, "Sending logs to syslog %s:%d over %s", config->host, config->port,
+             config->transport == LOG_SYSLOG_TRANSPORT_TCP ? "tcp" : "udp");
 
-    log_capture_register_handler(&send_syslog);
+    log_capture_register_named_handler("syslog", &send_syslog);
 
     return ESP_OK;
 }
@@ -2,12 +2,30 @@
 
 #include "esp_err.h"
 
+enum log_syslog_transport_e {
+    LOG_SYSLOG_TRANSPORT_UDP, // A datagram per message, RFC 5426.
+    LOG_SYSLOG_TRANSPORT_TCP, // One long lived connection, messages framed by octet counting, RFC 6587.
+};
+
+enum log_syslog_format_e {
+    LOG_SYSLOG_FORMAT_RFC5424,
+    LOG_SYSLOG_FORMAT_RFC3164, // For older servers, BSD syslog.
+};
+
+#define LOG_SYSLOG_FACILITY_USER 1
+#define LOG_SYSLOG_FACILITY_LOCAL0 16
+
 struct log_syslog_client_config_s {
     const char *host;
     int port;
+    enum log_syslog_transport_e transport;
+    enum log_syslog_format_e format;
+    int facility;
+    const char *hostname; // Sent as HOSTNAME, NULL for none. Received entries carry the device they came from.
+    int flush_ms;         // Max time a message waits for more to share its TCP segment.
 };
 
-#define SYSLOG_CLIENT_DEFAULTS { .port = 514 }
+#define SYSLOG_CLIENT_DEFAULTS { .port = 514, .facility = LOG_SYSLOG_FACILITY_USER, .flush_ms = 50 }
 
 typedef struct log_syslog_client_config_s log_syslog_client_config_t;
 
@@ -0,0 +1,82 @@
+#include <stddef.h>
+#include <string.h>
+
+#include "log_intern.h"
+#include "log_tag_cache.h"
+
+#define TAG_CACHE_PROBES 4
+
+static size_t tag_cache_pos(const struct log_tag_cache_s *cache, const char *tag)
+{
+    // Fibonacci hashing, the low bits of a pointer are mostly alignment.
+    return (uint32_t)((uintptr_t)tag * 2654435761u) >> (32 - cache->bits);
+}
+
+static struct log_tag_slot_s *tag_cache_slot(const struct log_tag_cache_s *cache, size_t pos, size_t i)
+{
+    return &cache->slots[(pos + i) & ((1u << cache->bits) - 1)];
+}
+
+uint32_t log_tag_cache_generation(const struct log_tag_cache_s *cache)
+{
+    return __atomic_load_n(&cache->generation, __ATOMIC_ACQUIRE);
+}
+
+bool log_tag_cache_get(const struct log_tag_cache_s *cache, const char *tag, uint8_t *value)
+{
+    uint32_t generation = log_tag_cache_generation(cache);
+    size_t pos = tag_cache_pos(cache, tag);
+    for (size_t i = 0; i < TAG_CACHE_PROBES; i++) {
+        const struct log_tag_slot_s *slot = tag_cache_slot(cache, pos, i);
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->tag, __ATOMIC_RELAXED) != tag)
+            continue;
+        uint32_t slot_generation = __atomic_load_n(&slot->generation, __ATOMIC_RELAXED);
+        uint16_t name = __atomic_load_n(&slot->name, __ATOMIC_RELAXED);
+        uint8_t slot_value = __atomic_load_n(&slot->value, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (seq & 1 || __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq || slot_generation != generation)
+            return false;
+        // The name is still compared, a buffer that held the tag may hold another one now.
+        if (strncmp(log_intern_str(name), tag, CONFIG_LOGGER_LOG_MAX_TAG_SIZE) != 0)
+            return false;
+        *value = slot_value;
+        return true;
+    }
+    return false;
+}
+
+/*
+ * Remember the value of a tag, in a free slot or the one of the same tag, otherwise in place of
+ * the first one probed. Tags that could not be interned are not cached.
+ */
+void log_tag_cache_put(struct log_tag_cache_s *cache, const char *tag, uint16_t name, uint8_t value)
+{
+    if (name == LOG_INTERN_NONE)
+        return;
+
+    size_t pos = tag_cache_pos(cache, tag);
+    struct log_tag_slot_s *victim = tag_cache_slot(cache, pos, 0);
+    for (size_t i = 0; i < TAG_CACHE_PROBES; i++) {
+        struct log_tag_slot_s *candidate = tag_cache_slot(cache, pos, i);
+        if (candidate->generation != cache->generation || candidate->tag == tag) {
+            victim = candidate;
+            break;
+        }
+    }
+    uint32_t seq = victim->seq;
+    __atomic_store_n(&victim->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&victim->tag, tag, __ATOMIC_RELAXED);
+    __atomic_store_n(&victim->generation, cache->generation, __ATOMIC_RELAXED);
+    __atomic_store_n(&victim->name, name, __ATOMIC_RELAXED);
+    __atomic_store_n(&victim->value, value, __ATOMIC_RELAXED);
+    __atomic_store_n(&victim->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void log_tag_cache_clear(struct log_tag_cache_s *cache)
+{
+    // Zero is the generation of slots never used.
+    uint32_t generation = cache->generation + 1;
+    __atomic_store_n(&cache->generation, generation ? generation : 1, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Tag pointer to a small value, for per tag settings checked on every line like levels and
+ * sampling rules. Tags are mostly string literals, so the pointer is a cheap key. The interned
+ * name guards against a buffer that is reused for another tag, like the arguments of a console
+ * command. Clearing starts a new generation, slots of older ones count as free.
+ *
+ * Getting takes no lock, a slot that is being written reads as a miss. Callers hold their own
+ * lock around putting and clearing.
+ */
+struct log_tag_slot_s {
+    uint32_t seq; // Odd while the slot is written.
+    const char *tag;
+    uint32_t generation;
+    uint16_t name;
+    uint8_t value;
+};
+
+struct log_tag_cache_s {
+    struct log_tag_slot_s *slots;
+    uint8_t bits;
+    uint32_t generation;
+};
+
+#define LOG_TAG_CACHE_INIT(slots_array, slots_bits) { .slots = (slots_array), .bits = (slots_bits), .generation = 1 }
+
+uint32_t log_tag_cache_generation(const struct log_tag_cache_s *cache);
+bool log_tag_cache_get(const struct log_tag_cache_s *cache, const char *tag, uint8_t *value);
+void log_tag_cache_put(struct log_tag_cache_s *cache, const char *tag, uint16_t name, uint8_t value);
+void log_tag_cache_clear(struct log_tag_cache_s *cache);
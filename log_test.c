@@ -9,6 +9,9 @@
 #include "esp_log.h"
 #include "argtable3/argtable3.h"
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
 static struct {
     struct arg_str *tag;
     struct arg_int *level;
@@ -31,6 +34,50 @@ static int cmd_log_test(int argc, char **argv)
 
 
 
+static struct {
+    struct arg_int *stack;
+    struct arg_end *end;
+} log_stack_args;
+
+struct log_stack_s {
+    TaskHandle_t caller;
+    UBaseType_t before;
+    UBaseType_t after;
+};
+
+static void log_stack_task(void *arg)
+{
+    struct log_stack_s *result = arg;
+    result->before = uxTaskGetStackHighWaterMark(NULL);
+    ESP_LOGI("logstack", "Measuring the stack used by logging a line, %d %s", 42, "with arguments");
+    result->after = uxTaskGetStackHighWaterMark(NULL);
+    xTaskNotifyGive(result->caller);
+    vTaskDelete(NULL);
+}
+
+/*
+ * Log a line from a fresh task and see how much deeper its stack got, which is what logging
+ * costs every task, with the handlers registered right now.
+ */
+static int cmd_log_stack(int argc, char **argv)
+{
+    int nerrors = arg_parse(argc, argv, (void **)&log_stack_args);
+    if (nerrors != 0) {
+        arg_print_errors(stderr, log_stack_args.end, argv[0]);
+        return 1;
+    }
+
+    int stack = log_stack_args.stack->count ? log_stack_args.stack->ival[0] : 4096;
+    struct log_stack_s result = {.caller = xTaskGetCurrentTaskHandle()};
+    if (xTaskCreate(log_stack_task, "logstack", stack, &result, uxTaskPriorityGet(NULL), NULL) != pdPASS) {
+        printf("Could not create a task with %d bytes of stack\n", stack);
+        return 1;
+    }
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    printf("Logging used %u bytes of stack, %u of %d left\n", (unsigned)(result.before - result.after), (unsigned)result.after, stack);
+    return 0;
+}
+
 esp_err_t log_test_init(void)
 {
     log_test_args.tag = arg_str1(NULL, NULL, "log tag", "");
@@ -48,5 +95,17 @@ esp_err_t log_test_init(void)
 
     ESP_ERROR_CHECK(esp_console_cmd_register(&log_test_cmd));
 
+    log_stack_args.stack = arg_int0(NULL, NULL, "<bytes>", "Stack of the task that logs, 4096 by default");
+    log_stack_args.end = arg_end(1);
+
+    const esp_console_cmd_t log_stack_cmd = {
+        .command = "logstack",
+        .help = "Measure the stack used by logging a line",
+        .hint = NULL,
+        .func = &cmd_log_stack,
+        .argtable = &log_stack_args,
+    };
+    ESP_ERROR_CHECK(esp_console_cmd_register(&log_stack_cmd));
+
     return ESP_OK;
 }
@@ -0,0 +1,226 @@
+## Minimal logstream server in Python, for testing the logstream client over UDP or TCP.
+import socketserver
+import struct
+import sys
+import threading
+
+HOST, PORT = "0.0.0.0", 1514
+
+LEVELS = "NEWIDV"
+TASK_LEN, TAG_LEN = 16, 24
+
+def get_varint(data, pos):
+	result = shift = 0
+	while True:
+		b = data[pos]
+		pos += 1
+		result |= (b & 0x7f) << shift
+		shift += 7
+		if not b & 0x80:
+			return result, pos
+
+def put_varint(value):
+	out = bytearray()
+	while value >= 0x80:
+		out.append((value & 0x7f) | 0x80)
+		value >>= 7
+	out.append(value)
+	return bytes(out)
+
+def zigzag(value):
+	return (value >> 1) ^ -(value & 1)
+
+# Must match the dictionary in log_stream_compress.c.
+DICTIONARY = b"".join(bytes([len(name) << 1]) + name for name in b"main IDLE tiT sys_evt esp_timer wifi phy_init cpu_start "
+	b"heap_init spi_flash netif event nvs esp_netif_handlers mqtt_client HTTP_CLIENT httpd logstream syslog system_api".split()) + (
+	b"Initializing Starting started stopped Connected connected disconnected "
+	b"Disconnected reconnect retry timeout Failed to failed error Error: "
+	b"ESP_ERR_ ESP_OK ESP_FAIL received sending sent bytes free heap: "
+	b"memory 0x00000000 state: status: channel rssi sta ip: , mask: , gw: "
+	b"address port version config enabled disabled  ms (ms) done: ")
+
+def get_length(data, pos, value):
+	while True:
+		b = data[pos]
+		pos += 1
+		value += b
+		if b != 255:
+			return value, pos
+
+def decompress(data):
+	out = bytearray(DICTIONARY)
+	pos = 0
+	while pos < len(data):
+		token = data[pos]
+		pos += 1
+		literals = token >> 4
+		if literals == 15:
+			literals, pos = get_length(data, pos, literals)
+		out += data[pos:pos + literals]
+		pos += literals
+		if pos >= len(data):
+			break
+		offset = data[pos] | data[pos + 1] << 8
+		pos += 2
+		match_len = token & 0xf
+		if match_len == 15:
+			match_len, pos = get_length(data, pos, match_len)
+		for _ in range(match_len + 4):
+			out.append(out[-offset])
+	return bytes(out[len(DICTIONARY):])
+
+def decompress_v2(data):
+	# The header is left as is, up to and including the session.
+	pos = 2
+	if data[1] & 0x01:
+		_, pos = get_varint(data, pos)
+	raw_len, body = get_varint(data, pos)
+	return bytes([data[0], data[1] & ~0x04]) + data[2:pos] + decompress(data[body:])
+
+# Key-value fields from log_kv(), see log_kv_codec.h, rendered like the device does.
+def format_kv(data):
+	fields = []
+	pos = 0
+	while pos < len(data):
+		key_len, kind = data[pos] >> 3, data[pos] & 7
+		key = data[pos + 1:pos + 1 + key_len]
+		pos += 1 + key_len
+		if kind in (0, 1):
+			value, pos = get_varint(data, pos)
+			value = str(zigzag(value) if kind == 0 else value)
+		elif kind in (2, 3):
+			size = 4 if kind == 2 else 8
+			value = ("%.6f" % struct.unpack_from("<f" if kind == 2 else "<d", data, pos)[0]).rstrip("0")
+			value += "0" if value.endswith(".") else ""
+			pos += size
+		elif kind == 4:
+			value = "true" if data[pos] else "false"
+			pos += 1
+		elif kind == 5:
+			str_len, pos = get_varint(data, pos)
+			value = data[pos:pos + str_len].decode(errors="replace").replace('"', '\\"')
+			if not str_len or any(c in value for c in ' ="'):
+				value = '"%s"' % value
+			pos += str_len
+		else:
+			break
+		fields.append(key + b"=" + value.encode())
+	return b" ".join(fields)
+
+def decode_v1(data):
+	header = struct.Struct("<BBBHQ%ds%dsI" % (TASK_LEN, TAG_LEN))
+	pos = 0
+	while pos + header.size <= len(data):
+		_, core, level, _, timestamp, task, tag, data_len = header.unpack_from(data, pos)
+		pos += header.size
+		yield None, 0, level, core, timestamp, task.rstrip(b"\0"), tag.rstrip(b"\0"), data[pos:pos + data_len]
+		pos += data_len
+
+def decode_v2(data):
+	flags = data[1]
+	pos = 2
+	if flags & 0x80:
+		return
+	if flags & 0x01:
+		_, pos = get_varint(data, pos)
+	seq = timestamp = 0
+	strings = []
+	def get_string(pos):
+		value, pos = get_varint(data, pos)
+		if value & 1:
+			return strings[value >> 1], pos
+		s = data[pos:pos + (value >> 1)]
+		if len(strings) < 16:
+			strings.append(s)
+		return s, pos + (value >> 1)
+	while pos < len(data):
+		info = data[pos]
+		pos += 1
+		# Extensions: the device a relayed record came from, left out sequence numbers, key-value data
+		# and lines dropped by sampling before this one.
+		source = None
+		ext = 0
+		if info & 0x80:
+			ext, pos = get_varint(data, pos)
+		if ext & 0x01:
+			source, pos = get_string(pos)
+			_, pos = get_varint(data, pos)
+		if ext & 0x02:
+			_, pos = get_varint(data, pos)
+		sampled = 0
+		if ext & 0x08:
+			sampled, pos = get_varint(data, pos)
+		if flags & 0x01:
+			value, pos = get_varint(data, pos)
+			seq += zigzag(value)
+		value, pos = get_varint(data, pos)
+		timestamp += zigzag(value)
+		task, pos = get_string(pos)
+		tag, pos = get_string(pos)
+		data_len, pos = get_varint(data, pos)
+		line = data[pos:pos + data_len]
+		if ext & 0x04:
+			line = format_kv(line)
+		if sampled:
+			line += b" (+%d sampled)" % sampled
+		yield source, seq, info & 7, (info >> 3) & 0xf, timestamp, task, tag, line
+		pos += data_len
+
+# Acknowledge the highest sequence number seen, so the client only replays what came after it
+# when it reconnects. Unlike the C server, gaps are not tracked here.
+acked = {}
+
+def make_ack(client, data, seq):
+	if len(data) < 3 or data[0] != 2 or not data[1] & 0x01:
+		return None
+	session, _ = get_varint(data, 2)
+	if seq <= acked.get((client, session), 0):
+		return None
+	acked[(client, session)] = seq
+	return bytes([2, 0x80, 2]) + put_varint(session) + put_varint(seq)
+
+def handle_packet(client, data):
+	if not data:
+		return None
+	decoder = {1: decode_v1, 2: decode_v2}.get(data[0])
+	if not decoder:
+		print("%s: unknown version %d" % (client, data[0]))
+		return None
+	if data[0] == 2 and len(data) > 1 and data[1] & 0x04:
+		data = decompress_v2(data)
+	highest = 0
+	for source, seq, level, core, timestamp, task, tag, msg in decoder(data):
+		print("%s: #%-6d %s %d (%-6d) %15s%20s: %s" % (source.decode(errors="replace") if source else client, seq, LEVELS[level] if level < 6 else "X", core, timestamp,
+			task.decode(errors="replace"), tag.decode(errors="replace"), msg.decode(errors="replace")))
+		highest = max(highest, seq)
+	return make_ack(client, data, highest)
+
+class LogstreamUDPHandler(socketserver.BaseRequestHandler):
+	def handle(self):
+		ack = handle_packet(self.client_address[0], self.request[0])
+		if ack:
+			self.request[1].sendto(ack, self.client_address)
+
+class LogstreamTCPHandler(socketserver.StreamRequestHandler):
+	def handle(self):
+		# Frames are prefixed with their length, as a big endian u16.
+		while True:
+			header = self.rfile.read(2)
+			if len(header) < 2:
+				break
+			ack = handle_packet(self.client_address[0], self.rfile.read(struct.unpack(">H", header)[0]))
+			if ack:
+				self.wfile.write(struct.pack(">H", len(ack)) + ack)
+
+if __name__ == "__main__":
+	port = int(sys.argv[1]) if len(sys.argv) > 1 else PORT
+	try:
+		socketserver.ThreadingTCPServer.allow_reuse_address = True
+		tcp_server = socketserver.ThreadingTCPServer((HOST, port), LogstreamTCPHandler)
+		threading.Thread(target=tcp_server.serve_forever, daemon=True).start()
+		udp_server = socketserver.UDPServer((HOST, port), LogstreamUDPHandler)
+		udp_server.serve_forever(poll_interval=0.5)
+	except (IOError, SystemExit):
+		raise
+	except KeyboardInterrupt:
+		print ("Crtl+C Pressed. Shutting down.")
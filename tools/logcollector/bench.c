@@ -0,0 +1,164 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "collector.h"
+#include "log_stream_codec.h"
+#include "log_stream_compress.h"
+
+#define BENCH_PACKET_SIZE 1400
+
+struct bench_s {
+    int sources;
+    int port;
+    bool compress;
+    volatile bool stop;
+    uint64_t packets;
+    uint64_t entries;
+    uint64_t bytes;
+};
+
+static const char *bench_tags[] = {"wifi", "esp_netif_handlers", "main", "logstream", "app_sensor", "mqtt_client"};
+static const char *bench_tasks[] = {"main", "sys_evt", "tiT", "sensor_task", "esp_timer"};
+static const char *bench_formats[] = {
+    "sta ip: 192.168.2.%d, mask: 255.255.255.0, gw: 192.168.2.1",
+    "Connected to AP, rssi -%d",
+    "free heap: %d bytes",
+    "temperature %d.5 C, humidity 41 %%",
+    "published message id %d to topic devices/node/telemetry",
+};
+
+/*
+ * Send full datagrams from every source in turn, as fast as the socket takes them.
+ */
+static void *bench_sender(void *arg)
+{
+    struct bench_s *bench = arg;
+    static struct logstream_compressor_s compressor;
+    char raw[LOGSTREAM_MAX_RAW_SIZE];
+    char packet[BENCH_PACKET_SIZE];
+    int *socks = calloc(bench->sources, sizeof(*socks));
+    uint32_t *seqs = calloc(bench->sources, sizeof(*seqs));
+    struct sockaddr_in dest = {.sin_family = AF_INET, .sin_port = htons(bench->port), .sin_addr.s_addr = htonl(INADDR_LOOPBACK)};
+
+    for (int i = 0; i < bench->sources; i++)
+        socks[i] = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+
+    uint64_t timestamp = 0;
+    for (uint32_t round = 0; !bench->stop; round++) {
+        for (int i = 0; i < bench->sources && !bench->stop; i++) {
+            struct logstream_encoder_s enc;
+            logstream_encoder_init(&enc, raw, bench->compress ? 2 * BENCH_PACKET_SIZE : BENCH_PACKET_SIZE, LOGSTREAM_FLAG_SEQ, i + 1);
+            while (1) {
+                char data[128];
+                uint32_t n = seqs[i] + round;
+                snprintf(data, sizeof(data), bench_formats[n % 5], n % 255);
+                struct logstream_record_s record = {
+                    .seq = seqs[i] + 1,
+                    .level = 3,
+                    .timestamp = timestamp += 7,
+                    .task = bench_tasks[n % 5],
+                    .task_len = strlen(bench_tasks[n % 5]),
+                    .tag = bench_tags[n % 6],
+                    .tag_len = strlen(bench_tags[n % 6]),
+                    .data = data,
+                    .data_len = strlen(data),
+                };
+                if (!logstream_encode(&enc, &record))
+                    break;
+                seqs[i]++;
+            }
+
+            const char *buf = raw;
+            size_t len = enc.len;
+            if (bench->compress) {
+                len = logstream_compress_datagram(&compressor, raw, enc.len, packet, sizeof(packet));
+                buf = packet;
+                if (!len) {
+                    fprintf(stderr, "Datagram did not compress into a packet\n");
+                    exit(1);
+                }
+            }
+            if (sendto(socks[i], buf, len, 0, (struct sockaddr *)&dest, sizeof(dest)) == (ssize_t)len) {
+                bench->packets++;
+                bench->entries += enc.records;
+                bench->bytes += len;
+            }
+        }
+    }
+
+    for (int i = 0; i < bench->sources; i++)
+        close(socks[i]);
+    free(socks);
+    free(seqs);
+    return NULL;
+}
+
+struct bench_collector_s {
+    struct collector_config_s config;
+    struct collector_stats_s stats;
+};
+
+static void *bench_collector(void *arg)
+{
+    struct bench_collector_s *collector = arg;
+    if (collector_run(&collector->config, &collector->stats) < 0)
+        __atomic_store_n(collector->config.bound_port, -1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+/*
+ * Run the collector on loopback, with sources simulated by another thread.
+ */
+int collector_bench(int sources, int seconds, const char *dir, bool compress)
+{
+    volatile bool stop = false;
+    int port = 0;
+    struct bench_collector_s collector = {
+        .config =
+            {
+                .dir = dir,
+                .bind_addr = "127.0.0.1",
+                .stop = &stop,
+                .bound_port = &port,
+            },
+    };
+    struct bench_s bench = {.sources = sources, .compress = compress};
+    pthread_t collector_thread, sender_thread;
+
+    pthread_create(&collector_thread, NULL, bench_collector, &collector);
+    while (!__atomic_load_n(&port, __ATOMIC_ACQUIRE))
+        usleep(1000);
+    if (port < 0) {
+        pthread_join(collector_thread, NULL);
+        return -1;
+    }
+    bench.port = port;
+
+    uint64_t start = collector_now_us();
+    pthread_create(&sender_thread, NULL, bench_sender, &bench);
+    sleep(seconds);
+    bench.stop = true;
+    pthread_join(sender_thread, NULL);
+    uint64_t elapsed = collector_now_us() - start;
+
+    // Let the collector catch up with what is still in the socket.
+    usleep(200000);
+    stop = true;
+    pthread_join(collector_thread, NULL);
+
+    double s = elapsed / 1e6;
+    printf("%d sources, %s, %s\n", sources, compress ? "compressed" : "uncompressed", dir ? dir : "not stored");
+    printf("sent:     %10.0f entries/s %8.0f packets/s %8.2f MB/s\n", bench.entries / s, bench.packets / s, bench.bytes / s / 1e6);
+    printf("received: %10.0f entries/s %8.0f packets/s %8.2f MB/s\n", collector.stats.entries / s, collector.stats.packets / s,
+           collector.stats.bytes / s / 1e6);
+    printf("dropped by the kernel: %.2f%%, gaps given up: %llu, duplicates: %llu, malformed: %llu\n",
+           bench.packets ? 100.0 * (bench.packets - collector.stats.packets) / bench.packets : 0.0, (unsigned long long)collector.stats.lost,
+           (unsigned long long)collector.stats.duplicates, (unsigned long long)collector.stats.malformed);
+    return 0;
+}
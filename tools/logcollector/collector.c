@@ -0,0 +1,478 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "collector.h"
+#include "log_kv_codec.h"
+#include "log_stream_codec.h"
+#include "log_stream_compress.h"
+
+#define BATCH_SIZE 64
+#define PACKET_SIZE 2048
+#define RECV_BUFFER_SIZE (8 * 1024 * 1024)
+#define POLL_MS 100
+
+#define SOURCE_TABLE_SIZE 4096 // Power of two.
+#define SOURCE_PROBES 16
+#define CONTROL_INTERVAL_US 200000
+#define NACK_MAX_ROUNDS 3
+#define FLUSH_INTERVAL_US 100000
+#define STATS_INTERVAL_US 10000000
+
+// Version 1 entries, as sent by an ESP32 with the default task name and tag sizes.
+#define V1_TASK_LEN 16
+#define V1_TAG_LEN 24
+#define V1_HEADER_SIZE (1 + 1 + 1 + 2 + 8 + V1_TASK_LEN + V1_TAG_LEN + 4)
+
+/*
+ * Per device state, like in the logstream server: sequence tracking to drop duplicates and
+ * ask for gaps, and the last acknowledged sequence so the device knows what to replay.
+ */
+struct source_s {
+    bool used;
+    bool active; // Heard from since the last follow up.
+    struct sockaddr_in addr;
+    struct logstream_seq_s seq;
+    uint32_t acked;
+    uint32_t nack_next;
+    uint8_t nack_rounds;
+    uint64_t last_seen_us;
+    uint64_t last_nack_us;
+    uint64_t last_ack_us;
+};
+
+struct collector_s {
+    const struct collector_config_s *config;
+    struct collector_stats_s *stats;
+    struct store_s *store;
+    int sock;
+    int syslog_sock;
+    struct source_s sources[SOURCE_TABLE_SIZE];
+    char raw[LOGSTREAM_MAX_RAW_SIZE];
+    char packets[BATCH_SIZE][PACKET_SIZE];
+    struct sockaddr_in addrs[BATCH_SIZE];
+    struct iovec iovecs[BATCH_SIZE];
+    struct mmsghdr msgs[BATCH_SIZE];
+};
+
+uint64_t collector_now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+void collector_print_entry(const struct collector_entry_s *entry, FILE *out)
+{
+    static const char levels[] = "NEWIDV";
+    char addr[INET_ADDRSTRLEN];
+    char when[32];
+    struct in_addr in = {.s_addr = entry->source};
+    time_t seconds = entry->received_us / 1000000;
+    struct tm tm;
+
+    inet_ntop(AF_INET, &in, addr, sizeof(addr));
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime_r(&seconds, &tm));
+    fprintf(out, "%s.%03u %-15s %c %u (%-6llu) %15.*s %20.*s: %.*s\n", when, (unsigned)(entry->received_us / 1000 % 1000), addr,
+            entry->level < sizeof(levels) - 1 ? levels[entry->level] : 'X', entry->core, (unsigned long long)entry->timestamp,
+            (int)entry->task_len, entry->task, (int)entry->tag_len, entry->tag, (int)entry->data_len, entry->data);
+}
+
+static struct source_s *collector_get_source(struct collector_s *c, const struct sockaddr_in *addr, uint64_t now)
+{
+    uint32_t h = (addr->sin_addr.s_addr * 2654435761u) ^ addr->sin_port;
+    struct source_s *stalest = NULL;
+    for (size_t i = 0; i < SOURCE_PROBES; i++) {
+        struct source_s *source = &c->sources[(h + i) & (SOURCE_TABLE_SIZE - 1)];
+        if (source->used && source->addr.sin_addr.s_addr == addr->sin_addr.s_addr && source->addr.sin_port == addr->sin_port)
+            return source;
+        if (!source->used) {
+            stalest = source;
+            c->stats->sources++;
+            break;
+        }
+        if (!stalest || source->last_seen_us < stalest->last_seen_us)
+            stalest = source;
+    }
+
+    // Take a free slot, or forget the one we heard the least from recently.
+    memset(stalest, 0, sizeof(*stalest));
+    stalest->used = true;
+    stalest->addr = *addr;
+    stalest->last_seen_us = now;
+    return stalest;
+}
+
+static void collector_emit(struct collector_s *c, struct collector_entry_s *entry)
+{
+    c->stats->entries++;
+    if (c->store)
+        store_append(c->store, entry);
+    if (c->config->print)
+        collector_print_entry(entry, stdout);
+}
+
+static void collector_handle_v1(struct collector_s *c, const struct sockaddr_in *addr, const char *packet, size_t len, uint64_t now)
+{
+    size_t offset = 0;
+    while (offset + V1_HEADER_SIZE <= len) {
+        const char *p = packet + offset;
+        uint32_t data_len;
+        memcpy(&data_len, p + V1_HEADER_SIZE - 4, sizeof(data_len));
+        if (p[0] != LOGSTREAM_VERSION_1 || data_len > len - offset - V1_HEADER_SIZE) {
+            c->stats->malformed++;
+            return;
+        }
+
+        struct collector_entry_s entry = {
+            .received_us = now,
+            .source = addr->sin_addr.s_addr,
+            .kind = COLLECTOR_KIND_LOGSTREAM,
+            .core = p[1],
+            .level = p[2],
+            .task = p + 13,
+            .task_len = strnlen(p + 13, V1_TASK_LEN),
+            .tag = p + 13 + V1_TASK_LEN,
+            .tag_len = strnlen(p + 13 + V1_TASK_LEN, V1_TAG_LEN),
+            .data = p + V1_HEADER_SIZE,
+            .data_len = data_len,
+        };
+        memcpy(&entry.timestamp, p + 5, sizeof(entry.timestamp));
+        collector_emit(c, &entry);
+        offset += V1_HEADER_SIZE + data_len;
+    }
+}
+
+/*
+ * Entries relayed by a logstream server are stored as coming from the device they were logged on.
+ */
+static void collector_relayed_source(struct collector_entry_s *entry, const struct logstream_record_s *record)
+{
+    char name[INET_ADDRSTRLEN];
+    struct in_addr in;
+
+    if (!record->source_len || record->source_len >= sizeof(name))
+        return;
+    memcpy(name, record->source, record->source_len);
+    name[record->source_len] = '\0';
+    if (inet_pton(AF_INET, name, &in) == 1)
+        entry->source = in.s_addr;
+}
+
+static void collector_handle_v2(struct collector_s *c, const struct sockaddr_in *addr, const char *packet, size_t len, uint64_t now)
+{
+    struct logstream_decoder_s dec;
+    struct logstream_record_s record;
+    struct source_s *source = collector_get_source(c, addr, now);
+    source->last_seen_us = now;
+    source->active = true;
+
+    if (len >= LOGSTREAM_V2_HEADER_SIZE && (packet[1] & LOGSTREAM_FLAG_COMPRESSED)) {
+        len = logstream_decompress_datagram(packet, len, c->raw, sizeof(c->raw));
+        packet = c->raw;
+    }
+    if (logstream_decoder_init(&dec, packet, len) != LOGSTREAM_VERSION_2) {
+        c->stats->malformed++;
+        return;
+    }
+
+    int ret;
+    while ((ret = logstream_decode(&dec, &record)) > 0) {
+        if (record.skipped && (dec.flags & LOGSTREAM_FLAG_SEQ))
+            logstream_seq_skip(&source->seq, dec.session, record.seq - record.skipped, record.skipped);
+
+        // Replayed history is older than the live sequence, anything else is checked for duplicates.
+        bool replayed = (dec.flags & LOGSTREAM_FLAG_REPLAY) && source->seq.started && source->seq.session == dec.session &&
+                        record.seq < source->seq.next;
+        if (!replayed && (dec.flags & LOGSTREAM_FLAG_SEQ)) {
+            uint32_t lost = source->seq.lost;
+            bool fresh = logstream_seq_receive(&source->seq, dec.session, record.seq);
+            c->stats->lost += source->seq.lost - lost;
+            if (!fresh) {
+                c->stats->duplicates++;
+                continue;
+            }
+        }
+
+        struct collector_entry_s entry = {
+            .received_us = now,
+            .timestamp = record.timestamp,
+            .source = addr->sin_addr.s_addr,
+            .seq = record.seq,
+            .kind = COLLECTOR_KIND_LOGSTREAM,
+            .level = record.level,
+            .core = record.core,
+            .task = record.task,
+            .task_len = record.task_len,
+            .tag = record.tag,
+            .tag_len = record.tag_len,
+            .data = record.data,
+            .data_len = record.data_len,
+        };
+        c->stats->sampled += record.sampled;
+        // Key-value records are stored as the text the device would have printed.
+        char text[PACKET_SIZE];
+        if (record.kv) {
+            entry.data = text;
+            entry.data_len = log_kv_format(record.data, record.data_len, text, sizeof(text));
+        }
+        collector_relayed_source(&entry, &record);
+        collector_emit(c, &entry);
+    }
+    if (ret < 0)
+        c->stats->malformed++;
+}
+
+/*
+ * Syslog severities to log levels, emergency to error are all errors.
+ */
+static uint8_t collector_syslog_level(unsigned severity)
+{
+    static const uint8_t levels[] = {1, 1, 1, 1, 2, 3, 3, 4};
+    return levels[severity & 7];
+}
+
+/*
+ * Accepts "<PRI>message", and takes the app name as tag from "<PRI>1 TIMESTAMP HOST APP PROCID MSGID SD MSG".
+ */
+static void collector_handle_syslog(struct collector_s *c, const struct sockaddr_in *addr, const char *packet, size_t len, uint64_t now)
+{
+    struct collector_entry_s entry = {
+        .received_us = now,
+        .source = addr->sin_addr.s_addr,
+        .kind = COLLECTOR_KIND_SYSLOG,
+        .level = 3,
+        .data = packet,
+        .data_len = len,
+    };
+
+    const char *end = packet + len;
+    const char *p = packet;
+    if (p < end && *p == '<') {
+        unsigned pri = 0;
+        for (p++; p < end && *p >= '0' && *p <= '9'; p++)
+            pri = pri * 10 + (*p - '0');
+        if (p < end && *p == '>') {
+            p++;
+            entry.level = collector_syslog_level(pri);
+            entry.data = p;
+            entry.data_len = end - p;
+        }
+    }
+
+    if (end - p > 2 && p[0] == '1' && p[1] == ' ') {
+        const char *fields[7];
+        size_t n_fields = 0;
+        for (const char *q = p + 2; q < end && n_fields < 6; n_fields++) {
+            fields[n_fields] = q;
+            if (*q == '[' && n_fields == 5) {
+                // Structured data, skip to the closing bracket of the last element.
+                while (q < end && !(*q == ']' && (q + 1 == end || q[1] == ' ')))
+                    q++;
+                q++;
+            } else {
+                while (q < end && *q != ' ')
+                    q++;
+            }
+            q += q < end;
+            fields[n_fields + 1] = q;
+        }
+        if (n_fields == 6) {
+            entry.tag = fields[2];
+            entry.tag_len = fields[3] - fields[2] - 1;
+            if (entry.tag_len == 1 && entry.tag[0] == '-')
+                entry.tag_len = 0;
+            entry.data = fields[6];
+            entry.data_len = end - fields[6];
+        }
+    }
+    collector_emit(c, &entry);
+}
+
+static void collector_send_control(struct collector_s *c, struct source_s *source, uint64_t now)
+{
+    struct logstream_range_s ranges[LOGSTREAM_NACK_MAX_RANGES];
+    char buf[LOGSTREAM_NACK_MAX_SIZE];
+
+    if (!source->seq.started)
+        return;
+
+    if (now - source->last_nack_us >= CONTROL_INTERVAL_US) {
+        size_t n_ranges = logstream_seq_missing(&source->seq, ranges, LOGSTREAM_NACK_MAX_RANGES);
+        if (n_ranges && source->seq.next == source->nack_next && ++source->nack_rounds >= NACK_MAX_ROUNDS) {
+            uint32_t lost = source->seq.lost;
+            logstream_seq_skip_gap(&source->seq);
+            c->stats->lost += source->seq.lost - lost;
+            source->nack_rounds = 0;
+            n_ranges = logstream_seq_missing(&source->seq, ranges, LOGSTREAM_NACK_MAX_RANGES);
+        } else if (source->seq.next != source->nack_next) {
+            source->nack_rounds = 0;
+        }
+        if (n_ranges) {
+            size_t len = logstream_encode_nack(buf, sizeof(buf), source->seq.session, ranges, n_ranges);
+            sendto(c->sock, buf, len, MSG_DONTWAIT, (struct sockaddr *)&source->addr, sizeof(source->addr));
+            source->last_nack_us = now;
+            source->nack_next = source->seq.next;
+        }
+    }
+
+    uint32_t acked = source->seq.next - 1;
+    if (acked != source->acked && now - source->last_ack_us >= CONTROL_INTERVAL_US) {
+        size_t len = logstream_encode_ack(buf, sizeof(buf), source->seq.session, acked);
+        sendto(c->sock, buf, len, MSG_DONTWAIT, (struct sockaddr *)&source->addr, sizeof(source->addr));
+        source->last_ack_us = now;
+        source->acked = acked;
+    }
+}
+
+static void collector_follow_up(struct collector_s *c, uint64_t now)
+{
+    for (size_t i = 0; i < SOURCE_TABLE_SIZE; i++) {
+        struct source_s *source = &c->sources[i];
+        if (source->used && (source->active || source->seq.highest >= source->seq.next))
+            collector_send_control(c, source, now);
+        source->active = false;
+    }
+}
+
+/*
+ * Receive everything waiting on sock, a batch at a time. Returns false on errors.
+ */
+static bool collector_drain(struct collector_s *c, int sock)
+{
+    while (1) {
+        for (size_t i = 0; i < BATCH_SIZE; i++) {
+            c->iovecs[i] = (struct iovec){.iov_base = c->packets[i], .iov_len = PACKET_SIZE};
+            c->msgs[i].msg_hdr = (struct msghdr){
+                .msg_name = &c->addrs[i],
+                .msg_namelen = sizeof(c->addrs[i]),
+                .msg_iov = &c->iovecs[i],
+                .msg_iovlen = 1,
+            };
+        }
+
+        int n = recvmmsg(sock, c->msgs, BATCH_SIZE, MSG_DONTWAIT, NULL);
+        if (n < 0)
+            return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+
+        uint64_t now = collector_now_us();
+        for (int i = 0; i < n; i++) {
+            const char *packet = c->packets[i];
+            size_t len = c->msgs[i].msg_len;
+            c->stats->packets++;
+            c->stats->bytes += len;
+            if (sock == c->syslog_sock)
+                collector_handle_syslog(c, &c->addrs[i], packet, len, now);
+            else if (len > 0 && packet[0] == LOGSTREAM_VERSION_1)
+                collector_handle_v1(c, &c->addrs[i], packet, len, now);
+            else if (len > 0 && packet[0] == LOGSTREAM_VERSION_2)
+                collector_handle_v2(c, &c->addrs[i], packet, len, now);
+            else
+                c->stats->malformed++;
+        }
+        if (n < BATCH_SIZE)
+            return true;
+    }
+}
+
+static int collector_socket(const struct collector_config_s *config, int port, int *bound_port)
+{
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0)
+        return -1;
+
+    int size = RECV_BUFFER_SIZE;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
+    struct sockaddr_in addr = {.sin_family = AF_INET, .sin_port = htons(port), .sin_addr.s_addr = htonl(INADDR_ANY)};
+    if (config->bind_addr)
+        inet_pton(AF_INET, config->bind_addr, &addr.sin_addr);
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    socklen_t len = sizeof(addr);
+    getsockname(sock, (struct sockaddr *)&addr, &len);
+    if (bound_port)
+        *bound_port = ntohs(addr.sin_port);
+    return sock;
+}
+
+static void collector_print_stats(const struct collector_stats_s *stats, const struct collector_stats_s *last, uint64_t elapsed_us)
+{
+    double seconds = elapsed_us / 1e6;
+    fprintf(stderr, "sources %zu, %.0f entries/s, %.0f packets/s, %.2f MB/s, %llu lost, %llu duplicates, %llu malformed, %llu sampled\n", stats->sources,
+            (stats->entries - last->entries) / seconds, (stats->packets - last->packets) / seconds,
+            (stats->bytes - last->bytes) / seconds / 1e6, (unsigned long long)stats->lost, (unsigned long long)stats->duplicates,
+            (unsigned long long)stats->malformed, (unsigned long long)stats->sampled);
+}
+
+int collector_run(const struct collector_config_s *config, struct collector_stats_s *stats)
+{
+    struct collector_s *c = calloc(1, sizeof(*c));
+    int ret = -1;
+    c->config = config;
+    c->stats = stats;
+    c->sock = c->syslog_sock = -1;
+
+    if (config->dir && !(c->store = store_open(config->dir, config->segment_size ? config->segment_size : COLLECTOR_DEFAULT_SEGMENT_SIZE))) {
+        fprintf(stderr, "Can not write to %s: %s\n", config->dir, strerror(errno));
+        goto out;
+    }
+    if ((c->sock = collector_socket(config, config->port, config->bound_port)) < 0) {
+        fprintf(stderr, "Can not listen on port %d: %s\n", config->port, strerror(errno));
+        goto out;
+    }
+    if (config->syslog_port && (c->syslog_sock = collector_socket(config, config->syslog_port, NULL)) < 0) {
+        fprintf(stderr, "Can not listen on port %d: %s\n", config->syslog_port, strerror(errno));
+        goto out;
+    }
+
+    struct pollfd fds[] = {{.fd = c->sock, .events = POLLIN}, {.fd = c->syslog_sock, .events = POLLIN}};
+    uint64_t last_control = 0, last_flush = 0, last_stats = collector_now_us();
+    struct collector_stats_s last = *stats;
+    while (!config->stop || !*config->stop) {
+        int n = poll(fds, 2, POLL_MS);
+        if (n < 0 && errno != EINTR)
+            goto out;
+
+        for (size_t i = 0; i < 2 && n > 0; i++) {
+            if ((fds[i].revents & POLLIN) && !collector_drain(c, fds[i].fd))
+                goto out;
+        }
+
+        uint64_t now = collector_now_us();
+        if (now - last_control >= CONTROL_INTERVAL_US / 4) {
+            collector_follow_up(c, now);
+            last_control = now;
+        }
+        if (c->store && now - last_flush >= FLUSH_INTERVAL_US) {
+            store_flush(c->store);
+            last_flush = now;
+        }
+        if (config->stats && now - last_stats >= STATS_INTERVAL_US) {
+            collector_print_stats(stats, &last, now - last_stats);
+            last = *stats;
+            last_stats = now;
+        }
+    }
+    ret = 0;
+
+out:
+    if (c->sock >= 0)
+        close(c->sock);
+    if (c->syslog_sock >= 0)
+        close(c->syslog_sock);
+    if (c->store)
+        store_close(c->store);
+    free(c);
+    return ret;
+}
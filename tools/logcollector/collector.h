@@ -0,0 +1,91 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define COLLECTOR_DEFAULT_PORT 1514
+#define COLLECTOR_DEFAULT_SYSLOG_PORT 5514
+#define COLLECTOR_DEFAULT_SEGMENT_SIZE (64 * 1024 * 1024)
+
+enum collector_kind_e {
+    COLLECTOR_KIND_LOGSTREAM,
+    COLLECTOR_KIND_SYSLOG,
+};
+
+/*
+ * An entry as received, or as read back from the store. Strings point into a packet or a
+ * segment buffer and are only valid during the callback they are passed to.
+ */
+struct collector_entry_s {
+    uint64_t received_us; // Wall clock at the collector, what the store is indexed by.
+    uint64_t timestamp;   // As sent by the device.
+    uint32_t source;      // IPv4 address of the device, network order.
+    uint32_t seq;
+    uint8_t kind;
+    uint8_t level;
+    uint8_t core;
+    const char *task;
+    size_t task_len;
+    const char *tag;
+    size_t tag_len;
+    const char *data;
+    size_t data_len;
+};
+
+typedef void collector_entry_cb_t(const struct collector_entry_s *entry, void *arg);
+
+struct collector_config_s {
+    const char *dir;       // Where segments are written, NULL to not store anything.
+    int port;              // Logstream port, 0 for any free one.
+    int syslog_port;       // Syslog port, 0 to not listen.
+    const char *bind_addr; // NULL for any.
+    uint64_t segment_size;
+    bool print;          // Print entries to stdout as they arrive.
+    bool stats;          // Print a line of statistics to stderr every 10 seconds.
+    volatile bool *stop; // Set to stop collecting.
+    int *bound_port;     // If not NULL, set to the logstream port once listening.
+};
+
+struct collector_stats_s {
+    uint64_t packets;
+    uint64_t entries;
+    uint64_t bytes;
+    uint64_t duplicates;
+    uint64_t malformed;
+    uint64_t lost;
+    uint64_t sampled; // Lines the devices dropped by sampling, represented by the entries received.
+    size_t sources;
+};
+
+int collector_run(const struct collector_config_s *config, struct collector_stats_s *stats);
+
+uint64_t collector_now_us(void);
+void collector_print_entry(const struct collector_entry_s *entry, FILE *out);
+
+/*
+ * Append only segment files, indexed by receive time:
+ *   NNNNNNNN.seg: a header with the time of the first entry, then the entries back to back.
+ *   NNNNNNNN.idx: every STORE_INDEX_INTERVAL bytes of segment, the time and offset of the entry there.
+ */
+struct store_s;
+
+struct store_query_s {
+    uint64_t since_us;
+    uint64_t until_us; // 0 for no limit.
+    uint32_t source;   // 0 for all.
+    int max_level;     // Most verbose level to include.
+    const char *grep;  // Substring of the data, NULL for all.
+};
+
+struct store_s *store_open(const char *dir, uint64_t segment_size);
+int store_append(struct store_s *store, const struct collector_entry_s *entry);
+void store_flush(struct store_s *store);
+void store_close(struct store_s *store);
+
+int store_query(const char *dir, const struct store_query_s *query, collector_entry_cb_t *cb, void *arg);
+int store_tail(const char *dir, const struct store_query_s *query, size_t lines, bool follow, volatile bool *stop, collector_entry_cb_t *cb,
+               void *arg);
+
+int collector_bench(int sources, int seconds, const char *dir, bool compress);
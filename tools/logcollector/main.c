@@ -0,0 +1,207 @@
+#define _GNU_SOURCE
+
+#include <arpa/inet.h>
+#include <getopt.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "collector.h"
+
+static volatile bool stop;
+
+static void on_signal(int sig)
+{
+    stop = true;
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage:\n"
+                    "  logcollector listen [-p port] [-s syslog_port] [-b addr] [-d dir] [-S segment_mb] [-v] [-q]\n"
+                    "  logcollector query -d dir [--since time] [--until time] [--source addr] [--level n] [--grep text]\n"
+                    "  logcollector tail -d dir [-n lines] [-f] [--source addr] [--level n] [--grep text]\n"
+                    "  logcollector bench [-c sources] [-t seconds] [-d dir] [-z]\n"
+                    "\n"
+                    "Times are seconds since the epoch, negative seconds relative to now, or \"YYYY-MM-DD HH:MM:SS\".\n"
+                    "Levels are 1 (error) to 5 (verbose), entries up to the given level are included.\n");
+}
+
+static uint64_t parse_time(const char *str)
+{
+    struct tm tm = {};
+    char *end = strptime(str, "%Y-%m-%d %H:%M:%S", &tm);
+    if (end && *end == '\0') {
+        tm.tm_isdst = -1;
+        return (uint64_t)mktime(&tm) * 1000000;
+    }
+
+    double seconds = strtod(str, NULL);
+    if (seconds < 0)
+        return collector_now_us() + (int64_t)(seconds * 1e6);
+    return seconds * 1e6;
+}
+
+static void print_entry(const struct collector_entry_s *entry, void *arg)
+{
+    collector_print_entry(entry, stdout);
+}
+
+static int cmd_listen(int argc, char **argv)
+{
+    struct collector_config_s config = {
+        .port = COLLECTOR_DEFAULT_PORT,
+        .syslog_port = COLLECTOR_DEFAULT_SYSLOG_PORT,
+        .segment_size = COLLECTOR_DEFAULT_SEGMENT_SIZE,
+        .print = true,
+        .stats = true,
+        .stop = &stop,
+    };
+    struct collector_stats_s stats = {};
+    int opt;
+
+    while ((opt = getopt(argc, argv, "p:s:b:d:S:vq")) != -1) {
+        switch (opt) {
+        case 'p':
+            config.port = atoi(optarg);
+            break;
+        case 's':
+            config.syslog_port = atoi(optarg);
+            break;
+        case 'b':
+            config.bind_addr = optarg;
+            break;
+        case 'd':
+            config.dir = optarg;
+            config.print = false;
+            break;
+        case 'S':
+            config.segment_size = strtoull(optarg, NULL, 0) * 1024 * 1024;
+            break;
+        case 'v':
+            config.print = true;
+            break;
+        case 'q':
+            config.stats = false;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    return collector_run(&config, &stats) < 0;
+}
+
+static int cmd_read(int argc, char **argv, bool tail)
+{
+    static const struct option options[] = {
+        {"dir", required_argument, NULL, 'd'},     {"since", required_argument, NULL, 'a'}, {"until", required_argument, NULL, 'u'},
+        {"source", required_argument, NULL, 'r'},  {"level", required_argument, NULL, 'l'}, {"grep", required_argument, NULL, 'g'},
+        {"lines", required_argument, NULL, 'n'},   {"follow", no_argument, NULL, 'f'},     {},
+    };
+    struct store_query_s query = {.max_level = 5};
+    const char *dir = NULL;
+    size_t lines = 10;
+    bool follow = false;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "d:n:f", options, NULL)) != -1) {
+        switch (opt) {
+        case 'd':
+            dir = optarg;
+            break;
+        case 'a':
+            query.since_us = parse_time(optarg);
+            break;
+        case 'u':
+            query.until_us = parse_time(optarg);
+            break;
+        case 'r':
+            if (inet_pton(AF_INET, optarg, &query.source) != 1) {
+                fprintf(stderr, "Bad address %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'l':
+            query.max_level = atoi(optarg);
+            break;
+        case 'g':
+            query.grep = optarg;
+            break;
+        case 'n':
+            lines = strtoul(optarg, NULL, 0);
+            break;
+        case 'f':
+            follow = true;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    if (!dir) {
+        usage();
+        return 1;
+    }
+
+    int ret = tail ? store_tail(dir, &query, lines, follow, &stop, print_entry, NULL) : store_query(dir, &query, print_entry, NULL);
+    if (ret < 0)
+        fprintf(stderr, "Can not read %s\n", dir);
+    return ret < 0;
+}
+
+static int cmd_bench(int argc, char **argv)
+{
+    int sources = 100, seconds = 5;
+    const char *dir = NULL;
+    bool compress = false;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "c:t:d:z")) != -1) {
+        switch (opt) {
+        case 'c':
+            sources = atoi(optarg);
+            break;
+        case 't':
+            seconds = atoi(optarg);
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        case 'z':
+            compress = true;
+            break;
+        default:
+            usage();
+            return 1;
+        }
+    }
+    return collector_bench(sources, seconds, dir, compress) < 0;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc < 2) {
+        usage();
+        return 1;
+    }
+
+    struct sigaction sa = {.sa_handler = on_signal};
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    const char *cmd = argv[1];
+    argc--;
+    argv++;
+    if (strcmp(cmd, "listen") == 0)
+        return cmd_listen(argc, argv);
+    if (strcmp(cmd, "query") == 0)
+        return cmd_read(argc, argv, false);
+    if (strcmp(cmd, "tail") == 0)
+        return cmd_read(argc, argv, true);
+    if (strcmp(cmd, "bench") == 0)
+        return cmd_bench(argc, argv);
+    usage();
+    return 1;
+}
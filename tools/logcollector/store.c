@@ -0,0 +1,393 @@
+#define _GNU_SOURCE
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "collector.h"
+
+#define STORE_MAGIC "LOGSEG1"
+#define STORE_INDEX_INTERVAL (64 * 1024)
+#define STORE_BUFFER_SIZE (1024 * 1024)
+#define STORE_MAX_SEGMENTS 100000
+#define STORE_FOLLOW_US 100000
+
+struct segment_header_s {
+    char magic[8];
+    uint64_t first_us;
+} __attribute__((packed));
+
+struct segment_record_s {
+    uint32_t len; // Including this header.
+    uint32_t source;
+    uint64_t received_us;
+    uint64_t timestamp;
+    uint32_t seq;
+    uint8_t kind;
+    uint8_t level;
+    uint8_t core;
+    uint8_t task_len;
+    uint8_t tag_len;
+    uint8_t reserved;
+    uint16_t data_len;
+} __attribute__((packed));
+
+struct segment_index_s {
+    uint64_t received_us;
+    uint64_t offset;
+} __attribute__((packed));
+
+struct store_s {
+    char *dir;
+    uint64_t segment_size;
+    uint32_t segment;
+    FILE *seg;
+    FILE *idx;
+    uint64_t offset;
+    uint64_t next_index;
+    uint64_t last_us;
+};
+
+static void segment_path(char *path, size_t size, const char *dir, uint32_t segment, const char *ext)
+{
+    snprintf(path, size, "%s/%08u.%s", dir, segment, ext);
+}
+
+static int compare_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * List the segment numbers in dir, sorted. Returns the count, or -1 if dir can not be read.
+ */
+static int store_list(const char *dir, uint32_t *segments, size_t max)
+{
+    DIR *d = opendir(dir);
+    if (!d)
+        return -1;
+
+    size_t n = 0;
+    struct dirent *de;
+    while ((de = readdir(d)) && n < max) {
+        unsigned segment;
+        char ext[4];
+        if (sscanf(de->d_name, "%8u.%3s", &segment, ext) == 2 && strcmp(ext, "seg") == 0)
+            segments[n++] = segment;
+    }
+    closedir(d);
+    qsort(segments, n, sizeof(*segments), compare_u32);
+    return n;
+}
+
+static int store_start_segment(struct store_s *store)
+{
+    char path[4096];
+    if (store->seg)
+        fclose(store->seg);
+    if (store->idx)
+        fclose(store->idx);
+    store->seg = store->idx = NULL;
+
+    store->segment++;
+    segment_path(path, sizeof(path), store->dir, store->segment, "seg");
+    if (!(store->seg = fopen(path, "wbx")))
+        return -1;
+    setvbuf(store->seg, NULL, _IOFBF, STORE_BUFFER_SIZE);
+    segment_path(path, sizeof(path), store->dir, store->segment, "idx");
+    if (!(store->idx = fopen(path, "wb")))
+        return -1;
+
+    struct segment_header_s header = {.magic = STORE_MAGIC, .first_us = store->last_us};
+    fwrite(&header, sizeof(header), 1, store->seg);
+    store->offset = sizeof(header);
+    store->next_index = 0;
+    return 0;
+}
+
+/*
+ * Open dir for writing, entries go to a new segment after the ones already there.
+ */
+struct store_s *store_open(const char *dir, uint64_t segment_size)
+{
+    static uint32_t segments[STORE_MAX_SEGMENTS];
+    int n = store_list(dir, segments, STORE_MAX_SEGMENTS);
+    if (n < 0)
+        return NULL;
+
+    struct store_s *store = calloc(1, sizeof(*store));
+    store->dir = strdup(dir);
+    store->segment_size = segment_size;
+    store->segment = n > 0 ? segments[n - 1] : 0;
+    store->last_us = collector_now_us();
+    if (store_start_segment(store) < 0) {
+        store_close(store);
+        return NULL;
+    }
+    return store;
+}
+
+int store_append(struct store_s *store, const struct collector_entry_s *entry)
+{
+    struct segment_record_s record = {
+        .source = entry->source,
+        .timestamp = entry->timestamp,
+        .seq = entry->seq,
+        .kind = entry->kind,
+        .level = entry->level,
+        .core = entry->core,
+        .task_len = entry->task_len > UINT8_MAX ? UINT8_MAX : entry->task_len,
+        .tag_len = entry->tag_len > UINT8_MAX ? UINT8_MAX : entry->tag_len,
+        .data_len = entry->data_len > UINT16_MAX ? UINT16_MAX : entry->data_len,
+    };
+    record.len = sizeof(record) + record.task_len + record.tag_len + record.data_len;
+
+    // The index needs time to only go forward, even if the clock is set back.
+    store->last_us = entry->received_us > store->last_us ? entry->received_us : store->last_us;
+    record.received_us = store->last_us;
+
+    if (store->offset + record.len > store->segment_size && store->offset > sizeof(struct segment_header_s)) {
+        if (store_start_segment(store) < 0)
+            return -1;
+    }
+    if (store->offset >= store->next_index) {
+        struct segment_index_s index = {.received_us = record.received_us, .offset = store->offset};
+        fwrite(&index, sizeof(index), 1, store->idx);
+        store->next_index = store->offset + STORE_INDEX_INTERVAL;
+    }
+
+    fwrite(&record, sizeof(record), 1, store->seg);
+    fwrite(entry->task, 1, record.task_len, store->seg);
+    fwrite(entry->tag, 1, record.tag_len, store->seg);
+    if (fwrite(entry->data, 1, record.data_len, store->seg) != record.data_len)
+        return -1;
+    store->offset += record.len;
+    return 0;
+}
+
+void store_flush(struct store_s *store)
+{
+    fflush(store->seg);
+    fflush(store->idx);
+}
+
+void store_close(struct store_s *store)
+{
+    if (store->seg)
+        fclose(store->seg);
+    if (store->idx)
+        fclose(store->idx);
+    free(store->dir);
+    free(store);
+}
+
+static bool store_match(const struct store_query_s *query, const struct collector_entry_s *entry)
+{
+    if (entry->received_us < query->since_us)
+        return false;
+    if (query->source && entry->source != query->source)
+        return false;
+    if (entry->level > query->max_level)
+        return false;
+    if (query->grep && !memmem(entry->data, entry->data_len, query->grep, strlen(query->grep)))
+        return false;
+    return true;
+}
+
+/*
+ * Read the record at the current position of f into buf. Returns false at the end of the
+ * segment, or on a partially written record.
+ */
+static bool store_read_record(FILE *f, char *buf, struct collector_entry_s *entry)
+{
+    struct segment_record_s record;
+    long start = ftell(f);
+    if (fread(&record, sizeof(record), 1, f) != 1 || record.len != sizeof(record) + record.task_len + record.tag_len + record.data_len ||
+        fread(buf, 1, record.len - sizeof(record), f) != record.len - sizeof(record)) {
+        // Still being written, try again from here later.
+        clearerr(f);
+        fseek(f, start, SEEK_SET);
+        return false;
+    }
+
+    *entry = (struct collector_entry_s){
+        .received_us = record.received_us,
+        .timestamp = record.timestamp,
+        .source = record.source,
+        .seq = record.seq,
+        .kind = record.kind,
+        .level = record.level,
+        .core = record.core,
+        .task = buf,
+        .task_len = record.task_len,
+        .tag = buf + record.task_len,
+        .tag_len = record.tag_len,
+        .data = buf + record.task_len + record.tag_len,
+        .data_len = record.data_len,
+    };
+    return true;
+}
+
+static FILE *store_open_segment(const char *dir, uint32_t segment, struct segment_header_s *header)
+{
+    char path[4096];
+    segment_path(path, sizeof(path), dir, segment, "seg");
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return NULL;
+    if (fread(header, sizeof(*header), 1, f) != 1 || memcmp(header->magic, STORE_MAGIC, sizeof(header->magic)) != 0) {
+        fclose(f);
+        return NULL;
+    }
+    setvbuf(f, NULL, _IOFBF, STORE_BUFFER_SIZE);
+    return f;
+}
+
+/*
+ * Offset of the last indexed entry received before since, where a scan for since can start.
+ */
+static uint64_t store_seek_offset(const char *dir, uint32_t segment, uint64_t since_us)
+{
+    char path[4096];
+    segment_path(path, sizeof(path), dir, segment, "idx");
+    FILE *f = fopen(path, "rb");
+    if (!f)
+        return sizeof(struct segment_header_s);
+
+    fseek(f, 0, SEEK_END);
+    long lo = 0, hi = ftell(f) / (long)sizeof(struct segment_index_s);
+    uint64_t offset = sizeof(struct segment_header_s);
+    while (lo < hi) {
+        long mid = lo + (hi - lo) / 2;
+        struct segment_index_s index;
+        fseek(f, mid * sizeof(index), SEEK_SET);
+        if (fread(&index, sizeof(index), 1, f) != 1)
+            break;
+        if (index.received_us < since_us) {
+            offset = index.offset;
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    fclose(f);
+    return offset;
+}
+
+int store_query(const char *dir, const struct store_query_s *query, collector_entry_cb_t *cb, void *arg)
+{
+    static uint32_t segments[STORE_MAX_SEGMENTS];
+    static char buf[UINT16_MAX + 2 * UINT8_MAX];
+    int n = store_list(dir, segments, STORE_MAX_SEGMENTS);
+    if (n < 0)
+        return -1;
+
+    // Skip the segments that end before since, the first to look in starts before it.
+    int first = 0;
+    for (int i = 0; i < n; i++) {
+        struct segment_header_s header;
+        FILE *f = store_open_segment(dir, segments[i], &header);
+        if (!f)
+            continue;
+        fclose(f);
+        if (header.first_us <= query->since_us)
+            first = i;
+        else
+            break;
+    }
+
+    for (int i = first; i < n; i++) {
+        struct segment_header_s header;
+        FILE *f = store_open_segment(dir, segments[i], &header);
+        if (!f)
+            continue;
+        if (query->until_us && header.first_us > query->until_us) {
+            fclose(f);
+            break;
+        }
+
+        fseek(f, store_seek_offset(dir, segments[i], query->since_us), SEEK_SET);
+        struct collector_entry_s entry;
+        while (store_read_record(f, buf, &entry)) {
+            if (query->until_us && entry.received_us > query->until_us) {
+                fclose(f);
+                return 0;
+            }
+            if (store_match(query, &entry))
+                cb(&entry, arg);
+        }
+        fclose(f);
+    }
+    return 0;
+}
+
+/*
+ * Print the last lines matching entries, starting from the last index point of the newest
+ * segment, then keep printing new entries while follow is set.
+ */
+int store_tail(const char *dir, const struct store_query_s *query, size_t lines, bool follow, volatile bool *stop, collector_entry_cb_t *cb,
+               void *arg)
+{
+    static uint32_t segments[STORE_MAX_SEGMENTS];
+    static char buf[UINT16_MAX + 2 * UINT8_MAX];
+    int n = store_list(dir, segments, STORE_MAX_SEGMENTS);
+    if (n <= 0)
+        return n;
+
+    uint32_t segment = segments[n - 1];
+    struct segment_header_s header;
+    FILE *f = store_open_segment(dir, segment, &header);
+    if (!f)
+        return -1;
+
+    // Find where the last lines start, then print from there.
+    long *offsets = calloc(lines + 1, sizeof(*offsets));
+    size_t count = 0;
+    fseek(f, store_seek_offset(dir, segment, UINT64_MAX), SEEK_SET);
+    struct collector_entry_s entry;
+    long offset = ftell(f);
+    while (store_read_record(f, buf, &entry)) {
+        if (store_match(query, &entry))
+            offsets[count++ % (lines + 1)] = offset;
+        offset = ftell(f);
+    }
+    if (count > lines)
+        fseek(f, offsets[(count - lines) % (lines + 1)], SEEK_SET);
+    else if (count > 0)
+        fseek(f, offsets[0], SEEK_SET);
+    free(offsets);
+
+    while (!stop || !*stop) {
+        while (store_read_record(f, buf, &entry)) {
+            if (store_match(query, &entry))
+                cb(&entry, arg);
+        }
+        fflush(stdout);
+        if (!follow)
+            break;
+
+        // Move on when the collector has started a new segment.
+        char path[4096];
+        segment_path(path, sizeof(path), dir, segment + 1, "seg");
+        if (access(path, R_OK) == 0) {
+            FILE *next = store_open_segment(dir, segment + 1, &header);
+            if (next) {
+                // Whatever was written to the old one before it moved on.
+                while (store_read_record(f, buf, &entry)) {
+                    if (store_match(query, &entry))
+                        cb(&entry, arg);
+                }
+                fclose(f);
+                f = next;
+                segment++;
+                continue;
+            }
+        }
+        usleep(STORE_FOLLOW_US);
+    }
+    fclose(f);
+    return 0;
+}